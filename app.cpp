@@ -11,6 +11,8 @@
 #include "net/udpsocket.h"
 #include "p2p_service.h"
 #include "db/redispool.h"
+#include "peer_registry.h"
+#include "fiber/stack_allocator.h"
 #include <utils/string8.h>
 #include <log/log.h>
 #include <log/callstack.h>
@@ -168,9 +170,17 @@ int Application::main()
 {
     signal(SIGPIPE, SIG_IGN);
     signal(SIGABRT, Signalcatch);
-    signal(SIGSEGV, Signalcatch);
     signal(SIGUSR1, Signalcatch);
 
+    // 协程栈溢出会命中保护页, 此时原栈已不可用, SIGSEGV需要在信号栈上处理
+    StackAllocator::InstallSignalStack();
+    struct sigaction action;
+    memset(&action, 0, sizeof(action));
+    action.sa_handler = Signalcatch;
+    action.sa_flags = SA_ONSTACK;
+    sigemptyset(&action.sa_mask);
+    sigaction(SIGSEGV, &action, nullptr);
+
     RedisManager::get();
     uint32_t ioWorkerCount = Config::Lookup<uint32_t>("worker.io_worker_num", 4);
     uint32_t processWorkerCount = Config::Lookup<uint32_t>("worker.process_worker_num", 4);
@@ -185,6 +195,7 @@ int Application::main()
     acceptWorker->start();
     ioWorker->start();
     processWorker->start();
+    PeerManager::get()->setPersistWorker(processWorker);  // peer表异步写入redis
 
     Epoll::SP epoll(new (std::nothrow)Epoll(processWorker, ioWorker));
     UdpServer::SP udpServer(new (std::nothrow)UdpServer(epoll, ioWorker, processWorker));
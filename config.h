@@ -26,6 +26,19 @@ T Chars2Other(const char *src)
     throw eular::Exception(str);
     return t;
 }
+
+// 特化定义在config.cpp中, 需在此声明, 否则其他编译单元会使用上面的通用版本
+template<> short Chars2Other<short>(const char *src);
+template<> unsigned short Chars2Other<unsigned short>(const char *src);
+template<> int Chars2Other<int>(const char *src);
+template<> unsigned int Chars2Other<unsigned int>(const char *src);
+template<> float Chars2Other<float>(const char *src);
+template<> double Chars2Other<double>(const char *src);
+template<> long Chars2Other<long>(const char *src);
+template<> unsigned long Chars2Other<unsigned long>(const char *src);
+template<> bool Chars2Other<bool>(const char *src);
+template<> const char *Chars2Other<const char *>(const char *src);
+template<> eular::String8 Chars2Other<eular::String8>(const char *src);
 }
 
 class Config
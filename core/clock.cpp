@@ -0,0 +1,135 @@
+/*************************************************************************
+    > File Name: clock.cpp
+    > Author: hsz
+    > Brief:
+    > Created Time: Sat 17 Oct 2026 10:21:53 PM CST
+ ************************************************************************/
+
+#include "clock.h"
+#include "config.h"
+#include <utils/utils.h>
+#include <log/log.h>
+#include <string.h>
+#include <time.h>
+#if defined(__x86_64__)
+#include <cpuid.h>
+#include <x86intrin.h>
+#endif
+
+#define LOG_TAG "clock"
+#define TSC_CALIBRATE_US 20000
+
+namespace eular {
+
+static thread_local uint64_t gCachedUs = 0;     // 0表示无缓存
+
+static uint64_t ReadClock(clockid_t id)
+{
+    timespec ts;
+    clock_gettime(id, &ts);
+    return ts.tv_sec * 1000000ull + ts.tv_nsec / 1000;
+}
+
+#if defined(__x86_64__)
+/**
+ * @brief TSC与CLOCK_MONOTONIC的换算: us = baseUs + ((tsc - baseTsc) * mult >> 32)
+ */
+struct TscCalibration {
+    uint64_t baseTsc;
+    uint64_t baseUs;
+    uint64_t mult;
+};
+
+static TscCalibration gTsc;
+
+static bool InvariantTsc()
+{
+    uint32_t eax = 0, ebx = 0, ecx = 0, edx = 0;
+    if (!__get_cpuid(0x80000007, &eax, &ebx, &ecx, &edx)) {
+        return false;
+    }
+    return edx & (1u << 8);
+}
+
+static bool CalibrateTsc()
+{
+    if (!InvariantTsc()) {
+        return false;
+    }
+
+    uint64_t beginUs = ReadClock(CLOCK_MONOTONIC);
+    uint64_t beginTsc = __rdtsc();
+    uint64_t endUs = beginUs;
+    while (endUs - beginUs < TSC_CALIBRATE_US) {
+        endUs = ReadClock(CLOCK_MONOTONIC);
+    }
+    uint64_t endTsc = __rdtsc();
+    if (endTsc <= beginTsc) {
+        return false;
+    }
+
+    gTsc.baseTsc = endTsc;
+    gTsc.baseUs = endUs;
+    gTsc.mult = ((endUs - beginUs) << 32) / (endTsc - beginTsc);
+    return gTsc.mult != 0;
+}
+#endif
+
+static Clock::Source LoadSource()
+{
+    String8 source = Config::Lookup<String8>("clock.source", "monotonic");
+    if (strcmp(source.c_str(), "coarse") == 0) {
+        return Clock::COARSE;
+    }
+    if (strcmp(source.c_str(), "tsc") == 0) {
+#if defined(__x86_64__)
+        if (CalibrateTsc()) {
+            return Clock::TSC;
+        }
+#endif
+        LOGW("invariant tsc unavailable, fall back to CLOCK_MONOTONIC");
+    }
+    return Clock::MONOTONIC;
+}
+
+Clock::Source Clock::GetSource()
+{
+    static const Source source = LoadSource();
+    return source;
+}
+
+uint64_t Clock::PreciseUs()
+{
+    switch (GetSource()) {
+    case COARSE:
+        return ReadClock(CLOCK_MONOTONIC_COARSE);
+#if defined(__x86_64__)
+    case TSC: {
+        uint64_t tsc = __rdtsc();
+        if (eular_unlikely(tsc < gTsc.baseTsc)) {   // 各核TSC之间的微小偏差
+            return gTsc.baseUs;
+        }
+        return gTsc.baseUs + (uint64_t)(((unsigned __int128)(tsc - gTsc.baseTsc) * gTsc.mult) >> 32);
+    }
+#endif
+    default:
+        return ReadClock(CLOCK_MONOTONIC);
+    }
+}
+
+uint64_t Clock::NowUs()
+{
+    return gCachedUs ? gCachedUs : PreciseUs();
+}
+
+void Clock::Update()
+{
+    gCachedUs = PreciseUs();
+}
+
+void Clock::Invalidate()
+{
+    gCachedUs = 0;
+}
+
+} // namespace eular
@@ -0,0 +1,60 @@
+/*************************************************************************
+    > File Name: clock.h
+    > Author: hsz
+    > Brief: 运行时使用的单调时钟, 调度线程每轮事件循环缓存一次
+    > Created Time: Sat 17 Oct 2026 10:21:48 PM CST
+ ************************************************************************/
+
+#ifndef __EULAR_CORE_CLOCK_H__
+#define __EULAR_CORE_CLOCK_H__
+
+#include <stdint.h>
+
+namespace eular {
+
+/**
+ * @brief 单调时钟, 不受系统时间调整影响. 定时器、心跳、统计等都应使用它而不是墙上时间
+ *
+ * 调度线程在每轮循环开始和epoll_wait返回后调用Update刷新线程缓存, 之后的Now*直接返回缓存值,
+ * 误差为本轮循环已执行的时间; 未刷新过缓存的线程(如主线程)每次都读取时钟源.
+ * 时钟源由clock.source配置, 第一次读取时确定:
+ *  monotonic: CLOCK_MONOTONIC(默认)
+ *  coarse:    CLOCK_MONOTONIC_COARSE, 读取更快, 精度为一个tick(1-4ms)
+ *  tsc:       rdtsc按CLOCK_MONOTONIC校准, 仅x86_64且CPU支持invariant TSC时可用, 否则回退到monotonic
+ */
+class Clock
+{
+public:
+    enum Source {
+        MONOTONIC = 0,
+        COARSE,
+        TSC,
+    };
+
+    /**
+     * @brief 当前时刻(ms/us), 有缓存时返回缓存值
+     */
+    static uint64_t NowMs() { return NowUs() / 1000; }
+    static uint64_t NowUs();
+
+    /**
+     * @brief 直接读取时钟源, 不使用也不刷新缓存
+     */
+    static uint64_t PreciseUs();
+
+    /**
+     * @brief 刷新当前线程的缓存, 由调度线程每轮循环调用
+     */
+    static void Update();
+
+    /**
+     * @brief 清除当前线程的缓存, 线程退出调度循环时调用, 之后的读取不再使用旧值
+     */
+    static void Invalidate();
+
+    static Source GetSource();
+};
+
+} // namespace eular
+
+#endif // __EULAR_CORE_CLOCK_H__
@@ -6,9 +6,11 @@
  ************************************************************************/
 
 #include "timer.h"
+#include "clock.h"
 #include <utils/utils.h>
 #include <log/log.h>
 #include <atomic>
+#include <string.h>
 
 #define LOG_TAG "timer"
 
@@ -19,43 +21,30 @@ std::atomic<uint64_t>   gUniqueIdCount{0};
 Timer::Timer() :
     mTime(0),
     mCb(nullptr),
-    mRecycleTime(0)
+    mRecycleTime(0),
+    mSlack(0),
+    mSlot(-1),
+    mRunning(false)
 {
     mUniqueId = ++gUniqueIdCount;
 }
 
-Timer::Timer(uint64_t ms, CallBack cb, uint32_t recycle) :
+Timer::Timer(uint64_t ms, CallBack cb, uint32_t recycle, uint32_t slack) :
     mTime(CurrentTime() + ms),
-    mCb(cb),
-    mRecycleTime(recycle)
+    mCb(std::move(cb)),
+    mRecycleTime(recycle),
+    mSlack(slack),
+    mSlot(-1),
+    mRunning(false)
 {
     mUniqueId = ++gUniqueIdCount;
 }
 
-Timer::Timer(const Timer& timer) :
-    mTime(timer.mTime),
-    mCb(timer.mCb),
-    mRecycleTime(timer.mRecycleTime),
-    mUniqueId(timer.mUniqueId)
-{
-
-}
-
 Timer::~Timer()
 {
 
 }
 
-Timer &Timer::operator=(const Timer& timer)
-{
-    mTime = timer.mTime;
-    mCb = timer.mCb;
-    mRecycleTime = timer.mRecycleTime;
-    mUniqueId = timer.mUniqueId;
-
-    return *this;
-}
-
 void Timer::cancel()
 {
     mTime = 0;
@@ -80,28 +69,48 @@ void Timer::reset(uint64_t ms, CallBack cb, uint32_t recycle)
     }
 
     mTime = ms;
-    mCb = cb;
+    mCb = std::move(cb);
     mRecycleTime = recycle;
 }
 
 /**
- * @brief 获取绝对时间
- * 
- * @return uint64_t 返回获得的绝对时间
+ * @brief 获取单调时间(ms), 调度线程上为本轮循环缓存的值
  */
 uint64_t Timer::CurrentTime()
 {
-    return Time::Abstime();
+    return Clock::NowMs();
 }
 
-TimerManager::TimerManager()
+/**
+ * @brief 在[expires, expires + slack]中取低位0最多的时刻, 窗口重叠的定时器因此落到同一时刻
+ */
+static uint64_t ApplySlack(uint64_t expires, uint32_t slack)
 {
+    if (slack == 0) {
+        return expires;
+    }
+    uint64_t limit = expires + slack;
+    uint32_t bit = 63 - __builtin_clzll(expires ^ limit);   // 二者不同的最高位, limit在该位为1
+    return limit & ~((1ull << bit) - 1);
+}
 
+TimerManager::TimerManager() :
+    mWheelTime(Timer::CurrentTime()),
+    mNextWakeTime(~0ull),
+    mTimerCount(0)
+{
+    memset(mSlotBitmap, 0, sizeof(mSlotBitmap));
 }
 
 TimerManager::~TimerManager()
 {
-
+    // 释放时间轮持有的引用
+    for (uint32_t i = 0; i < WHEEL_SLOTS; ++i) {
+        while (mSlots[i].next != &mSlots[i]) {
+            Timer::SP timer = static_cast<Timer *>(mSlots[i].next)->mHold;
+            removeTimer(timer.get());
+        }
+    }
 }
 
 /**
@@ -109,90 +118,177 @@ TimerManager::~TimerManager()
  */
 uint64_t TimerManager::getNearTimeout()
 {
-    RDAutoLock<RWMutex> rdlcok(mTimerRWMutex);
+    WRAutoLock<RWMutex> wrlock(mTimerRWMutex);
     mTickle = false;
-    if (mTimers.empty()) {
+    if (mTimerCount == 0) {
+        mNextWakeTime = ~0ull;
         return ~0ull;
     }
 
-    const Timer::SP &timer = *mTimers.begin();
     uint64_t nowMs = Timer::CurrentTime();
-    if (nowMs >= timer->getTimeout()) {
+    mNextWakeTime = nextExpireTime();
+    if (nowMs >= mNextWakeTime) {
         return 0;
     }
-    return timer->getTimeout() - nowMs;
+    return mNextWakeTime - nowMs;
 }
 
-uint64_t TimerManager::addTimer(uint64_t ms, Timer::CallBack cb, uint32_t recycle)
+Timer::SP TimerManager::addTimer(uint64_t ms, Timer::CallBack cb, uint32_t recycle, uint32_t slack)
 {
-    Timer::SP timer(new (std::nothrow)Timer(ms, cb, recycle));
+    Timer::SP timer(new Timer(ms, std::move(cb), recycle, slack));
     return addTimer(timer);
 }
 
-static void OnTimer(std::weak_ptr<void> cond, std::function<void()> cb)
-{
-    std::shared_ptr<void> temp = cond.lock();
-    if (temp) {
-        cb();
+struct ConditionCallback {
+    std::weak_ptr<void> cond;
+    Timer::CallBack     cb;
+
+    void operator()()
+    {
+        std::shared_ptr<void> temp = cond.lock();
+        if (temp) {
+            cb();
+        }
     }
+};
+
+Timer::SP TimerManager::addConditionTimer(uint64_t ms, Timer::CallBack cb, std::weak_ptr<void> cond,
+                                          uint32_t recycle, uint32_t slack)
+{
+    return addTimer(ms, ConditionCallback{cond, std::move(cb)}, recycle, slack);
 }
 
-uint64_t TimerManager::addConditionTimer(uint64_t ms, Timer::CallBack cb, std::weak_ptr<void> cond, uint32_t recycle)
+bool TimerManager::delTimer(const Timer::SP &timer)
 {
-    return addTimer(ms, std::bind(&OnTimer, cond, cb), recycle);
+    if (!timer) {
+        return false;
+    }
+
+    WRAutoLock<RWMutex> wrLock(mTimerRWMutex);
+    if (timer->mSlot < 0) {     // 已到期或已取消
+        return false;
+    }
+    removeTimer(timer.get());
+    return true;
 }
 
 bool TimerManager::delTimer(uint64_t uniqueId)
 {
     WRAutoLock<RWMutex> wrLock(mTimerRWMutex);
-    bool flag = false;
-    for (auto it = mTimers.begin(); it != mTimers.end();) {
-        if ((*it)->mUniqueId == uniqueId) {
-            mTimers.erase(it);
-            flag = true;
-            break;
-        }
-        ++it;
+    auto it = mTimerIndex.find(uniqueId);
+    if (it == mTimerIndex.end()) {
+        return false;
+    }
+    Timer::SP hold = it->second->mHold;     // 调用方没有句柄, 移出时间轮前先持有
+    removeTimer(hold.get());
+    return true;
+}
+
+TimerManager::TimerStats TimerManager::getTimerStats() const
+{
+    TimerStats stats;
+    {
+        RDAutoLock<RWMutex> rdlock(mTimerRWMutex);
+        stats.count = mTimerCount;
     }
-    return flag;
+    stats.expiredLastTick = mExpiredLastTick.load(std::memory_order_relaxed);
+    stats.expiredMaxTick = mExpiredMaxTick.load(std::memory_order_relaxed);
+    stats.expiredTotal = mExpiredTotal.load(std::memory_order_relaxed);
+    stats.ticks = mExpireTicks.load(std::memory_order_relaxed);
+    return stats;
+}
+
+bool TimerManager::hasTimer() const
+{
+    RDAutoLock<RWMutex> rdlock(mTimerRWMutex);
+    return mTimerCount > 0;
 }
 
-void TimerManager::ListExpireTimer(std::vector<std::function<void()>> &cbs)
+void TimerManager::ListExpireTimer(std::vector<Task> &cbs)
 {
     uint64_t nowMS = Timer::CurrentTime();
     std::vector<Timer::SP> expired;
     {
         RDAutoLock<RWMutex> rdlock(mTimerRWMutex);
-        if (mTimers.empty()) {
+        if (mTimerCount == 0 || mWheelTime > nowMS) {
             return;
         }
     }
+
     WRAutoLock<RWMutex> wrlock(mTimerRWMutex);
-    auto it = mTimers.begin();
-    while (it != mTimers.end() && (*it)->mTime <= nowMS) {
-        ++it;
+    while (mWheelTime <= nowMS) {
+        if (mTimerCount == 0) {
+            mWheelTime = nowMS + 1;
+            break;
+        }
+
+        // 跳过空槽, 直接到下一个可能有定时器到期或降级的时刻
+        uint64_t next = nextExpireTime();
+        if (next > nowMS) {
+            mWheelTime = nowMS + 1;
+            break;
+        }
+        if (next > mWheelTime) {
+            mWheelTime = next;
+        }
+
+        uint32_t index = mWheelTime & (WHEEL_ROOT_SIZE - 1);
+        if (index == 0) {
+            for (uint32_t level = 1; level < WHEEL_LEVELS && cascade(level) == 0; ++level) {
+            }
+        }
+
+        TimerNode &slot = mSlots[index];
+        while (slot.next != &slot) {
+            Timer *timer = static_cast<Timer *>(slot.next);
+            expired.push_back(timer->mHold);
+            removeTimer(timer);
+        }
+        ++mWheelTime;
+    }
+
+    if (!expired.empty()) {
+        uint64_t count = expired.size();
+        mExpiredLastTick.store(count, std::memory_order_relaxed);
+        if (count > mExpiredMaxTick.load(std::memory_order_relaxed)) {
+            mExpiredMaxTick.store(count, std::memory_order_relaxed);
+        }
+        mExpiredTotal.fetch_add(count, std::memory_order_relaxed);
+        mExpireTicks.fetch_add(1, std::memory_order_relaxed);
     }
-    expired.insert(expired.begin(), mTimers.begin(), it);
-    mTimers.erase(mTimers.begin(), it);
 
     for (auto &timer : expired) {
-        cbs.push_back(timer->mCb);
         if (timer->mRecycleTime) {
+            // 循环定时器的回调不可复制, 通过Timer调用. 上一次的回调还在执行(耗时超过间隔)时跳过本次,
+            // 否则同一个回调会在两个线程上同时执行
+            if (!timer->mRunning.exchange(true, std::memory_order_acquire)) {
+                cbs.push_back([timer]() {
+                    try {
+                        timer->mCb();
+                    } catch (...) {
+                        timer->mRunning.store(false, std::memory_order_release);
+                        throw;
+                    }
+                    timer->mRunning.store(false, std::memory_order_release);
+                });
+            }
             timer->refresh();
-            mTimers.insert(timer);
+            insertTimer(timer.get());
+        } else {
+            cbs.push_back(std::move(timer->mCb));
         }
     }
 }
 
-uint64_t TimerManager::addTimer(Timer::SP timer)
+Timer::SP TimerManager::addTimer(Timer::SP timer)
 {
     if (!timer) {
-        return 0;
+        return nullptr;
     }
     LOGD("addTimer() %p", &mTimerRWMutex);
     mTimerRWMutex.wlock();
-    auto it = mTimers.insert(timer).first;
-    bool atFront = (it == mTimers.begin()) && !mTickle;
+    insertTimer(timer.get());
+    bool atFront = ApplySlack(timer->mTime, timer->mSlack) < mNextWakeTime && !mTickle;
     if (atFront) {
         mTickle = true;
     }
@@ -202,7 +298,156 @@ uint64_t TimerManager::addTimer(Timer::SP timer)
         onTimerInsertedAtFront();
     }
 
-    return timer->getUniqueId();
+    return timer;
+}
+
+/**
+ * @brief 按到期时间(已计入slack)放入对应层的槽, 与mWheelTime相差越大层级越高
+ */
+void TimerManager::insertTimer(Timer *timer)
+{
+    uint64_t expires = ApplySlack(timer->mTime, timer->mSlack);
+    uint64_t delta = expires > mWheelTime ? expires - mWheelTime : 0;
+    uint32_t slot = 0;
+    if (delta < WHEEL_ROOT_SIZE) {
+        if (expires < mWheelTime) {     // 已过期, 下一次处理时触发
+            expires = mWheelTime;
+        }
+        slot = expires & (WHEEL_ROOT_SIZE - 1);
+    } else {
+        if (delta > 0xffffffffull) {    // 超出时间轮范围, 放在最高层, 降级时重新计算
+            expires = mWheelTime + 0xffffffffull;
+            delta = 0xffffffffull;
+        }
+        uint32_t level = 1;
+        uint32_t shift = WHEEL_ROOT_BITS;
+        while (level < WHEEL_LEVELS - 1 && delta >= (1ull << (shift + WHEEL_LEVEL_BITS))) {
+            ++level;
+            shift += WHEEL_LEVEL_BITS;
+        }
+        slot = WHEEL_ROOT_SIZE + (level - 1) * WHEEL_LEVEL_SIZE +
+            ((expires >> shift) & (WHEEL_LEVEL_SIZE - 1));
+    }
+
+    TimerNode &head = mSlots[slot];
+    timer->prev = head.prev;
+    timer->next = &head;
+    head.prev->next = timer;
+    head.prev = timer;
+    timer->mSlot = slot;
+    if (!timer->mHold) {
+        timer->mHold = timer->shared_from_this();
+        mTimerIndex.emplace(timer->mUniqueId, timer);
+        ++mTimerCount;
+    }
+    mSlotBitmap[slot / 64] |= 1ull << (slot % 64);
+}
+
+void TimerManager::removeTimer(Timer *timer)
+{
+    int32_t slot = timer->mSlot;
+    timer->prev->next = timer->next;
+    timer->next->prev = timer->prev;
+    timer->prev = timer;
+    timer->next = timer;
+    timer->mSlot = -1;
+    if (mSlots[slot].next == &mSlots[slot]) {
+        mSlotBitmap[slot / 64] &= ~(1ull << (slot % 64));
+    }
+    --mTimerCount;
+    mTimerIndex.erase(timer->mUniqueId);
+    timer->mHold.reset();   // 调用方持有引用, 不会在此析构
+}
+
+/**
+ * @brief 将level层当前的槽降级到低层
+ *
+ * @return 该槽的下标, 为0时还需降级更高一层
+ */
+uint32_t TimerManager::cascade(uint32_t level)
+{
+    uint32_t shift = WHEEL_ROOT_BITS + (level - 1) * WHEEL_LEVEL_BITS;
+    uint32_t index = (mWheelTime >> shift) & (WHEEL_LEVEL_SIZE - 1);
+    uint32_t slot = WHEEL_ROOT_SIZE + (level - 1) * WHEEL_LEVEL_SIZE + index;
+
+    TimerNode &head = mSlots[slot];
+    if (head.next == &head) {
+        return index;
+    }
+
+    // 先整体摘下再逐个插入, 插入可能回到同一个槽(超出范围的定时器)
+    TimerNode list;
+    list.next = head.next;
+    list.prev = head.prev;
+    list.next->prev = &list;
+    list.prev->next = &list;
+    head.next = &head;
+    head.prev = &head;
+    mSlotBitmap[slot / 64] &= ~(1ull << (slot % 64));
+
+    while (list.next != &list) {
+        Timer *timer = static_cast<Timer *>(list.next);
+        list.next = timer->next;
+        list.next->prev = &list;
+        insertTimer(timer);
+    }
+    return index;
+}
+
+/**
+ * @brief 最近一个需要处理的时刻: 第0层为到期时间, 更高层为降级时间, 不会晚于其中定时器的到期时间
+ */
+uint64_t TimerManager::nextExpireTime() const
+{
+    uint32_t index = mWheelTime & (WHEEL_ROOT_SIZE - 1);
+    int32_t found = findSlot(index, WHEEL_ROOT_SIZE);
+    if (found >= 0) {
+        return mWheelTime + (found - index);
+    }
+    bool wrapped = findSlot(0, index) >= 0;
+
+    uint32_t shift = WHEEL_ROOT_BITS;
+    for (uint32_t level = 1; level < WHEEL_LEVELS; ++level) {
+        // 本层下一次降级的时刻
+        uint64_t boundary = ((mWheelTime + (1ull << shift) - 1) >> shift) << shift;
+        if (wrapped) {  // 低层绕回的槽在下一次降级之后才到期
+            return boundary;
+        }
+
+        uint32_t base = WHEEL_ROOT_SIZE + (level - 1) * WHEEL_LEVEL_SIZE;
+        index = (boundary >> shift) & (WHEEL_LEVEL_SIZE - 1);
+        found = findSlot(base + index, base + WHEEL_LEVEL_SIZE);
+        if (found >= 0) {
+            return boundary + ((uint64_t)(found - base - index) << shift);
+        }
+        wrapped = findSlot(base, base + index) >= 0;
+        shift += WHEEL_LEVEL_BITS;
+    }
+
+    if (wrapped) {
+        return ((mWheelTime + (1ull << shift) - 1) >> shift) << shift;
+    }
+    return ~0ull;
+}
+
+/**
+ * @brief [begin, end)中第一个非空的槽, 没有返回-1
+ */
+int32_t TimerManager::findSlot(uint32_t begin, uint32_t end) const
+{
+    while (begin < end) {
+        uint32_t word = begin / 64;
+        uint64_t bits = mSlotBitmap[word] & (~0ull << (begin % 64));
+        uint32_t wordEnd = (word + 1) * 64;
+        if (end < wordEnd) {
+            bits &= (1ull << (end % 64)) - 1;
+        }
+        if (bits) {
+            return word * 64 + __builtin_ctzll(bits);
+        }
+        begin = wordEnd;
+    }
+    return -1;
 }
 
 } // namespace eular
@@ -11,27 +11,43 @@
 #include <utils/utils.h>
 #include <utils/mutex.h>
 #include <utils/singleton.h>
+#include "fiber/task.h"
 #include <sys/epoll.h>
 #include <stdint.h>
-#include <set>
+#include <atomic>
 #include <memory>
 #include <functional>
+#include <unordered_map>
+#include <vector>
 
 namespace eular {
 class TimerManager;
-class Timer : public std::enable_shared_from_this<Timer>
+
+/**
+ * @brief 时间轮槽中的双向链表节点, 槽本身是哨兵
+ */
+struct TimerNode {
+    TimerNode *prev;
+    TimerNode *next;
+
+    TimerNode() : prev(this), next(this) {}
+};
+
+/**
+ * @brief 定时器. addTimer返回的Timer::SP即取消句柄, delTimer(handle)为O(1)
+ */
+class Timer : public TimerNode, public std::enable_shared_from_this<Timer>
 {
 public:
     typedef std::shared_ptr<Timer> SP;
-    typedef std::function<void(void)> CallBack;
+    typedef Task CallBack;
     ~Timer();
 
-    Timer &operator=(const Timer& timer);
-
     uint64_t getTimeout() const { return mTime; }
     uint64_t getUniqueId() const { return mUniqueId; }
+    uint32_t getSlack() const { return mSlack; }
     void setNextTime(uint64_t timeMs) { mTime = timeMs; }
-    void setCallback(CallBack cb) { mCb = cb; }
+    void setCallback(CallBack cb) { mCb = std::move(cb); }
     void setRecycleTime(uint64_t ms) { mRecycleTime = ms; }
 
     void cancel();
@@ -42,59 +58,109 @@ public:
 
 private:
     Timer();
-    Timer(uint64_t ms, CallBack cb, uint32_t recycle);
-    Timer(const Timer& timer);
+    Timer(uint64_t ms, CallBack cb, uint32_t recycle, uint32_t slack);
+    Timer(const Timer& timer) = delete;
+    Timer &operator=(const Timer& timer) = delete;
 
 private:
     friend class TimerManager;
-    struct Comparator {
-        // 传给set的比较器，从小到大排序
-        bool operator()(const Timer::SP &left, const Timer::SP &right) {
-            if (left == nullptr && right == nullptr) {
-                return false;
-            }
-            if (left == nullptr) {
-                return true;
-            }
-            if (right == nullptr) {
-                return false;
-            }
-            if (left->mTime == right->mTime) { // 时间相同，比较ID
-                return left->mUniqueId < right->mUniqueId;
-            }
-            return left->mTime < right->mTime;
-        }
-    };
 
 private:
-    uint64_t    mTime;          // (绝对时间)下一次执行时间(ms)
+    uint64_t    mTime;          // 下一次执行的时刻(Clock::NowMs, ms)
     uint64_t    mRecycleTime;   // 循环时间ms
     CallBack    mCb;            // 回调函数
     uint64_t    mUniqueId;      // 定时器唯一ID
+    uint32_t    mSlack;         // 允许延后触发的时间(ms), 到期时刻取[mTime, mTime + mSlack]中最"整"的一个
+    int32_t     mSlot;          // 所在时间轮槽, -1表示不在时间轮中
+    Timer::SP   mHold;          // 在时间轮中时持有自身, 移出时释放
+    std::atomic<bool> mRunning; // 循环定时器的回调已投递还未返回, 期间到期的不再投递
 };
 
+/**
+ * @brief 分层时间轮, 精度1ms
+ *
+ * 第0层256个槽, 每槽1ms; 第1-4层各64个槽, 每槽分别覆盖2^8、2^14、2^20、2^26ms, 共覆盖2^32ms(约49天),
+ * 更远的定时器放在最高层, 降级时重新计算. 插入和删除都是O(1), 到期时高层的槽整体降级到低层.
+ * 每个槽有一位标记是否非空, 用于计算最近的超时时间
+ */
 class TimerManager
 {
     DISALLOW_COPY_AND_ASSIGN(TimerManager);
 public:
-    typedef std::set<Timer *, Timer::Comparator>::iterator TimerIterator;
     TimerManager();
     virtual ~TimerManager();
 
+    /**
+     * @brief 距最近一个定时器到期的时间(ms), 无定时器返回~0ull. 最近的定时器在高层时返回其降级时间, 不会晚于到期时间
+     */
     uint64_t getNearTimeout();
-    uint64_t addTimer(uint64_t ms, Timer::CallBack cb, uint32_t recycle = 0);
-    uint64_t addConditionTimer(uint64_t ms, Timer::CallBack cb, std::weak_ptr<void> cond, uint32_t recycle = 0);
+
+    /**
+     * @brief 添加定时器
+     *
+     * @param ms 超时时间(ms)
+     * @param cb 回调
+     * @param recycle 循环周期(ms), 0表示只执行一次
+     * @param slack 允许延后触发的时间(ms). 到期窗口重叠的定时器会落在同一时刻, 一次唤醒一起处理;
+     *              心跳、IO超时等不要求精确的定时器应设置, 0表示按ms精确触发
+     */
+    Timer::SP addTimer(uint64_t ms, Timer::CallBack cb, uint32_t recycle = 0, uint32_t slack = 0);
+    Timer::SP addConditionTimer(uint64_t ms, Timer::CallBack cb, std::weak_ptr<void> cond,
+                                uint32_t recycle = 0, uint32_t slack = 0);
+
+    /**
+     * @brief 通过addTimer返回的句柄取消, O(1)
+     */
+    bool delTimer(const Timer::SP &timer);
+
+    /**
+     * @brief 通过唯一ID取消, 经ID索引查找, O(1)
+     */
     bool delTimer(uint64_t uniqueId);
 
+    struct TimerStats {
+        uint64_t count;             // 当前定时器数量
+        uint64_t expiredLastTick;   // 最近一次ListExpireTimer到期的数量
+        uint64_t expiredMaxTick;    // 单次ListExpireTimer到期数量的最大值
+        uint64_t expiredTotal;      // 累计到期数量
+        uint64_t ticks;             // 处理到期(有定时器到期)的次数
+    };
+    TimerStats getTimerStats() const;
+
+    bool hasTimer() const;
+
 protected:
-    void ListExpireTimer(std::vector<std::function<void()>> &cbs);
-    uint64_t addTimer(Timer::SP timer);
+    void ListExpireTimer(std::vector<Task> &cbs);
+    Timer::SP addTimer(Timer::SP timer);
     virtual void onTimerInsertedAtFront() = 0;
 
 private:
-    RWMutex mTimerRWMutex;
+    static const uint32_t WHEEL_ROOT_BITS = 8;
+    static const uint32_t WHEEL_LEVEL_BITS = 6;
+    static const uint32_t WHEEL_LEVELS = 5;
+    static const uint32_t WHEEL_ROOT_SIZE = 1 << WHEEL_ROOT_BITS;
+    static const uint32_t WHEEL_LEVEL_SIZE = 1 << WHEEL_LEVEL_BITS;
+    static const uint32_t WHEEL_SLOTS = WHEEL_ROOT_SIZE + (WHEEL_LEVELS - 1) * WHEEL_LEVEL_SIZE;
+
+    void insertTimer(Timer *timer);
+    void removeTimer(Timer *timer);
+    uint32_t cascade(uint32_t level);
+    uint64_t nextExpireTime() const;
+    int32_t findSlot(uint32_t begin, uint32_t end) const;
+
+private:
+    mutable RWMutex mTimerRWMutex;
     bool mTickle = false;       // 是否触发onTimerInsertedAtFront
-    std::set<Timer::SP, Timer::Comparator>  mTimers;        // 定时器集合
+    uint64_t mWheelTime;        // 下一个要处理的时刻(ms), 之前的槽都已处理
+    uint64_t mNextWakeTime;     // getNearTimeout返回的唤醒时刻, 更早的定时器插入时需要唤醒
+    uint64_t mTimerCount;
+    TimerNode mSlots[WHEEL_SLOTS];
+    uint64_t mSlotBitmap[WHEEL_SLOTS / 64];     // 非空的槽
+    std::unordered_map<uint64_t, Timer *> mTimerIndex;  // 唯一ID -> 时间轮中的定时器
+    std::atomic<uint64_t> mExpiredLastTick = {0};
+    std::atomic<uint64_t> mExpiredMaxTick = {0};
+    std::atomic<uint64_t> mExpiredTotal = {0};
+    std::atomic<uint64_t> mExpireTicks = {0};
 };
 
 } // namespace eular
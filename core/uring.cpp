@@ -0,0 +1,213 @@
+/*************************************************************************
+    > File Name: uring.cpp
+    > Author: hsz
+    > Brief:
+    > Created Time: Sat 17 Oct 2026 06:02:36 PM CST
+ ************************************************************************/
+
+#include "uring.h"
+#include <log/log.h>
+#include <errno.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#define LOG_TAG "IoUring"
+
+namespace eular {
+
+static int io_uring_setup(uint32_t entries, io_uring_params *params)
+{
+    return (int)syscall(__NR_io_uring_setup, entries, params);
+}
+
+static int io_uring_enter(int fd, uint32_t toSubmit, uint32_t minComplete, uint32_t flags)
+{
+    return (int)syscall(__NR_io_uring_enter, fd, toSubmit, minComplete, flags, nullptr, 0);
+}
+
+template<typename T>
+static inline T *RingPtr(void *ring, uint32_t offset)
+{
+    return reinterpret_cast<T *>(static_cast<uint8_t *>(ring) + offset);
+}
+
+IoUring::IoUring() :
+    mRingFd(-1),
+    mFeatures(0),
+    mToSubmit(0),
+    mSqRing(MAP_FAILED),
+    mSqRingSize(0),
+    mCqRing(MAP_FAILED),
+    mCqRingSize(0),
+    mSqes(static_cast<io_uring_sqe *>(MAP_FAILED)),
+    mSqesSize(0),
+    mSqHead(nullptr),
+    mSqTail(nullptr),
+    mSqMask(0),
+    mSqEntries(0),
+    mSqArray(nullptr),
+    mSqeTail(0),
+    mCqHead(nullptr),
+    mCqTail(nullptr),
+    mCqMask(0),
+    mCqes(nullptr)
+{
+}
+
+IoUring::~IoUring()
+{
+    release();
+}
+
+bool IoUring::init(uint32_t entries)
+{
+    LOG_ASSERT2(mRingFd < 0);
+    io_uring_params params;
+    memset(&params, 0, sizeof(params));
+    mRingFd = io_uring_setup(entries, &params);
+    if (mRingFd < 0) {
+        LOGW("io_uring_setup(%u) error. [%d,%s]", entries, errno, strerror(errno));
+        return false;
+    }
+    mFeatures = params.features;
+
+    mSqRingSize = params.sq_off.array + params.sq_entries * sizeof(uint32_t);
+    mCqRingSize = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+    if (mFeatures & IORING_FEAT_SINGLE_MMAP) {
+        mSqRingSize = mSqRingSize > mCqRingSize ? mSqRingSize : mCqRingSize;
+    }
+
+    mSqRing = mmap(nullptr, mSqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+        mRingFd, IORING_OFF_SQ_RING);
+    if (mSqRing == MAP_FAILED) {
+        LOGE("mmap sq ring error. [%d,%s]", errno, strerror(errno));
+        release();
+        return false;
+    }
+    if (mFeatures & IORING_FEAT_SINGLE_MMAP) {
+        mCqRing = mSqRing;
+    } else {
+        mCqRing = mmap(nullptr, mCqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+            mRingFd, IORING_OFF_CQ_RING);
+        if (mCqRing == MAP_FAILED) {
+            LOGE("mmap cq ring error. [%d,%s]", errno, strerror(errno));
+            release();
+            return false;
+        }
+    }
+
+    mSqesSize = params.sq_entries * sizeof(io_uring_sqe);
+    mSqes = static_cast<io_uring_sqe *>(mmap(nullptr, mSqesSize, PROT_READ | PROT_WRITE,
+        MAP_SHARED | MAP_POPULATE, mRingFd, IORING_OFF_SQES));
+    if (mSqes == MAP_FAILED) {
+        LOGE("mmap sqes error. [%d,%s]", errno, strerror(errno));
+        release();
+        return false;
+    }
+
+    mSqHead = RingPtr<std::atomic<uint32_t>>(mSqRing, params.sq_off.head);
+    mSqTail = RingPtr<std::atomic<uint32_t>>(mSqRing, params.sq_off.tail);
+    mSqMask = *RingPtr<uint32_t>(mSqRing, params.sq_off.ring_mask);
+    mSqEntries = *RingPtr<uint32_t>(mSqRing, params.sq_off.ring_entries);
+    mSqArray = RingPtr<uint32_t>(mSqRing, params.sq_off.array);
+    mSqeTail = mSqTail->load(std::memory_order_relaxed);
+
+    mCqHead = RingPtr<std::atomic<uint32_t>>(mCqRing, params.cq_off.head);
+    mCqTail = RingPtr<std::atomic<uint32_t>>(mCqRing, params.cq_off.tail);
+    mCqMask = *RingPtr<uint32_t>(mCqRing, params.cq_off.ring_mask);
+    mCqes = RingPtr<io_uring_cqe>(mCqRing, params.cq_off.cqes);
+    return true;
+}
+
+io_uring_sqe *IoUring::getSqe()
+{
+    if (sqSpace() == 0) {
+        return nullptr;
+    }
+
+    uint32_t index = mSqeTail & mSqMask;
+    io_uring_sqe *sqe = &mSqes[index];
+    memset(sqe, 0, sizeof(*sqe));
+    mSqArray[index] = index;
+    ++mSqeTail;
+    ++mToSubmit;
+    return sqe;
+}
+
+uint32_t IoUring::sqSpace() const
+{
+    return mSqEntries - (mSqeTail - mSqHead->load(std::memory_order_acquire));
+}
+
+int IoUring::submit()
+{
+    if (mToSubmit == 0) {
+        return 0;
+    }
+
+    // 内核看到tail之前SQE的内容必须已经写完
+    mSqTail->store(mSqeTail, std::memory_order_release);
+    int ret = 0;
+    do {
+        ret = io_uring_enter(mRingFd, mToSubmit, 0, 0);
+    } while (ret < 0 && errno == EINTR);
+
+    if (ret < 0) {
+        return -errno;
+    }
+    mToSubmit -= ret;
+    return ret;
+}
+
+uint32_t IoUring::reap(io_uring_cqe *cqes, uint32_t count)
+{
+    uint32_t head = mCqHead->load(std::memory_order_relaxed);
+    uint32_t tail = mCqTail->load(std::memory_order_acquire);
+    uint32_t n = 0;
+    while (head != tail && n < count) {
+        cqes[n++] = mCqes[head & mCqMask];
+        ++head;
+    }
+    // 拷贝完成后才能让内核复用这些CQE
+    mCqHead->store(head, std::memory_order_release);
+    return n;
+}
+
+bool IoUring::hasCompletion() const
+{
+    return mCqHead->load(std::memory_order_relaxed) != mCqTail->load(std::memory_order_acquire);
+}
+
+bool IoUring::Supported()
+{
+    static int supported = -1;
+    if (supported < 0) {
+        IoUring ring;
+        supported = ring.init(2) ? 1 : 0;
+    }
+    return supported == 1;
+}
+
+void IoUring::release()
+{
+    if (mSqes != MAP_FAILED) {
+        munmap(mSqes, mSqesSize);
+        mSqes = static_cast<io_uring_sqe *>(MAP_FAILED);
+    }
+    if (mCqRing != MAP_FAILED && mCqRing != mSqRing) {
+        munmap(mCqRing, mCqRingSize);
+    }
+    mCqRing = MAP_FAILED;
+    if (mSqRing != MAP_FAILED) {
+        munmap(mSqRing, mSqRingSize);
+        mSqRing = MAP_FAILED;
+    }
+    if (mRingFd >= 0) {
+        close(mRingFd);
+        mRingFd = -1;
+    }
+}
+
+} // namespace eular
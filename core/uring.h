@@ -0,0 +1,109 @@
+/*************************************************************************
+    > File Name: uring.h
+    > Author: hsz
+    > Brief: io_uring环形队列的最小封装, 直接使用系统调用, 不依赖liburing
+    > Created Time: Sat 17 Oct 2026 06:02:31 PM CST
+ ************************************************************************/
+
+#ifndef __EULAR_CORE_URING_H__
+#define __EULAR_CORE_URING_H__
+
+#include <utils/mutex.h>
+#include <linux/io_uring.h>
+#include <stdint.h>
+#include <atomic>
+
+namespace eular {
+
+/**
+ * @brief 单个io_uring实例
+ *
+ * getSqe/submit不是线程安全的, 由调用方加锁; reap同一时刻只能有一个线程调用.
+ * 提交与收割可以在不同线程并发进行
+ */
+class IoUring : public NonCopyAble
+{
+public:
+    IoUring();
+    ~IoUring();
+
+    /**
+     * @brief 创建io_uring并映射SQ/CQ
+     *
+     * @param entries SQ大小, 内核会向上取整到2的幂
+     * @return 失败返回false(内核不支持, 被seccomp禁用等), 调用方应回退到epoll
+     */
+    bool init(uint32_t entries);
+
+    int fd() const { return mRingFd; }
+    uint32_t features() const { return mFeatures; }
+
+    /**
+     * @brief 取一个空闲的SQE, 已清零. SQ已满时返回nullptr
+     */
+    io_uring_sqe *getSqe();
+
+    /**
+     * @brief SQ中剩余的空闲SQE数
+     */
+    uint32_t sqSpace() const;
+
+    /**
+     * @brief 将getSqe取到的SQE提交给内核
+     *
+     * @return 本次提交的数量, 出错返回-errno. 未提交的SQE留到下次submit
+     */
+    int submit();
+
+    /**
+     * @brief 取出已完成的CQE
+     *
+     * @param cqes 输出
+     * @param count cqes容量
+     * @return 取出的数量
+     */
+    uint32_t reap(io_uring_cqe *cqes, uint32_t count);
+
+    /**
+     * @brief CQ中是否有未取出的CQE
+     */
+    bool hasCompletion() const;
+
+    /**
+     * @brief 当前内核是否可用io_uring(结果缓存)
+     */
+    static bool Supported();
+
+private:
+    void release();
+
+private:
+    int         mRingFd;
+    uint32_t    mFeatures;
+    uint32_t    mToSubmit;          // 已填写未提交的SQE数
+
+    void *      mSqRing;
+    size_t      mSqRingSize;
+    void *      mCqRing;            // IORING_FEAT_SINGLE_MMAP时与mSqRing相同
+    size_t      mCqRingSize;
+    io_uring_sqe *mSqes;
+    size_t      mSqesSize;
+
+    // SQ
+    std::atomic<uint32_t> *mSqHead;
+    std::atomic<uint32_t> *mSqTail;
+    uint32_t    mSqMask;
+    uint32_t    mSqEntries;
+    uint32_t *  mSqArray;
+    uint32_t    mSqeTail;           // 本地tail, submit时发布给内核
+
+    // CQ
+    std::atomic<uint32_t> *mCqHead;
+    std::atomic<uint32_t> *mCqTail;
+    uint32_t    mCqMask;
+    io_uring_cqe *mCqes;
+};
+
+} // namespace eular
+
+#endif // __EULAR_CORE_URING_H__
@@ -79,12 +79,14 @@ void FdContext::setTimeOut(int type, uint64_t ms)
 
 uint64_t FdContext::getTimeOut(int type) const
 {
+    uint64_t ms = -1;
     if (type == SO_RCVTIMEO) {
-        return recvTimeout;
-    } else if (type = SO_SNDTIMEO) {
-        return sendTimeout;
+        ms = recvTimeout;
+    } else if (type == SO_SNDTIMEO) {
+        ms = sendTimeout;
     }
-    return -1;
+    // 与SO_RCVTIMEO/SO_SNDTIMEO语义一致: 0表示不超时
+    return ms == 0 ? (uint64_t)-1 : ms;
 }
 
 Fdmanager::Fdmanager()
@@ -131,6 +133,9 @@ void Fdmanager::del(int fd)
     if (fd >= mFdCtxVec.size()) {
         return;
     }
+    if (mFdCtxVec[fd]) {
+        mFdCtxVec[fd]->mIsClosed = true;    // 仍持有此上下文的协程(如阻塞在do_io中)据此停止重试
+    }
     mFdCtxVec[fd].reset();
 }
 
@@ -39,7 +39,10 @@ public:
      * @param ms 
      */
     void setTimeOut(int type, uint64_t ms);
-    uint64_t getTimeOut(int type) const; 
+    /**
+     * @brief 获取超时时间, 未设置或设置为0时返回(uint64_t)-1, 表示不超时
+     */
+    uint64_t getTimeOut(int type) const;
 
 private:
     FdContext(int fd);
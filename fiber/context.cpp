@@ -0,0 +1,217 @@
+/*************************************************************************
+    > File Name: context.cpp
+    > Author: hsz
+    > Brief: 协程上下文切换后端
+    > Created Time: Sat 17 Oct 2026 10:05:18 AM CST
+ ************************************************************************/
+
+#include "context.h"
+#include <log/log.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define LOG_TAG "context"
+
+#if defined(FIBER_USE_UCONTEXT)
+
+namespace eular {
+
+bool ContextInit(FiberContext *ctx)
+{
+    return getcontext(&ctx->uctx) == 0;
+}
+
+bool ContextMake(FiberContext *ctx, void *stack, size_t size, ContextEntry entry)
+{
+    if (getcontext(&ctx->uctx)) {
+        return false;
+    }
+    ctx->uctx.uc_stack.ss_sp = stack;
+    ctx->uctx.uc_stack.ss_size = size;
+    ctx->uctx.uc_link = nullptr;
+    makecontext(&ctx->uctx, entry, 0);
+    return true;
+}
+
+bool ContextSwap(FiberContext *from, FiberContext *to)
+{
+    return swapcontext(&from->uctx, &to->uctx) == 0;
+}
+
+const char *ContextBackend()
+{
+    return "ucontext";
+}
+
+} // namespace eular
+
+#else
+
+extern "C" {
+/**
+ * @brief 保存callee-saved寄存器到当前栈，将栈顶写入*from后切换到to栈并恢复寄存器
+ */
+void eular_context_swap(void **from, void *to);
+void eular_context_start();
+}
+
+#if defined(__x86_64__)
+/**
+ * System V AMD64 ABI: callee-saved为rbx rbp r12-r15，另需保存mxcsr和x87控制字
+ *
+ * 切出后栈布局(低地址 -> 高地址):
+ * | mxcsr | x87cw | r15 | r14 | r13 | r12 | rbx | rbp | 返回地址 |
+ */
+asm(R"(
+    .text
+    .globl  eular_context_swap
+    .hidden eular_context_swap
+    .type   eular_context_swap, @function
+    .align  16
+eular_context_swap:
+    pushq   %rbp
+    pushq   %rbx
+    pushq   %r12
+    pushq   %r13
+    pushq   %r14
+    pushq   %r15
+    subq    $8, %rsp
+    stmxcsr (%rsp)
+    fnstcw  4(%rsp)
+    movq    %rsp, (%rdi)
+    movq    %rsi, %rsp
+    ldmxcsr (%rsp)
+    fldcw   4(%rsp)
+    addq    $8, %rsp
+    popq    %r15
+    popq    %r14
+    popq    %r13
+    popq    %r12
+    popq    %rbx
+    popq    %rbp
+    ret
+    .size   eular_context_swap, .-eular_context_swap
+
+    .globl  eular_context_start
+    .hidden eular_context_start
+    .type   eular_context_start, @function
+    .align  16
+eular_context_start:
+    xorq    %rbp, %rbp
+    callq   *%rbx
+    callq   abort@PLT
+    .size   eular_context_start, .-eular_context_start
+)");
+
+static const size_t CONTEXT_SAVED_WORDS = 8;     // mxcsr/x87cw + 6个通用寄存器 + 返回地址
+static const size_t CONTEXT_ENTRY_INDEX = 5;     // rbx在栈上的位置, 用于保存入口函数
+static const size_t CONTEXT_RET_INDEX   = 7;
+
+#elif defined(__aarch64__)
+/**
+ * AAPCS64: callee-saved为x19-x28 fp(x29) lr(x30)以及d8-d15的低64位
+ *
+ * 切出后栈布局(低地址 -> 高地址):
+ * | x19 x20 ... x28 | x29 | x30 | d8 ... d15 |
+ */
+asm(R"(
+    .text
+    .globl  eular_context_swap
+    .hidden eular_context_swap
+    .type   eular_context_swap, %function
+    .align  4
+eular_context_swap:
+    sub     sp, sp, #160
+    stp     x19, x20, [sp, #0]
+    stp     x21, x22, [sp, #16]
+    stp     x23, x24, [sp, #32]
+    stp     x25, x26, [sp, #48]
+    stp     x27, x28, [sp, #64]
+    stp     x29, x30, [sp, #80]
+    stp     d8,  d9,  [sp, #96]
+    stp     d10, d11, [sp, #112]
+    stp     d12, d13, [sp, #128]
+    stp     d14, d15, [sp, #144]
+    mov     x2, sp
+    str     x2, [x0]
+    mov     sp, x1
+    ldp     x19, x20, [sp, #0]
+    ldp     x21, x22, [sp, #16]
+    ldp     x23, x24, [sp, #32]
+    ldp     x25, x26, [sp, #48]
+    ldp     x27, x28, [sp, #64]
+    ldp     x29, x30, [sp, #80]
+    ldp     d8,  d9,  [sp, #96]
+    ldp     d10, d11, [sp, #112]
+    ldp     d12, d13, [sp, #128]
+    ldp     d14, d15, [sp, #144]
+    add     sp, sp, #160
+    ret
+    .size   eular_context_swap, .-eular_context_swap
+
+    .globl  eular_context_start
+    .hidden eular_context_start
+    .type   eular_context_start, %function
+    .align  4
+eular_context_start:
+    mov     x29, xzr
+    blr     x19
+    bl      abort
+    .size   eular_context_start, .-eular_context_start
+)");
+
+static const size_t CONTEXT_SAVED_WORDS = 20;    // 12个通用寄存器 + 8个浮点寄存器
+static const size_t CONTEXT_ENTRY_INDEX = 0;     // x19, 用于保存入口函数
+static const size_t CONTEXT_RET_INDEX   = 11;    // x30
+
+#endif
+
+namespace eular {
+
+bool ContextInit(FiberContext *ctx)
+{
+    // 主协程的栈顶在第一次切出时由eular_context_swap写入
+    ctx->sp = nullptr;
+    return true;
+}
+
+bool ContextMake(FiberContext *ctx, void *stack, size_t size, ContextEntry entry)
+{
+    if (stack == nullptr || size < CONTEXT_SAVED_WORDS * sizeof(uint64_t) + 64) {
+        return false;
+    }
+
+    // 栈顶按16字节对齐，并预留一个槽位，保证进入入口函数时满足ABI的对齐要求
+    uintptr_t top = ((uintptr_t)stack + size) & ~(uintptr_t)15;
+    uint64_t *sp = (uint64_t *)(top - 16) - CONTEXT_SAVED_WORDS;
+    memset(sp, 0, (CONTEXT_SAVED_WORDS + 2) * sizeof(uint64_t));
+
+#if defined(__x86_64__)
+    sp[0] = 0x1F80 | ((uint64_t)0x037F << 32);  // mxcsr和x87控制字的默认值
+#endif
+    sp[CONTEXT_ENTRY_INDEX] = (uint64_t)(uintptr_t)entry;
+    sp[CONTEXT_RET_INDEX] = (uint64_t)(uintptr_t)&eular_context_start;
+
+    ctx->sp = sp;
+    return true;
+}
+
+bool ContextSwap(FiberContext *from, FiberContext *to)
+{
+    LOG_ASSERT2(to->sp != nullptr);
+    eular_context_swap(&from->sp, to->sp);
+    return true;
+}
+
+const char *ContextBackend()
+{
+#if defined(__x86_64__)
+    return "asm-x86_64";
+#else
+    return "asm-aarch64";
+#endif
+}
+
+} // namespace eular
+
+#endif
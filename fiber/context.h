@@ -0,0 +1,68 @@
+/*************************************************************************
+    > File Name: context.h
+    > Author: hsz
+    > Brief: 协程上下文切换后端
+    > Created Time: Sat 17 Oct 2026 10:05:12 AM CST
+ ************************************************************************/
+
+#ifndef __EULAR_FIBER_CONTEXT_H__
+#define __EULAR_FIBER_CONTEXT_H__
+
+#include <stdint.h>
+#include <stddef.h>
+
+/**
+ * 编译期选择上下文切换方式:
+ *  1、默认在x86-64和aarch64下使用汇编实现，仅保存callee-saved寄存器，不涉及信号掩码，无系统调用
+ *  2、定义FIBER_USE_UCONTEXT或其他架构时退回ucontext，swapcontext每次切换都会调用rt_sigprocmask
+ */
+#if !defined(FIBER_USE_UCONTEXT) && !defined(__x86_64__) && !defined(__aarch64__)
+#define FIBER_USE_UCONTEXT
+#endif
+
+#if defined(FIBER_USE_UCONTEXT)
+#include <ucontext.h>
+#endif
+
+namespace eular {
+
+typedef void (*ContextEntry)();
+
+#if defined(FIBER_USE_UCONTEXT)
+struct FiberContext {
+    ucontext_t  uctx;
+};
+#else
+struct FiberContext {
+    void *      sp;     // 切出时的栈顶，callee-saved寄存器保存在栈上
+};
+#endif
+
+/**
+ * @brief 初始化线程主协程的上下文(主协程使用线程栈)
+ */
+bool ContextInit(FiberContext *ctx);
+
+/**
+ * @brief 在给定的栈上构造上下文，第一次切入时执行entry，entry不允许返回
+ *
+ * @param ctx 上下文
+ * @param stack 栈底(低地址)
+ * @param size 栈大小
+ * @param entry 入口函数
+ */
+bool ContextMake(FiberContext *ctx, void *stack, size_t size, ContextEntry entry);
+
+/**
+ * @brief 保存当前上下文到from并切换到to
+ */
+bool ContextSwap(FiberContext *from, FiberContext *to);
+
+/**
+ * @brief 返回当前使用的后端名称
+ */
+const char *ContextBackend();
+
+} // namespace eular
+
+#endif // __EULAR_FIBER_CONTEXT_H__
@@ -6,9 +6,13 @@
  ************************************************************************/
 
 #include "fiber.h"
+#include "stack_allocator.h"
+#include "config.h"
 #include <log/log.h>
+#include <sys/mman.h>
 #include <atomic>
 #include <exception>
+#include <vector>
 
 #define LOG_TAG "fiber"
 
@@ -20,62 +24,78 @@ static std::atomic<uint64_t> gFiberCount(0);    // 当前协程总数
 static thread_local Fiber *gCurrentFiber = nullptr;         // 当前正在执行的协程
 static thread_local Fiber::SP gThreadMainFiber = nullptr;   // 一个线程的主协程
 
-uint64_t getStackSize()
+static std::atomic<uint64_t> gMaxStackUsage(0);   // 已观测到的最大栈使用量
+
+#define DEFAULT_STACK_SIZE          (1024 * 1024)
+#define DEFAULT_SMALL_STACK_SIZE    (64 * 1024)
+#define MIN_SMALL_STACK_SIZE        (16 * 1024)
+
+static uint64_t configStackSize()
 {
-    // TODO: 从配置文件中获取栈大小
-    static uint64_t size = 1024 * 1024;
+    static uint64_t size = Config::Lookup<uint64_t>("fiber.stack_size", DEFAULT_STACK_SIZE);
     return size;
 }
 
-class MallocAllocator
+static uint64_t configSmallStackSize()
 {
-public:
-    static void *alloc(uint64_t size)
-    {
-        return malloc(size);
-    }
-    static void dealloc(void *ptr, uint64_t size)
-    {
-        LOG_ASSERT(ptr, "dealloc a null pointer");
-        free(ptr);
-    }
-};
+    static uint64_t size = []() {
+        uint64_t size = Config::Lookup<uint64_t>("fiber.small_stack_size", DEFAULT_SMALL_STACK_SIZE);
+        if (size < MIN_SMALL_STACK_SIZE) {
+            size = MIN_SMALL_STACK_SIZE;
+        }
+        if (size > DEFAULT_SMALL_STACK_SIZE) {
+            size = DEFAULT_SMALL_STACK_SIZE;
+        }
+        return size;
+    }();
+    return size;
+}
+
+/**
+ * 栈水位探测. 新mmap的栈和MADV_DONTNEED之后的栈读出来都是0, 所以用0作为"未使用"的标记,
+ * 不需要预先填充整块栈; 每次测量后只需把用过的区域重新清零
+ */
+static bool stackProbeEnable()
+{
+    static bool enable = Config::Lookup<bool>("fiber.stack_probe", false);
+    return enable;
+}
 
-using Allocator = MallocAllocator;
+using Allocator = StackAllocator;
 
 Fiber::Fiber() :
-    mFiberId(++gFiberId)
+    mRunning(false),
+    mFiberId(++gFiberId),
+    mStackSize(0),
+    mStack(nullptr)
 {
     ++gFiberCount;
     mState = EXEC;
-    if (getcontext(&mCtx)) {
+    if (!ContextInit(&mCtx)) {
         LOG_ASSERT(false, "getcontext error, %d %s", errno, strerror(errno));
     }
     SetThis(this);
     LOGD("Fiber::Fiber() start id = %d, total = %d", mFiberId, gFiberCount.load());
 }
 
-Fiber::Fiber(std::function<void()> cb, uint64_t stackSize) :
+Fiber::Fiber(Task cb, uint64_t stackSize) :
     mState(READY),
+    mRunning(false),
     mFiberId(++gFiberId),
-    mCb(cb)
+    mCb(std::move(cb))
 {
     ++gFiberCount;
 
-    mStackSize = stackSize ? stackSize : getStackSize();
+    mStackSize = stackSize ? stackSize : configStackSize();
     mStack = Allocator::alloc(mStackSize);
     LOG_ASSERT(mStack, "Fiber id = %lu, stack pointer is null", mFiberId);
 
-    if (getcontext(&mCtx)) {
-        LOG_ASSERT(false, "Fiber::Fiber(std::function<void()>, uint64_t) getcontext error. %d %s",
+    if (!ContextMake(&mCtx, mStack, mStackSize, &FiberEntry)) {
+        LOG_ASSERT(false, "Fiber::Fiber(Task, uint64_t) getcontext error. %d %s",
             errno, strerror(errno));
     }
-    mCtx.uc_stack.ss_sp = mStack;
-    mCtx.uc_stack.ss_size = mStackSize;
-    mCtx.uc_link = nullptr;
-    makecontext(&mCtx, &FiberEntry, 0);
 
-    LOGD("Fiber::Fiber(std::function<void()>, uint64_t) id = %lu, total = %d",
+    LOGD("Fiber::Fiber(Task, uint64_t) id = %lu, total = %d",
         mFiberId, gFiberCount.load());
 }
 
@@ -84,8 +104,10 @@ Fiber::~Fiber()
     --gFiberCount;
     LOGD("Fiber::~Fiber() id = %lu, total = %d", mFiberId, gFiberCount.load());
     if (mStack) {
-        LOG_ASSERT(mState == TERM || mState == EXCEPT,
+        // READY: 尚未运行或reset(nullptr)后未再使用(调度线程退出时的cbFiber), 栈上无需析构的对象
+        LOG_ASSERT(mState == TERM || mState == EXCEPT || mState == READY,
             "file %s, line %d", __FILE__, __LINE__);
+        recordStackUsage();
         Allocator::dealloc(mStack, mStackSize);
     } else {    // main fiber
         LOG_ASSERT(!mCb, "");
@@ -96,20 +118,17 @@ Fiber::~Fiber()
 }
 
 // 调用位置在主协程中。
-void Fiber::reset(std::function<void()> cb)
+void Fiber::reset(Task cb)
 {
     LOG_ASSERT(mStack, "main fiber can't reset"); // 排除main fiber
     // 暂停态，执行态，ready态无法reset
     LOG_ASSERT(mState == TERM || mState == EXCEPT || mState == READY,
         "reset unauthorized operation");
-    mCb = cb;
-    if (getcontext(&mCtx)) {
-        LOG_ASSERT(false, "File %s, Line %s. getcontex error.", __FILE__, __LINE__);
-    }
-    mCtx.uc_stack.ss_sp = mStack;
-    mCtx.uc_stack.ss_size = mStackSize;
-    mCtx.uc_link = nullptr;
-    makecontext(&mCtx, &FiberEntry, 0);
+    recordStackUsage();
+    mCb = std::move(cb);
+    if (!ContextMake(&mCtx, mStack, mStackSize, &FiberEntry)) {
+        LOG_ASSERT(false, "File %s, Line %d. getcontex error.", __FILE__, __LINE__);
+    }
     mState = READY;
 }
 
@@ -118,7 +137,7 @@ void Fiber::swapIn()
     SetThis(this);
     LOG_ASSERT(mState != EXEC, "");
     mState = EXEC;
-    if (swapcontext(&gThreadMainFiber->mCtx, &mCtx)) {
+    if (!ContextSwap(&gThreadMainFiber->mCtx, &mCtx)) {
         LOG_ASSERT(false, "swapIn() id = %d, errno = %d, %s", mFiberId, errno, strerror(errno));
     }
 }
@@ -126,7 +145,7 @@ void Fiber::swapIn()
 void Fiber::swapOut()
 {
     SetThis(gThreadMainFiber.get());
-    if (swapcontext(&mCtx, &gThreadMainFiber->mCtx)) {
+    if (!ContextSwap(&mCtx, &gThreadMainFiber->mCtx)) {
         LOG_ASSERT(false, "swapIn() id = %d, errno = %d, %s", mFiberId, errno, strerror(errno));
     }
 }
@@ -152,7 +171,7 @@ void Fiber::call()
 {
     SetThis(this);
     mState = EXEC;
-    if (swapcontext(&gThreadMainFiber->mCtx, &mCtx)) {
+    if (!ContextSwap(&gThreadMainFiber->mCtx, &mCtx)) {
         LOG_ASSERT(false, "call() id = %d, errno = %d, %s", mFiberId, errno, strerror(errno));
     }
 }
@@ -160,7 +179,7 @@ void Fiber::call()
 void Fiber::back()
 {
     SetThis(gThreadMainFiber.get());
-    if (swapcontext(&mCtx, &gThreadMainFiber->mCtx)) {
+    if (!ContextSwap(&mCtx, &gThreadMainFiber->mCtx)) {
         LOG_ASSERT(false, "back() id = %d, errno = %d, %s", mFiberId, errno, strerror(errno));
     }
 }
@@ -193,6 +212,73 @@ Fiber::FiberState Fiber::getState()
     return mState;
 }
 
+/**
+ * @brief 从栈底向上找到第一个非0的字, 即历史最深的位置. 未驻留内存的页一定没有被使用过，直接跳过
+ */
+uint64_t Fiber::getStackUsage() const
+{
+    if (mStack == nullptr) {
+        return 0;
+    }
+
+    static const uint64_t pageSize = sysconf(_SC_PAGESIZE);
+    uint64_t pages = (mStackSize + pageSize - 1) / pageSize;
+    std::vector<unsigned char> resident(pages, 1);
+    if (((uintptr_t)mStack % pageSize) == 0) {
+        mincore(mStack, mStackSize, resident.data());
+    }
+
+    for (uint64_t i = 0; i < pages; ++i) {
+        if (!(resident[i] & 1)) {
+            continue;
+        }
+        const uint64_t *begin = (const uint64_t *)((uint8_t *)mStack + i * pageSize);
+        const uint64_t *end = (const uint64_t *)((uint8_t *)mStack + std::min((i + 1) * pageSize, mStackSize));
+        for (const uint64_t *it = begin; it < end; ++it) {
+            if (*it != 0) {
+                return mStackSize - ((const uint8_t *)it - (const uint8_t *)mStack);
+            }
+        }
+    }
+    return 0;
+}
+
+uint64_t Fiber::MaxStackUsage()
+{
+    return gMaxStackUsage.load(std::memory_order_relaxed);
+}
+
+uint64_t Fiber::DefaultStackSize()
+{
+    return configStackSize();
+}
+
+uint64_t Fiber::SmallStackSize()
+{
+    return configSmallStackSize();
+}
+
+void Fiber::recordStackUsage()
+{
+    if (!stackProbeEnable() || mStack == nullptr) {
+        return;
+    }
+
+    uint64_t usage = getStackUsage();
+    uint64_t maxUsage = gMaxStackUsage.load(std::memory_order_relaxed);
+    while (usage > maxUsage &&
+           !gMaxStackUsage.compare_exchange_weak(maxUsage, usage, std::memory_order_relaxed)) {
+    }
+    if (usage > mStackSize / 4 * 3) {
+        LOGW("fiber %lu stack usage %lu/%lu exceeds 75%%", mFiberId, usage, mStackSize);
+    } else {
+        LOGD("fiber %lu stack usage %lu/%lu", mFiberId, usage, mStackSize);
+    }
+
+    // 清零用过的区域, 为下一次测量做准备
+    memset((uint8_t *)mStack + mStackSize - usage, 0, usage);
+}
+
 uint64_t Fiber::GetFiberID()
 {
     if (gCurrentFiber) {
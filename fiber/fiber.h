@@ -8,8 +8,10 @@
 #ifndef __FIBER_H__
 #define __FIBER_H__
 
+#include "context.h"
+#include "task.h"
 #include <stdio.h>
-#include <ucontext.h>
+#include <atomic>
 #include <functional>
 #include <memory>
 
@@ -29,10 +31,10 @@ public:
         TERM,       // 结束状态
         EXCEPT      // 异常状态
     };
-    Fiber(std::function<void()> cb, uint64_t stackSize = 0);
+    Fiber(Task cb, uint64_t stackSize = 0);
     ~Fiber();
 
-           void         reset(std::function<void()> cb);
+           void         reset(Task cb);
     static void         SetThis(Fiber *f);  // 设置当前正在执行的协程
     static Fiber::SP    GetThis();          // 获取当前正在执行的协程
            void         call();             // 唤醒当前线程的协程
@@ -43,19 +45,27 @@ public:
     FiberState          getState();         // 获取执行状态
     static uint64_t     GetFiberID();       // 获取当前协程ID
 
+    uint64_t            getStackSize() const { return mStackSize; }
+    uint64_t            getStackUsage() const;  // 栈水位(字节), 需开启fiber.stack_probe
+    static uint64_t     MaxStackUsage();        // 所有协程观测到的最大栈水位
+    static uint64_t     DefaultStackSize();     // fiber.stack_size, 默认1MiB
+    static uint64_t     SmallStackSize();       // fiber.small_stack_size, 16-64KiB, 用于短小的回调
+
 private:
     Fiber();                    // 线程的第一个协程调用
     static void FiberEntry();   // 协程入口函数
     void swapIn();              // 切换到前台, 获取执行权限
     void swapOut();             // 切换到后台, 让出执行权限
+    void recordStackUsage();    // 记录栈水位并清零已使用区域
 
 private:
-    ucontext_t      mCtx;
+    FiberContext    mCtx;
     FiberState      mState;
+    std::atomic<bool> mRunning;     // 由调度线程设置, 从resume前到切回后处理完状态, 期间其他线程不能恢复此协程
     uint64_t        mFiberId;
     uint64_t        mStackSize;
     void *          mStack;
-    std::function<void()> mCb;
+    Task            mCb;
     friend class Scheduler;
 };
 
@@ -0,0 +1,126 @@
+/*************************************************************************
+    > File Name: mpsc_queue.h
+    > Author: hsz
+    > Brief: 侵入式无锁多生产者单消费者队列
+    > Created Time: Sat 17 Oct 2026 02:48:15 PM CST
+ ************************************************************************/
+
+#ifndef __EULAR_FIBER_MPSC_QUEUE_H__
+#define __EULAR_FIBER_MPSC_QUEUE_H__
+
+#include <stdint.h>
+#include <atomic>
+
+namespace eular {
+
+/**
+ * @brief 入队元素需继承此结构
+ */
+struct MpscNode {
+    std::atomic<MpscNode *> mpscNext;
+
+    MpscNode() : mpscNext(nullptr) {}
+};
+
+/**
+ * @brief Vyukov侵入式MPSC队列
+ *
+ * push为一次exchange加一次store, 任意线程调用且不会阻塞;
+ * pop同一时刻只能有一个线程调用, 多个消费者时由调用方保证互斥(见Scheduler的批量取出)
+ *
+ * @tparam T 继承自MpscNode的类型
+ */
+template<typename T>
+class MpscQueue
+{
+public:
+    MpscQueue() :
+        mHead(&mStub),
+        mTail(&mStub)
+    {
+    }
+
+    MpscQueue(const MpscQueue &) = delete;
+    MpscQueue &operator=(const MpscQueue &) = delete;
+
+    /**
+     * @brief 任意线程均可调用
+     */
+    void push(T *item)
+    {
+        pushNode(static_cast<MpscNode *>(item));
+    }
+
+    /**
+     * @brief 仅限单个消费者调用
+     *
+     * @return 队列为空, 或生产者正处于push中间状态时返回nullptr
+     */
+    T *pop()
+    {
+        MpscNode *tail = mTail;
+        MpscNode *next = tail->mpscNext.load(std::memory_order_acquire);
+        if (tail == &mStub) {
+            if (next == nullptr) {
+                return nullptr;
+            }
+            mTail = next;
+            tail = next;
+            next = next->mpscNext.load(std::memory_order_acquire);
+        }
+
+        if (next != nullptr) {
+            mTail = next;
+            return static_cast<T *>(tail);
+        }
+
+        if (tail != mHead.load(std::memory_order_acquire)) {
+            // 生产者已exchange了head但还未链接next
+            mInconsistent.fetch_add(1, std::memory_order_relaxed);
+            return nullptr;
+        }
+
+        pushNode(&mStub);
+        next = tail->mpscNext.load(std::memory_order_acquire);
+        if (next != nullptr) {
+            mTail = next;
+            return static_cast<T *>(tail);
+        }
+        return nullptr;
+    }
+
+    /**
+     * @brief 仅限消费者调用
+     */
+    bool empty() const
+    {
+        return mTail == &mStub && mStub.mpscNext.load(std::memory_order_acquire) == nullptr;
+    }
+
+    /**
+     * @brief pop时遇到生产者未完成push的次数
+     */
+    uint64_t inconsistentCount() const
+    {
+        return mInconsistent.load(std::memory_order_relaxed);
+    }
+
+private:
+    void pushNode(MpscNode *node)
+    {
+        node->mpscNext.store(nullptr, std::memory_order_relaxed);
+        MpscNode *prev = mHead.exchange(node, std::memory_order_acq_rel);
+        prev->mpscNext.store(node, std::memory_order_release);
+    }
+
+private:
+    std::atomic<MpscNode *> mHead;              // 生产者端
+    char                    mPadding[64 - sizeof(std::atomic<MpscNode *>)];
+    MpscNode *              mTail;              // 消费者端
+    MpscNode                mStub;
+    std::atomic<uint64_t>   mInconsistent = {0};
+};
+
+} // namespace eular
+
+#endif // __EULAR_FIBER_MPSC_QUEUE_H__
@@ -7,15 +7,155 @@
 
 #include "scheduler.h"
 #include "hook.h"
+#include "stack_allocator.h"
+#include "core/clock.h"
 #include <utils/utils.h>
 #include <log/log.h>
 
 #define LOG_TAG "scheduler"
 
+#define DRAIN_BATCH_SIZE    32  // 每次从全局注入队列最多取出的任务数
+#define NODE_BATCH_SIZE     64  // 任务节点在线程缓存与全局链表之间的搬运粒度
+#define NODE_MAX_BATCHES    64  // 全局链表最多缓存的批数
+
 namespace eular {
 
 static thread_local Scheduler *gScheduler = nullptr;    // 线程调度器
 static thread_local Fiber *gMainFiber = nullptr;        // 调度器的主协程
+static thread_local void *gWorker = nullptr;            // 当前线程在gScheduler中对应的Worker
+static thread_local uint32_t gStealSeed = 0;            // 选择窃取对象的随机数种子
+
+/**
+ * 任务节点池. 节点一般在投递线程(如epoll线程)分配、在执行线程释放,
+ * 所以线程缓存满了之后整批归还到全局链表, 缓存为空时再从全局链表整批取回
+ */
+struct TaskNode {
+    TaskNode *next;
+    TaskNode *nextBatch;
+};
+
+static Mutex gNodeMutex;
+static TaskNode *gNodeBatches = nullptr;
+static uint32_t gNodeBatchCount = 0;
+
+/**
+ * 线程缓存只含平凡类型, thread_local不需要析构, 线程退出时其他thread_local对象的析构函数
+ * 释放任务节点也能安全读取state; 链表中的节点由首次使用时注册的TaskNodeCacheReleaser释放
+ */
+struct TaskNodeCache {
+    enum State : uint8_t {
+        UNUSED = 0,     // 本线程还未使用
+        ALIVE,
+        RELEASED,       // 线程正在退出, 缓存已释放, 之后直接使用全局的new/delete
+    };
+
+    TaskNode *head;
+    uint32_t count;
+    uint8_t state;
+};
+
+static thread_local TaskNodeCache gNodeCache;
+
+struct TaskNodeCacheReleaser {
+    ~TaskNodeCacheReleaser()
+    {
+        gNodeCache.state = TaskNodeCache::RELEASED;
+        while (gNodeCache.head) {
+            TaskNode *node = gNodeCache.head;
+            gNodeCache.head = node->next;
+            ::operator delete(node);
+        }
+        gNodeCache.count = 0;
+    }
+};
+
+static TaskNodeCache *LocalNodeCache()
+{
+    TaskNodeCache &cache = gNodeCache;
+    if (eular_unlikely(cache.state != TaskNodeCache::ALIVE)) {
+        if (cache.state == TaskNodeCache::RELEASED) {
+            return nullptr;
+        }
+        static thread_local TaskNodeCacheReleaser releaser;    // 首次使用时注册线程退出时的释放
+        (void)releaser;
+        cache.state = TaskNodeCache::ALIVE;
+    }
+    return &cache;
+}
+
+void *Scheduler::FiberBindThread::operator new(size_t size)
+{
+    static_assert(sizeof(FiberBindThread) >= sizeof(TaskNode), "");
+    TaskNodeCache *local = size == sizeof(FiberBindThread) ? LocalNodeCache() : nullptr;
+    if (local == nullptr) {
+        return ::operator new(size);
+    }
+
+    TaskNodeCache &cache = *local;
+    if (cache.head == nullptr) {
+        AutoLock<Mutex> lock(gNodeMutex);
+        if (gNodeBatches) {
+            cache.head = gNodeBatches;
+            cache.count = NODE_BATCH_SIZE;
+            gNodeBatches = gNodeBatches->nextBatch;
+            --gNodeBatchCount;
+        }
+    }
+    if (cache.head == nullptr) {
+        return ::operator new(size);
+    }
+
+    TaskNode *node = cache.head;
+    cache.head = node->next;
+    --cache.count;
+    return node;
+}
+
+void Scheduler::FiberBindThread::operator delete(void *ptr)
+{
+    if (ptr == nullptr) {
+        return;
+    }
+    TaskNodeCache *local = LocalNodeCache();
+    if (local == nullptr) {
+        ::operator delete(ptr);
+        return;
+    }
+
+    TaskNodeCache &cache = *local;
+    TaskNode *node = static_cast<TaskNode *>(ptr);
+    node->next = cache.head;
+    cache.head = node;
+    if (++cache.count < NODE_BATCH_SIZE * 2) {
+        return;
+    }
+
+    // 取出前NODE_BATCH_SIZE个作为一批
+    TaskNode *batch = cache.head;
+    TaskNode *last = batch;
+    for (uint32_t i = 1; i < NODE_BATCH_SIZE; ++i) {
+        last = last->next;
+    }
+    cache.head = last->next;
+    cache.count -= NODE_BATCH_SIZE;
+    last->next = nullptr;
+
+    {
+        AutoLock<Mutex> lock(gNodeMutex);
+        if (gNodeBatchCount < NODE_MAX_BATCHES) {
+            batch->nextBatch = gNodeBatches;
+            gNodeBatches = batch;
+            ++gNodeBatchCount;
+            return;
+        }
+    }
+
+    while (batch) {
+        node = batch;
+        batch = batch->next;
+        ::operator delete(node);
+    }
+}
 
 Scheduler::Scheduler(uint32_t threads, bool useCaller, const eular::String8 &name) :
     mContainUserCaller(useCaller),
@@ -41,6 +181,13 @@ Scheduler::Scheduler(uint32_t threads, bool useCaller, const eular::String8 &nam
     }
 
     mThreadCount = threads;
+    mWorkers.resize(mThreadCount + (useCaller ? 1 : 0));
+    for (size_t i = 0; i < mWorkers.size(); ++i) {
+        mWorkers[i] = new Worker(i);
+    }
+    if (useCaller) {
+        mWorkers[0]->tid.store(mRootThread);
+    }
 }
 
 Scheduler::~Scheduler()
@@ -49,6 +196,21 @@ Scheduler::~Scheduler()
     if (gScheduler == this) {
         gScheduler = nullptr;
     }
+
+    FiberBindThread *task = nullptr;
+    while ((task = mInjectQueue.pop()) != nullptr) {
+        delete task;
+    }
+    for (auto worker : mWorkers) {
+        FiberBindThread *ft = nullptr;
+        while (worker->localQueue.steal(ft)) {
+            delete ft;
+        }
+        while ((task = worker->pinnedQueue.pop()) != nullptr) {
+            delete task;
+        }
+        delete worker;
+    }
 }
 
 Scheduler *Scheduler::GetThis()
@@ -71,9 +233,11 @@ void Scheduler::start()
     mStopping = false;
     LOG_ASSERT(mThreads.empty(), "should be empty before start()");
     mThreads.resize(mThreadCount);
+    size_t offset = mWorkers.size() - mThreadCount;
     for (size_t i = 0; i < mThreadCount; ++i) {
         mThreads[i].reset(new Thread(std::bind(&Scheduler::run, this), mName + "_" + std::to_string(i)));
         mThreadIds.push_back(mThreads[i]->getTid());
+        mWorkers[offset + i]->tid.store(mThreads[i]->getTid());
         LOGD("thread [%s:%d] start", mThreads[i]->getName().c_str(), mThreads[i]->getTid());
     }
 }
@@ -133,80 +297,258 @@ void Scheduler::switchTo(int th)
     Fiber::Yeild2Hold();
 }
 
+/**
+ * @brief 提交任务
+ *
+ * @return 是否需要唤醒空闲线程
+ */
+bool Scheduler::push(FiberBindThread *ft)
+{
+    bool needTickle = mTaskCount.fetch_add(1) == 0;
+    if (ft->thread != -1) {
+        Worker *worker = getWorker(ft->thread);
+        if (worker != nullptr) {
+            ++worker->pinnedCount;
+            ++mPinnedCount;
+            worker->pinnedQueue.push(ft);
+            tickleWorker(worker->index);    // 只有指定线程可以执行, 直接唤醒它
+            return false;
+        }
+        LOGW("%s() thread %d does not belong to scheduler %s", __func__, ft->thread, mName.c_str());
+        ft->thread = -1;
+    }
+
+    Worker *self = currentWorker();
+    if (self != nullptr) {
+        self->localQueue.push(ft);
+    } else {
+        mInjectQueue.push(ft);
+        mInjectedCount.fetch_add(1, std::memory_order_relaxed);
+    }
+    return needTickle;
+}
+
+/**
+ * @brief 按 绑定队列 -> 本地队列 -> 全局注入队列 -> 窃取其他线程 的顺序获取任务
+ */
+Scheduler::FiberBindThread *Scheduler::pop(Worker *self)
+{
+    FiberBindThread *ft = nullptr;
+    if (mTaskCount.load(std::memory_order_relaxed) == 0) {
+        return nullptr;
+    }
+
+    ft = self->pinnedQueue.pop();
+    if (ft != nullptr) {
+        --self->pinnedCount;
+        --mPinnedCount;
+        return ft;
+    }
+
+    if (self->localQueue.pop(ft)) {
+        return ft;
+    }
+
+    ft = drainInjectQueue(self);
+    if (ft != nullptr) {
+        return ft;
+    }
+
+    uint32_t count = mWorkers.size();
+    gStealSeed = gStealSeed * 1103515245 + 12345;
+    uint32_t begin = (gStealSeed >> 16) % count;
+    for (uint32_t i = 0; i < count; ++i) {
+        Worker *victim = mWorkers[(begin + i) % count];
+        if (victim != self && victim->localQueue.steal(ft)) {
+            mStolenCount.fetch_add(1, std::memory_order_relaxed);
+            return ft;
+        }
+    }
+
+    return nullptr;
+}
+
+/**
+ * @brief 从全局注入队列取出一批任务, 第一个直接返回, 其余放入本地队列(可被其他线程窃取)
+ *
+ * MPSC只允许单个消费者, 其他线程取出时直接跳过而不是等待
+ */
+Scheduler::FiberBindThread *Scheduler::drainInjectQueue(Worker *self)
+{
+    if (mDrainLock.load(std::memory_order_relaxed) ||
+        mDrainLock.exchange(true, std::memory_order_acquire)) {
+        mDrainContended.fetch_add(1, std::memory_order_relaxed);
+        return nullptr;
+    }
+
+    FiberBindThread *first = mInjectQueue.pop();
+    if (first != nullptr) {
+        FiberBindThread *ft = nullptr;
+        for (uint32_t i = 1; i < DRAIN_BATCH_SIZE; ++i) {
+            ft = mInjectQueue.pop();
+            if (ft == nullptr) {
+                break;
+            }
+            self->localQueue.push(ft);
+        }
+        mDrainCount.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    mDrainLock.store(false, std::memory_order_release);
+    return first;
+}
+
+Scheduler::QueueStats Scheduler::getQueueStats() const
+{
+    QueueStats stats;
+    stats.injected = mInjectedCount.load(std::memory_order_relaxed);
+    stats.drained = mDrainCount.load(std::memory_order_relaxed);
+    stats.drainContended = mDrainContended.load(std::memory_order_relaxed);
+    stats.inconsistent = mInjectQueue.inconsistentCount();
+    for (auto worker : mWorkers) {
+        stats.inconsistent += worker->pinnedQueue.inconsistentCount();
+    }
+    stats.stolen = mStolenCount.load(std::memory_order_relaxed);
+    return stats;
+}
+
+Scheduler::Worker *Scheduler::getWorker(int tid) const
+{
+    for (auto worker : mWorkers) {
+        if (worker->tid.load(std::memory_order_relaxed) == tid) {
+            return worker;
+        }
+    }
+    return nullptr;
+}
+
+int Scheduler::getWorkerIndex() const
+{
+    Worker *self = currentWorker();
+    return self ? (int)self->index : -1;
+}
+
+int Scheduler::getWorkerTid(uint32_t index) const
+{
+    if (index >= mWorkers.size()) {
+        return -1;
+    }
+    return mWorkers[index]->tid.load(std::memory_order_relaxed);
+}
+
+bool Scheduler::hasRunnableTask() const
+{
+    Worker *self = currentWorker();
+    if (self != nullptr && self->pinnedCount.load() > 0) {
+        return true;
+    }
+    return (int64_t)mTaskCount.load() - (int64_t)mPinnedCount.load() > 0;
+}
+
+Scheduler::Worker *Scheduler::currentWorker() const
+{
+    if (gScheduler == this) {
+        return static_cast<Worker *>(gWorker);
+    }
+    return nullptr;
+}
+
 void Scheduler::run()
 {
     LOGI("Scheduler::run() in %s:%d", Thread::GetName().c_str(), gettid());
     setHookEnable(true);
+    StackAllocator::InstallSignalStack();
     setThis();
     if (gettid() != mRootThread) {
         gMainFiber = Fiber::GetThis().get();
     }
+
+    // start()中在线程创建之后才写入tid, 此处可能需要等待
+    Worker *self = nullptr;
+    while ((self = getWorker(gettid())) == nullptr) {
+        sched_yield();
+    }
+    gWorker = self;
+    gStealSeed = gettid();
+
     Fiber::SP idleFiber(new Fiber(std::bind(&Scheduler::idle, this)));
     Fiber::SP cbFiber(nullptr);
 
     FiberBindThread ft;
     while (true) {
+        Clock::Update();    // 本轮任务和定时器使用同一个缓存时刻
         ft.reset();
-        bool needTickle = false;
         bool isActive = false;
-        {
-            AutoLock<Mutex> lock(mQueueMutex);
-            auto it = mFiberQueue.begin();
-            while (it != mFiberQueue.end()) {
-                if (it->thread != -1 && it->thread != gettid()) {   // 不满足线程ID一致的条件
-                    ++it;
-                    needTickle = true;
-                    continue;
-                }
-
-                LOG_ASSERT(it->fiberPtr || it->cb, "task can not be null");
-                if (it->fiberPtr && it->fiberPtr->getState() == Fiber::EXEC) {  // 找到的协程处于执行状态
-                    ++it;
-                    continue;
+        FiberBindThread *task = pop(self);
+        if (task != nullptr) {
+            LOG_ASSERT(task->fiberPtr || task->cb, "task can not be null");
+            ++mActiveThreadCount;
+            if (task->fiberPtr && task->fiberPtr->mRunning.load(std::memory_order_acquire)) {
+                // 协程还未在其他线程上切出(Yeild2Hold设置HOLD时上下文还未保存), 放回队列稍后再执行.
+                // 绑定任务只会从自身队列取出
+                if (task->thread == -1) {
+                    mInjectQueue.push(task);
+                } else {
+                    ++self->pinnedCount;
+                    ++mPinnedCount;
+                    self->pinnedQueue.push(task);
                 }
-
-                // LOGD("Find executable tasks");
-                ft = *it;
-                mFiberQueue.erase(it++);
-                ++mActiveThreadCount;
-                isActive = true;
-                break;
+                --mActiveThreadCount;
+                tickle();
+                continue;
             }
-            needTickle |= it != mFiberQueue.end();
+
+            ft.fiberPtr.swap(task->fiberPtr);
+            ft.cb = std::move(task->cb);
+            ft.stackSize = task->stackSize;
+            delete task;
+            isActive = true;
+            --mTaskCount;
         }
 
-        if (needTickle) {
+        // 绑定的任务在提交时已经唤醒了对应线程
+        if (mTaskCount.load() > mPinnedCount.load()) {
             tickle();
         }
 
         if (ft.fiberPtr && (ft.fiberPtr->getState() != Fiber::EXEC && ft.fiberPtr->getState() != Fiber::EXCEPT)) {
+            ft.fiberPtr->mRunning.store(true, std::memory_order_relaxed);
             ft.fiberPtr->resume();
             --mActiveThreadCount;
             if (ft.fiberPtr->getState() == Fiber::READY) {  // 用户主动设置协程状态为REDAY
+                ft.fiberPtr->mRunning.store(false, std::memory_order_release);
                 schedule(ft.fiberPtr);
-            } else if (ft.fiberPtr->getState() != Fiber::TERM &&
-                       ft.fiberPtr->getState() != Fiber::EXCEPT) {
-                ft.fiberPtr->mState = Fiber::HOLD;
+            } else {
+                if (ft.fiberPtr->getState() != Fiber::TERM &&
+                    ft.fiberPtr->getState() != Fiber::EXCEPT) {
+                    ft.fiberPtr->mState = Fiber::HOLD;
+                }
+                ft.fiberPtr->mRunning.store(false, std::memory_order_release);
             }
             ft.reset();
         } else if (ft.cb) {
-            if (cbFiber) {
-                cbFiber->reset(ft.cb);
+            uint64_t stackSize = ft.stackSize ? ft.stackSize : Fiber::DefaultStackSize();
+            if (cbFiber && cbFiber->getStackSize() == stackSize) {
+                cbFiber->reset(std::move(ft.cb));
             } else {
-                cbFiber.reset(new Fiber(ft.cb));
+                cbFiber.reset(new Fiber(std::move(ft.cb), stackSize));     // 栈大小不一致时旧的协程栈归还到栈池
                 LOG_ASSERT(cbFiber != nullptr, "");
             }
             ft.reset();
+            cbFiber->mRunning.store(true, std::memory_order_relaxed);
             cbFiber->resume();
             --mActiveThreadCount;
             if (cbFiber->getState() == Fiber::READY) {  // 用户在callback函数内部调用Yeild2Ready
+                cbFiber->mRunning.store(false, std::memory_order_release);
                 schedule(cbFiber);
                 cbFiber.reset();
             } else if (cbFiber->getState() == Fiber::EXCEPT ||
                     cbFiber->getState() == Fiber::TERM) {
+                cbFiber->mRunning.store(false, std::memory_order_relaxed);
                 cbFiber->reset(nullptr);
             } else {    // 用户主动让出协程，需要将当前协程状态设为暂停态HOLD
                 cbFiber->mState = Fiber::HOLD;
+                cbFiber->mRunning.store(false, std::memory_order_release);
                 cbFiber.reset();
             }
         } else {
@@ -229,6 +571,7 @@ void Scheduler::run()
             }
         }
     }
+    Clock::Invalidate();
 }
 
 void Scheduler::setThis()
@@ -249,10 +592,14 @@ void Scheduler::tickle()
     LOGI("%s()", __func__);
 }
 
+void Scheduler::tickleWorker(uint32_t index)
+{
+    tickle();
+}
+
 bool Scheduler::stopping()
 {
-    AutoLock<Mutex> lock(mQueueMutex);
-    return mStopping && mFiberQueue.empty() && mActiveThreadCount == 0;
+    return mStopping && mTaskCount == 0 && mActiveThreadCount == 0;
 }
 
 } // namespace eular
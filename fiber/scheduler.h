@@ -9,7 +9,10 @@
 #define __SCHEDULER_H__
 
 #include "fiber.h"
+#include "task.h"
 #include "thread.h"
+#include "work_steal_queue.h"
+#include "mpsc_queue.h"
 #include <utils/string8.h>
 #include <utils/mutex.h>
 #include <memory>
@@ -41,22 +44,32 @@ public:
     void stop();
     
     bool hasIdleThread() const { return mIdleThreadCount.load() > 0; }
+    bool hasPendingTask() const { return mTaskCount.load() > 0; }
+
+    struct QueueStats {
+        uint64_t injected;          // 进入全局注入队列的任务数
+        uint64_t drained;           // 批量取出的次数
+        uint64_t drainContended;    // 取出时其他线程正在取出的次数
+        uint64_t inconsistent;      // 生产者push未完成导致本次未取到的次数
+        uint64_t stolen;            // 从其他线程窃取的任务数
+    };
+
+    /**
+     * @brief 任务队列的竞争统计
+     */
+    QueueStats getQueueStats() const;
 
     /**
      * @brief 调度函数
      * 
      * @param fc 协程或回调函数
      * @param th 线程ID
+     * @param stackSize 回调函数所用协程的栈大小, 0为fiber.stack_size. 对协程无效
      */
     template<class FiberOrCb>
-    void schedule(FiberOrCb fc, int th = -1)
+    void schedule(FiberOrCb fc, int th = -1, uint64_t stackSize = 0)
     {
-        bool needTickle = false;
-        {
-            AutoLock<Mutex> lock(mQueueMutex);
-            needTickle = scheduleNoLock(fc, th);
-        }
-        if (needTickle) {
+        if (scheduleNoLock(std::move(fc), th, stackSize)) {
             tickle();
         }
     }
@@ -65,12 +78,9 @@ public:
     void schedule(Iterator begin, Iterator end)
     {
         bool needTickle = false;
-        {
-            AutoLock<Mutex> lock(mQueueMutex);
-            while (begin != end) {
-                needTickle = scheduleNoLock(&*begin, -1) || needTickle;
-                ++begin;
-            }
+        while (begin != end) {
+            needTickle = scheduleNoLock(&*begin, -1) || needTickle;
+            ++begin;
         }
         if (needTickle) {
             tickle();
@@ -83,35 +93,64 @@ private:
     /**
      * @brief 协程信息结构体, 绑定哪个线程
      */
-    struct FiberBindThread {
+    struct FiberBindThread : public MpscNode {
         Fiber::SP fiberPtr;         // 协程智能指针对象
-        std::function<void()> cb;   // 协程执行函数
+        Task cb;                    // 协程执行函数
         int thread;                 // 内核线程ID
+        uint64_t stackSize;         // cb所需的栈大小, 0为默认大小
+
+        FiberBindThread() : thread(-1), stackSize(0) {}
+        FiberBindThread(Fiber::SP sp, int th) : fiberPtr(sp), thread(th), stackSize(0) {}
+        FiberBindThread(Fiber::SP *sp, int th) : thread(th), stackSize(0) { fiberPtr.swap(*sp); }
+        FiberBindThread(Task f, int th) : cb(std::move(f)), thread(th), stackSize(0) {}
+        FiberBindThread(Task *f, int th) : cb(std::move(*f)), thread(th), stackSize(0) {}
+        FiberBindThread(std::function<void()> *f, int th) : cb(std::move(*f)), thread(th), stackSize(0) { *f = nullptr; }
 
-        FiberBindThread() : thread(-1) {}
-        FiberBindThread(Fiber::SP sp, int th) : fiberPtr(sp), thread(th) {}
-        FiberBindThread(Fiber::SP *sp, int th) : thread(th) { fiberPtr.swap(*sp); }
-        FiberBindThread(std::function<void()> f, int th) : cb(f), thread(th) {}
-        FiberBindThread(std::function<void()> *f, int th) : thread(th) { cb.swap(*f); }
+        // 每次schedule都会分配, 使用线程本地的空闲链表
+        static void *operator new(size_t size);
+        static void operator delete(void *ptr);
 
         void reset()
         {
             fiberPtr = nullptr;
             cb = nullptr;
             thread = -1;
+            stackSize = 0;
         }
     };
 
+    /**
+     * @brief 每个调度线程一个, 任务分为三类:
+     *  1、绑定到该线程的任务(schedule时指定了th), 只能由该线程执行
+     *  2、该线程自己产生的任务, 放入本地的Chase-Lev队列, 空闲线程可以窃取
+     *  3、非调度线程产生的任务放入全局注入队列mInjectQueue
+     */
+    struct Worker {
+        uint32_t                            index;          // 在mWorkers中的下标
+        std::atomic<int>                    tid;            // 内核线程ID, 线程启动后赋值
+        WorkStealQueue<FiberBindThread *>   localQueue;     // 本地任务队列
+        MpscQueue<FiberBindThread>          pinnedQueue;    // 绑定到此线程的任务, 仅此线程消费
+        std::atomic<uint32_t>               pinnedCount;    // pinnedQueue中的任务数
+
+        Worker(uint32_t idx) : index(idx), tid(-1), pinnedCount(0) {}
+    };
+
     template<class FiberOrCb>
-    bool scheduleNoLock(FiberOrCb fc, int thread) {
-        bool needTickle = mFiberQueue.empty();
-        FiberBindThread ft(fc, thread);
-        if(ft.fiberPtr || ft.cb) {
-            mFiberQueue.push_back(ft);
+    bool scheduleNoLock(FiberOrCb fc, int thread, uint64_t stackSize = 0) {
+        FiberBindThread *ft = new FiberBindThread(std::move(fc), thread);
+        ft->stackSize = stackSize;
+        if (!ft->fiberPtr && !ft->cb) {
+            delete ft;
+            return false;
         }
-        return needTickle;
+        return push(ft);
     }
-    
+
+    bool push(FiberBindThread *ft);
+    FiberBindThread *pop(Worker *self);
+    FiberBindThread *drainInjectQueue(Worker *self);
+    Worker *getWorker(int tid) const;
+    Worker *currentWorker() const;
 
 protected:
     void run();
@@ -128,6 +167,25 @@ protected:
     virtual void tickle();
     virtual bool stopping();
 
+    /**
+     * @brief 通知指定线程有绑定到它的任务, 默认同tickle()
+     *
+     * @param index 线程下标, 见getWorkerIndex()
+     */
+    virtual void tickleWorker(uint32_t index);
+
+    /**
+     * @brief 调度线程下标, 包含用户线程时用户线程为0; 当前线程不属于此调度器时返回-1
+     */
+    int getWorkerIndex() const;
+    uint32_t getWorkerCount() const { return mWorkers.size(); }
+    int getWorkerTid(uint32_t index) const;
+
+    /**
+     * @brief 是否有当前线程可以执行的任务(绑定到当前线程的 + 未绑定的)
+     */
+    bool hasRunnableTask() const;
+
 
 protected:
     std::vector<Thread::SP> mThreads;           // 线程数组
@@ -142,9 +200,18 @@ protected:
 
 private:
     eular::String8          mName;              // 调度器名字
-    eular::Mutex            mQueueMutex;        // 任务队列锁
+    eular::Mutex            mQueueMutex;        // 线程数组锁
     Fiber::SP               mRootFiber;         // userCaller为true时有效
-    std::list<FiberBindThread> mFiberQueue;     // 待执行的协程队列
+    MpscQueue<FiberBindThread> mInjectQueue;    // 全局注入队列, 非调度线程提交的任务
+    std::atomic<bool>       mDrainLock = {false};   // 同一时刻只允许一个线程从mInjectQueue取出
+    std::vector<Worker *>   mWorkers;           // 与mThreadIds一一对应
+    std::atomic<uint64_t>   mTaskCount = {0};   // 所有队列中待执行的任务总数
+    std::atomic<uint64_t>   mPinnedCount = {0}; // 其中绑定线程的任务数
+
+    std::atomic<uint64_t>   mInjectedCount = {0};
+    std::atomic<uint64_t>   mDrainCount = {0};
+    std::atomic<uint64_t>   mDrainContended = {0};
+    std::atomic<uint64_t>   mStolenCount = {0};
 };
 
 } // namespace eular
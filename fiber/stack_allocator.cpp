@@ -0,0 +1,216 @@
+/*************************************************************************
+    > File Name: stack_allocator.cpp
+    > Author: hsz
+    > Brief: 协程栈分配器
+    > Created Time: Sat 17 Oct 2026 11:02:53 AM CST
+ ************************************************************************/
+
+#include "stack_allocator.h"
+#include "config.h"
+#include <log/log.h>
+#include <sys/mman.h>
+#include <signal.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <algorithm>
+#include <atomic>
+
+#define LOG_TAG "StackAllocator"
+
+#define DEFAULT_STACK_CLASSES   "65536,262144,1048576"
+#define DEFAULT_POOL_CAPACITY   64
+
+namespace eular {
+
+static std::atomic<uint64_t> gPoolHits(0);
+static std::atomic<uint64_t> gPoolMisses(0);
+static std::atomic<uint64_t> gPoolRecycled(0);
+static std::atomic<uint64_t> gPoolReleased(0);
+
+/**
+ * @brief 线程本地的空闲栈链表，线程退出时释放
+ */
+struct StackFreeList {
+    std::vector<std::vector<void *>> lists;     // 下标与ClassConfig::sizes一致
+    std::vector<uint64_t> sizes;
+
+    std::vector<void *> &get(const std::vector<uint64_t> &classes, int index)
+    {
+        if (lists.empty()) {
+            lists.resize(classes.size());
+            sizes = classes;
+        }
+        return lists[index];
+    }
+
+    ~StackFreeList()
+    {
+        uint64_t pageSize = sysconf(_SC_PAGESIZE);
+        for (size_t i = 0; i < lists.size(); ++i) {
+            for (void *ptr : lists[i]) {
+                munmap((uint8_t *)ptr - pageSize, sizes[i] + pageSize);
+            }
+        }
+    }
+};
+
+static thread_local StackFreeList gFreeList;
+
+const StackAllocator::ClassConfig &StackAllocator::GetConfig()
+{
+    static ClassConfig config = []() {
+        ClassConfig cfg;
+        cfg.pageSize = sysconf(_SC_PAGESIZE);
+        cfg.capacity = Config::Lookup<uint32_t>("fiber.stack_pool_capacity", DEFAULT_POOL_CAPACITY);
+
+        // 格式: 65536,262144,1048576
+        String8 classes = Config::Lookup<String8>("fiber.stack_classes", DEFAULT_STACK_CLASSES);
+        const char *str = classes.c_str();
+        while (*str) {
+            char *end = nullptr;
+            uint64_t size = strtoull(str, &end, 10);
+            if (end == str) {
+                ++str;
+                continue;
+            }
+            if (size > 0) {
+                size = (size + cfg.pageSize - 1) / cfg.pageSize * cfg.pageSize;
+                cfg.sizes.push_back(size);
+            }
+            str = end;
+        }
+        std::sort(cfg.sizes.begin(), cfg.sizes.end());
+        cfg.sizes.erase(std::unique(cfg.sizes.begin(), cfg.sizes.end()), cfg.sizes.end());
+        return cfg;
+    }();
+
+    return config;
+}
+
+int StackAllocator::ClassIndex(uint64_t size)
+{
+    const ClassConfig &cfg = GetConfig();
+    for (size_t i = 0; i < cfg.sizes.size(); ++i) {
+        if (size <= cfg.sizes[i]) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+uint64_t StackAllocator::RoundSize(uint64_t size)
+{
+    const ClassConfig &cfg = GetConfig();
+    int index = ClassIndex(size);
+    if (index >= 0) {
+        return cfg.sizes[index];
+    }
+    return (size + cfg.pageSize - 1) / cfg.pageSize * cfg.pageSize;
+}
+
+void *StackAllocator::MapStack(uint64_t size)
+{
+    uint64_t pageSize = GetConfig().pageSize;
+    void *base = mmap(nullptr, size + pageSize, PROT_READ | PROT_WRITE,
+                      MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (base == MAP_FAILED) {
+        LOGE("mmap(%lu) error. [%d,%s]", size + pageSize, errno, strerror(errno));
+        return nullptr;
+    }
+
+    // 栈向低地址增长，保护页放在最低处
+    if (mprotect(base, pageSize, PROT_NONE)) {
+        LOGE("mprotect guard page error. [%d,%s]", errno, strerror(errno));
+        munmap(base, size + pageSize);
+        return nullptr;
+    }
+
+    return (uint8_t *)base + pageSize;
+}
+
+void StackAllocator::UnmapStack(void *ptr, uint64_t size)
+{
+    uint64_t pageSize = GetConfig().pageSize;
+    if (munmap((uint8_t *)ptr - pageSize, size + pageSize)) {
+        LOGE("munmap(%p, %lu) error. [%d,%s]", ptr, size + pageSize, errno, strerror(errno));
+    }
+}
+
+void *StackAllocator::alloc(uint64_t size)
+{
+    const ClassConfig &cfg = GetConfig();
+    int index = ClassIndex(size);
+    if (index >= 0) {
+        std::vector<void *> &list = gFreeList.get(cfg.sizes, index);
+        if (!list.empty()) {
+            void *ptr = list.back();
+            list.pop_back();
+            ++gPoolHits;
+            return ptr;
+        }
+    }
+
+    ++gPoolMisses;
+    return MapStack(RoundSize(size));
+}
+
+void StackAllocator::dealloc(void *ptr, uint64_t size)
+{
+    LOG_ASSERT(ptr, "dealloc a null pointer");
+    const ClassConfig &cfg = GetConfig();
+    int index = ClassIndex(size);
+    uint64_t realSize = RoundSize(size);
+    if (index >= 0) {
+        std::vector<void *> &list = gFreeList.get(cfg.sizes, index);
+        if (list.size() < cfg.capacity) {
+            // 栈顶那一页几乎一定会被下次使用，保留; 其余归还物理页
+            if (realSize > cfg.pageSize) {
+                madvise(ptr, realSize - cfg.pageSize, MADV_DONTNEED);
+            }
+            list.push_back(ptr);
+            ++gPoolRecycled;
+            return;
+        }
+    }
+
+    ++gPoolReleased;
+    UnmapStack(ptr, realSize);
+}
+
+StackAllocator::Stats StackAllocator::GetStats()
+{
+    Stats stats;
+    stats.hits = gPoolHits.load(std::memory_order_relaxed);
+    stats.misses = gPoolMisses.load(std::memory_order_relaxed);
+    stats.recycled = gPoolRecycled.load(std::memory_order_relaxed);
+    stats.released = gPoolReleased.load(std::memory_order_relaxed);
+    return stats;
+}
+
+bool StackAllocator::InstallSignalStack()
+{
+    static thread_local void *signalStack = nullptr;
+    if (signalStack) {
+        return true;
+    }
+
+    const size_t size = SIGSTKSZ > 64 * 1024 ? SIGSTKSZ : 64 * 1024;
+    signalStack = malloc(size);
+    if (signalStack == nullptr) {
+        return false;
+    }
+
+    stack_t ss;
+    ss.ss_sp = signalStack;
+    ss.ss_size = size;
+    ss.ss_flags = 0;
+    if (sigaltstack(&ss, nullptr)) {
+        LOGE("sigaltstack error. [%d,%s]", errno, strerror(errno));
+        free(signalStack);
+        signalStack = nullptr;
+        return false;
+    }
+    return true;
+}
+
+} // namespace eular
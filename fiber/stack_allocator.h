@@ -0,0 +1,64 @@
+/*************************************************************************
+    > File Name: stack_allocator.h
+    > Author: hsz
+    > Brief: 协程栈分配器
+    > Created Time: Sat 17 Oct 2026 11:02:47 AM CST
+ ************************************************************************/
+
+#ifndef __EULAR_FIBER_STACK_ALLOCATOR_H__
+#define __EULAR_FIBER_STACK_ALLOCATOR_H__
+
+#include <stdint.h>
+#include <stddef.h>
+#include <vector>
+
+namespace eular {
+
+/**
+ * @brief 基于mmap的协程栈池
+ *
+ * 1、每个栈的低地址处有一页PROT_NONE的保护页，栈溢出时直接触发SIGSEGV，而不是踩坏相邻的堆内存
+ * 2、按大小分级(fiber.stack_classes)缓存在线程本地的空闲链表中，无需加锁
+ * 3、归还时通过MADV_DONTNEED释放物理页，只保留虚拟地址
+ * 4、超过最大级别的栈不缓存，直接mmap/munmap
+ */
+class StackAllocator
+{
+public:
+    struct Stats {
+        uint64_t hits;      // 从池中取得
+        uint64_t misses;    // 池为空，新mmap
+        uint64_t recycled;  // 归还到池中
+        uint64_t released;  // 池满或不可缓存，直接munmap
+    };
+
+    static void *alloc(uint64_t size);
+    static void  dealloc(void *ptr, uint64_t size);
+
+    /**
+     * @brief 返回size实际会分配的栈大小(向上取到所属级别或页大小)
+     */
+    static uint64_t RoundSize(uint64_t size);
+    static Stats GetStats();
+
+    /**
+     * @brief 为当前线程设置信号栈, 使协程栈溢出时SIGSEGV处理函数仍可执行
+     */
+    static bool InstallSignalStack();
+
+private:
+    struct ClassConfig {
+        std::vector<uint64_t>   sizes;      // 从小到大排列的级别
+        uint32_t                capacity;   // 每个线程每个级别最多缓存的数量
+        uint64_t                pageSize;
+    };
+
+    static const ClassConfig &GetConfig();
+    static int  ClassIndex(uint64_t size);
+    static void *MapStack(uint64_t size);
+    static void UnmapStack(void *ptr, uint64_t size);
+};
+
+} // namespace eular
+
+#endif // __EULAR_FIBER_STACK_ALLOCATOR_H__
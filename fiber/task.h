@@ -0,0 +1,205 @@
+/*************************************************************************
+    > File Name: task.h
+    > Author: hsz
+    > Brief: 小对象优化的任务类型, 替代std::function<void()>
+    > Created Time: Sat 17 Oct 2026 03:26:09 PM CST
+ ************************************************************************/
+
+#ifndef __EULAR_FIBER_TASK_H__
+#define __EULAR_FIBER_TASK_H__
+
+#include <cstddef>
+#include <functional>
+#include <new>
+#include <type_traits>
+#include <utility>
+
+namespace eular {
+
+/**
+ * @brief 只可移动的void()任务
+ *
+ * 不超过INLINE_SIZE字节且移动构造不抛异常的可调用对象直接存放在内部缓冲区,
+ * 如std::bind(&FDContext::executeEvent, ctx, EPOLLIN)、捕获几个指针的lambda、std::function本身;
+ * 更大的对象才会在堆上分配. 与std::function不同, 移动后源对象为空
+ */
+class Task
+{
+public:
+    static const size_t INLINE_SIZE = 48;
+
+    Task() : mOps(nullptr) {}
+    Task(std::nullptr_t) : mOps(nullptr) {}
+
+    template<typename F,
+             typename D = typename std::decay<F>::type,
+             typename = typename std::enable_if<!std::is_same<D, Task>::value>::type,
+             typename = decltype(std::declval<D &>()())>
+    Task(F &&f) : mOps(nullptr)
+    {
+        if (IsNull(f)) {
+            return;
+        }
+        typedef typename std::conditional<CanInline<D>::value, InlineOps<D>, HeapOps<D>>::type Ops;
+        Ops::Create(&mStorage, std::forward<F>(f));
+        mOps = &Ops::gTable;
+    }
+
+    Task(Task &&other) noexcept : mOps(nullptr)
+    {
+        moveFrom(other);
+    }
+
+    ~Task()
+    {
+        reset();
+    }
+
+    Task(const Task &) = delete;
+    Task &operator=(const Task &) = delete;
+
+    Task &operator=(Task &&other) noexcept
+    {
+        if (this != &other) {
+            reset();
+            moveFrom(other);
+        }
+        return *this;
+    }
+
+    Task &operator=(std::nullptr_t)
+    {
+        reset();
+        return *this;
+    }
+
+    void operator()()
+    {
+        mOps->invoke(&mStorage);
+    }
+
+    explicit operator bool() const { return mOps != nullptr; }
+
+    void swap(Task &other)
+    {
+        Task temp(std::move(other));
+        other = std::move(*this);
+        *this = std::move(temp);
+    }
+
+    void reset()
+    {
+        if (mOps) {
+            mOps->destroy(&mStorage);
+            mOps = nullptr;
+        }
+    }
+
+    /**
+     * @brief 可调用对象是否存放在内部缓冲区
+     */
+    bool isInline() const { return mOps != nullptr && mOps->isInline; }
+
+    friend bool operator==(const Task &task, std::nullptr_t) { return !task; }
+    friend bool operator==(std::nullptr_t, const Task &task) { return !task; }
+    friend bool operator!=(const Task &task, std::nullptr_t) { return !!task; }
+    friend bool operator!=(std::nullptr_t, const Task &task) { return !!task; }
+
+private:
+    typedef typename std::aligned_storage<INLINE_SIZE, alignof(std::max_align_t)>::type Storage;
+
+    struct OpsTable {
+        void (*invoke)(void *storage);
+        void (*move)(void *dst, void *src);     // 移动到dst并析构src
+        void (*destroy)(void *storage);
+        bool isInline;
+    };
+
+    template<typename D>
+    struct CanInline {
+        static const bool value = sizeof(D) <= INLINE_SIZE &&
+            alignof(Storage) % alignof(D) == 0 &&
+            std::is_nothrow_move_constructible<D>::value;
+    };
+
+    template<typename D>
+    struct InlineOps {
+        static const OpsTable gTable;
+
+        template<typename F>
+        static void Create(void *storage, F &&f)
+        {
+            new (storage) D(std::forward<F>(f));
+        }
+        static void Invoke(void *storage)
+        {
+            (*static_cast<D *>(storage))();
+        }
+        static void Move(void *dst, void *src)
+        {
+            new (dst) D(std::move(*static_cast<D *>(src)));
+            static_cast<D *>(src)->~D();
+        }
+        static void Destroy(void *storage)
+        {
+            static_cast<D *>(storage)->~D();
+        }
+    };
+
+    template<typename D>
+    struct HeapOps {
+        static const OpsTable gTable;
+
+        template<typename F>
+        static void Create(void *storage, F &&f)
+        {
+            *static_cast<D **>(storage) = new D(std::forward<F>(f));
+        }
+        static void Invoke(void *storage)
+        {
+            (**static_cast<D **>(storage))();
+        }
+        static void Move(void *dst, void *src)
+        {
+            *static_cast<D **>(dst) = *static_cast<D **>(src);
+        }
+        static void Destroy(void *storage)
+        {
+            delete *static_cast<D **>(storage);
+        }
+    };
+
+    template<typename F>
+    static bool IsNull(const F &) { return false; }
+    template<typename R, typename... Args>
+    static bool IsNull(R (* const &f)(Args...)) { return f == nullptr; }
+    template<typename R, typename... Args>
+    static bool IsNull(const std::function<R(Args...)> &f) { return !f; }
+
+    void moveFrom(Task &other)
+    {
+        if (other.mOps) {
+            other.mOps->move(&mStorage, &other.mStorage);
+            mOps = other.mOps;
+            other.mOps = nullptr;
+        }
+    }
+
+private:
+    Storage         mStorage;
+    const OpsTable *mOps;
+};
+
+template<typename D>
+const Task::OpsTable Task::InlineOps<D>::gTable = {
+    &Task::InlineOps<D>::Invoke, &Task::InlineOps<D>::Move, &Task::InlineOps<D>::Destroy, true
+};
+
+template<typename D>
+const Task::OpsTable Task::HeapOps<D>::gTable = {
+    &Task::HeapOps<D>::Invoke, &Task::HeapOps<D>::Move, &Task::HeapOps<D>::Destroy, false
+};
+
+} // namespace eular
+
+#endif // __EULAR_FIBER_TASK_H__
@@ -0,0 +1,179 @@
+/*************************************************************************
+    > File Name: work_steal_queue.h
+    > Author: hsz
+    > Brief: Chase-Lev工作窃取队列
+    > Created Time: Sat 17 Oct 2026 01:12:36 PM CST
+ ************************************************************************/
+
+#ifndef __EULAR_FIBER_WORK_STEAL_QUEUE_H__
+#define __EULAR_FIBER_WORK_STEAL_QUEUE_H__
+
+#include <stdint.h>
+#include <atomic>
+#include <vector>
+
+namespace eular {
+
+/**
+ * @brief 单生产者多消费者的无锁双端队列(Chase-Lev)
+ *
+ * 只有拥有者线程可以调用push/pop(从bottom端操作，LIFO，缓存友好)，
+ * 其他线程通过steal从top端窃取(FIFO). 内存序参考 Lê et al. "Correct and Efficient
+ * Work-Stealing for Weak Memory Models"(PPoPP'13)
+ *
+ * @tparam T 必须是可以原子读写的类型(一般为指针)
+ */
+template<typename T>
+class WorkStealQueue
+{
+public:
+    explicit WorkStealQueue(int64_t capacity = 256) :
+        mTop(0),
+        mBottom(0)
+    {
+        int64_t cap = 1;
+        while (cap < capacity) {
+            cap <<= 1;
+        }
+        mArray.store(new Array(cap), std::memory_order_relaxed);
+    }
+
+    ~WorkStealQueue()
+    {
+        for (Array *array : mGarbage) {
+            delete array;
+        }
+        delete mArray.load(std::memory_order_relaxed);
+    }
+
+    WorkStealQueue(const WorkStealQueue &) = delete;
+    WorkStealQueue &operator=(const WorkStealQueue &) = delete;
+
+    /**
+     * @brief 仅限拥有者线程调用
+     */
+    void push(T item)
+    {
+        int64_t b = mBottom.load(std::memory_order_relaxed);
+        int64_t t = mTop.load(std::memory_order_acquire);
+        Array *array = mArray.load(std::memory_order_relaxed);
+        if (b - t > array->capacity - 1) {
+            array = grow(array, b, t);
+        }
+        array->put(b, item);
+        std::atomic_thread_fence(std::memory_order_release);
+        mBottom.store(b + 1, std::memory_order_relaxed);
+    }
+
+    /**
+     * @brief 仅限拥有者线程调用
+     */
+    bool pop(T &item)
+    {
+        int64_t b = mBottom.load(std::memory_order_relaxed) - 1;
+        Array *array = mArray.load(std::memory_order_relaxed);
+        mBottom.store(b, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        int64_t t = mTop.load(std::memory_order_relaxed);
+
+        if (t > b) {    // 队列为空
+            mBottom.store(b + 1, std::memory_order_relaxed);
+            return false;
+        }
+
+        item = array->get(b);
+        if (t == b) {   // 最后一个元素，与窃取者竞争
+            bool success = mTop.compare_exchange_strong(t, t + 1,
+                std::memory_order_seq_cst, std::memory_order_relaxed);
+            mBottom.store(b + 1, std::memory_order_relaxed);
+            return success;
+        }
+        return true;
+    }
+
+    /**
+     * @brief 任意线程均可调用
+     */
+    bool steal(T &item)
+    {
+        int64_t t = mTop.load(std::memory_order_acquire);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        int64_t b = mBottom.load(std::memory_order_acquire);
+        if (t >= b) {
+            return false;
+        }
+
+        Array *array = mArray.load(std::memory_order_acquire);
+        item = array->get(t);
+        return mTop.compare_exchange_strong(t, t + 1,
+            std::memory_order_seq_cst, std::memory_order_relaxed);
+    }
+
+    bool empty() const
+    {
+        int64_t b = mBottom.load(std::memory_order_relaxed);
+        int64_t t = mTop.load(std::memory_order_relaxed);
+        return b <= t;
+    }
+
+    int64_t size() const
+    {
+        int64_t b = mBottom.load(std::memory_order_relaxed);
+        int64_t t = mTop.load(std::memory_order_relaxed);
+        return b > t ? b - t : 0;
+    }
+
+private:
+    struct Array {
+        int64_t             capacity;
+        int64_t             mask;
+        std::atomic<T> *    buffer;
+
+        explicit Array(int64_t cap) :
+            capacity(cap),
+            mask(cap - 1),
+            buffer(new std::atomic<T>[cap])
+        {
+        }
+
+        ~Array()
+        {
+            delete[] buffer;
+        }
+
+        T get(int64_t index) const
+        {
+            return buffer[index & mask].load(std::memory_order_relaxed);
+        }
+
+        void put(int64_t index, T item)
+        {
+            buffer[index & mask].store(item, std::memory_order_relaxed);
+        }
+    };
+
+    /**
+     * @brief 扩容. 窃取者可能仍在读旧数组，旧数组延迟到析构时释放
+     */
+    Array *grow(Array *array, int64_t bottom, int64_t top)
+    {
+        Array *newArray = new Array(array->capacity * 2);
+        for (int64_t i = top; i != bottom; ++i) {
+            newArray->put(i, array->get(i));
+        }
+        mGarbage.push_back(array);
+        mArray.store(newArray, std::memory_order_release);
+        return newArray;
+    }
+
+private:
+    std::atomic<int64_t>    mTop;
+    char                    mPadding[64 - sizeof(std::atomic<int64_t>)];    // 避免top和bottom伪共享
+    std::atomic<int64_t>    mBottom;
+    std::atomic<Array *>    mArray;
+    std::vector<Array *>    mGarbage;   // 只由拥有者线程修改
+};
+
+} // namespace eular
+
+#endif // __EULAR_FIBER_WORK_STEAL_QUEUE_H__
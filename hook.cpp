@@ -10,6 +10,7 @@
 #include <log/log.h>
 #include "iomanager.h"
 #include "fdmanager.h"
+#include <string.h>
 
 #define LOG_TAG "hook"
 
@@ -17,6 +18,17 @@ namespace eular {
 
 static thread_local bool gHookEnable = false;
 static uint32_t gConnectTimeoutMs = 3000;
+static const uint32_t gIoTimeoutSlackShift = 4;  // IO超时允许延后1/16, 相近的超时合并到一次唤醒
+
+/**
+ * @brief 协程挂起后可能在另一个线程上恢复, 而__errno_location()声明为const, 编译器会在同一函数内
+ * 复用挂起前取得的errno地址. 可能跨越挂起的errno读写都经过这里, 每次重新取当前线程的地址
+ */
+static __attribute__((noinline)) int *ErrnoLocation()
+{
+    __asm__ __volatile__("");   // 有副作用, 不会被推断为const而合并调用
+    return &errno;
+}
 
 #define HOOK_FUN(XX) \
     XX(sleep)        \
@@ -114,51 +126,111 @@ static ssize_t do_io(int fd, OriginFun fun, const char* hook_fun_name,
     ssize_t n = 0;
     eular::IOManager *iom = nullptr;
     std::weak_ptr<timer_info> winfo;
-    uint64_t timer = 0;
+    eular::Timer::SP timer;
     int ret;
 
 retry:
     n = fun(fd, std::forward<Args>(args)...);
-    while (n == -1 && errno == EINTR) {
+    while (n == -1 && *ErrnoLocation() == EINTR) {
         n = fun(fd, std::forward<Args>(args)...);
     }
 
-    if (n == -1 && errno == EAGAIN) {
+    if (n == -1 && *ErrnoLocation() == EAGAIN) {
+        timer.reset();
         iom = eular::IOManager::GetThis();
         winfo = tinfo;
 
-        if (to > 0) {
-            timer = iom->addConditionTimer(to, [winfo, fd, iom, event]() {
-                auto sp = winfo.lock();
-                if (!sp || sp->cancelled) {
-                    return;
-                }
-                sp->cancelled = ETIMEDOUT;
-                iom->cancelEvent(fd, (eular::IOManager::Event)(event));
-            }, winfo);
-        }
-
         ret = iom->addEvent(fd, (eular::IOManager::Event)(event));
-        if (eular_unlikely(ret)) {
+        if (ret == eular::IOManager::EVENT_READY) {
+            goto retry;     // EAGAIN之后边沿已到达, 无需挂起
+        } else if (eular_unlikely(ret)) {
             LOGE("%s addEvent(%d, 0x%x) error.", hook_fun_name, fd, event);
-            if (timer) {
-                iom->delTimer(timer);
-            }
             return Status::UNKNOWN_ERROR;
         } else {
+            // 先注册事件再加定时器: 事件即使在此期间触发, 协程也要等Yeild2Hold切出后才会被恢复
+            if (to != (uint64_t)-1) {    // -1: 未设置超时
+                timer = iom->addConditionTimer(to, [winfo, fd, iom, event]() {
+                    auto sp = winfo.lock();
+                    if (!sp || sp->cancelled) {
+                        return;
+                    }
+                    sp->cancelled = ETIMEDOUT;
+                    iom->cancelEvent(fd, (eular::IOManager::Event)(event));
+                }, winfo, 0, to >> gIoTimeoutSlackShift);
+            }
             eular::Fiber::Yeild2Hold();
             if (timer) {
                 iom->delTimer(timer);
             }
             if (tinfo->cancelled) {
-                errno = tinfo->cancelled;
+                *ErrnoLocation() = tinfo->cancelled;
+                return Status::UNKNOWN_ERROR;
+            }
+            if (ctx->isClosed()) {  // 等待期间fd被close, 不能再对可能已被复用的fd重试
+                *ErrnoLocation() = EBADF;
                 return Status::UNKNOWN_ERROR;
             }
             goto retry;
         }
     }
 
-    return Status::OK;
+    return n;
+}
+
+/**
+ * @brief io_uring后端可用于fd时返回当前IOManager, 否则返回nullptr由调用方走do_io
+ */
+static eular::IOManager *uring_manager(int fd, eular::FdContext::SP &ctx)
+{
+    if (!eular::gHookEnable) {
+        return nullptr;
+    }
+    eular::IOManager *iom = eular::IOManager::GetThis();
+    if (iom == nullptr || !iom->uringEnabled()) {
+        return nullptr;
+    }
+    ctx = eular::FdManager::Get()->get(fd);
+    if (!ctx || ctx->isClosed() || !ctx->isSocket() || ctx->getUserNonoblock()) {
+        return nullptr;
+    }
+    return iom;
+}
+
+/**
+ * @brief 直接提交SQE, 由内核等待就绪并完成读写, 协程在完成后恢复. 相比do_io省去
+ * 试探性的系统调用和epoll_ctl的注册/注销
+ *
+ * @param prep 填写opcode及参数, fd已填好
+ * @param n 结果, 失败时为-1并设置errno
+ * @return false 未走io_uring(未启用, 内核对非阻塞socket直接返回EAGAIN, SQ已满), 调用方应回退到do_io
+ */
+template<typename Prep>
+static bool uring_io(int fd, int type, Prep prep, ssize_t &n)
+{
+    eular::FdContext::SP ctx;
+    eular::IOManager *iom = uring_manager(fd, ctx);
+    if (iom == nullptr) {
+        return false;
+    }
+
+    io_uring_sqe sqe;
+    memset(&sqe, 0, sizeof(sqe));
+    sqe.fd = fd;
+    prep(sqe);
+    int32_t res = iom->uringSubmitAndWait(sqe, ctx->getTimeOut(type));
+    if (res == -EAGAIN || res == -EBUSY) {
+        return false;
+    }
+    if (res == -ECANCELED && ctx->isClosed()) {
+        res = -EBADF;   // 被close()取消, 与epoll后端一致返回EBADF
+    }
+    if (res < 0) {
+        *ErrnoLocation() = -res;
+        n = -1;
+    } else {
+        n = res;
+    }
+    return true;
 }
 
 #ifdef __cplusplus
@@ -183,8 +255,9 @@ unsigned int sleep(unsigned int seconds) {
     eular::Fiber::SP fiber = eular::Fiber::GetThis();
     eular::IOManager* iom = eular::IOManager::GetThis();
     LOG_ASSERT2(iom != nullptr);
-    iom->addTimer(seconds * 1000, 
-        std::bind((void(eular::Scheduler::*)(eular::Fiber::SP, int))&eular::IOManager::schedule, iom, fiber, -1));
+    iom->addTimer(seconds * 1000, [iom, fiber]() {
+        iom->schedule(fiber);
+    });
     eular::Fiber::Yeild2Hold();
     return 0;
 }
@@ -197,8 +270,9 @@ int usleep(useconds_t usec)
 
     eular::Fiber::SP ptr = eular::Fiber::GetThis();
     eular::IOManager *iom = eular::IOManager::GetThis();
-    iom->addTimer(usec / 1000, 
-        std::bind((void(eular::Scheduler::*)(eular::Fiber::SP, int))&eular::IOManager::schedule, iom, ptr, -1));
+    iom->addTimer(usec / 1000, [iom, ptr]() {
+        iom->schedule(ptr);
+    });
     eular::Fiber::Yeild2Hold();
     return 0;
 }
@@ -235,6 +309,27 @@ int connect_with_timeout(int fd, const struct sockaddr *addr, socklen_t addrlen,
         return connect_f(fd, addr, addrlen);
     }
 
+    eular::IOManager *uring = uring_manager(fd, fdctx);
+    if (uring != nullptr) {
+        io_uring_sqe sqe;
+        memset(&sqe, 0, sizeof(sqe));
+        sqe.opcode = IORING_OP_CONNECT;
+        sqe.fd = fd;
+        sqe.addr = (uint64_t)addr;
+        sqe.off = addrlen;
+        int32_t res = uring->uringSubmitAndWait(sqe, ms > 0 ? ms : (uint64_t)-1);
+        if (res == 0) {
+            return 0;
+        }
+        if (res == -ECANCELED && fdctx->isClosed()) {
+            res = -EBADF;
+        }
+        if (res != -EAGAIN && res != -EBUSY) {
+            *ErrnoLocation() = -res;
+            return Status::UNKNOWN_ERROR;
+        }
+    }
+
     int n = connect_f(fd, addr, addrlen);
     if (n == 0) {
         return 0;
@@ -244,35 +339,43 @@ int connect_with_timeout(int fd, const struct sockaddr *addr, socklen_t addrlen,
 
     // 连接出错了
     eular::IOManager *iom = eular::IOManager::GetThis();
+    int ret = iom->addEvent(fd, eular::IOManager::WRITE);
+    while (ret == eular::IOManager::EVENT_READY) {
+        // 锁存的可写边沿可能早于本次连接, 再调用一次connect确认连接是否仍在进行
+        n = connect_f(fd, addr, addrlen);
+        if (n == 0 || errno == EISCONN) {
+            return Status::OK;
+        } else if (errno != EALREADY) {
+            return Status::UNKNOWN_ERROR;
+        }
+        ret = iom->addEvent(fd, eular::IOManager::WRITE);
+    }
+
     std::shared_ptr<timer_info> sinfo(new timer_info);
     std::weak_ptr<timer_info> winfo(sinfo);
-    uint64_t timerUniqueId = 0;
+    eular::Timer::SP timer;
 
-    if (ms > 0) {
-        timerUniqueId = iom->addConditionTimer(ms, [winfo, fd, iom]() {
+    if (ret == Status::OK && ms > 0) {
+        timer = iom->addConditionTimer(ms, [winfo, fd, iom]() {
             auto t = winfo.lock();
             if (!t || t->cancelled) {
                 return;
             }
             t->cancelled = ETIMEDOUT;
             iom->cancelEvent(fd, eular::IOManager::WRITE);
-        }, winfo);
+        }, winfo, 0, ms >> gIoTimeoutSlackShift);
     }
 
-    int ret = iom->addEvent(fd, eular::IOManager::WRITE);
     if (ret == Status::OK) {
         eular::Fiber::Yeild2Hold();
-        if (timerUniqueId) {
-            iom->delTimer(timerUniqueId);
+        if (timer) {
+            iom->delTimer(timer);
         }
         if (sinfo->cancelled) {
-            errno = sinfo->cancelled;
+            *ErrnoLocation() = sinfo->cancelled;
             return Status::TIMED_OUT;
         }
     } else {
-        if (timerUniqueId) {
-            iom->delTimer(timerUniqueId);
-        }
         LOGE("connect addEvent error.");
     }
 
@@ -285,7 +388,7 @@ int connect_with_timeout(int fd, const struct sockaddr *addr, socklen_t addrlen,
         return Status::OK;
     }
 
-    errno = error;
+    *ErrnoLocation() = error;
     return Status::UNKNOWN_ERROR;
 }
 
@@ -296,7 +399,13 @@ int connect(int sockfd, const struct sockaddr *addr, socklen_t addrlen)
 
 int accept(int s, struct sockaddr *addr, socklen_t *addrlen)
 {
-    int fd = do_io(s, accept_f, "accept", eular::IOManager::READ, SO_RCVTIMEO, addr, addrlen);
+    ssize_t n = 0;
+    bool done = uring_io(s, SO_RCVTIMEO, [addr, addrlen](io_uring_sqe &sqe) {
+        sqe.opcode = IORING_OP_ACCEPT;
+        sqe.addr = (uint64_t)addr;
+        sqe.addr2 = (uint64_t)addrlen;
+    }, n);
+    int fd = done ? (int)n : do_io(s, accept_f, "accept", eular::IOManager::READ, SO_RCVTIMEO, addr, addrlen);
     if(fd >= 0) {
         eular::FdManager::Get()->get(fd, true);
     }
@@ -315,10 +424,39 @@ int accept(int s, struct sockaddr *addr, socklen_t *addrlen)
 
 ssize_t recv(int sockfd, void *buf, size_t len, int flags)
 {
+    ssize_t n = 0;
+    if (uring_io(sockfd, SO_RCVTIMEO, [buf, len, flags](io_uring_sqe &sqe) {
+            sqe.opcode = IORING_OP_RECV;
+            sqe.addr = (uint64_t)buf;
+            sqe.len = len;
+            sqe.msg_flags = flags;
+        }, n)) {
+        return n;
+    }
     return do_io(sockfd, recv_f, "recv", eular::IOManager::READ, SO_RCVTIMEO, buf, len, flags);
 }
 
 ssize_t recvfrom(int sockfd, void *buf, size_t len, int flags, struct sockaddr *src_addr, socklen_t *addrlen) {
+    iovec iov = { buf, len };
+    msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_name = src_addr;
+    msg.msg_namelen = (src_addr && addrlen) ? *addrlen : 0;
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+
+    ssize_t n = 0;
+    if (uring_io(sockfd, SO_RCVTIMEO, [&msg, flags](io_uring_sqe &sqe) {
+            sqe.opcode = IORING_OP_RECVMSG;
+            sqe.addr = (uint64_t)&msg;
+            sqe.len = 1;
+            sqe.msg_flags = flags;
+        }, n)) {
+        if (n >= 0 && src_addr && addrlen) {
+            *addrlen = msg.msg_namelen;
+        }
+        return n;
+    }
     return do_io(sockfd, recvfrom_f, "recvfrom", eular::IOManager::READ, SO_RCVTIMEO, buf, len, flags, src_addr, addrlen);
 }
 
@@ -335,10 +473,36 @@ ssize_t recvmsg(int sockfd, struct msghdr *msg, int flags) {
 // }
 
 ssize_t send(int s, const void *msg, size_t len, int flags) {
+    ssize_t n = 0;
+    if (uring_io(s, SO_SNDTIMEO, [msg, len, flags](io_uring_sqe &sqe) {
+            sqe.opcode = IORING_OP_SEND;
+            sqe.addr = (uint64_t)msg;
+            sqe.len = len;
+            sqe.msg_flags = flags;
+        }, n)) {
+        return n;
+    }
     return do_io(s, send_f, "send", eular::IOManager::WRITE, SO_SNDTIMEO, msg, len, flags);
 }
 
 ssize_t sendto(int s, const void *msg, size_t len, int flags, const struct sockaddr *to, socklen_t tolen) {
+    iovec iov = { const_cast<void *>(msg), len };
+    msghdr hdr;
+    memset(&hdr, 0, sizeof(hdr));
+    hdr.msg_name = const_cast<sockaddr *>(to);
+    hdr.msg_namelen = to ? tolen : 0;
+    hdr.msg_iov = &iov;
+    hdr.msg_iovlen = 1;
+
+    ssize_t n = 0;
+    if (uring_io(s, SO_SNDTIMEO, [&hdr, flags](io_uring_sqe &sqe) {
+            sqe.opcode = IORING_OP_SENDMSG;
+            sqe.addr = (uint64_t)&hdr;
+            sqe.len = 1;
+            sqe.msg_flags = flags;
+        }, n)) {
+        return n;
+    }
     return do_io(s, sendto_f, "sendto", eular::IOManager::WRITE, SO_SNDTIMEO, msg, len, flags, to, tolen);
 }
 
@@ -354,11 +518,12 @@ int close(int fd)
 
     eular::FdContext::SP ctxsp = eular::FdManager::Get()->get(fd);
     if (ctxsp) {
+        eular::FdManager::Get()->del(fd);   // 先标记关闭, 再唤醒等待者
         auto iom = eular::IOManager::GetThis();
         if (iom) {
+            iom->uringCancel(fd);   // io_uring持有文件引用, 关闭fd不会结束在途请求
             iom->cancelAll(fd);
         }
-        eular::FdManager::Get()->del(fd);
     }
     return close_f(fd);
 }
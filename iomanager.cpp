@@ -6,37 +6,88 @@
  ************************************************************************/
 
 #include "iomanager.h"
+#include "config.h"
+#include "core/clock.h"
 #include <utils/errors.h>
 #include <utils/exception.h>
 #include <log/log.h>
 #include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/timerfd.h>
+#include <sched.h>
 
 #define LOG_TAG "IOManager"
 #define EPOLL_MAX_SIZE 4096
+#define URING_ENTRIES 256
+#define URING_REAP_BATCH 64
+#define IDLE_SPIN_ROUNDS 16     // 刚处理完任务的线程休眠前让出CPU并检查任务的次数
 #define TOSTR(something) #something
 
 namespace eular {
 
+/**
+ * @brief 一次io_uring请求, 位于发起协程的栈上
+ */
+struct IOManager::UringRequest {
+    enum State {
+        SUBMITTED,      // 已提交, 发起者还未挂起
+        WAITING,        // 发起者已挂起或即将挂起, 完成方负责调度
+        DONE,           // 已完成, 发起者无需挂起
+    };
+
+    std::atomic<int>    state = {SUBMITTED};
+    std::atomic<int>    pending = {1};      // 还未收到的CQE数, 带超时时请求和超时各一个
+    int32_t             result = 0;
+    bool                timedOut = false;   // 本请求的超时到期(超时CQE为-ETIME)
+    Fiber::SP           fiber;
+    __kernel_timespec   timeout;
+    int                 fd = -1;
+    UringRequest *      prev = nullptr;     // 同一fd的在途请求链表
+    UringRequest *      next = nullptr;
+};
+
+// 超时SQE的user_data为请求地址加此标记, 取消请求自身的完成事件user_data为0
+#define URING_TIMEOUT_TAG 1ull
+
+const int IOManager::EVENT_READY;
+
 IOManager::IOManager(int threads, bool userCaller, String8 threadName) :
-    Scheduler(threads, userCaller, threadName)
+    Scheduler(threads, userCaller, threadName),
+    mUring(nullptr),
+    mTimerFd(-1)
 {
     LOGI("%s() start", __func__);
-    mEpollFd = epoll_create(EPOLL_MAX_SIZE);
-    LOG_ASSERT(mEpollFd > 0, "epoll_create error. [%d,%s]", errno, strerror(errno));
-
-    int ret = pipe(mTickleFd);
-    LOG_ASSERT(!ret, "pipe error. [%d,%s]", errno, strerror(errno));
-
-    epoll_event event;
-    memset(&event, 0, sizeof(event));
-    event.events = EPOLLIN | EPOLLET;
-    event.data.fd = mTickleFd[0];
+    mPerThreadEpoll = Config::Lookup<bool>("iomanager.epoll_per_thread", false);
+    String8 dispatch = Config::Lookup<String8>("iomanager.fd_dispatch", "hash");
+    mHashDispatch = strcmp(dispatch.c_str(), "round_robin") != 0;
+
+    mPollers.resize(mPerThreadEpoll ? getWorkerCount() : 1);
+    for (auto &poller : mPollers) {
+        poller = new Poller;
+        poller->epollFd = epoll_create(EPOLL_MAX_SIZE);
+        LOG_ASSERT(poller->epollFd > 0, "epoll_create error. [%d,%s]", errno, strerror(errno));
+
+        poller->wakeFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+        LOG_ASSERT(poller->wakeFd >= 0, "eventfd error. [%d,%s]", errno, strerror(errno));
+
+        epoll_event event;
+        memset(&event, 0, sizeof(event));
+        event.events = EPOLLIN | EPOLLET;   // 边沿触发, 一次写入只唤醒一个线程
+        event.data.ptr = poller;
+
+        int ret = epoll_ctl(poller->epollFd, EPOLL_CTL_ADD, poller->wakeFd, &event);
+        LOG_ASSERT(!ret, "epoll_ctl(EPOLL_CTL_ADD) error. [%d,%s]", errno, strerror(errno));
+    }
 
-    ret = fcntl(mTickleFd[0], F_SETFL, O_NONBLOCK);
-    LOG_ASSERT2(!ret);
+    String8 backend = Config::Lookup<String8>("iomanager.backend", "epoll");
+    if (strcmp(backend.c_str(), "io_uring") == 0) {
+        initUring();
+    }
 
-    ret = epoll_ctl(mEpollFd, EPOLL_CTL_ADD, mTickleFd[0], &event);
-    LOG_ASSERT(!ret, "epoll_ctl(EPOLL_CTL_ADD) error. [%d,%s]", errno, strerror(errno));
+    String8 timerMode = Config::Lookup<String8>("iomanager.timer_mode", "poll");
+    if (strcmp(timerMode.c_str(), "timerfd") == 0) {
+        initTimerFd();
+    }
 
     contextResize(256);
     start();
@@ -45,9 +96,15 @@ IOManager::IOManager(int threads, bool userCaller, String8 threadName) :
 IOManager::~IOManager()
 {
     stop();
-    close(mEpollFd);
-    close(mTickleFd[0]);
-    close(mTickleFd[1]);
+    for (auto poller : mPollers) {
+        close(poller->epollFd);
+        close(poller->wakeFd);
+        delete poller;
+    }
+    delete mUring;
+    if (mTimerFd >= 0) {
+        close(mTimerFd);
+    }
 
     for (size_t i = 0; i < mContextVec.size(); ++i) {
         if (mContextVec[i]) {
@@ -56,7 +113,7 @@ IOManager::~IOManager()
     }
 }
 
-int IOManager::addEvent(int fd, IOManager::Event ev, std::function<void()> cb)
+int IOManager::addEvent(int fd, IOManager::Event ev, Task cb)
 {
     Context *ctx = nullptr;
 
@@ -70,20 +127,31 @@ int IOManager::addEvent(int fd, IOManager::Event ev, std::function<void()> cb)
         ctx = mContextVec[fd];
     }
     mRWMutex.unlock();
+
+    AutoLock<Mutex> lock(ctx->mutex);
     if (eular_unlikely(ctx->events & ev)) { // 已存在此事件
         LOGW("%s() %d[ev: 0x%x] already exists", __func__, fd, ev);
         return INVALID_PARAM;
     }
 
-    uint32_t opt = ctx->events ? EPOLL_CTL_MOD : EPOLL_CTL_ADD;
-    epoll_event event;
-    event.events = EPOLLET | ctx->events | ev;
-    event.data.ptr = ctx;
-    int ret = epoll_ctl(mEpollFd, opt, fd, &event);
-    if (ret) {
-        LOGE("epoll_ctl(%d, %s, %d, 0x%x) error. [%d,%s]", mEpollFd, opt == EPOLL_CTL_MOD ? TOSTR(EPOLL_CTL_MOD) : TOSTR(EPOLL_CTL_ADD),
-            fd, event.events, errno, strerror(errno));
-        return UNKNOWN_ERROR;
+    if (ctx->ready & ev) {  // 上次IO返回EAGAIN之后边沿已经到达
+        ctx->ready &= ~ev;
+        return EVENT_READY;
+    }
+
+    if (!ctx->registered) { // fd第一次等待或cancelAll之后
+        assignHome(ctx);
+        int epollFd = mPollers[ctx->home]->epollFd;
+        epoll_event event;
+        event.events = EPOLLIN | EPOLLOUT | EPOLLET;
+        event.data.ptr = ctx;
+        int ret = epoll_ctl(epollFd, EPOLL_CTL_ADD, fd, &event);
+        if (ret) {
+            LOGE("epoll_ctl(%d, %s, %d, 0x%x) error. [%d,%s]", epollFd, TOSTR(EPOLL_CTL_ADD),
+                fd, event.events, errno, strerror(errno));
+            return UNKNOWN_ERROR;
+        }
+        ctx->registered = true;
     }
 
     ctx->events = (IOManager::Event)(ctx->events | ev);
@@ -108,7 +176,7 @@ bool IOManager::delEvent(int fd, IOManager::Event ev)
         if (mContextVec.size() <= fd) {
             return false;
         }
-        Context *ctx = mContextVec[fd];
+        ctx = mContextVec[fd];
         LOG_ASSERT2(ctx != nullptr);
     }
 
@@ -118,20 +186,8 @@ bool IOManager::delEvent(int fd, IOManager::Event ev)
         return false;
     }
 
-    Event newEvent = (Event)(ctx->events & ~ev);
-    int opt = newEvent ? EPOLL_CTL_MOD : EPOLL_CTL_DEL;
-    epoll_event epevent;
-    epevent.data.ptr = ctx;
-    epevent.events = EPOLLET | newEvent;
-    int ret = epoll_ctl(mEpollFd, opt, fd, &epevent);
-    if (ret) {
-        LOGE("epoll_ctl(%d, %s, %d, 0x%x) error. [%d,%s]", mEpollFd,
-            opt == EPOLL_CTL_MOD ? TOSTR(EPOLL_CTL_MOD) : TOSTR(EPOLL_CTL_DEL),
-            fd, epevent.events, errno, strerror(errno));
-        return false;
-    }
-
-    ctx->events = newEvent;
+    // 注册是持久的, 只需移除等待者
+    ctx->events = (Event)(ctx->events & ~ev);
     Context::EventContext &eventCtx = ctx->getContext(ev);
     ctx->resetContext(eventCtx);
     return true;
@@ -153,20 +209,7 @@ bool IOManager::cancelEvent(int fd, IOManager::Event ev)
     if (eular_unlikely(!(ctx->events & ev))) {
         return false;
     }
-    Event newEv = (Event)(ctx->events & ~ev);
-    int opt = newEv ? EPOLL_CTL_MOD : EPOLL_CTL_DEL;
-    epoll_event epevent;
-    epevent.data.ptr = ctx;
-    epevent.events = EPOLLET | newEv;
-
-    int ret = epoll_ctl(mEpollFd, opt, fd, &epevent);
-    if (ret < 0) {
-        LOGE("epoll_ctl(%d, %s, %d, 0x%x) error. [%d,%s]", mEpollFd,
-            opt == EPOLL_CTL_MOD ? TOSTR(EPOLL_CTL_MOD) : TOSTR(EPOLL_CTL_DEL),
-            fd, epevent.events, errno, strerror(errno));
-        return false;
-    }
-    ctx->triggerEvent(ev);
+    ctx->triggerEvent(ev, this);
     return true;
 }
 
@@ -183,18 +226,25 @@ bool IOManager::cancelAll(int fd)
     }
 
     AutoLock<Mutex> lock(ctx->mutex);
-    int ret = epoll_ctl(mEpollFd, EPOLL_CTL_DEL, fd, nullptr);
+    if (!ctx->registered) {
+        return false;
+    }
+    int epollFd = mPollers[ctx->home]->epollFd;
+    int ret = epoll_ctl(epollFd, EPOLL_CTL_DEL, fd, nullptr);
     if (ret < 0) {
-        LOGE("epoll_ctl(%d, EPOLL_CTL_DEL, %d, nullptr) error. [%d,%s]", mEpollFd,
+        LOGE("epoll_ctl(%d, EPOLL_CTL_DEL, %d, nullptr) error. [%d,%s]", epollFd,
             fd, errno, strerror(errno));
-        return false;
     }
+    ctx->registered = false;
+    ctx->ready = IOManager::NONE;
 
     if (ctx->events & IOManager::READ) {
-        ctx->triggerEvent(IOManager::READ);
-    } else if (ctx->events & IOManager::WRITE) {
-        ctx->triggerEvent(IOManager::WRITE);
+        ctx->triggerEvent(IOManager::READ, this);
     }
+    if (ctx->events & IOManager::WRITE) {
+        ctx->triggerEvent(IOManager::WRITE, this);
+    }
+    ctx->homeTid = -1;          // fd即将关闭, 复用此fd时重新分配
 
     LOG_ASSERT2(ctx->events == IOManager::NONE);
     return true;
@@ -215,81 +265,140 @@ void IOManager::idle()
             delete[] p;
         }
     });
+    std::vector<Task> cbs;  // 复用, 避免每轮循环分配
+    Poller *poller = mPollers[mPerThreadEpoll ? getWorkerIndex() : 0];
+    bool searching = false;     // 上一轮有事件, 任务可能还在陆续提交
 
     while (true) {
+        // 刚处理完一批任务的线程先自旋片刻再休眠, 期间它占用wakePending, 其他tickle视为已有线程被唤醒.
+        // 任务陆续提交时由它接着处理, 不必每提交一次就唤醒一次
+        if (searching && !poller->wakePending.exchange(true)) {
+            bool found = false;
+            for (uint32_t i = 0; i < IDLE_SPIN_ROUNDS && !found; ++i) {
+                sched_yield();
+                found = hasRunnableTask();
+            }
+            poller->wakePending.store(false);
+            if (found) {
+                Fiber::SP ptr = Fiber::GetThis();
+                auto rawPtr = ptr.get();
+                ptr.reset();
+                rawPtr->back();
+                continue;
+            }
+        }
+        searching = false;
+
+        // 先声明即将休眠, 再检查任务和定时器; 与tickle()中先提交任务再检查sleeping配对,
+        // 二者至少有一方能看到对方, 不会出现任务已提交但所有线程都在epoll_wait中的情况
+        ++poller->sleeping;
         uint64_t nextTimeout = 0;
         if (eular_unlikely(stopping(nextTimeout))) {
+            --poller->sleeping;
             LOGI("%s idle stoppong.", getName().c_str());
+            tickle();   // 依次唤醒其他线程退出
             break;
         }
+        if (hasRunnableTask()) {
+            nextTimeout = 0;
+        }
 
         int nev = 0;
         do {
             static const uint32_t maxTimeOut = 3000;
-            if (nextTimeout != ~0ull) {
-                nextTimeout = nextTimeout > maxTimeOut ? maxTimeOut : nextTimeout;
+            int waitMs = 0;
+            if (nextTimeout == 0) {
+                waitMs = 0;
+            } else if (mTimerFd >= 0) {
+                waitMs = -1;    // 定时器由timerfd唤醒
             } else {
-                nextTimeout = maxTimeOut;
+                waitMs = nextTimeout > maxTimeOut ? maxTimeOut : nextTimeout;
             }
 
-            nev = epoll_wait(mEpollFd, events, maxEvents, nextTimeout);
+            nev = epoll_wait(poller->epollFd, events, maxEvents, waitMs);
             if (nev < 0 && errno == EINTR) {
             } else {
                 break;
             }
         } while (true);
+        --poller->sleeping;
+        Clock::Update();    // epoll_wait可能阻塞了很久, 处理到期前刷新
+        mPolls.fetch_add(1, std::memory_order_relaxed);
+        if (nev == 0) {
+            mPollTimeouts.fetch_add(1, std::memory_order_relaxed);
+        }
 
         // LOGD("%s() %ld event amount %d\n", __func__, Fiber::GetFiberID(), nev);
-        std::vector<std::function<void()>> cbs;
-        ListExpireTimer(cbs);
-        if (!cbs.empty()) {
-            schedule<std::vector<std::function<void()>>::iterator>(cbs.begin(), cbs.end());
-            cbs.clear();
+        bool woken = false;
+        bool expire = mTimerFd < 0;
+        searching = nev > 0;
+        for (int i = 0; i < nev; ++i) {
+            if (events[i].data.ptr == &mTimerFd) {
+                uint64_t count = 0;
+                read(mTimerFd, &count, sizeof(count));
+                expire = true;
+                break;
+            }
+        }
+        if (expire) {
+            ListExpireTimer(cbs);
+            if (!cbs.empty()) {
+                schedule<std::vector<Task>::iterator>(cbs.begin(), cbs.end());
+                cbs.clear();
+            }
+            if (mTimerFd >= 0) {
+                armTimerFd();
+            }
         }
-        
+
         for (int i = 0; i < nev; ++i) {
             epoll_event &event = events[i];
 
-            if (event.data.fd == mTickleFd[0]) {
-                uint8_t buf[128] = {0};
-                while (read(mTickleFd[0], buf, sizeof(buf)) > 0);
+            if (event.data.ptr == &mTimerFd) {
+                continue;
+            }
+
+            if (mUring && event.data.ptr == mUring) {
+                reapUring();
+                continue;
+            }
+
+            if (event.data.ptr == poller) {
+                eventfd_t value = 0;
+                eventfd_read(poller->wakeFd, &value);
+                woken = true;
                 continue;
             }
 
             Context *ctx = static_cast<Context *>(event.data.ptr);
             AutoLock<Mutex> lock(ctx->mutex);
             if (event.events & (EPOLLERR | EPOLLHUP)) {
-                event.events |= (EPOLLIN | EPOLLOUT) & ctx->events;
+                event.events |= EPOLLIN | EPOLLOUT;
             }
-            int realEvents = IOManager::NONE;
+            uint32_t realEvents = IOManager::NONE;
             if (event.events & EPOLLIN) {
                 realEvents |= IOManager::READ;
             }
             if (event.events & EPOLLOUT) {
                 realEvents |= IOManager::WRITE;
             }
-            if ((ctx->events & realEvents) == IOManager::NONE) {
-                continue;
-            }
 
-            int leftEvents = (ctx->events & ~realEvents);
-            int opt = leftEvents ? EPOLL_CTL_MOD : EPOLL_CTL_DEL;
-            event.events = EPOLLET | leftEvents;
-            int ret = epoll_ctl(mEpollFd, opt, ctx->fd, &event);
-            if (ret) {
-                LOGE("epoll_ctl(%d, EPOLL_CTL_DEL, %d, nullptr) error. [%d,%s]", mEpollFd,
-                    ctx->fd, errno, strerror(errno));
-                continue;
+            // 注册是持久的边沿触发, 无人等待的边沿锁存下来, 否则下一次addEvent会错过它
+            ctx->ready |= realEvents & ~ctx->events;
+            if (realEvents & ctx->events & IOManager::READ) {
+                ctx->triggerEvent(IOManager::READ, this);
             }
-
-            if (realEvents & IOManager::READ) {
-                ctx->triggerEvent(IOManager::READ);
-            }
-            if (realEvents & IOManager::WRITE) {
-                ctx->triggerEvent(IOManager::WRITE);
+            if (realEvents & ctx->events & IOManager::WRITE) {
+                ctx->triggerEvent(IOManager::WRITE, this);
             }
         }
 
+        // 被唤醒的线程即将回到调度循环取任务, 此前的tickle都由它处理, 之后的tickle才需要再次唤醒.
+        // 先读取eventfd再清除标志, 清除之后的tickle会重新写入产生新的边沿
+        if (woken) {
+            poller->wakePending.store(false);
+        }
+
         Fiber::SP ptr = Fiber::GetThis();
         auto rawPtr = ptr.get();
         ptr.reset();
@@ -297,13 +406,334 @@ void IOManager::idle()
     }
 }
 
+/**
+ * @brief 只有存在休眠线程时才唤醒, 且同一时刻只有一个线程处于被唤醒(或休眠前自旋)状态:
+ * wakePending从写eventfd起, 直到被唤醒的线程回到调度循环才清除, 期间的tickle都跳过.
+ * 被唤醒的线程取到任务后若仍有剩余会再次调用tickle, 逐个唤醒
+ */
 void IOManager::tickle()
 {
-    if (!hasIdleThread()) {
+    mWakeRequested.fetch_add(1, std::memory_order_relaxed);
+    if (!mPerThreadEpoll) {
+        wake(mPollers[0]);
+        return;
+    }
+
+    // 每个线程有自己的epoll, 唤醒任意一个休眠的线程来执行未绑定的任务
+    uint32_t count = mPollers.size();
+    uint32_t begin = mNextWake.fetch_add(1, std::memory_order_relaxed);
+    for (uint32_t i = 0; i < count; ++i) {
+        if (wake(mPollers[(begin + i) % count])) {
+            return;
+        }
+    }
+}
+
+void IOManager::tickleWorker(uint32_t index)
+{
+    if (!mPerThreadEpoll) {
+        tickle();
+        return;
+    }
+
+    mWakeRequested.fetch_add(1, std::memory_order_relaxed);
+    if (index < mPollers.size()) {
+        wake(mPollers[index]);
+    }
+}
+
+/**
+ * @return poller中是否有休眠的线程
+ */
+bool IOManager::wake(Poller *poller)
+{
+    if (poller->sleeping.load() == 0) {
+        return false;
+    }
+    mWakeNeeded.fetch_add(1, std::memory_order_relaxed);
+    if (poller->wakePending.exchange(true)) {
+        return true;
+    }
+
+    int ret = eventfd_write(poller->wakeFd, 1);
+    LOG_ASSERT(ret == 0, "eventfd_write error. [%d,%s]", errno, strerror(errno));
+    mWakeIssued.fetch_add(1, std::memory_order_relaxed);
+    return true;
+}
+
+/**
+ * @brief 为fd选择home线程, 之后该fd的事件都由此线程的epoll监听, 协程也在此线程恢复
+ */
+void IOManager::assignHome(Context *ctx)
+{
+    if (!mPerThreadEpoll) {
+        ctx->home = 0;
+        ctx->homeTid = -1;
+        return;
+    }
+
+    uint32_t count = mPollers.size();
+    if (mHashDispatch) {
+        ctx->home = (uint32_t)ctx->fd % count;
+    } else {
+        ctx->home = mNextHome.fetch_add(1, std::memory_order_relaxed) % count;
+    }
+    ctx->homeTid = getWorkerTid(ctx->home);
+}
+
+/**
+ * @brief 创建io_uring并把它的fd加入每个epoll, CQ非空时由空闲线程收割.
+ * 内核不支持或不支持FAST_POLL(非阻塞socket上的请求会直接返回EAGAIN)时回退到epoll
+ */
+void IOManager::initUring()
+{
+    IoUring *uring = new IoUring;
+    if (!uring->init(URING_ENTRIES)) {
+        LOGW("io_uring unavailable, fall back to epoll");
+        delete uring;
+        return;
+    }
+    if (!(uring->features() & IORING_FEAT_FAST_POLL)) {
+        LOGW("io_uring without IORING_FEAT_FAST_POLL, fall back to epoll");
+        delete uring;
+        return;
+    }
+
+    for (auto poller : mPollers) {
+        epoll_event event;
+        memset(&event, 0, sizeof(event));
+        event.events = EPOLLIN | EPOLLET;
+        event.data.ptr = uring;
+        int ret = epoll_ctl(poller->epollFd, EPOLL_CTL_ADD, uring->fd(), &event);
+        if (ret) {
+            LOGW("epoll_ctl(%d, EPOLL_CTL_ADD, %d) error. [%d,%s], fall back to epoll",
+                poller->epollFd, uring->fd(), errno, strerror(errno));
+            delete uring;   // 关闭fd时会自动从epoll中移除
+            return;
+        }
+    }
+    mUring = uring;
+}
+
+/**
+ * @brief 创建timerfd并注册到所有epoll. 多个epoll时使用EPOLLEXCLUSIVE, 到期只唤醒一个线程
+ */
+void IOManager::initTimerFd()
+{
+    int fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    if (fd < 0) {
+        LOGW("timerfd_create error. [%d,%s], fall back to poll", errno, strerror(errno));
+        return;
+    }
+
+    for (auto poller : mPollers) {
+        epoll_event event;
+        memset(&event, 0, sizeof(event));
+        event.events = EPOLLIN | EPOLLET;
+        if (mPollers.size() > 1) {
+            event.events |= EPOLLEXCLUSIVE;
+        }
+        event.data.ptr = &mTimerFd;
+        int ret = epoll_ctl(poller->epollFd, EPOLL_CTL_ADD, fd, &event);
+        if (ret && (event.events & EPOLLEXCLUSIVE)) {  // 内核低于4.5
+            event.events &= ~EPOLLEXCLUSIVE;
+            ret = epoll_ctl(poller->epollFd, EPOLL_CTL_ADD, fd, &event);
+        }
+        if (ret) {
+            LOGW("epoll_ctl(%d, EPOLL_CTL_ADD, %d) error. [%d,%s], fall back to poll",
+                poller->epollFd, fd, errno, strerror(errno));
+            close(fd);
+            return;
+        }
+    }
+    mTimerFd = fd;
+}
+
+/**
+ * @brief 按最近的到期时间重新设置timerfd, 没有定时器时解除.
+ * 只在最近的到期时间可能提前(插入到最前面)或到期处理之后调用
+ */
+void IOManager::armTimerFd()
+{
+    AutoLock<Mutex> lock(mTimerFdMutex);
+    uint64_t timeout = getNearTimeout();
+    itimerspec spec;
+    memset(&spec, 0, sizeof(spec));
+    if (timeout == 0) {
+        spec.it_value.tv_nsec = 1;      // it_value全0表示解除, 已到期的用最小值立即触发
+    } else if (timeout != ~0ull) {
+        spec.it_value.tv_sec = timeout / 1000;
+        spec.it_value.tv_nsec = (timeout % 1000) * 1000000;
+    }
+    if (timerfd_settime(mTimerFd, 0, &spec, nullptr)) {
+        LOGE("timerfd_settime(%d, %lu ms) error. [%d,%s]", mTimerFd, timeout, errno, strerror(errno));
+    }
+}
+
+/**
+ * @brief 同一时刻只有一个线程收割; 其他线程发现有人在收割直接返回,
+ * 收割者释放标志后会再检查一次CQ, 不会遗漏在此期间完成的请求
+ */
+void IOManager::reapUring()
+{
+    io_uring_cqe cqes[URING_REAP_BATCH];
+    do {
+        if (mUringReaping.exchange(true)) {
+            return;
+        }
+
+        uint32_t n = 0;
+        while ((n = mUring->reap(cqes, URING_REAP_BATCH)) > 0) {
+            for (uint32_t i = 0; i < n; ++i) {
+                uint64_t userData = cqes[i].user_data;
+                if (userData == 0) {    // 取消请求自身的完成事件
+                    continue;
+                }
+                UringRequest *req = reinterpret_cast<UringRequest *>(userData & ~URING_TIMEOUT_TAG);
+                if (userData & URING_TIMEOUT_TAG) {
+                    // 请求先完成时超时被取消(-ECANCELED); -ETIME表示超时到期, 请求随之被取消
+                    req->timedOut = cqes[i].res == -ETIME;
+                } else {
+                    req->result = cqes[i].res;
+                }
+                // 请求和超时的CQE都收到后才能唤醒发起者, 之后req所在的栈可能已失效
+                if (req->pending.fetch_sub(1, std::memory_order_acq_rel) != 1) {
+                    continue;
+                }
+                if (req->state.exchange(UringRequest::DONE) == UringRequest::WAITING) {
+                    Fiber::SP fiber;
+                    fiber.swap(req->fiber);
+                    schedule(&fiber);
+                }
+                // 否则发起者还未挂起, 它看到DONE后直接返回, 此后不能再访问req
+            }
+        }
+
+        mUringReaping.store(false);
+    } while (mUring->hasCompletion());
+}
+
+int32_t IOManager::uringSubmitAndWait(const io_uring_sqe &tmpl, uint64_t timeoutMs)
+{
+    LOG_ASSERT2(mUring != nullptr);
+    const bool withTimeout = timeoutMs != (uint64_t)-1;
+    static_assert(alignof(UringRequest) > URING_TIMEOUT_TAG, "");
+    UringRequest req;
+    req.fiber = Fiber::GetThis();
+    req.fd = tmpl.fd;
+    req.pending.store(withTimeout ? 2 : 1, std::memory_order_relaxed);
+
+    {
+        AutoLock<Mutex> lock(mUringMutex);
+        // 请求和超时必须在同一次提交中, 先确保SQ有足够空间
+        uint32_t needed = withTimeout ? 2 : 1;
+        if (mUring->sqSpace() < needed) {
+            mUring->submit();
+            if (mUring->sqSpace() < needed) {
+                return -EBUSY;
+            }
+        }
+        io_uring_sqe *sqe = mUring->getSqe();
+        *sqe = tmpl;
+        sqe->user_data = reinterpret_cast<uint64_t>(&req);
+
+        if (withTimeout) {
+            io_uring_sqe *link = mUring->getSqe();
+            sqe->flags |= IOSQE_IO_LINK;
+            req.timeout.tv_sec = timeoutMs / 1000;
+            req.timeout.tv_nsec = (timeoutMs % 1000) * 1000000;
+            link->opcode = IORING_OP_LINK_TIMEOUT;
+            link->fd = -1;
+            link->addr = reinterpret_cast<uint64_t>(&req.timeout);
+            link->len = 1;
+            link->user_data = reinterpret_cast<uint64_t>(&req) | URING_TIMEOUT_TAG;
+        }
+
+        UringRequest *&head = mUringInflight[req.fd];
+        req.next = head;
+        if (head) {
+            head->prev = &req;
+        }
+        head = &req;
+
+        int ret = 0;
+        while ((ret = mUring->submit()) == -EAGAIN || ret == -EBUSY) {
+            // CQ溢出或内核暂时无法分配请求, 先收割再重试
+            reapUring();
+            sched_yield();
+        }
+        LOG_ASSERT(ret >= 0, "io_uring_enter error. [%d,%s]", -ret, strerror(-ret));
+    }
+
+    // socket已就绪时请求在io_uring_enter中就已完成, 直接收割可以省掉一次挂起
+    if (mUring->hasCompletion()) {
+        reapUring();
+    }
+    if (req.state.exchange(UringRequest::WAITING) != UringRequest::DONE) {
+        Fiber::Yeild2Hold();
+    }
+
+    {
+        AutoLock<Mutex> lock(mUringMutex);
+        if (req.prev) {
+            req.prev->next = req.next;
+        } else {
+            mUringInflight[req.fd] = req.next;  // 链表空时保留表项, 避免每次请求都分配节点
+        }
+        if (req.next) {
+            req.next->prev = req.prev;
+        }
+    }
+
+    // 只有本请求自己的超时到期才是ETIMEDOUT; 其他原因的取消保持ECANCELED, 由hook按fd是否已关闭转换为EBADF
+    if (req.timedOut && req.result == -ECANCELED) {
+        return -ETIMEDOUT;
+    }
+    return req.result;
+}
+
+/**
+ * @brief 按user_data逐个取消fd上的在途请求. IORING_ASYNC_CANCEL_FD需要5.19,
+ * 而按user_data取消在支持FAST_POLL(5.7)的内核上都可用
+ */
+void IOManager::uringCancel(int fd)
+{
+    if (mUring == nullptr) {
         return;
     }
-    int ret = write(mTickleFd[1], "T", 1);
-    LOG_ASSERT2(ret == 1);
+
+    AutoLock<Mutex> lock(mUringMutex);
+    auto it = mUringInflight.find(fd);
+    if (it == mUringInflight.end() || it->second == nullptr) {
+        return;
+    }
+    for (UringRequest *req = it->second; req != nullptr; req = req->next) {
+        io_uring_sqe *sqe = mUring->getSqe();
+        if (sqe == nullptr) {
+            mUring->submit();
+            sqe = mUring->getSqe();
+            if (sqe == nullptr) {
+                LOGW("%s(%d) submission queue full", __func__, fd);
+                break;
+            }
+        }
+        sqe->opcode = IORING_OP_ASYNC_CANCEL;
+        sqe->fd = -1;
+        sqe->addr = reinterpret_cast<uint64_t>(req);
+        sqe->user_data = 0;
+    }
+    mUring->submit();
+}
+
+IOManager::WakeupStats IOManager::getWakeupStats() const
+{
+    WakeupStats stats;
+    stats.requested = mWakeRequested.load(std::memory_order_relaxed);
+    stats.needed = mWakeNeeded.load(std::memory_order_relaxed);
+    stats.issued = mWakeIssued.load(std::memory_order_relaxed);
+    stats.polls = mPolls.load(std::memory_order_relaxed);
+    stats.timeouts = mPollTimeouts.load(std::memory_order_relaxed);
+    return stats;
 }
 
 bool IOManager::stopping()
@@ -314,7 +744,11 @@ bool IOManager::stopping()
 
 void IOManager::onTimerInsertedAtFront()
 {
-    tickle();
+    if (mTimerFd >= 0) {
+        armTimerFd();
+    } else {
+        tickle();
+    }
 }
 
 IOManager::Context::EventContext& IOManager::Context::getContext(IOManager::Event event)
@@ -337,15 +771,16 @@ void IOManager::Context::resetContext(IOManager::Context::EventContext& ctx)
     ctx.cb = nullptr;
 }
 
-void IOManager::Context::triggerEvent(IOManager::Event event)
+void IOManager::Context::triggerEvent(IOManager::Event event, Scheduler *owner)
 {
     LOG_ASSERT2(event & events);
     events = (Event)(events & ~event);
     EventContext &eventCtx = getContext(event);
+    int thread = eventCtx.scheduler == owner ? homeTid : -1;
     if (eventCtx.cb) {
-        eventCtx.scheduler->schedule(&eventCtx.cb);
+        eventCtx.scheduler->schedule(&eventCtx.cb, thread);
     } else {
-        eventCtx.scheduler->schedule(&eventCtx.fiber);
+        eventCtx.scheduler->schedule(&eventCtx.fiber, thread);
     }
 
     eventCtx.scheduler = nullptr;
@@ -366,17 +801,20 @@ void IOManager::contextResize(uint32_t size)
         }
     }
     mContextVec.resize(size);
-    uint32_t i = 0;
-    for (auto &it : mContextVec) {
-        if (it == nullptr) {
-            it = new Context;
-            it->fd = i++;
+    for (uint32_t i = 0; i < mContextVec.size(); ++i) {
+        if (mContextVec[i] == nullptr) {
+            mContextVec[i] = new Context;
+            mContextVec[i]->fd = i;   // 下标即fd, 扩容时新建的Context也必须与之对应
         }
     }
 }
 
 bool IOManager::stopping(uint64_t& timeout)
 {
+    if (mTimerFd >= 0) {
+        timeout = ~0ull;    // 不需要计算最近的超时, 到期由timerfd通知
+        return !hasTimer() && Scheduler::stopping();
+    }
     timeout = getNearTimeout();
     return timeout == ~0ull
         && Scheduler::stopping();
@@ -10,7 +10,10 @@
 
 #include "fiber/scheduler.h"
 #include "core/timer.h"
+#include "core/uring.h"
 #include <utils/mutex.h>
+#include <atomic>
+#include <unordered_map>
 #include <vector>
 
 namespace eular {
@@ -26,45 +29,133 @@ public:
         WRITE = EPOLLOUT
     };
 
-    int  addEvent(int fd, Event ev, std::function<void()> cb = nullptr);
+    /**
+     * @brief addEvent的返回值: 事件在调用前已就绪(边沿已被锁存), 未注册等待, 调用方应直接重试IO
+     */
+    static const int EVENT_READY = 1;
+
+    /**
+     * @brief 等待fd上的事件. fd第一次调用时以EPOLLIN|EPOLLOUT|EPOLLET持久注册到epoll,
+     * 之后事件触发和再次等待都不需要epoll_ctl
+     *
+     * @param cb 为空时等待的是当前协程
+     * @return OK 已注册等待; EVENT_READY 事件已就绪; 其他为错误
+     */
+    int  addEvent(int fd, Event ev, Task cb = nullptr);
     bool delEvent(int fd, Event ev);
     bool cancelEvent(int fd, Event ev);
     bool cancelAll(int fd);
 
     static IOManager *GetThis();
 
+    struct WakeupStats {
+        uint64_t requested;     // tickle()调用次数
+        uint64_t needed;        // 调用时有线程阻塞在epoll_wait中的次数
+        uint64_t issued;        // 实际写eventfd的次数
+        uint64_t polls;         // epoll_wait返回的次数, 即空闲线程被唤醒的次数; 按时间差分即wakeups/sec
+        uint64_t timeouts;      // 其中因超时(定时器到期或轮询上限)返回的次数
+    };
+    WakeupStats getWakeupStats() const;
+
+    /**
+     * @brief iomanager.backend为io_uring且内核支持时为true, 否则使用epoll
+     */
+    bool uringEnabled() const { return mUring != nullptr; }
+
+    /**
+     * @brief iomanager.timer_mode为timerfd且创建成功时为true
+     */
+    bool timerFdEnabled() const { return mTimerFd >= 0; }
+
+    /**
+     * @brief 通过io_uring执行一次操作, 当前协程挂起直到完成
+     *
+     * @param sqe 已填好opcode/fd/addr等字段的模板, user_data由此函数设置
+     * @param timeoutMs 超时时间(ms), (uint64_t)-1表示不超时
+     * @return 同CQE的res: >=0成功, <0为-errno, 超时为-ETIMEDOUT
+     */
+    int32_t uringSubmitAndWait(const io_uring_sqe &sqe, uint64_t timeoutMs);
+
+    /**
+     * @brief 取消fd上所有在途的io_uring请求, 关闭fd前调用
+     */
+    void uringCancel(int fd);
+
 protected:
     virtual void idle() override;
     virtual void tickle() override;
+    virtual void tickleWorker(uint32_t index) override;
     virtual bool stopping() override;
     virtual void onTimerInsertedAtFront() override;
 
+    /**
+     * @brief epoll实例. 默认所有线程共用一个;
+     * iomanager.epoll_per_thread为true时每个线程一个, fd在addEvent时分配到某个线程(home)
+     */
+    struct Poller {
+        int epollFd = -1;
+        int wakeFd = -1;                            // eventfd：用于唤醒epoll_wait
+        std::atomic<uint32_t> sleeping = {0};       // 处于或即将进入epoll_wait的线程数
+        std::atomic<bool> wakePending = {false};    // 有线程已被唤醒或在休眠前自旋, 还未回到调度循环
+    };
+
     struct Context {
         struct EventContext {
             Scheduler *scheduler = nullptr;
             Fiber::SP fiber;
-            std::function<void()> cb;
+            Task cb;
         };
 
         EventContext& getContext(Event event);
 
         // TODO: 将参数改成Event
         void resetContext(EventContext& ctx);
-        void triggerEvent(Event event);
+        /**
+         * @brief 事件就绪, 将等待的协程或回调交给调度器
+         *
+         * @param owner 当事件由owner注册时, 任务绑定到home线程执行
+         */
+        void triggerEvent(Event event, Scheduler *owner);
 
         EventContext read;
         EventContext write;
         int fd = 0;
-        Event events = NONE;
+        Event events = NONE;    // 有协程或回调在等待的事件
+        uint32_t ready = NONE;  // 边沿到达时无人等待的事件, 由下一次addEvent消费
+        bool registered = false;    // 已持久注册到epoll, cancelAll时移除
+        uint32_t home = 0;      // 所属Poller下标
+        int homeTid = -1;       // 所属线程, 共用epoll时为-1
         Mutex mutex;
     };
 
     void contextResize(uint32_t size);
     bool stopping(uint64_t& timeout);
+    void assignHome(Context *ctx);
+    bool wake(Poller *poller);
+    void initUring();
+    void reapUring();
+    void initTimerFd();
+    void armTimerFd();
+
+    struct UringRequest;
 
 private:
-    int         mEpollFd;
-    int         mTickleFd[2];       // pipe：用于触发epoll
+    std::vector<Poller *>   mPollers;
+    bool                    mPerThreadEpoll;    // iomanager.epoll_per_thread
+    bool                    mHashDispatch;      // iomanager.fd_dispatch为hash时按fd取模, 否则轮询
+    std::atomic<uint32_t>   mNextHome = {0};
+    std::atomic<uint32_t>   mNextWake = {0};
+    std::atomic<uint64_t>   mWakeRequested = {0};
+    std::atomic<uint64_t>   mWakeNeeded = {0};
+    std::atomic<uint64_t>   mWakeIssued = {0};
+    std::atomic<uint64_t>   mPolls = {0};
+    std::atomic<uint64_t>   mPollTimeouts = {0};
+    IoUring *               mUring;             // iomanager.backend为io_uring时有效
+    Mutex                   mUringMutex;        // 保护SQ
+    std::atomic<bool>       mUringReaping = {false};
+    std::unordered_map<int, UringRequest *> mUringInflight; // fd -> 在途请求链表, 由mUringMutex保护, 关闭fd时逐个取消
+    int                     mTimerFd;           // iomanager.timer_mode为timerfd时有效, 按最近的定时器设置
+    Mutex                   mTimerFdMutex;      // 串行化计算最近到期时间与timerfd_settime, 避免较晚的设置覆盖较早的
     RWMutex     mRWMutex;           // 管理IOManager
     std::vector<Context *> mContextVec;
 };
@@ -174,12 +174,12 @@ void Epoll::event_loop()
                 continue;
             }
 
-            if (ev.events & EPOLLIN) {
-                mIOWorker->schedule(std::bind(&FDContext::executeEvent, ctx, EPOLLIN));
-            }
-
-            if (ev.events & EPOLLOUT) {
-                mIOWorker->schedule(std::bind(&FDContext::executeEvent, ctx, EPOLLOUT));
+            // executeEvent会执行完整的请求处理(解码、编码、压缩、日志), 使用默认栈;
+            // 同一大小的栈也能在协程和栈池中复用.
+            // 边沿触发时可读事件通常带着EPOLLOUT一起返回, 合并为一个任务
+            uint32_t ready = ev.events & (EPOLLIN | EPOLLOUT);
+            if (ready) {
+                mIOWorker->schedule(std::bind(&FDContext::executeEvent, ctx, ready));
             }
         }
     }
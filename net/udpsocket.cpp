@@ -8,7 +8,8 @@
 #include "udpsocket.h"
 #include "config.h"
 #include "fdmanager.h"
-#include "db/redispool.h"
+#include "core/clock.h"
+#include "peer_registry.h"
 #include "protocol/protocol.h"
 #include <log/log.h>
 
@@ -28,10 +29,9 @@ UdpServer::UdpServer(Epoll::SP epoll, IOManager *io_worker, IOManager *processWo
     LOG_ASSERT2(mSocket > 0);
     LOGD("udp socket %d", mSocket);
     mDisconnectionTimeoutMS = Config::Lookup<uint32_t>("udp.disconnection_timeout_ms", 3000);
+    mScanSlackMS = Config::Lookup<uint32_t>("udp.scan_slack_ms", 250);
     mEpoll = epoll;
     FdManager::get()->get(mSocket, true)->setUserNonblock(true);
-
-    mMutex.setMutexName("udpserver");
 }
 
 UdpServer::~UdpServer()
@@ -42,28 +42,31 @@ UdpServer::~UdpServer()
 void UdpServer::start()
 {
     LOG_ASSERT2(mEpoll->addEvent(shared_from_this(), std::bind(&UdpServer::onReadEvent, this), nullptr, EPOLLIN));
-    mTimerID = mProcessWorker->addTimer(1000, std::bind(&UdpServer::onTimerEvent, this), 1500);
-    LOG_ASSERT2(mTimerID > 0);
+    mTimer = mProcessWorker->addTimer(1000, std::bind(&UdpServer::onTimerEvent, this), 1500, mScanSlackMS);
+    LOG_ASSERT2(mTimer != nullptr);
 }
 
 void UdpServer::stop()
 {
     mEpoll->delEvent(shared_from_this(), EPOLLIN);
-    mProcessWorker->delTimer(mTimerID);
+    mProcessWorker->delTimer(mTimer);
+    mTimer.reset();
+}
+
+#define XX(cmd, response, type, extra, method) P2S_MESSAGE_STATIC_CHECK(cmd, response, type, extra, method)
+UDP_SERVER_MESSAGE_MAP(XX)
+#undef XX
+
+MessageResult UdpServer::dispatch(const FrameView &frame, Request &ctx, MessageInfo &info)
+{
+    P2S_MESSAGE_DISPATCH(UDP_SERVER_MESSAGE_MAP)
 }
 
 void UdpServer::onReadEvent()
 {
     LOGD("UdpServer::onReadEvent()");
-    P2S_Request req;
-    Peer_Info info;
     Address addr;
-    ProtocolParser parser;
-    ByteBuffer ret;
-    P2S_Response response;
-    std::shared_ptr<RedisPool::RedisAPI> redis = RedisManager::get()->getRedis();
-    response.statusCode = (uint16_t)P2PStatus::OK;
-    strcpy(response.msg, Status2String(P2PStatus::OK).c_str());
+    FrameView frame;
 
     while (true) {
         ByteBuffer buffer;
@@ -82,115 +85,94 @@ void UdpServer::onReadEvent()
         }
         LOGD("%s() recv: %s", __func__, log.c_str());
         
-        if (parser.parse(buffer) == false) {
+        if (ProtocolParser::ParseView(buffer.const_data(), buffer.size(), frame) == false) {
             LOGW("%s() ProtocolParser error from [%s:%d]", __func__, addr.getIP().c_str(), addr.getPort());
             break;
         }
 
-        ByteBuffer &data = parser.data();
         LOGD("%s() udp client [%s:%d] request flag 0x%04x", __func__,
-            addr.getIP().c_str(), addr.getPort(), parser.commnd());
-        switch (parser.commnd()) {
-        case P2S_REQUEST_SEND_PEER_INFO:    // 客户端想要建立udp连接，此时对端发送的应该是tcp回复的uuid
-        {
-            {
-                memcpy(&info, data.const_data(), data.size());
-                LOGD("uuid: %s", info.peer_uuid);
-                // 插入数据到client map
-                AutoLock<Mutex> lock(mMutex);
-                mUdpClientMap[info.peer_uuid] = std::make_pair(addr, Time::Abstime());
-            }
-            {
-                response.flag = P2S_RESPONSE_SEND_PEER_INFO;
-                String8 uuid = info.peer_uuid;
-                if (redis && redis->redisInterface()->isKeyExist(uuid)) { // 当键存在时
-                    redis->redisInterface()->hashSetFiledValue(uuid, "udphost", addr.getIP());
-                    redis->redisInterface()->hashSetFiledValue(uuid, "udpport", String8::format("%u", addr.getPort()));
-                } else {
-                    response.statusCode = (uint16_t)P2PStatus::NO_CONTENT;
-                    strcpy(response.msg, Status2String(P2PStatus::NO_CONTENT).c_str());
-                }
-                ret = ProtocolGenerator::generator(P2S_RESPONSE_SEND_PEER_INFO, (uint8_t *)&response, P2S_Response_Size);
-            }
-            break;
-        }
-        case P2S_REQUEST_HEARTBEAT_DETECT:
-        {
-            bool shouldResponse = false;
-            {
-                memcpy(&info, data.const_data(), data.size());
-                LOGD("uuid: %s", info.peer_uuid);
-
-                if (redis) {    // 先从redis检查key是否还存在
-                    if (redis->redisInterface()->isKeyExist(info.peer_uuid) == false) {
-                        mUdpClientMap.erase(info.peer_uuid);
-                    }
-                }
-                // 更新用户数据信息
-                AutoLock<Mutex> lock(mMutex);
-                const auto &it = mUdpClientMap.find(info.peer_uuid);
-                if (it != mUdpClientMap.end()) {
-                    mUdpClientMap[info.peer_uuid] = std::make_pair(addr, Time::Abstime());
-                    shouldResponse = true;
-                } else {
-                    response.statusCode = (uint16_t)P2PStatus::NO_CONTENT;
-                    strcpy(response.msg, Status2String(P2PStatus::NO_CONTENT).c_str());
-                }
-            }
-            if (shouldResponse) {
-                response.flag = P2S_RESPONSE_HEARTBEAT_DETECT;
-                String8 uuid = info.peer_uuid;
-                if (redis) {
-                    redis->redisInterface()->hashSetFiledValue(uuid, "udphost", addr.getIP());
-                    redis->redisInterface()->hashSetFiledValue(uuid, "udpport",
-                        String8::format("%u", addr.getPort()));
-                }
-                ret = ProtocolGenerator::generator(P2S_RESPONSE_HEARTBEAT_DETECT, (uint8_t *)&response, P2S_Response_Size);
-            }
-            break;
-        }
-        case P2S_REQUEST_CONNECT_TO_PEER:
-        {
-            // udp接收数据需要两个Peer_Info, 一个自己的，一个对端的
-            memcpy(&info, parser.data().const_data(), Peer_Info_Size);
-            String8 initiator_uuid = info.peer_uuid;
-            memcpy(&info, parser.data().const_data() + Peer_Info_Size, Peer_Info_Size);
-            String8 peer_uuid = info.peer_uuid;
-
-            sockaddr_in peer_addr;
-            sockaddr_in initiator_addr = addr.getsockaddr();
-            {
-                AutoLock<Mutex> lock(mMutex);
-                auto it = mUdpClientMap.find(peer_uuid);
-                if (it == mUdpClientMap.end()) {
-                    response.statusCode = (uint16_t)P2PStatus::NOT_FOUND;
-                    strcpy(response.msg, Status2String(P2PStatus::NOT_FOUND).c_str());
-                    ret = ProtocolGenerator::generator(P2S_RESPONSE_CONNECT_TO_PEER, (uint8_t *)&response, P2S_Response_Size);
-                    break;
-                }
-                peer_addr = it->second.first.getsockaddr();
-            }
-            onConnectToPeer(peer_uuid, &peer_addr, initiator_uuid, &initiator_addr);
-            break;
+            addr.getIP().c_str(), addr.getPort(), frame.commnd());
+        Request req;
+        MessageInfo info;
+        req.from = &addr;
+        memset(&req.response, 0, sizeof(P2S_Response));
+        req.response.statusCode = (uint16_t)P2PStatus::OK;
+        strcpy(req.response.msg, Status2String(P2PStatus::OK).c_str());
+        // 未知命令和长度不符的请求直接丢弃
+        if (dispatch(frame, req, info) != MessageResult::OK) {
+            LOGW("%s() drop request 0x%04x (%u bytes) from [%s:%d]", __func__, frame.commnd(),
+                frame.length(), addr.getIP().c_str(), addr.getPort());
+            continue;
         }
-        default:
-            break;
+        if (req.reply.payloadSize() == 0) {
+            continue;
         }
 
-        LOGD("%s() send buf size = %zu", __func__, ret.size());
+        const uint8_t *reply = req.reply.finish();
+        LOGD("%s() send buf size = %zu", __func__, req.reply.size());
         log.clear();
-        for (int i = 0; i < ret.size(); ++i) {
+        for (size_t i = 0; i < req.reply.size(); ++i) {
             if (i % 16 == 0) {
                 log.appendFormat("\n\t");
             }
-            log.appendFormat("0x%02x ", ret[i]);
+            log.appendFormat("0x%02x ", reply[i]);
         }
         LOGD("%s() send: %s", __func__, log.c_str());
-        Socket::sendto(ret, addr);
-        ret.clear();
+        Socket::sendto(reply, req.reply.size(), addr);
+    }
+}
+
+/**
+ * @brief 客户端想要建立udp连接，此时对端发送的应该是tcp回复的uuid
+ */
+void UdpServer::onRequestSendPeerInfo(const FrameView &frame, const Peer_Info &info, Request &req)
+{
+    String8 uuid(info.peer_uuid, strnlen(info.peer_uuid, UUID_SIZE));
+    LOGD("uuid: %s", uuid.c_str());
+    req.response.flag = P2S_RESPONSE_SEND_PEER_INFO;
+    if (!PeerManager::get()->updateUdp(uuid, req.from->getBigEndianIP(), req.from->getBigEndianPort())) {
+        req.response.statusCode = (uint16_t)P2PStatus::NO_CONTENT;  // 未通过tcp注册
+        strcpy(req.response.msg, Status2String(P2PStatus::NO_CONTENT).c_str());
+    }
+    req.reply.setCommand(P2S_RESPONSE_SEND_PEER_INFO);
+    req.reply.append(&req.response, P2S_Response_Size);
+}
+
+void UdpServer::onRequestHeartbeat(const FrameView &frame, const Peer_Info &info, Request &req)
+{
+    String8 uuid(info.peer_uuid, strnlen(info.peer_uuid, UUID_SIZE));
+    LOGD("uuid: %s", uuid.c_str());
+    // 更新udp地址和心跳时间, tcp会话已断开的peer不再存在, 不回复
+    req.response.flag = P2S_RESPONSE_HEARTBEAT_DETECT;
+    if (PeerManager::get()->updateUdp(uuid, req.from->getBigEndianIP(), req.from->getBigEndianPort())) {
+        req.reply.setCommand(P2S_RESPONSE_HEARTBEAT_DETECT);
+        req.reply.append(&req.response, P2S_Response_Size);
     }
 }
 
+void UdpServer::onRequestConnectToPeer(const FrameView &frame, const Peer_Connect &msg, Request &req)
+{
+    String8 initiator_uuid(msg.initiator.peer_uuid, strnlen(msg.initiator.peer_uuid, UUID_SIZE));
+    String8 peer_uuid(msg.target.peer_uuid, strnlen(msg.target.peer_uuid, UUID_SIZE));
+
+    sockaddr_in initiator_addr = req.from->getsockaddr();
+    PeerRecord peer;
+    if (!PeerManager::get()->find(peer_uuid, peer) || peer.udpPort == 0) {
+        req.response.flag = P2S_RESPONSE_CONNECT_TO_PEER;
+        req.response.statusCode = (uint16_t)P2PStatus::NOT_FOUND;
+        strcpy(req.response.msg, Status2String(P2PStatus::NOT_FOUND).c_str());
+        req.reply.setCommand(P2S_RESPONSE_CONNECT_TO_PEER);
+        req.reply.append(&req.response, P2S_Response_Size);
+        return;
+    }
+    sockaddr_in peer_addr;
+    memset(&peer_addr, 0, sizeof(peer_addr));
+    peer_addr.sin_family = AF_INET;
+    peer_addr.sin_addr.s_addr = peer.udpHost;
+    peer_addr.sin_port = peer.udpPort;
+    onConnectToPeer(peer_uuid, &peer_addr, initiator_uuid, &initiator_addr);
+}
+
 /**
  * @brief 从服务器拿到的IP:Port无法连接，需要借助服务器来连接
  *
@@ -215,21 +197,10 @@ bool UdpServer::onConnectToPeer(const String8 &peer_uuid, const sockaddr_in *pee
 
 void UdpServer::onTimerEvent()
 {
-    AutoLock<Mutex> lock(mMutex);
-    uint64_t currentTimeMS = Time::Abstime();
-    for (auto it = mUdpClientMap.begin(); it != mUdpClientMap.end();) {
-        if (it->second.second < (currentTimeMS - mDisconnectionTimeoutMS)) {    // 当超过3s未收到数据则认为其断开连接
-            auto redis = RedisManager::get()->getRedis();
-            if (redis && redis->redisInterface()->isKeyExist(it->first)) {
-                static const char *fields[] = { "udphost", "udpport" };
-                redis->redisInterface()->hashDelFileds(it->first, fields, 2);
-            } else {
-                LOGW("getRedis return null or uuid: \'%s\' is not exist!", it->first.c_str());
-            }
-            mUdpClientMap.erase(it++);
-            continue;
-        }
-        ++it;
+    // 当超过3s未收到数据则认为其断开连接, 清除其udp地址
+    uint32_t expired = PeerManager::get()->expireUdp(Clock::NowMs(), mDisconnectionTimeoutMS);
+    if (expired) {
+        LOGD("%u udp clients disconnected", expired);
     }
 }
 
@@ -12,12 +12,18 @@
 #include "socket.h"
 #include "epoll.h"
 #include "iomanager.h"
+#include "protocol/message.h"
 #include <utils/utils.h>
 #include <memory>
-#include <map>
 
 namespace eular {
 
+// XX(请求命令, 响应命令, 数据开头的结构体, 结构体之后可选数据的最大长度, 处理函数), 见protocol/message.h
+#define UDP_SERVER_MESSAGE_MAP(XX)                                                                                    \
+    XX(P2S_REQUEST_SEND_PEER_INFO,   P2S_RESPONSE_SEND_PEER_INFO,   Peer_Info,    0,  onRequestSendPeerInfo)   \
+    XX(P2S_REQUEST_HEARTBEAT_DETECT, P2S_RESPONSE_HEARTBEAT_DETECT, Peer_Info,    0,  onRequestHeartbeat)      \
+    XX(P2S_REQUEST_CONNECT_TO_PEER,  P2S_RESPONSE_CONNECT_TO_PEER,  Peer_Connect, 0,  onRequestConnectToPeer)  \
+
 class UdpServer : public Socket
 {
     DISALLOW_COPY_AND_ASSIGN(UdpServer);
@@ -34,15 +40,24 @@ public:
     void onTimerEvent();
 
 protected:
+    struct Request {
+        const Address * from;
+        P2S_Response    response;
+        FrameBuilder    reply;      // 没有数据时不回复
+    };
+    MessageResult dispatch(const FrameView &frame, Request &ctx, MessageInfo &info);
+
+    void onRequestSendPeerInfo(const FrameView &frame, const Peer_Info &info, Request &req);
+    void onRequestHeartbeat(const FrameView &frame, const Peer_Info &info, Request &req);
+    void onRequestConnectToPeer(const FrameView &frame, const Peer_Connect &msg, Request &req);
     bool onConnectToPeer(const String8 &peer_uuid, const sockaddr_in *addr, const String8 &initiator_uuid, const sockaddr_in *);
 
 protected:
     IOManager*  mIOWorker;
     IOManager*  mProcessWorker;
-    std::map<String8, std::pair<Address, uint64_t>>  mUdpClientMap; // uuid, address, 上次发送数据的时间 协助检测用户是否连接
-    Mutex       mMutex;                             // 保证mUdpClientMap的增删不冲突
     uint32_t    mDisconnectionTimeoutMS;            // 超过此时间未发送数据意味着断开连接
-    uint64_t    mTimerID;
+    uint32_t    mScanSlackMS;                       // 断线扫描定时器的slack
+    Timer::SP   mTimer;
     Epoll::SP   mEpoll;
 };
 
@@ -48,7 +48,8 @@ void P2PService::handle_client(Socket::SP client)
     P2PSession::SP session(new P2PSession(client));
     FdManager::get()->get(client->socket())->setUserNonblock(true);
 
-    if (mEpoll->addEvent(client, session, EPOLLIN) != true) {
+    // 可写事件用于发送socket写满时积压的响应和推送
+    if (mEpoll->addEvent(client, session, EPOLLIN | EPOLLOUT) != true) {
         LOGE("%s() add event to epoll failed.", __func__);
     }
 }
@@ -6,17 +6,31 @@
  ************************************************************************/
 
 #include "p2p_session.h"
-#include "db/redispool.h"
+#include "peer_registry.h"
+#include "protocol/compress.h"
+#include "iomanager.h"
+#include "config.h"
+#include "core/clock.h"
 #include <utils/buffer.h>
 #include <utils/mutex.h>
 #include <log/log.h>
+#include <sys/socket.h>
 
 #define LOG_TAG "P2PSession"
 
 namespace eular {
 
 P2PSession::P2PSession(Socket::SP sock) :
-    mRefresh(false)
+    mRefresh(false),
+    mDecoder(Config::Lookup<uint32_t>("tcp.max_frame_size", P2P_MAX_FRAME_SIZE)),
+    mCompressThreshold(Config::Lookup<uint32_t>("tcp.compress_threshold", 4096)),
+    mCompressLevel(Config::Lookup<uint32_t>("tcp.compress_level", 1)),
+    mMaxSendBuffer(Config::Lookup<uint32_t>("tcp.max_send_buffer", 1024 * 1024)),
+    mCapabilities(0),
+    mSubscriberId(0),
+    mSendOffset(0),
+    mPushWorker(nullptr),
+    mPushPending(false)
 {
     mClientSocket.swap(sock);
 }
@@ -29,20 +43,11 @@ P2PSession::~P2PSession()
 void P2PSession::onReadEvent(int fd)
 {
     LOGD("%s(%d)", __func__, fd);
-    P2S_Request req;
-    P2S_Response response;
-    ByteBuffer buffer;
-    ProtocolParser parser;
-
-    std::vector<Peer_Info> peerInfoVec;
-    std::shared_ptr<RedisPool::RedisAPI> redis = RedisManager::get()->getRedis();
+    FrameView frame;
+    ByteBuffer &buffer = mDecoder.buffer();     // 上次剩余的半帧之后追加本次读取的数据
 
     while (true) {
-        memset(&response, 0, sizeof(P2S_Response));
-        memset(&req, 0, sizeof(P2S_Request));
-        response.statusCode = (uint16_t)P2PStatus::OK;
-        strcpy(response.msg, Status2String(P2PStatus::OK).c_str());
-
+        size_t pending = buffer.size();
         int recvSize = mClientSocket->recv(buffer);
         LOGD("%s() %d recv size %d", __func__, fd, recvSize);
         if (recvSize <= 0) {
@@ -53,153 +58,559 @@ void P2PSession::onReadEvent(int fd)
         }
 
         String8 log;
-        for (int i = 0; i < buffer.size(); ++i) {
-            if (i % 16 == 0) {
+        for (size_t i = pending; i < buffer.size(); ++i) {
+            if ((i - pending) % 16 == 0) {
                 log.appendFormat("\n\t");
             }
             log.appendFormat("0x%02x ", buffer[i]);
         }
         LOGD("%s() recv: %s", __func__, log.c_str());
 
-        // FIXME: 当多个数据包到达时ProtocolParser只能解析出一个，之后的无法解析出
-        if (parser.parse(buffer) == false) {
+        // 一次读取可能包含多个帧, 也可能以半帧结尾
+        ProtocolDecoder::Status status;
+        while ((status = mDecoder.next(frame)) == ProtocolDecoder::FRAME_READY) {
+            onRequest(fd, frame);
+        }
+        if (status == ProtocolDecoder::FRAME_ERROR) {
+            LOGE("%s() client %d sent an invalid frame (max %u bytes), disconnect",
+                __func__, fd, mDecoder.maxFrameSize());
+            mDecoder.reset();
+            ::shutdown(fd, SHUT_RDWR);      // 由epoll收到EPOLLHUP后走正常的下线流程
             break;
         }
+    }
+}
 
-        ByteBuffer &data = parser.data();
-
-        const Address::SP &addr = mClientSocket->getRemoteAddr();
-        LOGD("%s() client %d [%s:%u] send request 0x%04x", __func__, fd, addr->getIP().c_str(), addr->getPort(), parser.commnd());
-        switch (parser.commnd()) {
-        case P2S_REQUEST_SEND_PEER_INFO:    // 客户端发送本机信息
-            {
-                // 本条命令接待的数据应该是Peer_Info
-                Peer_Info info;
-                memcpy(&info, data.const_data(), data.size());
-                response.flag = P2S_RESPONSE_SEND_PEER_INFO;
-                String8 name = info.peer_name;
-                mUUIDKey = String8::format("%s+%s", name.c_str(), addr->dump().c_str());
-                if (mRefresh && redis != nullptr) {
-                    redis->redisInterface()->delKey(mUuid.uuid());
-                }
-                mUuid.init(mUUIDKey);
-                mRefresh = true;
-                LOGD("client %d name %s key %s uuid: %s", fd, name.c_str(), mUUIDKey.c_str(), mUuid.uuid().c_str());
-                std::vector<std::pair<String8, String8>> fields;
-                fields.push_back(std::make_pair("name", name));
-                fields.push_back(std::make_pair("uidkey", mUUIDKey));
-                fields.push_back(std::make_pair("tcphost", addr->getIP()));
-                fields.push_back(std::make_pair("tcpport", String8::format("%u", addr->getPort())));
-
-                if (redis != nullptr) {
-                    if (redis->redisInterface()->hashCreateOrReplace(mUuid.uuid(), fields)) {
-                        response.statusCode = (uint16_t)P2PStatus::REDIS_SERVER_ERROR;  // redis错误
-                        strcpy(response.msg, Status2String(P2PStatus::REDIS_SERVER_ERROR).c_str());
-                    }
-                }
-                response.number = 1;
-                strcpy(info.peer_uuid, mUuid.uuid().c_str());
-                peerInfoVec.push_back(info);
-            }
-            break;
-        case P2S_REQUEST_GET_PEER_INFO:
-            {
-                Peer_Info peerInfo;
-                memcpy(&peerInfo, data.const_data(), data.size());
-                LOG_ASSERT2(mUuid.uuid() == peerInfo.peer_uuid);
-
-                response.flag = P2S_RESPONSE_GET_PEER_INFO;
-                std::vector<String8> uuidVec;
-                if (redis && redis->redisInterface()->getAllKeys(uuidVec)) { // 获取数据所有的键，数据库存错的键的类型都是哈希键
-                    response.statusCode = (uint16_t)P2PStatus::REDIS_SERVER_ERROR;
-                    strcpy(response.msg, Status2String(P2PStatus::REDIS_SERVER_ERROR).c_str());
-                }
-                std::map<String8, String8> fieldVal;
-                for (auto &uuid : uuidVec) {
-                    if (uuid == mUuid.uuid()) { // 排除自身
-                        continue;
-                    }
-                    if (redis && redis->redisInterface()->hashGetKeyAll(uuid, fieldVal) > 0) {
-                        Peer_Info info;
-                        auto name = fieldVal.find("name");
-                        auto udpIP = fieldVal.find("udphost");
-                        auto udpPort = fieldVal.find("udpport");
-                        if (name == fieldVal.end() ||
-                            udpIP == fieldVal.end() ||
-                            udpPort == fieldVal.end()) {
-                            continue;
-                        }
-                        info.host_binary = inet_addr(udpIP->second.c_str());
-                        uint32_t port;
-                        sscanf(udpPort->second.c_str(), "%u", &port);
-                        info.port_binary = htons(port);
-                        strcpy(info.peer_name, name->second.c_str());
-                        strcpy(info.peer_uuid, uuid.c_str());
-                        peerInfoVec.push_back(info);
+#define XX(cmd, response, type, extra, method) P2S_MESSAGE_STATIC_CHECK(cmd, response, type, extra, method)
+P2P_SESSION_MESSAGE_MAP(XX)
+#undef XX
+
+MessageResult P2PSession::dispatch(const FrameView &frame, Request &ctx, MessageInfo &info)
+{
+    P2S_MESSAGE_DISPATCH(P2P_SESSION_MESSAGE_MAP)
+}
+
+static size_t ReserveResponse(FrameBuilder &out, bool compact)
+{
+    return out.reserve(compact ? sizeof(P2S_Compact_Response) : sizeof(P2S_Response));
+}
+
+static void WriteResponse(FrameBuilder &out, size_t offset, const P2S_Response &response, bool compact)
+{
+    if (compact) {
+        P2S_Compact_Response *header = out.at<P2S_Compact_Response>(offset);
+        header->flag = response.flag;
+        header->statusCode = response.statusCode;
+        header->number = response.number;
+    } else {
+        memcpy(out.at<P2S_Response>(offset), &response, sizeof(P2S_Response));
+    }
+}
+
+static const uint8_t *PackFrame(FrameBuilder &out, FrameBuilder &packed, size_t &size,
+    const P2PSession::FrameFormat &format)
+{
+    const uint8_t *frame = out.finish();
+    size = out.size();
+    if ((format.capabilities & P2P_CAP_COMPRESS) && format.compressThreshold &&
+        out.payloadSize() >= format.compressThreshold) {
+        if (CompressFrame(out, packed, format.compressLevel)) {
+            LOGD("%s() compress %zu -> %zu bytes", __func__, out.payloadSize(), packed.payloadSize());
+            size = packed.size();
+            return packed.finish();
+        }
+    }
+    return frame;
+}
+
+/**
+ * @brief 处理一个请求帧. frame指向接收缓存, 只在本函数内有效
+ */
+void P2PSession::onRequest(int fd, const FrameView &frame)
+{
+    Request req;
+    req.fd = fd;
+    req.number = 0;
+    req.compact = mCapabilities & P2P_CAP_COMPACT_PEERS;
+    req.hello = false;
+    req.capabilities = 0;
+    req.subscribe = false;
+    req.resumed = false;
+    req.out.setCommand(P2S_RESPONSE);
+    size_t responseOffset = ReserveResponse(req.out, req.compact);     // 处理函数的数据追加在其后
+    memset(&req.response, 0, sizeof(P2S_Response));
+    req.response.statusCode = (uint16_t)P2PStatus::OK;
+    strcpy(req.response.msg, Status2String(P2PStatus::OK).c_str());
+
+    const Address::SP &addr = mClientSocket->getRemoteAddr();
+    LOGD("%s() client %d [%s:%u] send request 0x%04x", __func__, fd, addr->getIP().c_str(), addr->getPort(), frame.commnd());
+    MessageInfo info;
+    // 只有响应会压缩, 带压缩标志的请求按未知请求处理
+    MessageResult result = frame.flags() & P2P_FRAME_COMPRESSED ?
+        MessageResult::UNKNOWN_COMMAND : dispatch(frame, req, info);
+    switch (result) {
+    case MessageResult::OK:
+        req.response.flag = info.response;
+        break;
+    case MessageResult::BAD_LENGTH:
+        LOGW("%s() client %d request 0x%04x with %u bytes, expect [%u, %u]", __func__, fd,
+            frame.commnd(), frame.length(), info.minSize, info.maxSize);
+        req.response.flag = info.response;
+        req.response.statusCode = (uint16_t)P2PStatus::BAD_REQUEST;
+        strcpy(req.response.msg, Status2String(P2PStatus::BAD_REQUEST).c_str());
+        break;
+    default:
+        LOGW("unknow flag 0x%04x", frame.commnd());
+        req.response.statusCode = (uint16_t)P2PStatus::BAD_REQUEST;
+        strcpy(req.response.msg, Status2String(P2PStatus::BAD_REQUEST).c_str());
+        break;
+    }
+    if (req.cached) {
+        // 多个会话共用同一个缓冲区, 不复制
+        LOGD("%s() send cached peer list (%zu bytes) to client(%d)", __func__,
+            req.cached->frame.size(), mClientSocket->socket());
+        AutoLock<Mutex> lock(mSendMutex);
+        writeOut(req.cached->frame.data(), req.cached->frame.size());
+        return;
+    }
+    req.response.number = req.number;
+    WriteResponse(req.out, responseOffset, req.response, req.compact);
+
+    const uint8_t *retsult = req.out.finish();
+    size_t retsultSize = req.out.size();
+    String8 log;
+    for (size_t i = 0; i < retsultSize; ++i) {
+        if (i % 16 == 0) {
+            log.appendFormat("\n\t");
+        }
+        log.appendFormat("0x%02x ", retsult[i]);
+    }
+    LOGD("%s() send(%zu) to client(%d) peer_info %u: %s", __func__, 
+        retsultSize, mClientSocket->socket(), req.number, log.c_str());
+    {
+        AutoLock<Mutex> lock(mSendMutex);
+        if (req.subscribe) {
+            // 与响应在同一临界区内生效, 保证推送在订阅响应之后
+            mCursors = req.cursors;
+            if (mSubscriberId == 0) {
+                std::weak_ptr<P2PSession> weak = shared_from_this();
+                mPushWorker = IOManager::GetThis();
+                mSubscriberId = PeerManager::get()->subscribe([weak]() {
+                    P2PSession::SP session = weak.lock();
+                    if (session) {
+                        session->onPeerChanged();
                     }
-                }
-                response.number = peerInfoVec.size();
-            }
-            break;
-        case P2S_REQUEST_CONNECT_TO_PEER:
-            {
-                // TODO: 将对端想要连接的uuid相关信息从redis拿出来，并告知此客户端有人想要与其建立连接
-                // 通过拿到的udp信息告知其有客户端想要连接
-                response.flag = P2S_RESPONSE_CONNECT_TO_PEER;
-                response.number = 0;
+                });
             }
-            break;
-        default:
-            LOGW("unknow flag 0x%04x", parser.commnd());
-            break;
         }
+        sendFrame(req.out);
+        if (req.hello) {
+            mCapabilities = req.capabilities;
+        }
+    }
+    if (req.resumed) {
+        onPeerChanged();    // 推送断线期间的变更
+    }
+}
 
-        ByteBuffer temp;
-        temp.append((uint8_t *)&response, sizeof(P2S_Response));
-        temp.append((uint8_t *)&peerInfoVec[0], sizeof(Peer_Info) * peerInfoVec.size());
-        ByteBuffer retsult = ProtocolGenerator::generator(P2S_RESPONSE, temp);
-        log.clear();
-        for (int i = 0; i < retsult.size(); ++i) {
-            if (i % 16 == 0) {
-                log.appendFormat("\n\t");
-            }
-            log.appendFormat("0x%02x ", retsult[i]);
+/**
+ * @brief 客户端发送本机信息
+ */
+void P2PSession::onRequestSendPeerInfo(const FrameView &frame, const Peer_Info &info, Request &req)
+{
+    const Address::SP &addr = mClientSocket->getRemoteAddr();
+    String8 name(info.peer_name, strnlen(info.peer_name, PEER_NAME_SIZE - 1));   // 与注册表和下发的名字同样截断
+    mUUIDKey = String8::format("%s+%s", name.c_str(), addr->dump().c_str());
+    mPeerName = name;
+    if (mRefresh) {
+        PeerManager::get()->removePeer(mUuid.uuid());
+    }
+    mUuid.init(mUUIDKey);
+    mRefresh = true;
+    LOGD("client %d name %s key %s uuid: %s", req.fd, name.c_str(), mUUIDKey.c_str(), mUuid.uuid().c_str());
+
+    PeerRecord record;
+    record.name = name;
+    record.uidKey = mUUIDKey;
+    record.tcpHost = addr->getBigEndianIP();
+    record.tcpPort = addr->getBigEndianPort();
+    record.lastSeenMs = Clock::NowMs();
+    PeerManager::get()->registerPeer(mUuid.uuid(), record);
+
+    // 回填uuid
+    Peer_Info reply = info;
+    reply.peer_name[PEER_NAME_SIZE - 1] = '\0';
+    strcpy(reply.peer_uuid, mUuid.uuid().c_str());
+    if (req.compact) {
+        CompactPeerWriter(req.out).append(reply);
+    } else {
+        req.out.append(&reply, Peer_Info_Size);
+    }
+    req.number = 1;
+}
+
+void P2PSession::onRequestGetPeerInfo(const FrameView &frame, const Peer_Info &info, Request &req)
+{
+    if (strncmp(mUuid.uuid().c_str(), info.peer_uuid, UUID_SIZE) != 0) {
+        // 请求中的uuid来自客户端, 与本会话注册的不一致时拒绝, 不能断言
+        LOGW("%s() client %d uuid %.*s mismatch %s", __func__, req.fd, UUID_SIZE, info.peer_uuid,
+            mUuid.uuid().c_str());
+        req.response.statusCode = (uint16_t)P2PStatus::FORBIDDEN;
+        strcpy(req.response.msg, Status2String(P2PStatus::FORBIDDEN).c_str());
+        return;
+    }
+
+    PeerQuery query;
+    const Peer_Query *peerQuery = frame.get<Peer_Query>(Peer_Info_Size);
+    if (peerQuery) {
+        query.cursorName = String8(peerQuery->cursor_name, strnlen(peerQuery->cursor_name, PEER_NAME_SIZE - 1));
+        query.cursorUuid = String8(peerQuery->cursor_uuid, strnlen(peerQuery->cursor_uuid, UUID_SIZE));
+        query.namePrefix = String8(peerQuery->name_prefix, strnlen(peerQuery->name_prefix, PEER_NAME_SIZE - 1));
+        query.udpOnly = peerQuery->flags & PEER_QUERY_UDP_ONLY;
+        query.maxCount = peerQuery->max_count;
+    }
+    if (PeerCache::get()->enabled() && findCachedPeers(query, req)) {
+        return;
+    }
+
+    // 排除自身; 一页最多registry.page_limit个, 原格式直接写入响应帧, 紧凑编码先暂存再逐个编码
+    PeerRegistry *registry = PeerManager::get();
+    bool more = false;
+    if (req.compact) {
+        mListScratch.resize(registry->pageLimit());
+        more = registry->list(query, mUuid.uuid(), mListScratch.data(), req.number);
+        CompactPeerWriter writer(req.out);
+        for (uint32_t i = 0; i < req.number; ++i) {
+            writer.append(mListScratch[i]);
+        }
+    } else {
+        size_t offset = req.out.reserve(sizeof(Peer_Info) * registry->pageLimit());
+        more = registry->list(query, mUuid.uuid(), req.out.at<Peer_Info>(offset), req.number);
+        req.out.truncate(offset + sizeof(Peer_Info) * req.number);
+    }
+    if (more) {
+        req.response.statusCode = (uint16_t)P2PStatus::PARTIAL_CONTENT;
+        strcpy(req.response.msg, Status2String(P2PStatus::PARTIAL_CONTENT).c_str());
+    }
+}
+
+bool P2PSession::findCachedPeers(const PeerQuery &query, Request &req)
+{
+    req.cached = FindSharedPage(query, mPeerName, mUuid.uuid(), frameFormat(), mListScratch);
+    return req.cached != nullptr;
+}
+
+P2PSession::FrameFormat P2PSession::frameFormat() const
+{
+    FrameFormat format;
+    format.capabilities = mCapabilities;
+    format.compressThreshold = mCompressThreshold;
+    format.compressLevel = mCompressLevel;
+    return format;
+}
+
+PeerListCache::EntrySP P2PSession::FindSharedPage(const PeerQuery &query, const String8 &name,
+    const String8 &uuid, const FrameFormat &format, std::vector<Peer_Info> &scratch)
+{
+    PeerRegistry *registry = PeerManager::get();
+    PeerListCache *cache = PeerCache::get();
+    // 响应的编码和是否压缩只取决于协商的能力, 压缩阈值和级别对所有会话相同
+    uint32_t capabilities = format.capabilities & (P2P_CAP_COMPACT_PEERS | P2P_CAP_COMPRESS);
+    std::string key = PeerListCache::MakeKey(query, registry->pageLimit(), capabilities);
+    uint64_t generation = registry->generation();
+    PeerListCache::EntrySP cached;
+    switch (cache->find(generation, key, name, uuid, cached)) {
+    case PeerListCache::HIT:
+        return cached;
+    case PeerListCache::BYPASS:
+        return nullptr;
+    default:
+        break;
+    }
+
+    PeerListCache::EntrySP entry = BuildSharedPage(query, format, scratch);
+    // 生成期间peer表有变化时结果不一定对应generation, 只用于本次请求
+    if (registry->generation() == generation) {
+        cache->store(generation, key, entry);
+    }
+    return entry->contains(name, uuid) ? nullptr : entry;
+}
+
+std::shared_ptr<PeerListCache::Entry> P2PSession::BuildSharedPage(const PeerQuery &query,
+    const FrameFormat &format, std::vector<Peer_Info> &scratch)
+{
+    // 取不排除任何peer的一页, 再取其后的一个, 确定这一页对哪些请求者相同
+    PeerRegistry *registry = PeerManager::get();
+    std::shared_ptr<PeerListCache::Entry> entry = std::make_shared<PeerListCache::Entry>();
+    uint32_t count = 0;
+    scratch.resize(registry->pageLimit() + 1);
+    registry->list(query, String8(), scratch.data(), count);
+    uint32_t total = count;
+    if (count > 0) {
+        PeerQuery next = query;
+        next.cursorName = scratch[count - 1].peer_name;
+        next.cursorUuid = scratch[count - 1].peer_uuid;
+        next.maxCount = 1;
+        uint32_t lookahead = 0;
+        registry->list(next, String8(), &scratch[count], lookahead);
+        total += lookahead;
+
+        // 与注册表的索引键相同, 都是截断后的名字
+        entry->empty = false;
+        entry->firstName = scratch[0].peer_name;
+        entry->firstUuid = scratch[0].peer_uuid;
+        entry->lastName = scratch[total - 1].peer_name;
+        entry->lastUuid = scratch[total - 1].peer_uuid;
+    }
+
+    P2S_Response response;
+    memset(&response, 0, sizeof(P2S_Response));
+    response.flag = P2S_RESPONSE_GET_PEER_INFO;
+    response.number = count;
+    P2PStatus status = total > count ? P2PStatus::PARTIAL_CONTENT : P2PStatus::OK;
+    response.statusCode = (uint16_t)status;
+    strcpy(response.msg, Status2String(status).c_str());
+
+    bool compact = format.capabilities & P2P_CAP_COMPACT_PEERS;
+    FrameBuilder out(P2S_RESPONSE), packed;
+    size_t responseOffset = ReserveResponse(out, compact);
+    if (compact) {
+        CompactPeerWriter writer(out);
+        for (uint32_t i = 0; i < count; ++i) {
+            writer.append(scratch[i]);
         }
-        LOGD("%s() send(%d) to client(%d) peer_info %zu: %s", __func__, 
-            retsult.size(), mClientSocket->socket(), peerInfoVec.size(), log.c_str());
-        mClientSocket->send(retsult);
+    } else {
+        out.append(scratch.data(), sizeof(Peer_Info) * count);
+    }
+    WriteResponse(out, responseOffset, response, compact);
+    size_t size = 0;
+    const uint8_t *frame = PackFrame(out, packed, size, format);
+    entry->frame.assign(frame, frame + size);
+    return entry;
+}
 
-        peerInfoVec.clear();
+void P2PSession::onRequestConnectToPeer(const FrameView &frame, const Peer_Connect &msg, Request &req)
+{
+    // TODO: 将对端想要连接的uuid相关信息从redis拿出来，并告知此客户端有人想要与其建立连接
+    // 通过拿到的udp信息告知其有客户端想要连接
+}
+
+void P2PSession::onRequestSubscribePeers(const FrameView &frame, const Peer_Info &info, Request &req)
+{
+    req.subscribe = true;
+    req.resumed = parseSubscribe(frame, req.cursors);
+    if (!req.resumed) {
+        req.response.statusCode = (uint16_t)P2PStatus::RESET_CONTENT;
+        strcpy(req.response.msg, Status2String(P2PStatus::RESET_CONTENT).c_str());
+    }
+
+    Peer_Subscribe sub;
+    sub.epoch = PeerManager::get()->epoch();
+    sub.shard_count = req.cursors.size();
+    req.out.append(&sub, sizeof(Peer_Subscribe));
+    req.out.append(req.cursors.data(), sizeof(uint64_t) * req.cursors.size());
+}
+
+void P2PSession::onRequestHello(const FrameView &frame, const Peer_Hello &hello, Request &req)
+{
+    LOGD("%s() client %d version %u capabilities 0x%08x", __func__, req.fd, hello.version, hello.capabilities);
+    Peer_Hello reply;
+    reply.version = P2P_PROTOCOL_VERSION;
+    reply.capabilities = hello.capabilities & P2P_CAP_SUPPORTED;
+    if (mCompressThreshold == 0) {
+        reply.capabilities &= ~P2P_CAP_COMPRESS;
     }
+    req.out.append(&reply, Peer_Hello_Size);
+    req.hello = true;
+    req.capabilities = reply.capabilities;
 }
 
 void P2PSession::onWritEvent(int fd)
 {
     LOGD("%s()", __func__);
+    AutoLock<Mutex> lock(mSendMutex);
+    if (mSendOffset == mSendBuffer.size()) {
+        return;
+    }
+    mSendOffset += sendSome(mSendBuffer.data() + mSendOffset, mSendBuffer.size() - mSendOffset);
+    if (mSendOffset == mSendBuffer.size()) {
+        mSendBuffer.clear();
+        mSendOffset = 0;
+    }
 }
 
 void P2PSession::onShutdown()
 {
-    // 将uuid从redis移除
-    std::shared_ptr<RedisPool::RedisAPI> redis = RedisManager::get()->getRedis();
-    if (redis) {
-        redis->redisInterface()->delKey(mUuid.uuid());
+    {
+        AutoLock<Mutex> lock(mSendMutex);
+        if (mSubscriberId) {
+            PeerManager::get()->unsubscribe(mSubscriberId);
+            mSubscriberId = 0;
+        }
+    }
+    if (mRefresh) {
+        PeerManager::get()->removePeer(mUuid.uuid());
+    }
+}
+
+bool P2PSession::parseSubscribe(const FrameView &frame, std::vector<uint64_t> &cursors)
+{
+    PeerRegistry *registry = PeerManager::get();
+    const Peer_Subscribe *sub = frame.get<Peer_Subscribe>(Peer_Info_Size);
+    if (sub != nullptr) {
+        size_t need = Peer_Info_Size + Peer_Subscribe_Size + sizeof(uint64_t) * sub->shard_count;
+        if (sub->epoch == registry->epoch() && sub->shard_count == registry->shardCount() && frame.length() >= need) {
+            cursors.resize(sub->shard_count);
+            memcpy(cursors.data(), frame.data() + Peer_Info_Size + Peer_Subscribe_Size,
+                sizeof(uint64_t) * sub->shard_count);
+            // 只检查序号是否仍在变更记录内, 不读取
+            std::vector<uint64_t> probe = cursors;
+            std::vector<Peer_Change> none;
+            if (registry->readChanges(probe, none, 0)) {
+                return true;
+            }
+        }
     }
+
+    registry->currentSeqs(cursors);
+    return false;
 }
 
-void P2PSession::onRequestSendPeerInfo(const P2S_Request &req)
+/**
+ * @brief 由修改peer表的线程调用, 只调度推送任务
+ */
+void P2PSession::onPeerChanged()
 {
+    if (mPushPending.exchange(true) == false) {
+        mPushWorker->schedule(std::bind(&P2PSession::flushPeerChanges, shared_from_this()));
+    }
+}
+
+void P2PSession::flushPeerChanges()
+{
+    mPushPending = false;   // 先清除, 读取之后的变更会再调度一次
+
+    PeerRegistry *registry = PeerManager::get();
+    P2S_Response response;
+    memset(&response, 0, sizeof(P2S_Response));
+    response.flag = P2S_RESPONSE_PEER_CHANGE;
+    response.statusCode = (uint16_t)P2PStatus::OK;
+    strcpy(response.msg, Status2String(P2PStatus::OK).c_str());
+
+    AutoLock<Mutex> lock(mSendMutex);
+    if (mSubscriberId == 0) {
+        return;
+    }
+    mPushChanges.clear();
+    if (!registry->readChanges(mCursors, mPushChanges, registry->pageLimit())) {
+        // 推送落后超过registry.changelog_size, 取消订阅并通知客户端重新订阅
+        LOGW("%s() client %d subscription fell behind change log", __func__, mClientSocket->socket());
+        registry->unsubscribe(mSubscriberId);
+        mSubscriberId = 0;
+        response.statusCode = (uint16_t)P2PStatus::RESET_CONTENT;
+        strcpy(response.msg, Status2String(P2PStatus::RESET_CONTENT).c_str());
+    } else if (mPushChanges.size() == registry->pageLimit()) {
+        onPeerChanged();    // 一帧最多registry.page_limit个, 剩余的下次推送
+    }
+
+    bool compact = mCapabilities & P2P_CAP_COMPACT_PEERS;
+    FrameBuilder out(P2S_RESPONSE);
+    size_t responseOffset = ReserveResponse(out, compact);
+    CompactPeerWriter writer(out);
+    const String8 &self = mUuid.uuid();
+    for (const Peer_Change &change : mPushChanges) {
+        if (strcmp(self.c_str(), change.peer_info.peer_uuid) == 0) {    // 不推送自身的变更
+            continue;
+        }
+        if (compact) {
+            writer.append(change);
+        } else {
+            out.append(&change, sizeof(Peer_Change));
+        }
+        ++response.number;
+    }
+    if (response.number == 0 && response.statusCode == (uint16_t)P2PStatus::OK) {
+        return;
+    }
 
+    WriteResponse(out, responseOffset, response, compact);
+    sendFrame(out);
 }
 
-void P2PSession::onRequestGetPeerInfo(const P2S_Request &req)
+const uint8_t *P2PSession::packFrame(FrameBuilder &out, FrameBuilder &packed, size_t &size) const
 {
+    return PackFrame(out, packed, size, frameFormat());
+}
 
+void P2PSession::sendFrame(FrameBuilder &out)
+{
+    FrameBuilder packed;
+    size_t size = 0;
+    const uint8_t *frame = packFrame(out, packed, size);
+    writeOut(frame, size);
 }
 
-void P2PSession::onRequestConnectToPeer(const P2S_Request &req)
+void P2PSession::writeOut(const uint8_t *data, size_t size)
 {
+    if (mSendOffset == mSendBuffer.size()) {    // 有积压时须排在其后, 保证帧不交错
+        size_t sent = sendSome(data, size);
+        data += sent;
+        size -= sent;
+        if (size == 0) {
+            return;
+        }
+    }
+
+    size_t backlog = mSendBuffer.size() - mSendOffset + size;
+    if (backlog > (size_t)mMaxSendBuffer * 2) {
+        LOGW("%s() client %d %zu bytes not sent, disconnect", __func__, mClientSocket->socket(), backlog);
+        mSendBuffer.clear();
+        mSendOffset = 0;
+        ::shutdown(mClientSocket->socket(), SHUT_RDWR);     // 由epoll收到EPOLLHUP后走正常的下线流程
+        return;
+    }
+    if (mSendOffset > mSendBuffer.size() / 2) {     // 已发出的部分过半时再移动, 分摊拷贝开销
+        mSendBuffer.erase(mSendBuffer.begin(), mSendBuffer.begin() + mSendOffset);
+        mSendOffset = 0;
+    }
+    mSendBuffer.insert(mSendBuffer.end(), data, data + size);
+
+    if (backlog > mMaxSendBuffer && mSubscriberId) {
+        // 积压主要来自推送: 取消订阅, 客户端收到RESET_CONTENT后重新订阅
+        LOGW("%s() client %d %zu bytes not sent, drop subscription", __func__, mClientSocket->socket(), backlog);
+        PeerManager::get()->unsubscribe(mSubscriberId);
+        mSubscriberId = 0;
 
+        bool compact = mCapabilities & P2P_CAP_COMPACT_PEERS;
+        P2S_Response response;
+        memset(&response, 0, sizeof(P2S_Response));
+        response.flag = P2S_RESPONSE_PEER_CHANGE;
+        response.statusCode = (uint16_t)P2PStatus::RESET_CONTENT;
+        strcpy(response.msg, Status2String(P2PStatus::RESET_CONTENT).c_str());
+        FrameBuilder out(P2S_RESPONSE);
+        WriteResponse(out, ReserveResponse(out, compact), response, compact);
+        const uint8_t *frame = out.finish();
+        mSendBuffer.insert(mSendBuffer.end(), frame, frame + out.size());
+    }
+}
+
+size_t P2PSession::sendSome(const uint8_t *data, size_t size)
+{
+    size_t sent = 0;
+    while (sent < size) {
+        int n = mClientSocket->send(data + sent, size - sent);
+        if (n > 0) {
+            sent += n;
+        } else if (n < 0 && errno == EINTR) {
+            continue;
+        } else if (n < 0 && errno == EAGAIN) {
+            break;
+        } else {
+            LOGE("%s() client %d send error. [%d, %s]", __func__, mClientSocket->socket(), errno, strerror(errno));
+            return size;
+        }
+    }
+    return sent;
 }
 
 } // namespace eular
@@ -9,17 +9,31 @@
 #define __EULAR_P2P_P2P_SESSION_H__
 
 #include "protocol/protocol.h"
+#include "protocol/message.h"
 #include "net/socket.h"
 #include "session.h"
+#include "peer_cache.h"
 #include "util/uuid.h"
+#include <utils/mutex.h>
+#include <atomic>
+#include <vector>
 
 namespace eular {
+class IOManager;
+
+// XX(请求命令, 响应命令, 数据开头的结构体, 结构体之后可选数据的最大长度, 处理函数), 见protocol/message.h
+#define P2P_SESSION_MESSAGE_MAP(XX)                                                                                    \
+    XX(P2S_REQUEST_SEND_PEER_INFO,  P2S_RESPONSE_SEND_PEER_INFO,  Peer_Info,    0,                  onRequestSendPeerInfo)   \
+    XX(P2S_REQUEST_GET_PEER_INFO,   P2S_RESPONSE_GET_PEER_INFO,   Peer_Info,    Peer_Query_Size,    onRequestGetPeerInfo)    \
+    XX(P2S_REQUEST_CONNECT_TO_PEER, P2S_RESPONSE_CONNECT_TO_PEER, Peer_Connect, 0,                  onRequestConnectToPeer)  \
+    XX(P2S_REQUEST_SUBSCRIBE_PEERS, P2S_RESPONSE_SUBSCRIBE_PEERS, Peer_Info,    P2P_MAX_FRAME_SIZE, onRequestSubscribePeers) \
+    XX(P2S_REQUEST_HELLO,           P2S_RESPONSE_HELLO,           Peer_Hello,   0,                  onRequestHello)          \
 
 /**
  * @brief peer连接后为其分配一个session，用于处理请求
  * 
  */
-class P2PSession : public Session
+class P2PSession : public Session, public std::enable_shared_from_this<P2PSession>
 {
 public:
     typedef std::shared_ptr<P2PSession> SP;
@@ -31,16 +45,123 @@ public:
     virtual void onWritEvent(int fd) override;
     virtual void onShutdown() override;
 
+    /**
+     * @brief 响应的编码方式, 由协商的能力和tcp.compress_*决定
+     */
+    struct FrameFormat {
+        uint32_t    capabilities = 0;       // P2P_CAP_COMPACT_PEERS | P2P_CAP_COMPRESS
+        uint32_t    compressThreshold = 0;  // 数据不小于此值时压缩, 0表示不压缩
+        uint32_t    compressLevel = 1;
+    };
+
+    /**
+     * @brief 生成不排除任何peer的一页GET_PEER_INFO响应, 并记录本页加其后一个peer的(name, uuid)范围.
+     * 范围之外的请求者排除自身后的结果与之相同, 可以共用这个响应帧
+     *
+     * @param scratch 暂存一页结果, 复用容量
+     */
+    static std::shared_ptr<PeerListCache::Entry> BuildSharedPage(const PeerQuery &query,
+        const FrameFormat &format, std::vector<Peer_Info> &scratch);
+
+    /**
+     * @brief 从缓存取GET_PEER_INFO的响应, 未命中时用BuildSharedPage生成, peer表在生成期间未变化时缓存
+     *
+     * @param name, uuid 请求者自身
+     * @return 请求者在这一页的范围内时返回nullptr, 由调用者生成排除自身的响应
+     */
+    static PeerListCache::EntrySP FindSharedPage(const PeerQuery &query, const String8 &name,
+        const String8 &uuid, const FrameFormat &format, std::vector<Peer_Info> &scratch);
+
 protected:
-    void onRequestSendPeerInfo(const P2S_Request &req);
-    void onRequestGetPeerInfo(const P2S_Request &req);
-    void onRequestConnectToPeer(const P2S_Request &req);
+    /**
+     * @brief 一个请求的处理结果, 由处理函数填写后统一编码发送
+     */
+    struct Request {
+        int                     fd;
+        P2S_Response            response;       // 处理完成后写入out中预留的位置, 紧凑编码时只写状态码
+        FrameBuilder            out;            // 处理函数把响应数据直接追加在其中
+        uint32_t                number;         // 响应中Peer_Info的数量
+        bool                    compact;        // 响应按P2P_CAP_COMPACT_PEERS编码
+        bool                    hello;          // 协商的能力在发送握手响应后生效
+        uint32_t                capabilities;
+        PeerListCache::EntrySP  cached;         // 不为空时直接发送缓存的响应帧, 忽略out
+        bool                    subscribe;      // 订阅的起始序号在发送时生效
+        bool                    resumed;
+        std::vector<uint64_t>   cursors;
+    };
+    MessageResult dispatch(const FrameView &frame, Request &ctx, MessageInfo &info);
+
+    void onRequest(int fd, const FrameView &frame);
+    void onRequestSendPeerInfo(const FrameView &frame, const Peer_Info &info, Request &req);
+    void onRequestGetPeerInfo(const FrameView &frame, const Peer_Info &info, Request &req);
+    void onRequestConnectToPeer(const FrameView &frame, const Peer_Connect &msg, Request &req);
+    void onRequestSubscribePeers(const FrameView &frame, const Peer_Info &info, Request &req);
+    void onRequestHello(const FrameView &frame, const Peer_Hello &hello, Request &req);
+
+    /**
+     * @brief 按本会话的编码方式调用FindSharedPage, 结果放在req.cached
+     *
+     * @return 请求者在这一页的范围内时返回false, 由调用者生成排除自身的响应
+     */
+    bool findCachedPeers(const PeerQuery &query, Request &req);
+    FrameFormat frameFormat() const;
+
+    /**
+     * @brief 解析订阅请求中的序号, 无法续传时取当前序号
+     *
+     * @return 是否从客户端给出的序号续传
+     */
+    bool parseSubscribe(const FrameView &frame, std::vector<uint64_t> &cursors);
+    void onPeerChanged();
+    void flushPeerChanges();
+
+    /**
+     * @brief 完成帧并按协商的能力决定是否压缩
+     *
+     * @param packed 压缩时的输出
+     * @return 要发送的帧, 长度为size
+     */
+    const uint8_t *packFrame(FrameBuilder &out, FrameBuilder &packed, size_t &size) const;
+
+    /**
+     * @brief 同上并发送, 须持有mSendMutex
+     */
+    void sendFrame(FrameBuilder &out);
+
+    /**
+     * @brief 发送数据, 须持有mSendMutex. socket写满时剩余部分存入mSendBuffer, 在可写事件中继续发送;
+     * 积压超过tcp.max_send_buffer时取消订阅并推送RESET_CONTENT, 超过两倍时断开连接
+     */
+    void writeOut(const uint8_t *data, size_t size);
+
+    /**
+     * @brief 一直发送到写满为止, 须持有mSendMutex
+     *
+     * @return 已发出的字节数, 连接出错时视为全部发出(由断开事件清理会话)
+     */
+    size_t sendSome(const uint8_t *data, size_t size);
 
 protected:
     Socket::SP  mClientSocket;
     String8     mUUIDKey;
     UUID        mUuid;
+    String8     mPeerName;
     bool        mRefresh;   // 如果uuid不是第一次创建，则此值为true
+    ProtocolDecoder mDecoder;       // 只在onReadEvent中使用, 同一fd的读事件不会并发
+    std::vector<Peer_Info> mListScratch;    // 紧凑编码时暂存一页结果, 同上只在读事件中使用
+    uint32_t    mCompressThreshold; // 协商了P2P_CAP_COMPRESS后, 数据不小于此值的响应压缩发送, 0表示不压缩
+    uint32_t    mCompressLevel;     // LZ4加速系数, 越大越快压缩率越低
+    uint32_t    mMaxSendBuffer;     // tcp.max_send_buffer, 未发出数据的上限
+
+    Mutex       mSendMutex;         // 请求响应和变更推送可能在不同线程发送, 保证帧不交错且推送按序号顺序
+    uint32_t    mCapabilities;      // 协商的P2P_CAP_*, 只在读事件中修改, 修改和推送时的读取由mSendMutex保护
+    uint64_t    mSubscriberId;      // 0表示未订阅, 由mSendMutex保护
+    std::vector<uint64_t> mCursors; // 各分片已推送的序号, 由mSendMutex保护
+    std::vector<Peer_Change> mPushChanges;  // 推送时读取变更用, 由mSendMutex保护, 复用容量
+    std::vector<uint8_t> mSendBuffer;   // socket写满后未发出的数据, 由mSendMutex保护
+    size_t      mSendOffset;        // mSendBuffer中已发出的字节数
+    IOManager * mPushWorker;
+    std::atomic<bool> mPushPending; // 已有推送任务在途, 多次变更合并为一次推送
 };
 
 } // namespace eular
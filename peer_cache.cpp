@@ -0,0 +1,125 @@
+/*************************************************************************
+    > File Name: peer_cache.cpp
+    > Author: hsz
+    > Brief:
+    > Created Time: Sun 18 Oct 2026 06:40:16 AM CST
+ ************************************************************************/
+
+#include "peer_cache.h"
+#include "config.h"
+#include <log/log.h>
+#include <string.h>
+
+#define LOG_TAG "PeerCache"
+
+namespace eular {
+
+// 与PeerRegistry的索引顺序一致: 先name后uuid, 按字节比较.
+// 名字只比较前PEER_NAME_SIZE - 1个字符, 与注册表和Peer_Info中截断后的名字一致
+static int CompareKey(const String8 &name, const String8 &uuid, const String8 &otherName, const String8 &otherUuid)
+{
+    int ret = strncmp(name.c_str(), otherName.c_str(), PEER_NAME_SIZE - 1);
+    return ret ? ret : strcmp(uuid.c_str(), otherUuid.c_str());
+}
+
+bool PeerListCache::Entry::contains(const String8 &name, const String8 &uuid) const
+{
+    return !empty && CompareKey(name, uuid, firstName, firstUuid) >= 0 &&
+        CompareKey(name, uuid, lastName, lastUuid) <= 0;
+}
+
+PeerListCache::PeerListCache() :
+    mGeneration(0),
+    mHits(0),
+    mMisses(0),
+    mBypassed(0),
+    mStored(0),
+    mInvalidations(0)
+{
+    mCapacity = Config::Lookup<uint32_t>("registry.list_cache_size", 1024);
+    LOGD("peer list cache size %u", mCapacity);
+}
+
+std::string PeerListCache::MakeKey(const PeerQuery &query, uint32_t pageLimit, uint32_t format)
+{
+    uint32_t maxCount = query.maxCount;
+    if (maxCount == 0 || maxCount > pageLimit) {
+        maxCount = pageLimit;
+    }
+
+    // 字符串字段不含'\0', 用作分隔
+    std::string key;
+    key.reserve(sizeof(uint32_t) * 2 + 1 + query.cursorName.length() + query.cursorUuid.length() +
+        query.namePrefix.length() + 2);
+    key.append((const char *)&format, sizeof(format));
+    key.append((const char *)&maxCount, sizeof(maxCount));
+    key.push_back(query.udpOnly ? '1' : '0');
+    key.append(query.cursorName.c_str(), query.cursorName.length());
+    key.push_back('\0');
+    key.append(query.cursorUuid.c_str(), query.cursorUuid.length());
+    key.push_back('\0');
+    key.append(query.namePrefix.c_str(), query.namePrefix.length());
+    return key;
+}
+
+PeerListCache::Result PeerListCache::find(uint64_t generation, const std::string &key,
+    const String8 &name, const String8 &uuid, EntrySP &entry)
+{
+    {
+        RDAutoLock<RWMutex> rdlock(mMutex);
+        if (generation == mGeneration) {
+            auto it = mEntries.find(key);
+            if (it != mEntries.end()) {
+                entry = it->second;
+            }
+        }
+    }
+
+    if (!entry) {
+        mMisses.fetch_add(1, std::memory_order_relaxed);
+        return MISS;
+    }
+    if (entry->contains(name, uuid)) {
+        entry.reset();
+        mBypassed.fetch_add(1, std::memory_order_relaxed);
+        return BYPASS;
+    }
+    mHits.fetch_add(1, std::memory_order_relaxed);
+    return HIT;
+}
+
+void PeerListCache::store(uint64_t generation, const std::string &key, const EntrySP &entry)
+{
+    if (mCapacity == 0) {
+        return;
+    }
+    WRAutoLock<RWMutex> wrlock(mMutex);
+    if (generation < mGeneration) {
+        return;     // 生成期间已有更新的结果
+    }
+    if (generation > mGeneration) {
+        if (!mEntries.empty()) {
+            mInvalidations.fetch_add(1, std::memory_order_relaxed);
+        }
+        mEntries.clear();
+        mGeneration = generation;
+    }
+    if (mEntries.size() >= mCapacity && mEntries.find(key) == mEntries.end()) {
+        mEntries.erase(mEntries.begin());
+    }
+    mEntries[key] = entry;
+    mStored.fetch_add(1, std::memory_order_relaxed);
+}
+
+PeerListCache::Stats PeerListCache::getStats() const
+{
+    Stats stats;
+    stats.hits = mHits.load(std::memory_order_relaxed);
+    stats.misses = mMisses.load(std::memory_order_relaxed);
+    stats.bypassed = mBypassed.load(std::memory_order_relaxed);
+    stats.stored = mStored.load(std::memory_order_relaxed);
+    stats.invalidations = mInvalidations.load(std::memory_order_relaxed);
+    return stats;
+}
+
+} // namespace eular
@@ -0,0 +1,104 @@
+/*************************************************************************
+    > File Name: peer_cache.h
+    > Author: hsz
+    > Brief: GET_PEER_INFO响应缓存, 按peer表的generation整体失效
+    > Created Time: Sun 18 Oct 2026 06:40:12 AM CST
+ ************************************************************************/
+
+#ifndef __EULAR_P2P_PEER_CACHE_H__
+#define __EULAR_P2P_PEER_CACHE_H__
+
+#include "peer_registry.h"
+#include <utils/singleton.h>
+#include <utils/utils.h>
+#include <utils/mutex.h>
+#include <utils/string8.h>
+#include <atomic>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace eular {
+
+/**
+ * @brief 缓存编码好的GET_PEER_INFO响应帧, 相同的查询直接发送同一个缓冲区
+ *
+ * 缓存的一页不排除任何peer, 记录本页(加上其后的一个peer)的(name, uuid)范围.
+ * 请求者自身不在范围内时, 排除自身后的结果与缓存的完全相同, 可以共用;
+ * 在范围内时(每个客户端只在一页中出现)由请求者自己生成.
+ *
+ * peer表每次变更generation递增, 缓存的generation落后时全部作废, 不逐条失效
+ */
+class PeerListCache
+{
+    friend class Singleton<PeerListCache>;
+    DISALLOW_COPY_AND_ASSIGN(PeerListCache);
+public:
+    struct Entry {
+        std::vector<uint8_t>    frame;      // 完整的响应帧(按格式可能已压缩), 直接发送
+        bool        empty = true;           // 本页和其后都没有peer
+        String8     firstName;              // 范围起点: 本页第一个peer
+        String8     firstUuid;
+        String8     lastName;               // 范围终点: 本页之后的第一个peer, 没有时为本页最后一个
+        String8     lastUuid;
+
+        bool contains(const String8 &name, const String8 &uuid) const;
+    };
+    typedef std::shared_ptr<const Entry> EntrySP;
+
+    enum Result {
+        HIT,
+        MISS,           // 没有或已过期
+        BYPASS,         // 请求者在缓存的范围内, 不能共用
+    };
+
+    struct Stats {
+        uint64_t hits;
+        uint64_t misses;
+        uint64_t bypassed;
+        uint64_t stored;
+        uint64_t invalidations;     // 因generation变化整体作废的次数
+    };
+
+    /**
+     * @brief 缓存键: 响应格式(协商的能力)和归一化后的查询条件
+     */
+    static std::string MakeKey(const PeerQuery &query, uint32_t pageLimit, uint32_t format);
+
+    /**
+     * @brief 查找generation时的缓存
+     *
+     * @param name, uuid 请求者自身
+     */
+    Result find(uint64_t generation, const std::string &key, const String8 &name, const String8 &uuid, EntrySP &entry);
+
+    /**
+     * @brief 保存generation时生成的响应, generation须在生成前后都未变化
+     */
+    void store(uint64_t generation, const std::string &key, const EntrySP &entry);
+
+    bool enabled() const { return mCapacity > 0; }
+    Stats getStats() const;
+
+private:
+    PeerListCache();
+
+private:
+    uint32_t    mCapacity;          // registry.list_cache_size, 最多缓存的响应数, 0表示不缓存
+    mutable RWMutex mMutex;
+    uint64_t    mGeneration;
+    std::unordered_map<std::string, EntrySP> mEntries;
+
+    std::atomic<uint64_t> mHits;
+    std::atomic<uint64_t> mMisses;
+    std::atomic<uint64_t> mBypassed;
+    std::atomic<uint64_t> mStored;
+    std::atomic<uint64_t> mInvalidations;
+};
+
+typedef Singleton<PeerListCache> PeerCache;
+
+} // namespace eular
+
+#endif // __EULAR_P2P_PEER_CACHE_H__
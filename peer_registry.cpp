@@ -0,0 +1,439 @@
+/*************************************************************************
+    > File Name: peer_registry.cpp
+    > Author: hsz
+    > Brief:
+    > Created Time: Sat 17 Oct 2026 11:06:42 PM CST
+ ************************************************************************/
+
+#include "peer_registry.h"
+#include "config.h"
+#include "iomanager.h"
+#include "core/clock.h"
+#include "db/redispool.h"
+#include <log/log.h>
+#include <arpa/inet.h>
+#include <random>
+#include <string.h>
+
+#define LOG_TAG "PeerRegistry"
+
+namespace eular {
+
+static String8 IPString(uint32_t host)
+{
+    char buf[INET_ADDRSTRLEN] = {0};
+    inet_ntop(AF_INET, &host, buf, sizeof(buf));
+    return String8(buf);
+}
+
+static void FillPeerInfo(Peer_Info &info, const std::string &uuid, const PeerRecord &record)
+{
+    memset(&info, 0, sizeof(info));
+    info.host_binary = record.udpHost;
+    info.port_binary = record.udpPort;
+    strncpy(info.peer_uuid, uuid.c_str(), sizeof(info.peer_uuid) - 1);
+    strncpy(info.peer_name, record.name.c_str(), sizeof(info.peer_name) - 1);
+}
+
+PeerRegistry::PeerRegistry() :
+    mPersistWorker(nullptr),
+    mPersistScheduled(false),
+    mGeneration(0),
+    mNextSubscriberId(0)
+{
+    uint32_t shards = Config::Lookup<uint32_t>("registry.shards", 16);
+    uint32_t count = 1;
+    while (count < shards) {
+        count <<= 1;
+    }
+    mShardMask = count - 1;
+    mShards = new Shard[count];
+    mPageLimit = Config::Lookup<uint32_t>("registry.page_limit", 256);
+    if (mPageLimit == 0) {
+        mPageLimit = 1;
+    }
+    mRedisPersist = Config::Lookup<bool>("registry.redis_persist", true);
+    mChangeLogSize = Config::Lookup<uint32_t>("registry.changelog_size", 4096);
+    if (mChangeLogSize == 0) {
+        mChangeLogSize = 1;
+    }
+    std::random_device rd;
+    do {
+        mEpoch = ((uint64_t)rd() << 32) | rd();
+    } while (mEpoch == 0);    // 0表示客户端没有序号
+    LOGD("peer registry shards %u, redis persist %d", count, mRedisPersist);
+}
+
+PeerRegistry::~PeerRegistry()
+{
+    delete[] mShards;
+}
+
+PeerRegistry::Shard &PeerRegistry::shard(const std::string &uuid) const
+{
+    return mShards[std::hash<std::string>()(uuid) & mShardMask];
+}
+
+void PeerRegistry::registerPeer(const String8 &uuid, const PeerRecord &record)
+{
+    std::string key = uuid.c_str();
+    bool drain = false;
+    {
+        Shard &s = shard(key);
+        WRAutoLock<RWMutex> wrlock(s.mutex);
+        PeerRecord &peer = s.peers[key];
+        s.index.erase(IndexKey(peer.name.c_str(), key));   // 重复注册时名字可能变化
+        uint32_t udpHost = peer.udpHost;
+        uint16_t udpPort = peer.udpPort;
+        peer = record;
+        if (peer.name.length() > PEER_NAME_SIZE - 1) {
+            peer.name = String8(record.name.c_str(), PEER_NAME_SIZE - 1);  // 与下发的Peer_Info一致, 游标才能精确定位
+        }
+        s.index[IndexKey(peer.name.c_str(), key)] = &peer;
+        if (record.udpPort == 0) {
+            peer.udpHost = udpHost;
+            peer.udpPort = udpPort;
+        }
+        appendChange(s, PEER_CHANGE_JOIN, key, peer);
+
+        PeerRecord stored = peer;
+        drain = persist([uuid, stored](RedisInterface *redis) {
+            std::vector<std::pair<String8, String8>> fields;
+            fields.push_back(std::make_pair("name", stored.name));
+            fields.push_back(std::make_pair("uidkey", stored.uidKey));
+            fields.push_back(std::make_pair("tcphost", IPString(stored.tcpHost)));
+            fields.push_back(std::make_pair("tcpport", String8::format("%u", ntohs(stored.tcpPort))));
+            if (stored.udpPort) {
+                fields.push_back(std::make_pair("udphost", IPString(stored.udpHost)));
+                fields.push_back(std::make_pair("udpport", String8::format("%u", ntohs(stored.udpPort))));
+            }
+            if (redis->hashCreateOrReplace(uuid, fields)) {
+                LOGW("persist peer %s error", uuid.c_str());
+            }
+        });
+    }
+    notifySubscribers();
+    if (drain) {
+        schedulePersist();
+    }
+}
+
+bool PeerRegistry::removePeer(const String8 &uuid)
+{
+    std::string key = uuid.c_str();
+    bool drain = false;
+    {
+        Shard &s = shard(key);
+        WRAutoLock<RWMutex> wrlock(s.mutex);
+        auto it = s.peers.find(key);
+        if (it == s.peers.end()) {
+            return false;
+        }
+        appendChange(s, PEER_CHANGE_LEAVE, key, it->second);
+        s.index.erase(IndexKey(it->second.name.c_str(), key));
+        s.peers.erase(it);
+        drain = persist([uuid](RedisInterface *redis) {
+            redis->delKey(uuid);
+        });
+    }
+    notifySubscribers();
+    if (drain) {
+        schedulePersist();
+    }
+    return true;
+}
+
+bool PeerRegistry::updateUdp(const String8 &uuid, uint32_t host, uint16_t port)
+{
+    std::string key = uuid.c_str();
+    bool changed = false;
+    bool drain = false;
+    {
+        Shard &s = shard(key);
+        WRAutoLock<RWMutex> wrlock(s.mutex);
+        auto it = s.peers.find(key);
+        if (it == s.peers.end()) {
+            return false;
+        }
+        PeerRecord &peer = it->second;
+        changed = peer.udpHost != host || peer.udpPort != port;
+        peer.udpHost = host;
+        peer.udpPort = port;
+        peer.lastSeenMs = Clock::NowMs();
+        // 心跳只刷新时间, 地址不变时无需写redis和通知订阅者
+        if (changed) {
+            appendChange(s, PEER_CHANGE_UPDATE, key, peer);
+            drain = persist([uuid, host, port](RedisInterface *redis) {
+                redis->hashSetFiledValue(uuid, "udphost", IPString(host));
+                redis->hashSetFiledValue(uuid, "udpport", String8::format("%u", ntohs(port)));
+            });
+        }
+    }
+
+    if (changed) {
+        notifySubscribers();
+    }
+    if (drain) {
+        schedulePersist();
+    }
+    return true;
+}
+
+uint32_t PeerRegistry::expireUdp(uint64_t nowMs, uint64_t timeoutMs)
+{
+    uint32_t expired = 0;
+    bool drain = false;
+    for (uint32_t i = 0; i <= mShardMask; ++i) {
+        Shard &s = mShards[i];
+        WRAutoLock<RWMutex> wrlock(s.mutex);
+        for (auto &it : s.peers) {
+            PeerRecord &peer = it.second;
+            // lastSeenMs由其他线程按其缓存时刻写入, 可能比nowMs新, 不能相减
+            if (peer.udpPort && peer.lastSeenMs + timeoutMs < nowMs) {
+                peer.udpHost = 0;
+                peer.udpPort = 0;
+                appendChange(s, PEER_CHANGE_UPDATE, it.first, peer);
+                ++expired;
+
+                String8 uuid(it.first.c_str());
+                drain |= persist([uuid](RedisInterface *redis) {
+                    static const char *fields[] = { "udphost", "udpport" };
+                    redis->hashDelFileds(uuid, fields, 2);
+                });
+            }
+        }
+    }
+    if (expired) {
+        notifySubscribers();
+    }
+    if (drain) {
+        schedulePersist();
+    }
+    return expired;
+}
+
+bool PeerRegistry::find(const String8 &uuid, PeerRecord &record) const
+{
+    std::string key = uuid.c_str();
+    Shard &s = shard(key);
+    RDAutoLock<RWMutex> rdlock(s.mutex);
+    auto it = s.peers.find(key);
+    if (it == s.peers.end()) {
+        return false;
+    }
+    record = it->second;
+    return true;
+}
+
+bool PeerRegistry::list(const PeerQuery &query, const String8 &exclude, std::vector<Peer_Info> &out) const
+{
+    size_t begin = out.size();
+    uint32_t count = 0;
+    out.resize(begin + mPageLimit);
+    bool more = list(query, exclude, out.data() + begin, count);
+    out.resize(begin + count);
+    return more;
+}
+
+bool PeerRegistry::list(const PeerQuery &query, const String8 &exclude, Peer_Info *out, uint32_t &count) const
+{
+    uint32_t maxCount = query.maxCount;
+    if (maxCount == 0 || maxCount > mPageLimit) {
+        maxCount = mPageLimit;
+    }
+    std::string prefix = query.namePrefix.c_str();
+    IndexKey cursor(query.cursorName.c_str(), query.cursorUuid.c_str());
+    bool hasCursor = !cursor.first.empty() || !cursor.second.empty();
+    if (hasCursor && cursor.first < prefix) {   // 游标在前缀范围之前, 从前缀开始
+        cursor = IndexKey(prefix, std::string());
+        hasCursor = false;
+    }
+
+    // 同时持有各分片的读锁, 直接在各分片的有序索引上多路归并, 只复制选中的peer
+    typedef std::map<IndexKey, const PeerRecord *>::const_iterator Iterator;
+    std::vector<Iterator> its(mShardMask + 1);
+    for (uint32_t i = 0; i <= mShardMask; ++i) {
+        const Shard &s = mShards[i];
+        s.mutex.rlock();
+        its[i] = hasCursor ? s.index.upper_bound(cursor) : s.index.lower_bound(IndexKey(prefix, std::string()));
+    }
+
+    bool more = false;
+    count = 0;
+    while (true) {
+        int32_t min = -1;
+        for (uint32_t i = 0; i <= mShardMask; ++i) {
+            Iterator &it = its[i];
+            // 跳过不满足条件的, 超出前缀范围时该分片结束
+            while (it != mShards[i].index.end()) {
+                const PeerRecord *peer = it->second;
+                if (it->first.first.compare(0, prefix.size(), prefix) != 0) {
+                    it = mShards[i].index.end();
+                } else if ((query.udpOnly && peer->udpPort == 0) || exclude == it->first.second.c_str()) {
+                    ++it;
+                } else {
+                    break;
+                }
+            }
+            if (it != mShards[i].index.end() && (min < 0 || it->first < its[min]->first)) {
+                min = i;
+            }
+        }
+        if (min < 0) {
+            break;
+        }
+        if (count == maxCount) {
+            more = true;
+            break;
+        }
+        FillPeerInfo(out[count], its[min]->first.second, *its[min]->second);
+        ++count;
+        ++its[min];
+    }
+
+    for (uint32_t i = 0; i <= mShardMask; ++i) {
+        mShards[i].mutex.unlock();
+    }
+    return more;
+}
+
+size_t PeerRegistry::size() const
+{
+    size_t count = 0;
+    for (uint32_t i = 0; i <= mShardMask; ++i) {
+        RDAutoLock<RWMutex> rdlock(mShards[i].mutex);
+        count += mShards[i].peers.size();
+    }
+    return count;
+}
+
+void PeerRegistry::currentSeqs(std::vector<uint64_t> &seqs) const
+{
+    seqs.resize(mShardMask + 1);
+    for (uint32_t i = 0; i <= mShardMask; ++i) {
+        RDAutoLock<RWMutex> rdlock(mShards[i].mutex);
+        seqs[i] = mShards[i].seq;
+    }
+}
+
+bool PeerRegistry::readChanges(std::vector<uint64_t> &cursors, std::vector<Peer_Change> &out, uint32_t maxCount) const
+{
+    if (cursors.size() != mShardMask + 1) {
+        return false;
+    }
+
+    uint32_t count = 0;
+    for (uint32_t i = 0; i <= mShardMask; ++i) {     // 读满后继续检查其余分片的游标
+        const Shard &s = mShards[i];
+        RDAutoLock<RWMutex> rdlock(s.mutex);
+        uint64_t first = s.seq - s.changes.size() + 1;  // 记录中最早的序号
+        if (cursors[i] > s.seq || cursors[i] + 1 < first) {
+            return false;
+        }
+        size_t idx = cursors[i] + 1 - first;
+        for (; idx < s.changes.size() && count < maxCount; ++idx) {
+            out.push_back(s.changes[idx]);
+            ++count;
+        }
+        cursors[i] = first + idx - 1;
+    }
+    return true;
+}
+
+uint64_t PeerRegistry::subscribe(std::function<void()> notify)
+{
+    WRAutoLock<RWMutex> wrlock(mSubscriberMutex);
+    uint64_t id = ++mNextSubscriberId;
+    mSubscribers[id] = std::move(notify);
+    return id;
+}
+
+void PeerRegistry::unsubscribe(uint64_t id)
+{
+    WRAutoLock<RWMutex> wrlock(mSubscriberMutex);
+    mSubscribers.erase(id);
+}
+
+/**
+ * @brief 在持有分片写锁时调用
+ */
+void PeerRegistry::appendChange(Shard &s, uint8_t type, const std::string &uuid, const PeerRecord &record)
+{
+    Peer_Change change;
+    change.seq = ++s.seq;
+    change.shard = &s - mShards;
+    change.type = type;
+    FillPeerInfo(change.peer_info, uuid, record);
+    s.changes.push_back(change);
+    if (s.changes.size() > mChangeLogSize) {
+        s.changes.pop_front();
+    }
+    // 仍持有分片写锁, list()持有所有分片的读锁, 看到的表与generation一致
+    mGeneration.fetch_add(1, std::memory_order_release);
+}
+
+void PeerRegistry::notifySubscribers()
+{
+    RDAutoLock<RWMutex> rdlock(mSubscriberMutex);
+    for (auto &it : mSubscribers) {
+        it.second();
+    }
+}
+
+/**
+ * @brief 将写redis的操作入队. 须在持有分片写锁时调用, 这样同一个键的入队顺序与修改顺序一致
+ *
+ * @return true 调用方须在释放分片锁后调用schedulePersist()启动drain
+ */
+bool PeerRegistry::persist(std::function<void(RedisInterface *)> op)
+{
+    if (!mRedisPersist) {
+        return false;
+    }
+
+    AutoLock<Mutex> lock(mPersistMutex);
+    mPersistQueue.push_back(std::move(op));
+    if (mPersistScheduled) {
+        return false;
+    }
+    mPersistScheduled = true;
+    return true;
+}
+
+/**
+ * @brief 启动drain. 同一时刻最多一个drain, 避免同一个键的写入乱序; 未设置工作线程时在当前线程写入
+ */
+void PeerRegistry::schedulePersist()
+{
+    if (mPersistWorker == nullptr) {
+        drainPersistQueue();
+        return;
+    }
+    mPersistWorker->schedule(std::bind(&PeerRegistry::drainPersistQueue, this));
+}
+
+void PeerRegistry::drainPersistQueue()
+{
+    std::shared_ptr<RedisPool::RedisAPI> redis = RedisManager::get()->getRedis();
+    if (!redis) {
+        LOGW("%s() getRedis return null, pending writes dropped", __func__);
+    }
+
+    while (true) {
+        std::function<void(RedisInterface *)> op;
+        {
+            AutoLock<Mutex> lock(mPersistMutex);
+            if (mPersistQueue.empty()) {
+                mPersistScheduled = false;
+                return;
+            }
+            op = std::move(mPersistQueue.front());
+            mPersistQueue.pop_front();
+        }
+        if (redis) {
+            op(redis->redisInterface());
+        }
+    }
+}
+
+} // namespace eular
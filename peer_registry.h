@@ -0,0 +1,190 @@
+/*************************************************************************
+    > File Name: peer_registry.h
+    > Author: hsz
+    > Brief: 进程内的在线peer表, 按uuid分片加锁; redis只作为可选的异步持久化
+    > Created Time: Sat 17 Oct 2026 11:06:37 PM CST
+ ************************************************************************/
+
+#ifndef __EULAR_P2P_PEER_REGISTRY_H__
+#define __EULAR_P2P_PEER_REGISTRY_H__
+
+#include "protocol/protocol.h"
+#include "db/redis.h"
+#include <utils/singleton.h>
+#include <utils/utils.h>
+#include <utils/mutex.h>
+#include <utils/string8.h>
+#include <atomic>
+#include <deque>
+#include <functional>
+#include <map>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+namespace eular {
+class IOManager;
+
+struct PeerRecord {
+    String8     name;           // 注册时截断为PEER_NAME_SIZE - 1个字符, 与Peer_Info中的一致
+    String8     uidKey;         // 生成uuid的原始数据: name+tcp地址
+    uint32_t    tcpHost = 0;    // 网络字节序
+    uint16_t    tcpPort = 0;    // 网络字节序
+    uint32_t    udpHost = 0;    // 网络字节序, udpPort为0表示还未上报udp地址
+    uint16_t    udpPort = 0;
+    uint64_t    lastSeenMs = 0; // 最近一次注册或收到udp数据的时刻(Clock::NowMs)
+};
+
+/**
+ * @brief 分页查询条件. 结果按(name, uuid)排序, 游标为上一页最后一个peer的name和uuid(不含)
+ */
+struct PeerQuery {
+    String8     cursorName;
+    String8     cursorUuid;     // 为空表示从头开始
+    String8     namePrefix;     // 为空表示不过滤
+    bool        udpOnly = true; // 只返回已上报udp地址的peer
+    uint32_t    maxCount = 0;   // 本页最多返回的数量
+};
+
+/**
+ * @brief peer表, tcp会话注册/注销, udp服务更新udp地址和心跳时间
+ *
+ * 按uuid的哈希分成若干片, 每片一把读写锁, 不同peer的更新基本不会竞争.
+ * registry.redis_persist为true时每次修改都按顺序异步写入redis(与原来的hash键格式相同), 不影响请求处理
+ */
+class PeerRegistry
+{
+    friend class Singleton<PeerRegistry>;
+    DISALLOW_COPY_AND_ASSIGN(PeerRegistry);
+public:
+    ~PeerRegistry();
+
+    /**
+     * @brief tcp会话上报本机信息, 已存在时覆盖(保留udp地址)
+     */
+    void registerPeer(const String8 &uuid, const PeerRecord &record);
+    bool removePeer(const String8 &uuid);
+
+    /**
+     * @brief 更新udp地址和心跳时间
+     *
+     * @return peer未注册返回false
+     */
+    bool updateUdp(const String8 &uuid, uint32_t host, uint16_t port);
+
+    /**
+     * @brief 清除超过timeoutMs未收到udp数据的peer的udp地址
+     *
+     * @return 清除的数量
+     */
+    uint32_t expireUdp(uint64_t nowMs, uint64_t timeoutMs);
+
+    bool find(const String8 &uuid, PeerRecord &record) const;
+
+    /**
+     * @brief 按条件取一页peer, 用于P2S_RESPONSE_GET_PEER_INFO
+     *
+     * 每个分片按(name, uuid)有序索引, 查询时从各分片的游标位置多路归并.
+     * 开销与本页大小和分片数相关, 与peer总数无关(过滤掉的peer除外)
+     *
+     * @param exclude 排除的uuid(请求者自身)
+     * @return 游标之后是否还有满足条件的peer
+     */
+    bool list(const PeerQuery &query, const String8 &exclude, std::vector<Peer_Info> &out) const;
+
+    /**
+     * @brief 同上, 直接写入调用者的缓冲区(如响应帧中预留的位置), 不分配内存
+     *
+     * @param out 至少能容纳pageLimit()个
+     * @param count 写入的数量
+     */
+    bool list(const PeerQuery &query, const String8 &exclude, Peer_Info *out, uint32_t &count) const;
+
+    size_t size() const;
+    uint32_t pageLimit() const { return mPageLimit; }
+
+    /**
+     * @brief 本进程的变更序号空间标识, 重启后变化, 客户端据此判断旧序号是否还能续传
+     */
+    uint64_t epoch() const { return mEpoch; }
+    uint32_t shardCount() const { return mShardMask + 1; }
+
+    /**
+     * @brief 每次产生变更(加入/离开/udp地址变化)都递增, 心跳不变.
+     * 两次读取之间的list()结果相同时值不变, 用于判断缓存的响应是否过期
+     */
+    uint64_t generation() const { return mGeneration.load(std::memory_order_acquire); }
+
+    /**
+     * @brief 各分片当前最后一个变更的序号, 作为新订阅的起点
+     */
+    void currentSeqs(std::vector<uint64_t> &seqs) const;
+
+    /**
+     * @brief 读取各分片cursors之后的变更, 并推进cursors
+     *
+     * 每个分片保留最近registry.changelog_size条变更(加入/离开/udp地址变化, 心跳不产生变更),
+     * 开销只与变更数量有关
+     *
+     * @param cursors 各分片已读到的序号, 大小须为shardCount()
+     * @param maxCount 最多读取的数量
+     * @return 某个分片的游标已不在变更记录内(被覆盖或来自其他epoch)时返回false, 需要重新全量获取
+     */
+    bool readChanges(std::vector<uint64_t> &cursors, std::vector<Peer_Change> &out, uint32_t maxCount) const;
+
+    /**
+     * @brief 注册变更通知, 每次有变更时在修改线程上调用(不持有分片锁), 回调应尽快返回
+     *
+     * @return 订阅id, 用于取消
+     */
+    uint64_t subscribe(std::function<void()> notify);
+    void unsubscribe(uint64_t id);
+
+    /**
+     * @brief 异步持久化使用的调度器, 为空时在调用线程同步写入
+     */
+    void setPersistWorker(IOManager *worker) { mPersistWorker = worker; }
+
+private:
+    PeerRegistry();
+
+    typedef std::pair<std::string, std::string> IndexKey;  // (name, uuid)
+
+    struct Shard {
+        mutable RWMutex mutex;
+        std::unordered_map<std::string, PeerRecord> peers;
+        std::map<IndexKey, const PeerRecord *> index;      // 节点地址在rehash时不变
+        uint64_t seq = 0;                                   // 最后一个变更的序号
+        std::deque<Peer_Change> changes;                    // 最近的变更, 序号连续
+    };
+
+    Shard &shard(const std::string &uuid) const;
+    void appendChange(Shard &s, uint8_t type, const std::string &uuid, const PeerRecord &record);
+    void notifySubscribers();
+    bool persist(std::function<void(RedisInterface *)> op);
+    void schedulePersist();
+    void drainPersistQueue();
+
+private:
+    uint32_t    mShardMask;
+    uint32_t    mPageLimit;                     // registry.page_limit, 一页最多返回的数量
+    Shard *     mShards;
+    bool        mRedisPersist;                  // registry.redis_persist
+    IOManager * mPersistWorker;
+    Mutex       mPersistMutex;
+    std::deque<std::function<void(RedisInterface *)>> mPersistQueue;
+    bool        mPersistScheduled;              // 已有drain任务在途, 保证写入顺序
+    uint64_t    mEpoch;
+    std::atomic<uint64_t> mGeneration;
+    uint32_t    mChangeLogSize;                 // registry.changelog_size, 每个分片保留的变更数量
+    RWMutex     mSubscriberMutex;
+    std::map<uint64_t, std::function<void()>> mSubscribers;
+    uint64_t    mNextSubscriberId;
+};
+
+typedef Singleton<PeerRegistry> PeerManager;
+
+} // namespace eular
+
+#endif // __EULAR_P2P_PEER_REGISTRY_H__
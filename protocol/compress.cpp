@@ -0,0 +1,271 @@
+/*************************************************************************
+    > File Name: compress.cpp
+    > Author: hsz
+    > Brief:
+    > Created Time: Sun 18 Oct 2026 05:26:44 AM CST
+ ************************************************************************/
+
+#include "compress.h"
+#include <log/log.h>
+#include <string.h>
+
+#define LOG_TAG "compress"
+
+#define LZ4_MIN_MATCH       4
+#define LZ4_MF_LIMIT        12      // 最后一个匹配的起点距结尾至少12字节
+#define LZ4_LAST_LITERALS   5       // 最后5字节总是字面量
+#define LZ4_MAX_DISTANCE    65535
+#define LZ4_HASH_LOG        12
+#define LZ4_SKIP_TRIGGER    6       // 连续2^6次未匹配后步长加1
+
+// 每个线程一张哈希表, 不放在协程栈上
+static thread_local uint32_t gHashTable[1 << LZ4_HASH_LOG];
+
+static inline uint32_t read32(const uint8_t *p)
+{
+    uint32_t v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+static inline uint64_t read64(const uint8_t *p)
+{
+    uint64_t v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+static inline uint32_t hash4(uint32_t v)
+{
+    return (v * 2654435761u) >> (32 - LZ4_HASH_LOG);
+}
+
+// 从ip和match开始相同的字节数, 不超过limit
+static inline size_t countMatch(const uint8_t *ip, const uint8_t *match, const uint8_t *limit)
+{
+    const uint8_t *start = ip;
+    while (ip + sizeof(uint64_t) <= limit) {
+        uint64_t diff = read64(ip) ^ read64(match);
+        if (diff) {
+#if EULAR_BYTE_ORDER == EULAR_LITTLE_ENDIAN
+            return ip - start + (__builtin_ctzll(diff) >> 3);
+#else
+            return ip - start + (__builtin_clzll(diff) >> 3);
+#endif
+        }
+        ip += sizeof(uint64_t);
+        match += sizeof(uint64_t);
+    }
+    while (ip < limit && *ip == *match) {
+        ++ip;
+        ++match;
+    }
+    return ip - start;
+}
+
+static inline uint8_t *writeLength(uint8_t *op, size_t len)
+{
+    while (len >= 255) {
+        *op++ = 255;
+        len -= 255;
+    }
+    *op++ = (uint8_t)len;
+    return op;
+}
+
+static inline const uint8_t *readLength(const uint8_t *ip, const uint8_t *end, size_t &len)
+{
+    uint8_t byte;
+    do {
+        if (ip >= end) {
+            return nullptr;
+        }
+        byte = *ip++;
+        len += byte;
+    } while (byte == 255);
+    return ip;
+}
+
+size_t Lz4CompressBound(size_t len)
+{
+    return len + len / 255 + 16;
+}
+
+size_t Lz4Compress(const uint8_t *src, size_t len, uint8_t *dst, size_t capacity, int acceleration)
+{
+    if (capacity < Lz4CompressBound(len)) {
+        return 0;
+    }
+    if (acceleration < 1) {
+        acceleration = 1;
+    }
+
+    const uint8_t *ip = src;
+    const uint8_t *anchor = src;
+    const uint8_t *end = src + len;
+    uint8_t *op = dst;
+
+    if (len > LZ4_MF_LIMIT) {   // 更短的输入全部作为字面量
+        const uint8_t *mflimit = end - LZ4_MF_LIMIT;
+        const uint8_t *matchlimit = end - LZ4_LAST_LITERALS;
+        memset(gHashTable, 0, sizeof(gHashTable));
+        gHashTable[hash4(read32(ip))] = 0;
+        ++ip;
+
+        while (true) {
+            // 查找匹配, 连续未命中时加大步长
+            const uint8_t *match;
+            uint32_t attempts = (uint32_t)acceleration << LZ4_SKIP_TRIGGER;
+            while (true) {
+                if (ip > mflimit) {
+                    goto last_literals;
+                }
+                uint32_t h = hash4(read32(ip));
+                match = src + gHashTable[h];
+                gHashTable[h] = ip - src;
+                if (match < ip && ip - match <= LZ4_MAX_DISTANCE && read32(match) == read32(ip)) {
+                    break;
+                }
+                ip += attempts++ >> LZ4_SKIP_TRIGGER;
+            }
+            while (ip > anchor && match > src && ip[-1] == match[-1]) {
+                --ip;
+                --match;
+            }
+
+            // token | 字面量长度 | 字面量 | offset | 匹配长度
+            size_t literals = ip - anchor;
+            uint8_t *token = op++;
+            if (literals >= 15) {
+                *token = 15 << 4;
+                op = writeLength(op, literals - 15);
+            } else {
+                *token = literals << 4;
+            }
+            memcpy(op, anchor, literals);
+            op += literals;
+
+            uint16_t offset = ip - match;
+            *op++ = offset & 0xFF;
+            *op++ = offset >> 8;
+
+            size_t matched = countMatch(ip + LZ4_MIN_MATCH, match + LZ4_MIN_MATCH, matchlimit);
+            ip += LZ4_MIN_MATCH + matched;
+            if (matched >= 15) {
+                *token |= 15;
+                op = writeLength(op, matched - 15);
+            } else {
+                *token |= matched;
+            }
+            anchor = ip;
+
+            if (ip > mflimit) {
+                break;
+            }
+            gHashTable[hash4(read32(ip - 2))] = ip - 2 - src;
+        }
+    }
+
+last_literals:
+    size_t literals = end - anchor;
+    if (literals >= 15) {
+        *op++ = 15 << 4;
+        op = writeLength(op, literals - 15);
+    } else {
+        *op++ = literals << 4;
+    }
+    if (literals) {
+        memcpy(op, anchor, literals);
+        op += literals;
+    }
+    return op - dst;
+}
+
+int Lz4Decompress(const uint8_t *src, size_t len, uint8_t *dst, size_t capacity)
+{
+    const uint8_t *ip = src;
+    const uint8_t *iend = src + len;
+    uint8_t *op = dst;
+    uint8_t *oend = dst + capacity;
+
+    while (ip < iend) {
+        uint8_t token = *ip++;
+        size_t literals = token >> 4;
+        if (literals == 15 && (ip = readLength(ip, iend, literals)) == nullptr) {
+            return -1;
+        }
+        if ((size_t)(iend - ip) < literals || (size_t)(oend - op) < literals) {
+            return -1;
+        }
+        if (literals) {
+            memcpy(op, ip, literals);
+            ip += literals;
+            op += literals;
+        }
+        if (ip == iend) {
+            break;      // 最后一个序列只有字面量
+        }
+
+        if (iend - ip < 2) {
+            return -1;
+        }
+        size_t offset = ip[0] | (ip[1] << 8);
+        ip += 2;
+        if (offset == 0 || offset > (size_t)(op - dst)) {
+            return -1;
+        }
+        size_t matched = token & 15;
+        if (matched == 15 && (ip = readLength(ip, iend, matched)) == nullptr) {
+            return -1;
+        }
+        matched += LZ4_MIN_MATCH;
+        if ((size_t)(oend - op) < matched) {
+            return -1;
+        }
+        const uint8_t *match = op - offset;
+        if (offset >= matched) {
+            memcpy(op, match, matched);
+            op += matched;
+        } else {
+            while (matched--) {     // 与输出重叠, 逐字节复制
+                *op++ = *match++;
+            }
+        }
+    }
+    return op - dst;
+}
+
+bool CompressFrame(const FrameBuilder &src, FrameBuilder &dst, int acceleration)
+{
+    size_t rawLength = src.payloadSize();
+    size_t bound = Lz4CompressBound(rawLength);
+    dst.truncate(P2P_HEADER_SIZE);
+    dst.setCommand(src.command());
+    dst.setFlags(P2P_FRAME_COMPRESSED);
+
+    size_t offset = dst.reserve(sizeof(uint32_t) + bound);
+    uint8_t *buf = dst.at<uint8_t>(offset);
+    buf[0] = rawLength & 0xFF;
+    buf[1] = (rawLength >> 8) & 0xFF;
+    buf[2] = (rawLength >> 16) & 0xFF;
+    buf[3] = (rawLength >> 24) & 0xFF;
+    size_t compressed = Lz4Compress(src.payload(), rawLength, buf + sizeof(uint32_t), bound, acceleration);
+    dst.truncate(offset + sizeof(uint32_t) + compressed);
+    return compressed != 0 && dst.payloadSize() < rawLength;
+}
+
+bool DecompressFrame(const FrameView &frame, std::vector<uint8_t> &out, uint32_t maxSize)
+{
+    if (frame.length() < sizeof(uint32_t)) {
+        return false;
+    }
+    const uint8_t *data = frame.data();
+    uint32_t rawLength = data[0] | (data[1] << 8) | (data[2] << 16) | ((uint32_t)data[3] << 24);
+    if (rawLength > maxSize) {
+        LOGW("%s() decompressed size %u exceeds %u", __func__, rawLength, maxSize);
+        return false;
+    }
+    out.resize(rawLength);
+    int size = Lz4Decompress(data + sizeof(uint32_t), frame.length() - sizeof(uint32_t), out.data(), out.size());
+    return size == (int)rawLength;
+}
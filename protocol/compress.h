@@ -0,0 +1,58 @@
+/*************************************************************************
+    > File Name: compress.h
+    > Author: hsz
+    > Brief: 帧数据压缩. 格式与LZ4 block兼容, 客户端也可以直接用liblz4的LZ4_decompress_safe解压
+    > Created Time: Sun 18 Oct 2026 05:26:40 AM CST
+ ************************************************************************/
+
+#ifndef __EULAR_P2P_COMPRESS_H__
+#define __EULAR_P2P_COMPRESS_H__
+
+#include "protocol.h"
+#include <vector>
+#include <stdint.h>
+
+/**
+ * 帧头flags带P2P_FRAME_COMPRESSED时, 数据为:
+ *
+ *  raw_length(4byte, 小端) | LZ4 block
+ *
+ * 帧头的length为压缩后的长度. 只有协商了P2P_CAP_COMPRESS的会话才会收到压缩的帧
+ */
+
+/**
+ * @brief len字节压缩后的最大长度
+ */
+size_t Lz4CompressBound(size_t len);
+
+/**
+ * @brief 压缩为一个LZ4 block
+ *
+ * @param capacity dst的大小, 不能小于Lz4CompressBound(len)
+ * @param acceleration 加速系数, 1压缩率最高, 越大越快但压缩率越低
+ * @return 压缩后的长度, capacity不足时返回0
+ */
+size_t Lz4Compress(const uint8_t *src, size_t len, uint8_t *dst, size_t capacity, int acceleration = 1);
+
+/**
+ * @brief 解压一个LZ4 block, 对输入做完整的越界检查
+ *
+ * @return 解压后的长度, 数据错误或capacity不足时返回-1
+ */
+int Lz4Decompress(const uint8_t *src, size_t len, uint8_t *dst, size_t capacity);
+
+/**
+ * @brief 把src的数据压缩后作为dst的数据, 命令相同, dst的帧头带P2P_FRAME_COMPRESSED
+ *
+ * @return 压缩后不比原数据小时返回false, 此时应发送src
+ */
+bool CompressFrame(const FrameBuilder &src, FrameBuilder &dst, int acceleration = 1);
+
+/**
+ * @brief 解压带P2P_FRAME_COMPRESSED的帧数据
+ *
+ * @param maxSize 解压后长度的上限, 超过视为非法帧
+ */
+bool DecompressFrame(const FrameView &frame, std::vector<uint8_t> &out, uint32_t maxSize);
+
+#endif // __EULAR_P2P_COMPRESS_H__
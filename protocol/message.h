@@ -0,0 +1,84 @@
+/*************************************************************************
+    > File Name: message.h
+    > Author: hsz
+    > Brief: 请求命令到(数据结构体, 长度范围, 处理函数)的编译期分发
+    > Created Time: Sun 18 Oct 2026 02:41:08 AM CST
+ ************************************************************************/
+
+#ifndef __EULAR_P2P_MESSAGE_H__
+#define __EULAR_P2P_MESSAGE_H__
+
+#include "protocol.h"
+#include <type_traits>
+
+/**
+ * 使用者用X宏定义自己处理的请求:
+ *
+ *  XX(请求命令, 响应命令, 数据开头的结构体, 结构体之后可选数据的最大长度, 处理函数)
+ *
+ * 处理函数的形式为 void method(const FrameView &frame, const T &msg, Context &ctx), msg直接指向接收缓存.
+ * 长度不在[sizeof(T), sizeof(T) + 可选长度]内的请求在调用处理函数之前被拒绝.
+ *
+ * 分发展开成一个switch, 各分支内联长度检查和处理函数调用.
+ * 相比函数指针表, 命令随机分布时不会因间接调用预测失败而变慢(见test/test_message_dispatch.cc)
+ */
+
+struct MessageInfo {
+    uint16_t    command;
+    uint16_t    response;   // 响应命令
+    uint32_t    minSize;
+    uint32_t    maxSize;
+
+    bool accept(uint32_t length) const { return minSize <= length && length <= maxSize; }
+};
+
+enum class MessageResult {
+    OK,
+    UNKNOWN_COMMAND,
+    BAD_LENGTH,
+};
+
+template<typename T>
+inline MessageInfo MakeMessageInfo(uint16_t cmd, uint16_t response, uint32_t extra)
+{
+    MessageInfo info;
+    info.command = cmd;
+    info.response = response;
+    info.minSize = sizeof(T);
+    info.maxSize = sizeof(T) + extra;
+    return info;
+}
+
+// 在编译期检查命令范围和结构体类型, 在源文件中对MAP展开一次
+#define P2S_MESSAGE_STATIC_CHECK(cmd, response, type, extra, method)                            \
+    static_assert((cmd) > P2S_REQUEST && (cmd) < P2S_RESPONSE, #cmd " is not a request");        \
+    static_assert(std::is_pod<type>::value, #type " must be a packed POD");
+
+#define P2S_MESSAGE_CASE(cmd, response, type, extra, method)                                    \
+    case cmd:                                                                                   \
+        info = MakeMessageInfo<type>(cmd, response, extra);                                     \
+        if (!info.accept(frame.length())) {                                                     \
+            return MessageResult::BAD_LENGTH;                                                   \
+        }                                                                                       \
+        method(frame, *reinterpret_cast<const type *>(frame.data()), ctx);                     \
+        return MessageResult::OK;
+
+/**
+ * @brief 在处理类的成员函数中按MAP分发, 函数参数须命名为frame, ctx, info:
+ *
+ *  MessageResult dispatch(const FrameView &frame, Context &ctx, MessageInfo &info)
+ *  {
+ *      P2S_MESSAGE_DISPATCH(MAP)
+ *  }
+ *
+ * info为命中的命令的信息, 未注册的命令时不修改
+ */
+#define P2S_MESSAGE_DISPATCH(MAP)                                                               \
+    switch (frame.commnd()) {                                                                   \
+    MAP(P2S_MESSAGE_CASE)                                                                       \
+    default:                                                                                    \
+        break;                                                                                  \
+    }                                                                                           \
+    return MessageResult::UNKNOWN_COMMAND;
+
+#endif // __EULAR_P2P_MESSAGE_H__
@@ -116,25 +116,41 @@ ProtocolParser::~ProtocolParser()
 }
 
 bool ProtocolParser::parse(const uint8_t *buf, size_t len)
+{
+    FrameView view;
+    if (!ParseView(buf, len, view)) {
+        return false;
+    }
+
+    mCommnd = view.commnd();
+    mSendTime = view.time();
+    mDataBuffer.clear();
+    mDataBuffer.set(view.data(), view.length());
+    return true;
+}
+
+bool ProtocolParser::ParseView(const uint8_t *buf, size_t len, FrameView &view)
 {
     if (!buf || len < P2P_HEADER_SIZE) {
         return false;
     }
-    uint32_t flag, length;
-    uint16_t unused;
+    uint32_t flag, time, length;
+    uint16_t cmd, flags;
 
     buf = decode32u(buf, &flag);
     if (flag != SPECIAL_IDENTIFIER) {
         return false;
     }
 
-    buf = decode16u(buf, &mCommnd);
-    buf = decode16u(buf, &unused);
-    buf = decode32u(buf, &mSendTime);
+    buf = decode16u(buf, &cmd);
+    buf = decode16u(buf, &flags);
+    buf = decode32u(buf, &time);
     buf = decode32u(buf, &length);
+    if (length > len - P2P_HEADER_SIZE) {   // 数据不完整
+        return false;
+    }
 
-    mDataBuffer.clear();
-    mDataBuffer.set(buf, length);
+    view = FrameView(cmd, time, buf, length, flags);
     return true;
 }
 
@@ -163,24 +179,391 @@ eular::ByteBuffer &ProtocolParser::data()
     return mDataBuffer;
 }
 
+ProtocolDecoder::ProtocolDecoder(uint32_t maxFrameSize) :
+    mOffset(0),
+    mMaxFrameSize(maxFrameSize)
+{
+
+}
+
+ProtocolDecoder::Status ProtocolDecoder::next(ProtocolParser &parser)
+{
+    size_t frameSize = 0;
+    Status status = locate(frameSize);
+    if (status == FRAME_READY) {
+        parser.parse(mBuffer.const_data() + mOffset, frameSize);
+        mOffset += frameSize;
+    }
+    return status;
+}
+
+ProtocolDecoder::Status ProtocolDecoder::next(FrameView &view)
+{
+    size_t frameSize = 0;
+    Status status = locate(frameSize);
+    if (status == FRAME_READY) {
+        ProtocolParser::ParseView(mBuffer.const_data() + mOffset, frameSize, view);
+        mOffset += frameSize;
+    }
+    return status;
+}
+
+/**
+ * @brief 检查下一帧是否完整, 不完整时整理缓存
+ */
+ProtocolDecoder::Status ProtocolDecoder::locate(size_t &frameSize)
+{
+    size_t remain = mBuffer.size() - mOffset;
+    const uint8_t *buf = mBuffer.const_data() + mOffset;
+    uint32_t flag, length;
+
+    if (remain >= sizeof(flag)) {
+        decode32u(buf, &flag);
+        if (flag != SPECIAL_IDENTIFIER) {
+            return FRAME_ERROR;
+        }
+    }
+    if (remain < P2P_HEADER_SIZE) {
+        compact();
+        return NEED_MORE;
+    }
+
+    decode32u(buf + P2P_HEADER_SIZE - sizeof(length), &length);
+    if (length > mMaxFrameSize) {
+        return FRAME_ERROR;
+    }
+    if (remain - P2P_HEADER_SIZE < length) {
+        compact();
+        return NEED_MORE;
+    }
+
+    frameSize = P2P_HEADER_SIZE + length;
+    return FRAME_READY;
+}
+
+void ProtocolDecoder::reset()
+{
+    mBuffer.clear();
+    mOffset = 0;
+}
+
+/**
+ * @brief 丢弃已取出的帧, 剩余的半帧移到开头. 通常一次读取都是整帧, 只需清空
+ */
+void ProtocolDecoder::compact()
+{
+    size_t remain = mBuffer.size() - mOffset;
+    if (remain == 0) {
+        mBuffer.clear();
+    } else if (mOffset > 0) {
+        eular::ByteBuffer rest;
+        rest.set(mBuffer.const_data() + mOffset, remain);
+        mBuffer.set(rest.const_data(), rest.size());
+    }
+    mOffset = 0;
+}
+
+static thread_local std::vector<std::vector<uint8_t>> gFramePool;
+
+static uint8_t *EncodeHeader(uint8_t *buf, uint16_t cmd, uint32_t length)
+{
+    buf = encode32u(buf, SPECIAL_IDENTIFIER);
+    buf = encode16u(buf, cmd);
+    buf = encode16u(buf, 0);
+    buf = encode32u(buf, 0);
+    buf = encode32u(buf, length);
+    return buf;
+}
+
+FrameBuilder::FrameBuilder(uint16_t cmd)
+{
+    if (!gFramePool.empty()) {
+        mBuffer.swap(gFramePool.back());
+        gFramePool.pop_back();
+    }
+    mBuffer.resize(P2P_HEADER_SIZE);
+    EncodeHeader(mBuffer.data(), cmd, 0);
+}
+
+FrameBuilder::~FrameBuilder()
+{
+    // 析构时可能已不在构造时的线程(协程迁移), 放回当前线程的缓存
+    if (gFramePool.size() < P2P_POOL_BUFFERS && mBuffer.capacity() <= P2P_POOL_BUFFER_MAX) {
+        mBuffer.clear();
+        gFramePool.emplace_back();
+        gFramePool.back().swap(mBuffer);
+    }
+}
+
+void FrameBuilder::setCommand(uint16_t cmd)
+{
+    encode16u(mBuffer.data() + sizeof(uint32_t), cmd);
+}
+
+uint16_t FrameBuilder::command() const
+{
+    uint16_t cmd;
+    decode16u(mBuffer.data() + sizeof(uint32_t), &cmd);
+    return cmd;
+}
+
+void FrameBuilder::setFlags(uint16_t flags)
+{
+    encode16u(mBuffer.data() + sizeof(uint32_t) + sizeof(uint16_t), flags);
+}
+
+size_t FrameBuilder::reserve(size_t len)
+{
+    size_t offset = mBuffer.size();
+    mBuffer.resize(offset + len);
+    return offset;
+}
+
+void FrameBuilder::append(const void *data, size_t len)
+{
+    const uint8_t *begin = static_cast<const uint8_t *>(data);
+    mBuffer.insert(mBuffer.end(), begin, begin + len);
+}
+
+void FrameBuilder::truncate(size_t size)
+{
+    LOG_ASSERT2(size >= P2P_HEADER_SIZE && size <= mBuffer.size());
+    mBuffer.resize(size);
+}
+
+const uint8_t *FrameBuilder::finish()
+{
+    encode32u(mBuffer.data() + P2P_HEADER_SIZE - sizeof(uint32_t), payloadSize());
+    return mBuffer.data();
+}
+
+// 十六进制字符的值, 非小写十六进制为-1. 查表而不是比较范围: uuid是随机数字, 逐字符分支几乎每次都预测失败
+static const int8_t *HexTable()
+{
+    static int8_t table[256];
+    static bool inited = [] () {
+        memset(table, -1, sizeof(table));
+        for (int i = 0; i < 10; ++i) {
+            table['0' + i] = i;
+        }
+        for (int i = 0; i < 6; ++i) {
+            table['a' + i] = 10 + i;
+        }
+        return true;
+    }();
+    (void)inited;
+    return table;
+}
+
+// 只有32位小写十六进制的uuid能无损转成二进制
+static bool ParseBinaryUuid(const char *uuid, size_t len, uint8_t *out)
+{
+    if (len != 32) {
+        return false;
+    }
+    const int8_t *table = HexTable();
+    int invalid = 0;
+    for (size_t i = 0; i < 16; ++i) {
+        int high = table[(uint8_t)uuid[i * 2]];
+        int low = table[(uint8_t)uuid[i * 2 + 1]];
+        invalid |= high | low;      // 只有-1的符号位为1
+        out[i] = (high << 4) | (low & 0x0F);
+    }
+    return invalid >= 0;
+}
+
+static inline uint8_t *encodeVarint(uint8_t *buf, uint64_t n)
+{
+    while (n >= 0x80) {
+        *buf++ = (n & 0x7F) | 0x80;
+        n >>= 7;
+    }
+    *buf++ = n;
+    return buf;
+}
+
+static inline const uint8_t *decodeVarint(const uint8_t *buf, const uint8_t *end, uint64_t *n)
+{
+    *n = 0;
+    for (uint32_t shift = 0; buf < end && shift < 64; shift += 7) {
+        uint8_t byte = *buf++;
+        *n |= (uint64_t)(byte & 0x7F) << shift;
+        if ((byte & 0x80) == 0) {
+            return buf;
+        }
+    }
+    return nullptr;
+}
+
+CompactPeerWriter::CompactPeerWriter(FrameBuilder &out) :
+    mOut(out),
+    mLastLength(0)
+{
+}
+
+void CompactPeerWriter::append(const Peer_Info &info)
+{
+    size_t offset = mOut.reserve(PEER_COMPACT_MAX_SIZE);
+    uint8_t *begin = mOut.at<uint8_t>(offset);
+    uint8_t *end = encode(begin, info);
+    mOut.truncate(offset + (end - begin));
+}
+
+void CompactPeerWriter::append(const Peer_Change &change)
+{
+    size_t offset = mOut.reserve(PEER_COMPACT_MAX_SIZE);
+    uint8_t *begin = mOut.at<uint8_t>(offset);
+    uint8_t *buf = encode8u(begin, change.type);
+    buf = encode16u(buf, change.shard);
+    buf = encodeVarint(buf, change.seq);
+    buf = encode(buf, change.peer_info);
+    mOut.truncate(offset + (buf - begin));
+}
+
+uint8_t *CompactPeerWriter::encode(uint8_t *buf, const Peer_Info &info)
+{
+    size_t nameLength = strnlen(info.peer_name, PEER_NAME_SIZE - 1);
+    size_t uuidLength = strnlen(info.peer_uuid, UUID_SIZE - 1);
+    size_t shared = 0;
+    while (shared < nameLength && shared < mLastLength && info.peer_name[shared] == mLastName[shared]) {
+        ++shared;
+    }
+
+    uint8_t *flags = buf;
+    buf = encode8u(buf, 0);
+    buf = encode8u(buf, shared);
+    buf = encode8u(buf, nameLength - shared);
+    memcpy(buf, info.peer_name + shared, nameLength - shared);
+    buf += nameLength - shared;
+    memcpy(mLastName, info.peer_name, nameLength);
+    mLastLength = nameLength;
+
+    if (ParseBinaryUuid(info.peer_uuid, uuidLength, buf)) {
+        *flags |= PEER_COMPACT_BINARY_UUID;
+        buf += 16;
+    } else {
+        buf = encode8u(buf, uuidLength);
+        memcpy(buf, info.peer_uuid, uuidLength);
+        buf += uuidLength;
+    }
+
+    if (info.host_binary != 0 || info.port_binary != 0) {
+        *flags |= PEER_COMPACT_UDP;
+        memcpy(buf, &info.host_binary, sizeof(info.host_binary));   // 已是网络字节序, 原样传输
+        buf += sizeof(info.host_binary);
+        memcpy(buf, &info.port_binary, sizeof(info.port_binary));
+        buf += sizeof(info.port_binary);
+    }
+    return buf;
+}
+
+CompactPeerReader::CompactPeerReader(const uint8_t *data, size_t len) :
+    mData(data),
+    mEnd(data + len),
+    mLastLength(0),
+    mError(false)
+{
+}
+
+bool CompactPeerReader::next(Peer_Info &info)
+{
+    if (mError || mData == mEnd) {
+        return false;
+    }
+    return decode(info);
+}
+
+bool CompactPeerReader::next(Peer_Change &change)
+{
+    if (mError || mData == mEnd) {
+        return false;
+    }
+    if (mEnd - mData < 3) {
+        mError = true;
+        return false;
+    }
+    uint8_t type;
+    uint16_t shard;
+    uint64_t seq;
+    mData = decode8u(mData, &type);
+    mData = decode16u(mData, &shard);
+    mData = decodeVarint(mData, mEnd, &seq);
+    if (mData == nullptr) {
+        mError = true;
+        return false;
+    }
+    change.type = type;
+    change.shard = shard;
+    change.seq = seq;
+    return decode(change.peer_info);
+}
+
+bool CompactPeerReader::decode(Peer_Info &info)
+{
+    static const char hex[] = "0123456789abcdef";
+    memset(&info, 0, sizeof(Peer_Info));
+    mError = true;      // 以下任一检查失败即为格式错误
+
+    uint8_t flags, shared, suffix;
+    if (mEnd - mData < 3) {
+        return false;
+    }
+    mData = decode8u(mData, &flags);
+    mData = decode8u(mData, &shared);
+    mData = decode8u(mData, &suffix);
+    if (shared > mLastLength || shared + suffix >= PEER_NAME_SIZE || mEnd - mData < suffix) {
+        return false;
+    }
+    memcpy(mLastName + shared, mData, suffix);
+    mData += suffix;
+    mLastLength = shared + suffix;
+    memcpy(info.peer_name, mLastName, mLastLength);
+
+    if (flags & PEER_COMPACT_BINARY_UUID) {
+        if (mEnd - mData < 16) {
+            return false;
+        }
+        for (size_t i = 0; i < 16; ++i) {
+            info.peer_uuid[i * 2] = hex[mData[i] >> 4];
+            info.peer_uuid[i * 2 + 1] = hex[mData[i] & 0x0F];
+        }
+        mData += 16;
+    } else {
+        uint8_t length;
+        if (mData == mEnd) {
+            return false;
+        }
+        mData = decode8u(mData, &length);
+        if (length >= UUID_SIZE || mEnd - mData < length) {
+            return false;
+        }
+        memcpy(info.peer_uuid, mData, length);
+        mData += length;
+    }
+
+    if (flags & PEER_COMPACT_UDP) {
+        if (mEnd - mData < (ptrdiff_t)(sizeof(info.host_binary) + sizeof(info.port_binary))) {
+            return false;
+        }
+        memcpy(&info.host_binary, mData, sizeof(info.host_binary));
+        mData += sizeof(info.host_binary);
+        memcpy(&info.port_binary, mData, sizeof(info.port_binary));
+        mData += sizeof(info.port_binary);
+    }
+    mError = false;
+    return true;
+}
+
 eular::ByteBuffer ProtocolGenerator::generator(uint16_t cmd, const uint8_t *data, size_t len)
 {
+    uint8_t header[P2P_HEADER_SIZE];
+    EncodeHeader(header, cmd, (data ? len : 0));
+
     eular::ByteBuffer buffer;
-    uint8_t *temp;
-    uint8_t *buf = (uint8_t *)malloc(P2P_HEADER_SIZE + len + 1);
-    if (buf == nullptr) {
-        return buffer;
-    }
-    temp = buf;
-    temp = encode32u(temp, SPECIAL_IDENTIFIER);
-    temp = encode16u(temp, cmd);
-    temp = encode16u(temp, 0);
-    temp = encode32u(temp, 0);
-    temp = encode32u(temp, (data ? len : 0));
-    memcpy(temp, data, len);
-    buffer.set(buf, P2P_HEADER_SIZE + len);
-
-    free(buf);
+    buffer.set(header, P2P_HEADER_SIZE);
+    if (data) {
+        buffer.append(data, len);
+    }
     return buffer;
 }
 
@@ -9,20 +9,29 @@
 #define __EULAR_P2P_PROTOCOL_H__
 
 #include "endian.hpp"
+#include <utils/utils.h>
 #include <utils/buffer.h>
 #include <string>
+#include <vector>
 #include <stdint.h>
 
 #define __attribute_packed__        __attribute__((packed))
 
 #define SPECIAL_IDENTIFIER 0x55647382
 #define P2P_HEADER_SIZE 16
+#define P2P_MAX_FRAME_SIZE  (64 * 1024)     // 默认的数据最大长度, 超过视为非法帧
+#define P2P_POOL_BUFFERS    8               // FrameBuilder每个线程缓存的缓冲区数量
+#define P2P_POOL_BUFFER_MAX (1024 * 1024)   // 超过此容量的缓冲区用完即释放, 不放回缓存
+
+#define P2P_FRAME_COMPRESSED    0x0001      // 帧头flags: 数据经过压缩, 见protocol/compress.h
 
 #define P2S_REQUEST                     0x0100
 #define P2S_REQUEST_SEND_PEER_INFO      (P2S_REQUEST + 1)   // 发送本机信息
 #define P2S_REQUEST_GET_PEER_INFO       (P2S_REQUEST + 2)   // 获取所有的主机信息
 #define P2S_REQUEST_CONNECT_TO_PEER     (P2S_REQUEST + 3)   // 连接某一主机
 #define P2S_REQUEST_HEARTBEAT_DETECT    (P2S_REQUEST + 4)   // 客户端响应心跳检测
+#define P2S_REQUEST_SUBSCRIBE_PEERS     (P2S_REQUEST + 5)   // 订阅peer变更
+#define P2S_REQUEST_HELLO               (P2S_REQUEST + 6)   // 协商协议版本和能力
 
 #define P2S_RESPONSE                    0x1000
 #define P2S_RESPONSE_SEND_PEER_INFO     (P2S_RESPONSE + 1)  // 服务端响应客户端发送的信息
@@ -31,6 +40,9 @@
 #define P2S_RESPONSE_CONNECT_TO_ME      (P2S_RESPONSE + 4)  // 服务器响应对端有人要建立连接
 #define P2S_RESPONSE_HEARTBEAT_DETECT   (P2S_RESPONSE + 5)  // 服务端用于udp的心跳检测包(由服务端主动发起)
 #define P2S_RESPONSE_STATUS             (P2S_RESPONSE + 6)  // 服务器响应状态
+#define P2S_RESPONSE_SUBSCRIBE_PEERS    (P2S_RESPONSE + 7)  // 服务端响应订阅
+#define P2S_RESPONSE_PEER_CHANGE        (P2S_RESPONSE + 8)  // 服务端推送peer变更(由服务端主动发起)
+#define P2S_RESPONSE_HELLO              (P2S_RESPONSE + 9)  // 服务端响应协商结果
 
 #define UUID_SIZE       48
 #define PEER_NAME_SIZE  32
@@ -40,12 +52,13 @@
  * flag: 专用标志符 0x55 0x64 0x73 0x82
  * cmd: 命令
  * time: 发送此帧的时间
+ * flags: P2P_FRAME_*, 原为保留的0
  * length: 携带的数据长度
  * data: 数据
  * 
  * |                 8byte                 |
  * |-------------------|-------------------|
- * |    flag(4byte)    | cmd(2b) |0x00 0x00|
+ * |    flag(4byte)    | cmd(2b) |flags(2b)|
  * |-------------------|-------------------|
  * |    time(4byte)    |   length(4byte)   |
  * |-------------------|-------------------|
@@ -54,6 +67,44 @@
  * 
  */
 
+/**
+ * @brief 指向接收缓存中一个帧的只读视图, 不复制数据
+ *
+ * 有效期到接收缓存下一次被修改(ProtocolDecoder::next或recv)为止
+ */
+class FrameView
+{
+public:
+    FrameView() : mCommnd(0), mFlags(0), mSendTime(0), mData(nullptr), mLength(0) {}
+    FrameView(uint16_t cmd, uint32_t time, const uint8_t *data, uint32_t len, uint16_t flags = 0) :
+        mCommnd(cmd), mFlags(flags), mSendTime(time), mData(data), mLength(len) {}
+
+    uint16_t commnd() const { return mCommnd; }
+    uint16_t flags() const { return mFlags; }
+    uint32_t time() const { return mSendTime; }
+    const uint8_t *data() const { return mData; }
+    uint32_t length() const { return mLength; }
+
+    /**
+     * @brief 取数据中offset处的T, 长度不足时返回nullptr. 协议结构体都是packed的, 可以指向未对齐的地址
+     */
+    template<typename T>
+    const T *get(uint32_t offset = 0) const
+    {
+        if (offset > mLength || mLength - offset < sizeof(T)) {
+            return nullptr;
+        }
+        return reinterpret_cast<const T *>(mData + offset);
+    }
+
+protected:
+    uint16_t        mCommnd;
+    uint16_t        mFlags;
+    uint32_t        mSendTime;
+    const uint8_t * mData;
+    uint32_t        mLength;
+};
+
 class ProtocolParser
 {
 public:
@@ -63,6 +114,11 @@ public:
     bool parse(const uint8_t *buf, size_t len);
     bool parse(const eular::ByteBuffer &buffer);
 
+    /**
+     * @brief 只解析帧头, view指向buf中的数据, 不复制
+     */
+    static bool ParseView(const uint8_t *buf, size_t len, FrameView &view);
+
     uint16_t commnd() const;
     uint32_t time() const;
     uint32_t length() const;
@@ -74,6 +130,85 @@ protected:
     eular::ByteBuffer   mDataBuffer;
 };
 
+/**
+ * @brief tcp流的增量解帧. 保存上次读取剩余的半帧, 一次读取到的多个帧逐个取出
+ *
+ * 用法: recv追加到buffer()后, 循环调用next()直到返回NEED_MORE或FRAME_ERROR
+ */
+class ProtocolDecoder
+{
+public:
+    enum Status {
+        FRAME_READY,    // parser中为一个完整的帧
+        NEED_MORE,      // 剩余数据不足一帧, 已保留等待下次读取
+        FRAME_ERROR,    // 标志符错误或长度超过上限, 流已无法同步, 应断开连接
+    };
+
+    ProtocolDecoder(uint32_t maxFrameSize = P2P_MAX_FRAME_SIZE);
+    ~ProtocolDecoder() {}
+
+    eular::ByteBuffer &buffer() { return mBuffer; }
+    Status next(ProtocolParser &parser);
+    Status next(FrameView &view);       // 不复制数据, view在下一次调用next之前有效
+
+    size_t pending() const { return mBuffer.size() - mOffset; }
+    uint32_t maxFrameSize() const { return mMaxFrameSize; }
+    void reset();
+
+protected:
+    Status locate(size_t &frameSize);
+    void compact();
+
+protected:
+    eular::ByteBuffer   mBuffer;
+    size_t              mOffset;        // mBuffer中已取出的字节数
+    uint32_t            mMaxFrameSize;
+};
+
+/**
+ * @brief 就地构造一个帧: 先预留帧头, 数据直接写在其后, finish时回填长度
+ *
+ * 缓冲区取自线程缓存, 析构时放回, 缓存命中后构造响应不再分配内存.
+ * reserve/append可能使缓冲区扩容, 之前通过at()取得的指针随之失效, 应保存偏移
+ */
+class FrameBuilder
+{
+    DISALLOW_COPY_AND_ASSIGN(FrameBuilder);
+public:
+    FrameBuilder(uint16_t cmd = 0);
+    ~FrameBuilder();
+
+    void setCommand(uint16_t cmd);
+    uint16_t command() const;
+    void setFlags(uint16_t flags);      // P2P_FRAME_*
+
+    /**
+     * @brief 在末尾预留len字节(填0)
+     *
+     * @return 预留区域的偏移, 用at()访问
+     */
+    size_t reserve(size_t len);
+    void append(const void *data, size_t len);
+    void truncate(size_t size);         // 截断到size字节(含帧头)
+
+    template<typename T>
+    T *at(size_t offset) { return reinterpret_cast<T *>(mBuffer.data() + offset); }
+
+    size_t size() const { return mBuffer.size(); }
+    size_t payloadSize() const { return mBuffer.size() - P2P_HEADER_SIZE; }
+    const uint8_t *payload() const { return mBuffer.data() + P2P_HEADER_SIZE; }
+
+    /**
+     * @brief 回填数据长度
+     *
+     * @return 完整的帧, 长度为size()
+     */
+    const uint8_t *finish();
+
+private:
+    std::vector<uint8_t>    mBuffer;
+};
+
 class ProtocolGenerator
 {
 public:
@@ -100,6 +235,51 @@ typedef struct __P2S_Request {
 } __attribute_packed__ P2S_Request;
 static const uint32_t P2S_Request_Size = sizeof(P2S_Request);
 
+// P2S_REQUEST_CONNECT_TO_PEER: 发起者和想要连接的对端
+typedef struct __Peer_Connect {
+    Peer_Info   initiator;
+    Peer_Info   target;
+} __attribute_packed__ Peer_Connect;
+static const uint32_t Peer_Connect_Size = sizeof(Peer_Connect);
+
+// P2S_REQUEST_GET_PEER_INFO的分页与过滤条件, 跟在请求者的Peer_Info之后; 不带时取第一页, 只含已上报udp地址的peer.
+// 结果按(peer_name, peer_uuid)排序, 下一页的游标为本页最后一个Peer_Info的name和uuid;
+// 响应状态码为PARTIAL_CONTENT时表示还有下一页
+#define PEER_QUERY_UDP_ONLY     0x0001      // 只返回已上报udp地址的peer
+
+typedef struct __Peer_Query {
+    char        cursor_name[PEER_NAME_SIZE];    // 上一页最后一个peer, 都为空表示从头开始
+    char        cursor_uuid[UUID_SIZE];
+    char        name_prefix[PEER_NAME_SIZE];    // 名字前缀, 为空表示不过滤
+    uint16_t    flags;                          // PEER_QUERY_*
+    uint16_t    max_count;                      // 本页最多返回的数量, 为0或超过服务端上限时取上限
+} __attribute_packed__ Peer_Query;
+static const uint32_t Peer_Query_Size = sizeof(Peer_Query);
+
+// P2S_REQUEST_SUBSCRIBE_PEERS跟在请求者的Peer_Info之后, 后面再跟shard_count个uint64_t, 为各分片已收到的最后一个序号.
+// 不带或epoch为0时从当前开始订阅. 响应的P2S_Response.number为0, 后面跟当前的Peer_Subscribe和各分片序号:
+// 状态码OK表示已从给出的序号续传; RESET_CONTENT表示序号已失效(服务端重启或落后太多),
+// 客户端应先用GET_PEER_INFO全量获取, 再应用之后推送的变更.
+// 之后服务端用P2S_RESPONSE_PEER_CHANGE推送变更, number为后面Peer_Change的个数;
+// 推送的状态码为RESET_CONTENT时表示订阅落后太多已失效, 需要重新订阅
+#define PEER_CHANGE_JOIN        1           // 上线或重新上报本机信息
+#define PEER_CHANGE_LEAVE       2           // 下线
+#define PEER_CHANGE_UPDATE      3           // udp地址变化, 地址为0表示udp超时
+
+typedef struct __Peer_Subscribe {
+    uint64_t    epoch;          // 服务端序号空间标识
+    uint16_t    shard_count;    // 后面跟的序号个数
+} __attribute_packed__ Peer_Subscribe;
+static const uint32_t Peer_Subscribe_Size = sizeof(Peer_Subscribe);
+
+typedef struct __Peer_Change {
+    uint64_t    seq;            // 分片内的序号, 连续递增
+    uint16_t    shard;
+    uint8_t     type;           // PEER_CHANGE_*
+    Peer_Info   peer_info;      // 变更后的信息
+} __attribute_packed__ Peer_Change;
+static const uint32_t Peer_Change_Size = sizeof(Peer_Change);
+
 // 服务端响应结构体
 typedef struct __P2S_Response {
     uint16_t    flag;
@@ -109,6 +289,84 @@ typedef struct __P2S_Response {
 } __attribute_packed__ P2S_Response;
 static const uint32_t P2S_Response_Size = sizeof(P2S_Response);
 
+// P2S_REQUEST_HELLO: 客户端给出自己的版本和支持的能力, 响应的P2S_Response之后跟服务端的版本和双方都支持的能力.
+// 握手响应本身仍使用握手前的格式, 之后的响应按协商的能力编码. 不握手的旧客户端保持原格式;
+// 旧服务端对未知命令回复BAD_REQUEST(flag为0), 客户端据此退回原格式
+#define P2P_PROTOCOL_VERSION    1
+#define P2P_CAP_COMPACT_PEERS   0x00000001  // 紧凑编码, 见CompactPeerWriter
+#define P2P_CAP_COMPRESS        0x00000002  // 服务端可以压缩较大的tcp响应(P2P_FRAME_COMPRESSED), 请求不压缩
+#define P2P_CAP_SUPPORTED       (P2P_CAP_COMPACT_PEERS | P2P_CAP_COMPRESS)
+typedef struct __Peer_Hello {
+    uint16_t    version;        // P2P_PROTOCOL_VERSION
+    uint32_t    capabilities;   // P2P_CAP_*
+} __attribute_packed__ Peer_Hello;
+static const uint32_t Peer_Hello_Size = sizeof(Peer_Hello);
+
+// 协商了P2P_CAP_COMPACT_PEERS后tcp响应以此代替P2S_Response, 只有状态码, 没有原因描述;
+// 响应中的Peer_Info和推送的Peer_Change都用CompactPeerWriter编码
+typedef struct __P2S_Compact_Response {
+    uint16_t    flag;
+    uint16_t    statusCode;
+    uint32_t    number;         // 后面有多少个紧凑编码的peer
+} __attribute_packed__ P2S_Compact_Response;
+static const uint32_t P2S_Compact_Response_Size = sizeof(P2S_Compact_Response);
+
+/**
+ * 一个peer的紧凑编码:
+ *
+ *  flags(1byte) | shared(1byte) | suffix(1byte) | name[suffix] | uuid | [host(4byte) port(2byte)]
+ *
+ * shared为与上一个peer的名字相同的前缀长度, 列表按名字排序时只需传不同的后缀.
+ * flags带PEER_COMPACT_BINARY_UUID时uuid为16字节二进制(服务端分配的32位小写十六进制uuid),
+ * 否则为长度(1byte)加字符串; 带PEER_COMPACT_UDP时跟网络字节序的udp地址, 否则地址为0.
+ * Peer_Change在peer之前加 type(1byte) | shard(2byte) | seq(varint, 每字节低7位, 小端)
+ */
+#define PEER_COMPACT_BINARY_UUID    0x01
+#define PEER_COMPACT_UDP            0x02
+#define PEER_COMPACT_MAX_SIZE       (3 + PEER_NAME_SIZE + 1 + UUID_SIZE + 6 + 1 + 2 + 10)    // 一个Peer_Change的上限
+
+class CompactPeerWriter
+{
+public:
+    CompactPeerWriter(FrameBuilder &out);
+
+    void append(const Peer_Info &info);
+    void append(const Peer_Change &change);
+
+private:
+    uint8_t *encode(uint8_t *buf, const Peer_Info &info);
+
+private:
+    FrameBuilder &  mOut;
+    char            mLastName[PEER_NAME_SIZE];
+    size_t          mLastLength;
+};
+
+class CompactPeerReader
+{
+public:
+    CompactPeerReader(const uint8_t *data, size_t len);
+
+    /**
+     * @brief 取出下一个
+     *
+     * @return 数据结束或格式错误时返回false, 用error()区分
+     */
+    bool next(Peer_Info &info);
+    bool next(Peer_Change &change);
+    bool error() const { return mError; }
+
+private:
+    bool decode(Peer_Info &info);
+
+private:
+    const uint8_t * mData;
+    const uint8_t * mEnd;
+    char            mLastName[PEER_NAME_SIZE];
+    size_t          mLastLength;
+    bool            mError;
+};
+
 // TODO: 修改为P2P需要的状态码
 #define P2P_STATUS_MAP(XX)                                                    \
     XX(100, CONTINUE,                        Continue)                        \
@@ -0,0 +1,164 @@
+/*************************************************************************
+    > File Name: test_compact_peers.cc
+    > Author: hsz
+    > Brief: 10k个peer全量列表的字节数: 原格式 vs 紧凑编码, 以及编解码往返/截断数据的检查
+    > Created Time: Sun 18 Oct 2026 04:48:10 AM CST
+ ************************************************************************/
+
+#include "protocol/protocol.h"
+#include <log/log.h>
+#include <algorithm>
+#include <vector>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <arpa/inet.h>
+
+#define LOG_TAG "main"
+
+static const uint32_t gPeers = 10000;
+static const uint32_t gPage = 256;      // registry.page_limit默认值
+
+static uint64_t nowNs()
+{
+    timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static bool samePeer(const Peer_Info &a, const Peer_Info &b)
+{
+    return a.host_binary == b.host_binary && a.port_binary == b.port_binary &&
+        strcmp(a.peer_uuid, b.peer_uuid) == 0 && strcmp(a.peer_name, b.peer_name) == 0;
+}
+
+// 与服务端一致: uuid为md5的32位小写十六进制, 约1/10的peer还没有上报udp地址
+static std::vector<Peer_Info> makePeers()
+{
+    std::vector<Peer_Info> peers(gPeers);
+    for (uint32_t i = 0; i < gPeers; ++i) {
+        Peer_Info &info = peers[i];
+        memset(&info, 0, sizeof(Peer_Info));
+        for (uint32_t k = 0; k < 32; ++k) {
+            info.peer_uuid[k] = "0123456789abcdef"[rand() % 16];
+        }
+        snprintf(info.peer_name, PEER_NAME_SIZE, "desktop-%u", i % 3000);
+        if (rand() % 10) {
+            info.host_binary = htonl(0x0a000000 + i);
+            info.port_binary = htons(20000 + i % 40000);
+        }
+    }
+    // GET_PEER_INFO的结果按(peer_name, peer_uuid)排序
+    std::sort(peers.begin(), peers.end(), [](const Peer_Info &a, const Peer_Info &b) {
+        int ret = strcmp(a.peer_name, b.peer_name);
+        return ret < 0 || (ret == 0 && strcmp(a.peer_uuid, b.peer_uuid) < 0);
+    });
+    return peers;
+}
+
+static size_t listLegacy(const std::vector<Peer_Info> &peers)
+{
+    size_t bytes = 0;
+    for (size_t begin = 0; begin < peers.size(); begin += gPage) {
+        size_t count = std::min<size_t>(gPage, peers.size() - begin);
+        FrameBuilder out(P2S_RESPONSE);
+        out.reserve(P2S_Response_Size);
+        out.append(&peers[begin], sizeof(Peer_Info) * count);
+        bytes += out.size();
+    }
+    return bytes;
+}
+
+static size_t listCompact(const std::vector<Peer_Info> &peers, std::vector<Peer_Info> *decoded)
+{
+    size_t bytes = 0;
+    for (size_t begin = 0; begin < peers.size(); begin += gPage) {
+        size_t count = std::min<size_t>(gPage, peers.size() - begin);
+        FrameBuilder out(P2S_RESPONSE);
+        size_t offset = out.reserve(P2S_Compact_Response_Size);
+        CompactPeerWriter writer(out);
+        for (size_t i = begin; i < begin + count; ++i) {
+            writer.append(peers[i]);
+        }
+        bytes += out.size();
+
+        if (decoded) {
+            size_t payload = offset + P2S_Compact_Response_Size;
+            CompactPeerReader reader(out.at<uint8_t>(payload), out.size() - payload);
+            Peer_Info info;
+            while (reader.next(info)) {
+                decoded->push_back(info);
+            }
+        }
+    }
+    return bytes;
+}
+
+int main(int argc, char **argv)
+{
+    srand(1);
+    uint32_t failed = 0;
+    std::vector<Peer_Info> peers = makePeers();
+
+    std::vector<Peer_Info> decoded;
+    size_t legacy = listLegacy(peers);
+    size_t compact = listCompact(peers, &decoded);
+    bool same = decoded.size() == peers.size();
+    for (size_t i = 0; same && i < peers.size(); ++i) {
+        same = samePeer(peers[i], decoded[i]);
+    }
+    failed += !same;
+    printf("%u peers in pages of %u: legacy %zu bytes, compact %zu bytes (%.1fx smaller), round trip %s\n",
+        gPeers, gPage, legacy, compact, (double)legacy / compact, same ? "ok" : "MISMATCH");
+
+    // 非服务端格式的uuid按字符串传输; Peer_Change带类型/分片/序号
+    Peer_Change change;
+    memset(&change, 0, sizeof(Peer_Change));
+    change.seq = 1ull << 40;
+    change.shard = 15;
+    change.type = PEER_CHANGE_UPDATE;
+    strcpy(change.peer_info.peer_name, "peer-1");
+    strcpy(change.peer_info.peer_uuid, "9E3779B1-0000-4000-8000-000000000001");
+    FrameBuilder out(P2S_RESPONSE);
+    CompactPeerWriter(out).append(change);
+    CompactPeerReader reader(out.at<uint8_t>(P2P_HEADER_SIZE), out.payloadSize());
+    Peer_Change back;
+    same = reader.next(back) && back.seq == change.seq && back.shard == change.shard &&
+        back.type == change.type && samePeer(back.peer_info, change.peer_info);
+    failed += !same;
+    printf("change with text uuid: %s\n", same ? "ok" : "MISMATCH");
+
+    // 每个截断位置都应报告格式错误, 而不是越界读取
+    uint32_t undetected = 0;
+    for (size_t len = 1; len < out.payloadSize(); ++len) {
+        CompactPeerReader truncated(out.at<uint8_t>(P2P_HEADER_SIZE), len);
+        if (truncated.next(back) || !truncated.error()) {
+            ++undetected;
+        }
+    }
+    failed += undetected != 0;
+    printf("truncated change: %u of %zu cuts undetected\n", undetected, out.payloadSize() - 1);
+
+    const uint32_t rounds = 50;
+    uint64_t start = nowNs();
+    for (uint32_t round = 0; round < rounds; ++round) {
+        listLegacy(peers);
+    }
+    uint64_t legacyNs = nowNs() - start;
+    start = nowNs();
+    for (uint32_t round = 0; round < rounds; ++round) {
+        listCompact(peers, nullptr);
+    }
+    uint64_t compactNs = nowNs() - start;
+    decoded.clear();
+    start = nowNs();
+    for (uint32_t round = 0; round < rounds; ++round) {
+        decoded.clear();
+        listCompact(peers, &decoded);
+    }
+    uint64_t decodeNs = nowNs() - start - compactNs;
+    printf("per peer: legacy build %.1f ns, compact encode %.1f ns, compact decode %.1f ns\n",
+        (double)legacyNs / rounds / gPeers, (double)compactNs / rounds / gPeers, (double)decodeNs / rounds / gPeers);
+    return failed;
+}
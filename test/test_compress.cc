@@ -0,0 +1,241 @@
+/*************************************************************************
+    > File Name: test_compress.cc
+    > Author: hsz
+    > Brief: GET_PEER_INFO响应压缩前后的字节数与每个响应的压缩/解压耗时, 损坏数据的解压检查, 以及与liblz4的互通
+    > Created Time: Sun 18 Oct 2026 05:58:03 AM CST
+ ************************************************************************/
+
+#include "protocol/protocol.h"
+#include "protocol/compress.h"
+#include <log/log.h>
+#include <algorithm>
+#include <vector>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <arpa/inet.h>
+#include <dlfcn.h>
+
+#define LOG_TAG "main"
+
+static const uint32_t gPage = 256;      // registry.page_limit默认值
+static const uint32_t gRounds = 2000;
+
+static uint64_t nowNs()
+{
+    timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+// 一页按名字排序的peer, uuid为md5的32位十六进制
+static std::vector<Peer_Info> makePage()
+{
+    std::vector<Peer_Info> peers(gPage);
+    for (uint32_t i = 0; i < gPage; ++i) {
+        Peer_Info &info = peers[i];
+        memset(&info, 0, sizeof(Peer_Info));
+        for (uint32_t k = 0; k < 32; ++k) {
+            info.peer_uuid[k] = "0123456789abcdef"[rand() % 16];
+        }
+        snprintf(info.peer_name, PEER_NAME_SIZE, "desktop-%u", 1000 + i * 7);
+        if (rand() % 10) {
+            info.host_binary = htonl(0x0a000000 + rand() % 65536);
+            info.port_binary = htons(20000 + rand() % 40000);
+        }
+    }
+    return peers;
+}
+
+static void buildLegacy(FrameBuilder &out, const std::vector<Peer_Info> &peers)
+{
+    P2S_Response response;
+    memset(&response, 0, sizeof(P2S_Response));
+    response.flag = P2S_RESPONSE_GET_PEER_INFO;
+    response.statusCode = 206;
+    response.number = peers.size();
+    strcpy(response.msg, "Partial Content");
+    out.append(&response, P2S_Response_Size);
+    out.append(peers.data(), sizeof(Peer_Info) * peers.size());
+    out.finish();
+}
+
+static void buildCompact(FrameBuilder &out, const std::vector<Peer_Info> &peers)
+{
+    P2S_Compact_Response response;
+    response.flag = P2S_RESPONSE_GET_PEER_INFO;
+    response.statusCode = 206;
+    response.number = peers.size();
+    out.append(&response, P2S_Compact_Response_Size);
+    CompactPeerWriter writer(out);
+    for (const Peer_Info &info : peers) {
+        writer.append(info);
+    }
+    out.finish();
+}
+
+static uint32_t bench(const char *name, const FrameBuilder &raw)
+{
+    static const uint32_t levels[] = { 1, 4, 16 };
+    uint32_t failed = 0;
+    printf("%s response: %zu bytes payload\n", name, raw.payloadSize());
+    for (uint32_t level : levels) {
+        FrameBuilder packed;
+        bool smaller = CompressFrame(raw, packed, level);
+        const uint8_t *frame = packed.finish();
+
+        uint64_t start = nowNs();
+        for (uint32_t round = 0; round < gRounds; ++round) {
+            CompressFrame(raw, packed, level);
+        }
+        uint64_t compressNs = (nowNs() - start) / gRounds;
+
+        FrameView view;
+        ProtocolParser::ParseView(frame, packed.size(), view);
+        std::vector<uint8_t> out;
+        start = nowNs();
+        for (uint32_t round = 0; round < gRounds; ++round) {
+            DecompressFrame(view, out, P2P_POOL_BUFFER_MAX);
+        }
+        uint64_t decompressNs = (nowNs() - start) / gRounds;
+
+        // 压缩后不更小时服务端发送原帧, 但压缩数据仍须能正确解压
+        bool same = (view.flags() & P2P_FRAME_COMPRESSED) && out.size() == raw.payloadSize() &&
+            memcmp(out.data(), raw.payload(), out.size()) == 0;
+        failed += !same;
+        printf("  level %2u: %6zu bytes (%5.1f%%), compress %6.1f us, decompress %5.1f us, %5.0f MB/s in, %s, round trip %s\n",
+            level, packed.payloadSize(), 100.0 * packed.payloadSize() / raw.payloadSize(), compressNs / 1e3,
+            decompressNs / 1e3, raw.payloadSize() * 1e3 / compressNs, smaller ? "compressed" : "sent as is",
+            same ? "ok" : "FAILED");
+    }
+    return failed;
+}
+
+// 随机输入: 长度和内容的可压缩程度都随机, 覆盖短输入、长匹配和接近64K偏移的匹配
+static void randomInput(std::vector<uint8_t> &src)
+{
+    size_t len = rand() % 4 == 0 ? rand() % 70000 : rand() % 2000;
+    src.resize(len);
+    uint32_t alphabet = 1 + rand() % 256;
+    for (size_t i = 0; i < len; ++i) {
+        if (i >= 8 && rand() % 8 == 0) {   // 复制前面的一段, 产生匹配
+            size_t from = rand() % i;
+            size_t run = std::min<size_t>(len - i, 4 + rand() % 300);
+            for (size_t k = 0; k < run; ++k) {
+                src[i + k] = src[from + k];
+            }
+            i += run - 1;
+        } else {
+            src[i] = rand() % alphabet;
+        }
+    }
+}
+
+/**
+ * @brief 与liblz4双向互通: 本实现压缩的数据liblz4能解压, liblz4压缩的数据本实现能解压.
+ * 运行时加载liblz4, 不存在时跳过
+ */
+static uint32_t checkLiblz4(uint32_t inputs)
+{
+    typedef int (*CompressFun)(const char *, char *, int, int, int);
+    typedef int (*DecompressFun)(const char *, char *, int, int);
+    void *lib = dlopen("liblz4.so.1", RTLD_NOW);
+    if (lib == nullptr) {
+        lib = dlopen("liblz4.so", RTLD_NOW);
+    }
+    CompressFun compressFast = lib ? (CompressFun)dlsym(lib, "LZ4_compress_fast") : nullptr;
+    DecompressFun decompressSafe = lib ? (DecompressFun)dlsym(lib, "LZ4_decompress_safe") : nullptr;
+    if (compressFast == nullptr || decompressSafe == nullptr) {
+        printf("liblz4 not found, interop check skipped\n");
+        return 0;
+    }
+
+    uint32_t ourFailed = 0, theirFailed = 0;
+    size_t ourBytes = 0, theirBytes = 0, rawBytes = 0;
+    std::vector<uint8_t> src, dst, back;
+    for (uint32_t i = 0; i < inputs; ++i) {
+        randomInput(src);
+        int level = 1 + rand() % 16;
+        dst.resize(Lz4CompressBound(src.size()));
+        back.resize(src.size());
+        rawBytes += src.size();
+
+        size_t size = Lz4Compress(src.data(), src.size(), dst.data(), dst.size(), level);
+        int ret = decompressSafe((const char *)dst.data(), (char *)back.data(), size, back.size());
+        ourBytes += size;
+        if (ret != (int)src.size() || back != src) {
+            ++ourFailed;
+        }
+
+        int theirs = compressFast((const char *)src.data(), (char *)dst.data(), src.size(), dst.size(), level);
+        std::fill(back.begin(), back.end(), 0);
+        ret = Lz4Decompress(dst.data(), theirs, back.data(), back.size());
+        theirBytes += theirs;
+        if (theirs <= 0 && !src.empty()) {
+            ++theirFailed;
+        } else if (ret != (int)src.size() || back != src) {
+            ++theirFailed;
+        }
+    }
+    dlclose(lib);
+    printf("liblz4 interop, %u random inputs (%zu bytes): ours -> LZ4_decompress_safe %u failed (%zu bytes), "
+        "LZ4_compress_fast -> ours %u failed (%zu bytes): %s\n", inputs, rawBytes, ourFailed, ourBytes,
+        theirFailed, theirBytes, ourFailed + theirFailed ? "FAILED" : "ok");
+    return ourFailed + theirFailed;
+}
+
+int main(int argc, char **argv)
+{
+    srand(1);
+    uint32_t failed = 0;
+    std::vector<Peer_Info> peers = makePage();
+
+    FrameBuilder legacy(P2S_RESPONSE);
+    buildLegacy(legacy, peers);
+    failed += bench("legacy", legacy);
+
+    FrameBuilder compact(P2S_RESPONSE);
+    buildCompact(compact, peers);
+    failed += bench("compact", compact);
+
+    // 随机数据不可压缩, 应发送原帧; 短数据和全部重复的数据也要能往返
+    std::vector<uint8_t> noise(8192);
+    for (auto &byte : noise) {
+        byte = rand();
+    }
+    FrameBuilder random(P2S_RESPONSE), packed;
+    random.append(noise.data(), noise.size());
+    printf("random 8192 bytes: %s\n", CompressFrame(random, packed, 1) ? "COMPRESSED" : "sent as is");
+
+    for (size_t len : { 0, 1, 12, 13, 100, 70000 }) {
+        std::vector<uint8_t> src(len, 'x'), dst(Lz4CompressBound(len)), back(len);
+        size_t size = Lz4Compress(src.data(), len, dst.data(), dst.size());
+        int ret = Lz4Decompress(dst.data(), size, back.data(), back.size());
+        if (ret != (int)len || back != src) {
+            printf("round trip of %zu repeated bytes FAILED\n", len);
+            ++failed;
+        }
+    }
+
+    // 损坏的数据: 解压不能越界, 只能返回错误或错误的内容
+    std::vector<uint8_t> block(Lz4CompressBound(compact.payloadSize()));
+    size_t size = Lz4Compress(compact.payload(), compact.payloadSize(), block.data(), block.size());
+    std::vector<uint8_t> out(compact.payloadSize());
+    uint32_t rejected = 0;
+    const uint32_t corruptions = 100000;
+    for (uint32_t i = 0; i < corruptions; ++i) {
+        std::vector<uint8_t> bad(block.begin(), block.begin() + size);
+        for (uint32_t k = 0; k < 4; ++k) {
+            bad[rand() % bad.size()] = rand();
+        }
+        size_t len = rand() % 4 == 0 ? rand() % bad.size() : bad.size();
+        if (Lz4Decompress(bad.data(), len, out.data(), out.size()) < 0) {
+            ++rejected;
+        }
+    }
+    printf("corrupted blocks: %u of %u rejected, no out-of-bounds access\n", rejected, corruptions);
+
+    failed += checkLiblz4(20000);
+    return failed;
+}
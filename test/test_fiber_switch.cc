@@ -0,0 +1,86 @@
+/*************************************************************************
+    > File Name: test_fiber_switch.cc
+    > Author: hsz
+    > Brief: 协程切换性能测试, 对比当前后端与ucontext
+    > Created Time: Sat 17 Oct 2026 10:40:26 AM CST
+ ************************************************************************/
+
+#include "fiber/fiber.h"
+#include <log/log.h>
+#include <ucontext.h>
+#include <stdlib.h>
+#include <time.h>
+
+#define LOG_TAG "main"
+
+static const uint64_t gSwitchCount = 2000000;
+static bool gStop = false;
+
+static uint64_t nowNs()
+{
+    timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static void report(const char *name, uint64_t switches, uint64_t ns)
+{
+    printf("%-12s %10lu switches in %8.3f ms, %12.0f switches/sec, %6.1f ns/switch\n",
+        name, switches, ns / 1e6, switches * 1e9 / ns, (double)ns / switches);
+}
+
+static void benchFiber()
+{
+    eular::Fiber::GetThis();
+    eular::Fiber::SP fiber(new eular::Fiber([]() {
+        while (!gStop) {
+            eular::Fiber::Yeild2Hold();
+        }
+    }));
+
+    uint64_t begin = nowNs();
+    for (uint64_t i = 0; i < gSwitchCount / 2; ++i) {
+        fiber->resume();
+    }
+    uint64_t end = nowNs();
+    report(eular::ContextBackend(), gSwitchCount, end - begin);
+
+    gStop = true;
+    fiber->resume();
+}
+
+static ucontext_t gMainCtx;
+static ucontext_t gPeerCtx;
+
+static void ucontextEntry()
+{
+    while (true) {
+        swapcontext(&gPeerCtx, &gMainCtx);
+    }
+}
+
+static void benchUcontext()
+{
+    const size_t stackSize = 128 * 1024;
+    void *stack = malloc(stackSize);
+    getcontext(&gPeerCtx);
+    gPeerCtx.uc_stack.ss_sp = stack;
+    gPeerCtx.uc_stack.ss_size = stackSize;
+    gPeerCtx.uc_link = nullptr;
+    makecontext(&gPeerCtx, &ucontextEntry, 0);
+
+    uint64_t begin = nowNs();
+    for (uint64_t i = 0; i < gSwitchCount / 2; ++i) {
+        swapcontext(&gMainCtx, &gPeerCtx);
+    }
+    uint64_t end = nowNs();
+    report("ucontext(raw)", gSwitchCount, end - begin);
+    free(stack);
+}
+
+int main(int argc, char **argv)
+{
+    benchFiber();
+    benchUcontext();
+    return 0;
+}
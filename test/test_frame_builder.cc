@@ -0,0 +1,135 @@
+/*************************************************************************
+    > File Name: test_frame_builder.cc
+    > Author: hsz
+    > Brief: GET_PEER_INFO响应的构造开销: vector + 临时ByteBuffer + generator vs FrameBuilder就地写入
+    > Created Time: Sun 18 Oct 2026 04:05:21 AM CST
+ ************************************************************************/
+
+#include "protocol/protocol.h"
+#include <log/log.h>
+#include <new>
+#include <vector>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define LOG_TAG "main"
+
+static const uint32_t gPage = 64;       // registry.page_limit
+static const uint32_t gRounds = 100000;
+static uint64_t gAllocations = 0;
+static uint64_t gAllocatedBytes = 0;
+
+void *operator new(size_t size)
+{
+    ++gAllocations;
+    gAllocatedBytes += size;
+    void *ptr = malloc(size);
+    if (ptr == nullptr) {
+        throw std::bad_alloc();
+    }
+    return ptr;
+}
+
+void operator delete(void *ptr) noexcept
+{
+    free(ptr);
+}
+
+static uint64_t nowNs()
+{
+    timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static Peer_Info gPeers[gPage];
+
+// 模拟PeerRegistry::list, 把一页结果写到out
+static uint32_t listPage(Peer_Info *out)
+{
+    memcpy(out, gPeers, sizeof(gPeers));
+    return gPage;
+}
+
+static P2S_Response makeResponse(uint32_t number)
+{
+    P2S_Response response;
+    memset(&response, 0, sizeof(P2S_Response));
+    response.flag = P2S_RESPONSE_GET_PEER_INFO;
+    response.statusCode = 200;
+    response.number = number;
+    strcpy(response.msg, "OK");
+    return response;
+}
+
+// 原来的方式: 结果先放到vector, 再和响应拼到临时ByteBuffer, 最后generator复制成帧
+static uint64_t buildCopy()
+{
+    std::vector<Peer_Info> peers(gPage);
+    peers.resize(listPage(peers.data()));
+    P2S_Response response = makeResponse(peers.size());
+
+    eular::ByteBuffer temp;
+    temp.append((uint8_t *)&response, sizeof(P2S_Response));
+    temp.append((uint8_t *)peers.data(), sizeof(Peer_Info) * peers.size());
+    eular::ByteBuffer frame = ProtocolGenerator::generator(P2S_RESPONSE, temp);
+    return frame.size() + frame[P2P_HEADER_SIZE + sizeof(P2S_Response)];
+}
+
+static uint64_t buildInPlace()
+{
+    FrameBuilder out(P2S_RESPONSE);
+    size_t responseOffset = out.reserve(sizeof(P2S_Response));
+    size_t offset = out.reserve(sizeof(Peer_Info) * gPage);
+    uint32_t count = listPage(out.at<Peer_Info>(offset));
+    out.truncate(offset + sizeof(Peer_Info) * count);
+    P2S_Response response = makeResponse(count);
+    memcpy(out.at<P2S_Response>(responseOffset), &response, sizeof(P2S_Response));
+
+    const uint8_t *frame = out.finish();
+    return out.size() + frame[P2P_HEADER_SIZE + sizeof(P2S_Response)];
+}
+
+template<typename Fun>
+static void bench(const char *name, Fun fun)
+{
+    uint64_t sum = fun();   // 预热, 填充线程缓存
+    uint64_t allocations = gAllocations, bytes = gAllocatedBytes;
+    uint64_t start = nowNs();
+    for (uint32_t round = 0; round < gRounds; ++round) {
+        sum += fun();
+    }
+    uint64_t elapsed = nowNs() - start;
+    printf("%-8s %7.1f ns/response, %.2f allocations/response, %7.0f bytes allocated/response (checksum %lu)\n",
+        name, (double)elapsed / gRounds, (double)(gAllocations - allocations) / gRounds,
+        (double)(gAllocatedBytes - bytes) / gRounds, sum);
+}
+
+int main(int argc, char **argv)
+{
+    for (uint32_t i = 0; i < gPage; ++i) {
+        snprintf(gPeers[i].peer_name, PEER_NAME_SIZE, "peer-%u", i);
+        snprintf(gPeers[i].peer_uuid, UUID_SIZE, "9e3779b1-0000-4000-8000-%012x", i);
+    }
+
+    // 两种方式构造的帧须一致
+    std::vector<Peer_Info> peers(gPeers, gPeers + gPage);
+    P2S_Response response = makeResponse(gPage);
+    eular::ByteBuffer temp;
+    temp.append((uint8_t *)&response, sizeof(P2S_Response));
+    temp.append((uint8_t *)peers.data(), sizeof(Peer_Info) * peers.size());
+    eular::ByteBuffer expect = ProtocolGenerator::generator(P2S_RESPONSE, temp);
+
+    FrameBuilder out(P2S_RESPONSE);
+    out.append(&response, sizeof(P2S_Response));
+    out.append(gPeers, sizeof(gPeers));
+    const uint8_t *frame = out.finish();
+    bool same = out.size() == expect.size() && memcmp(frame, expect.const_data(), expect.size()) == 0;
+    printf("%u peers, %zu bytes per frame, identical: %s\n", gPage, expect.size(), same ? "yes" : "NO");
+
+    bench("copy", buildCopy);
+    bench("builder", buildInPlace);
+    return same ? 0 : 1;
+}
@@ -0,0 +1,130 @@
+/*************************************************************************
+    > File Name: test_frame_view.cc
+    > Author: hsz
+    > Brief: GET_PEER_INFO请求的解码速度: 复制到ProtocolParser再memcpy到结构体 vs FrameView直接访问
+    > Created Time: Sun 18 Oct 2026 02:03:16 AM CST
+ ************************************************************************/
+
+#include "protocol/protocol.h"
+#include <log/log.h>
+#include <new>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define LOG_TAG "main"
+
+static const uint32_t gFrames = 1000;   // 一次读取到的流水线请求
+static const uint32_t gRounds = 2000;
+static uint64_t gAllocations = 0;
+
+void *operator new(size_t size)
+{
+    ++gAllocations;
+    void *ptr = malloc(size);
+    if (ptr == nullptr) {
+        throw std::bad_alloc();
+    }
+    return ptr;
+}
+
+void operator delete(void *ptr) noexcept
+{
+    free(ptr);
+}
+
+static uint64_t nowNs()
+{
+    timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static eular::ByteBuffer makeStream()
+{
+    uint8_t payload[Peer_Info_Size + Peer_Query_Size];
+    Peer_Info *info = (Peer_Info *)payload;
+    Peer_Query *query = (Peer_Query *)(payload + Peer_Info_Size);
+    memset(payload, 0, sizeof(payload));
+    strcpy(info->peer_name, "peer-1");
+    strcpy(info->peer_uuid, "9e3779b1-0000-4000-8000-000000000001");
+    strcpy(query->name_prefix, "peer-4");
+    query->flags = PEER_QUERY_UDP_ONLY;
+    query->max_count = 64;
+
+    eular::ByteBuffer stream;
+    for (uint32_t i = 0; i < gFrames; ++i) {
+        eular::ByteBuffer frame = ProtocolGenerator::generator(P2S_REQUEST_GET_PEER_INFO, payload, sizeof(payload));
+        stream.append(frame.const_data(), frame.size());
+    }
+    return stream;
+}
+
+// 原来的方式: 数据复制到ProtocolParser, 再memcpy到结构体
+static uint64_t decodeCopy(ProtocolDecoder &decoder)
+{
+    ProtocolParser parser;
+    uint64_t sum = 0;
+    while (decoder.next(parser) == ProtocolDecoder::FRAME_READY) {
+        Peer_Info info;
+        Peer_Query query;
+        eular::ByteBuffer &data = parser.data();
+        memcpy(&info, data.const_data(), data.size() < Peer_Info_Size ? data.size() : Peer_Info_Size);
+        if (data.size() >= Peer_Info_Size + Peer_Query_Size) {
+            memcpy(&query, data.const_data() + Peer_Info_Size, Peer_Query_Size);
+            sum += query.max_count;
+        }
+        sum += info.peer_name[5];
+    }
+    return sum;
+}
+
+static uint64_t decodeView(ProtocolDecoder &decoder)
+{
+    FrameView frame;
+    uint64_t sum = 0;
+    while (decoder.next(frame) == ProtocolDecoder::FRAME_READY) {
+        const Peer_Info *info = frame.get<Peer_Info>();
+        const Peer_Query *query = frame.get<Peer_Query>(Peer_Info_Size);
+        if (info == nullptr) {
+            continue;
+        }
+        if (query) {
+            sum += query->max_count;
+        }
+        sum += info->peer_name[5];
+    }
+    return sum;
+}
+
+template<typename Fun>
+static void bench(const char *name, const eular::ByteBuffer &stream, Fun fun)
+{
+    ProtocolDecoder decoder;
+    decoder.buffer().append(stream.const_data(), stream.size());
+    fun(decoder);   // 预热, 使接收缓存达到所需容量
+
+    uint64_t sum = 0;
+    uint64_t elapsed = 0;
+    uint64_t allocations = 0;
+    for (uint32_t round = 0; round < gRounds; ++round) {
+        decoder.buffer().append(stream.const_data(), stream.size());
+        uint64_t before = gAllocations;
+        uint64_t start = nowNs();
+        sum += fun(decoder);
+        elapsed += nowNs() - start;
+        allocations += gAllocations - before;
+    }
+    uint64_t frames = (uint64_t)gFrames * gRounds;
+    printf("%-5s %7.2f Mframes/s, %5.1f ns/frame, %.2f allocations/frame (checksum %lu)\n",
+        name, frames * 1e3 / elapsed, (double)elapsed / frames, (double)allocations / frames, sum);
+}
+
+int main(int argc, char **argv)
+{
+    eular::ByteBuffer stream = makeStream();
+    bench("copy", stream, decodeCopy);
+    bench("view", stream, decodeView);
+    return 0;
+}
@@ -0,0 +1,232 @@
+/*************************************************************************
+    > File Name: test_io_backend.cc
+    > Author: hsz
+    > Brief: 对比epoll与io_uring后端: 回环TCP上accept/connect后做ping-pong
+    > Created Time: Sat 17 Oct 2026 06:41:09 PM CST
+ ************************************************************************/
+
+#include "iomanager.h"
+#include "config.h"
+#include "fdmanager.h"
+#include <log/log.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <errno.h>
+#include <atomic>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#define LOG_TAG "main"
+
+static const uint32_t gConnections = 16;
+static const uint32_t gRounds = 5000;
+static const uint32_t gMessageSize = 64;
+static std::atomic<uint32_t> gDone(0);
+static std::atomic<uint32_t> gErrors(0);
+
+static uint64_t nowNs()
+{
+    timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static bool recvAll(int fd, char *buf, size_t len)
+{
+    size_t got = 0;
+    while (got < len) {
+        ssize_t n = recv(fd, buf + got, len - got, 0);
+        if (n <= 0) {
+            return false;
+        }
+        got += n;
+    }
+    return true;
+}
+
+static void echo(int fd)
+{
+    char buf[gMessageSize];
+    while (recvAll(fd, buf, sizeof(buf))) {
+        if (send(fd, buf, sizeof(buf), 0) != sizeof(buf)) {
+            ++gErrors;
+            break;
+        }
+    }
+    close(fd);
+}
+
+static void acceptor(int listenFd)
+{
+    eular::IOManager *iom = eular::IOManager::GetThis();
+    for (uint32_t i = 0; i < gConnections; ++i) {
+        int fd = accept(listenFd, nullptr, nullptr);
+        if (fd < 0) {
+            ++gErrors;
+            continue;
+        }
+        iom->schedule(std::bind(&echo, fd));
+    }
+    close(listenFd);
+}
+
+static void client(sockaddr_in addr)
+{
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    int on = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+    if (connect(fd, (sockaddr *)&addr, sizeof(addr)) != 0) {
+        ++gErrors;
+        close(fd);
+        ++gDone;
+        return;
+    }
+
+    char buf[gMessageSize];
+    memset(buf, 'x', sizeof(buf));
+    for (uint32_t r = 0; r < gRounds; ++r) {
+        if (send(fd, buf, sizeof(buf), 0) != sizeof(buf) || !recvAll(fd, buf, sizeof(buf))) {
+            ++gErrors;
+            break;
+        }
+    }
+    close(fd);
+    ++gDone;
+}
+
+static void useBackend(const char *backend)
+{
+    char path[] = "/tmp/test_io_backend_XXXXXX";
+    int tmp = mkstemp(path);
+    dprintf(tmp, "iomanager:\n  backend: %s\n", backend);
+    ::close(tmp);
+    eular::ConfigManager::get()->Init(path);
+    unlink(path);
+}
+
+struct RecvResult {
+    std::atomic<bool> done = {false};
+    ssize_t n = 0;
+    int error = 0;
+    uint64_t elapsedMs = 0;
+};
+
+static void timedRecv(int fd, uint32_t timeoutMs, RecvResult *result)
+{
+    timeval tv = { (time_t)(timeoutMs / 1000), (suseconds_t)(timeoutMs % 1000 * 1000) };
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+    char buf[16];
+    uint64_t begin = nowNs();
+    result->n = recv(fd, buf, sizeof(buf), 0);
+    result->error = errno;
+    result->elapsedMs = (nowNs() - begin) / 1000000;
+    result->done = true;
+}
+
+/**
+ * @brief 超时到期返回ETIMEDOUT; 超时为0时一直等到数据到达; 等待中fd被关闭时两个后端都立即返回EBADF
+ */
+static uint32_t checkCancel(const char *backend)
+{
+    useBackend(backend);
+    eular::IOManager iom(2, false, "io_cancel");
+    int timeoutPair[2], zeroPair[2], closePair[2];
+    socketpair(AF_UNIX, SOCK_STREAM, 0, timeoutPair);
+    socketpair(AF_UNIX, SOCK_STREAM, 0, zeroPair);
+    socketpair(AF_UNIX, SOCK_STREAM, 0, closePair);
+
+    RecvResult timedOut, untimed, closed;
+    iom.schedule([&]() {
+        eular::FdManager::Get()->get(timeoutPair[0], true);
+        timedRecv(timeoutPair[0], 50, &timedOut);
+    });
+    iom.schedule([&]() {
+        eular::FdManager::Get()->get(zeroPair[0], true);
+        timedRecv(zeroPair[0], 0, &untimed);
+    });
+    iom.schedule([&]() {
+        eular::FdManager::Get()->get(closePair[0], true);
+        timedRecv(closePair[0], 5000, &closed);
+    });
+    usleep(20 * 1000);
+    iom.schedule([&]() {
+        close(closePair[0]);
+    });
+    usleep(80 * 1000);
+    ::send(zeroPair[1], "x", 1, 0);
+    while (!timedOut.done || !untimed.done || !closed.done) {
+        usleep(1000);
+    }
+
+    bool timeoutOk = timedOut.n < 0 && timedOut.error == ETIMEDOUT;
+    bool untimedOk = untimed.n == 1 && untimed.elapsedMs >= 50;
+    bool closeOk = closed.n < 0 && closed.error == EBADF && closed.elapsedMs < 1000;
+    printf("%-8s(%s) recv timeout: %s after %lu ms, %s | zero timeout: %zd bytes after %lu ms, %s"
+        " | closed while waiting: %s after %lu ms, %s\n",
+        backend, iom.uringEnabled() ? "io_uring" : "epoll", strerror(timedOut.error), timedOut.elapsedMs,
+        timeoutOk ? "ok" : "FAILED", untimed.n, untimed.elapsedMs, untimedOk ? "ok" : "FAILED",
+        strerror(closed.error), closed.elapsedMs, closeOk ? "ok" : "FAILED");
+    ::close(timeoutPair[0]);
+    ::close(timeoutPair[1]);
+    ::close(zeroPair[0]);
+    ::close(zeroPair[1]);
+    ::close(closePair[1]);
+    return !timeoutOk + !untimedOk + !closeOk;
+}
+
+static uint32_t bench(const char *backend, uint32_t threads)
+{
+    useBackend(backend);
+
+    gDone = 0;
+    gErrors = 0;
+    eular::IOManager iom(threads, false, "io_backend");
+
+    int listenFd = ::socket(AF_INET, SOCK_STREAM, 0);
+    sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    socklen_t len = sizeof(addr);
+    if (bind(listenFd, (sockaddr *)&addr, len) || listen(listenFd, 128) ||
+        getsockname(listenFd, (sockaddr *)&addr, &len)) {
+        perror("listen");
+        exit(1);
+    }
+
+    uint64_t begin = nowNs();
+    // 监听fd在调度线程中注册到FdManager, 以便accept走hook
+    iom.schedule([listenFd]() {
+        eular::FdManager::Get()->get(listenFd, true);
+        acceptor(listenFd);
+    });
+    for (uint32_t i = 0; i < gConnections; ++i) {
+        iom.schedule(std::bind(&client, addr));
+    }
+    while (gDone.load() < gConnections) {
+        usleep(1000);
+    }
+    uint64_t end = nowNs();
+
+    uint64_t total = (uint64_t)gConnections * gRounds;
+    printf("%-8s(%s) threads %u: %lu round trips in %8.3f ms, %10.0f rt/sec, %6.2f us/rt, errors %u\n",
+        backend, iom.uringEnabled() ? "io_uring" : "epoll", threads, total, (end - begin) / 1e6,
+        total * 1e9 / (end - begin), (end - begin) / 1e3 / total, gErrors.load());
+    return gErrors.load();
+}
+
+int main(int argc, char **argv)
+{
+    uint32_t threads = argc > 1 ? atoi(argv[1]) : 2;
+    uint32_t failed = 0;
+    failed += bench("epoll", threads);
+    failed += bench("io_uring", threads);
+    failed += checkCancel("epoll");
+    failed += checkCancel("io_uring");
+    return failed != 0;
+}
@@ -0,0 +1,92 @@
+/*************************************************************************
+    > File Name: test_io_syscalls.cc
+    > Author: hsz
+    > Brief: 统计hook的recv/send在epoll后端下每次往返的epoll_ctl/epoll_wait次数
+    > Created Time: Sat 17 Oct 2026 07:26:44 PM CST
+ ************************************************************************/
+
+#include "iomanager.h"
+#include "fdmanager.h"
+#include <log/log.h>
+#include <dlfcn.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <atomic>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#define LOG_TAG "main"
+
+static std::atomic<uint64_t> gEpollCtlCount(0);
+static std::atomic<uint64_t> gEpollWaitCount(0);
+
+typedef int (*epoll_ctl_fun)(int, int, int, struct epoll_event *);
+typedef int (*epoll_wait_fun)(int, struct epoll_event *, int, int);
+
+extern "C" int epoll_ctl(int epfd, int op, int fd, struct epoll_event *event)
+{
+    static epoll_ctl_fun real = (epoll_ctl_fun)dlsym(RTLD_NEXT, "epoll_ctl");
+    ++gEpollCtlCount;
+    return real(epfd, op, fd, event);
+}
+
+extern "C" int epoll_wait(int epfd, struct epoll_event *events, int maxevents, int timeout)
+{
+    static epoll_wait_fun real = (epoll_wait_fun)dlsym(RTLD_NEXT, "epoll_wait");
+    ++gEpollWaitCount;
+    return real(epfd, events, maxevents, timeout);
+}
+
+static const uint32_t gPairs = 8;
+static const uint32_t gRounds = 10000;
+static std::atomic<uint32_t> gDone(0);
+
+static void pingpong(int fd, bool initiator)
+{
+    char c = 'x';
+    for (uint32_t r = 0; r < gRounds; ++r) {
+        if (initiator && send(fd, &c, 1, 0) != 1) {
+            break;
+        }
+        if (recv(fd, &c, 1, 0) != 1) {
+            break;
+        }
+        if (!initiator && send(fd, &c, 1, 0) != 1) {
+            break;
+        }
+    }
+    ++gDone;
+}
+
+int main(int argc, char **argv)
+{
+    uint32_t threads = argc > 1 ? atoi(argv[1]) : 1;
+    int fds[gPairs][2];
+    {
+        eular::IOManager iom(threads, false, "syscalls");
+        for (uint32_t i = 0; i < gPairs; ++i) {
+            socketpair(AF_UNIX, SOCK_STREAM, 0, fds[i]);
+            eular::FdManager::Get()->get(fds[i][0], true);
+            eular::FdManager::Get()->get(fds[i][1], true);
+        }
+
+        uint64_t ctlBegin = gEpollCtlCount.load();
+        uint64_t waitBegin = gEpollWaitCount.load();
+        for (uint32_t i = 0; i < gPairs; ++i) {
+            iom.schedule(std::bind(&pingpong, fds[i][0], true));
+            iom.schedule(std::bind(&pingpong, fds[i][1], false));
+        }
+        while (gDone.load() < gPairs * 2) {
+            usleep(1000);
+        }
+
+        uint64_t roundTrips = (uint64_t)gPairs * gRounds;
+        uint64_t ctl = gEpollCtlCount.load() - ctlBegin;
+        uint64_t wait = gEpollWaitCount.load() - waitBegin;
+        printf("threads %u, %lu round trips (%lu recv): epoll_ctl %lu (%.3f per recv), epoll_wait %lu (%.3f per recv)\n",
+            threads, roundTrips, roundTrips * 2, ctl, (double)ctl / (roundTrips * 2),
+            wait, (double)wait / (roundTrips * 2));
+    }
+    return 0;
+}
@@ -0,0 +1,46 @@
+/*************************************************************************
+    > File Name: test_iomanager_wakeup.cc
+    > Author: hsz
+    > Brief: 统计IOManager突发投递任务时的唤醒次数
+    > Created Time: Sat 17 Oct 2026 04:52:17 PM CST
+ ************************************************************************/
+
+#include "iomanager.h"
+#include <log/log.h>
+#include <atomic>
+#include <sched.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#define LOG_TAG "main"
+
+static const uint64_t gBurstCount = 1000;
+static const uint64_t gBurstSize = 64;
+static std::atomic<uint64_t> gDone(0);
+
+static void task()
+{
+    ++gDone;
+}
+
+int main(int argc, char **argv)
+{
+    uint32_t threads = argc > 1 ? atoi(argv[1]) : 4;
+    eular::IOManager iom(threads, false, "wakeup");
+
+    for (uint64_t i = 0; i < gBurstCount; ++i) {
+        for (uint64_t j = 0; j < gBurstSize; ++j) {
+            iom.schedule(&task);
+        }
+        while (gDone.load() < (i + 1) * gBurstSize) {
+            sched_yield();
+        }
+        usleep(100);    // 让工作线程回到epoll_wait
+    }
+
+    eular::IOManager::WakeupStats stats = iom.getWakeupStats();
+    printf("threads %u, %lu tasks in %lu bursts: tickle %lu, needed %lu, eventfd writes %lu (%.2f per burst)\n",
+        threads, gBurstCount * gBurstSize, gBurstCount, stats.requested, stats.needed, stats.issued,
+        (double)stats.issued / gBurstCount);
+    return 0;
+}
@@ -0,0 +1,197 @@
+/*************************************************************************
+    > File Name: test_message_dispatch.cc
+    > Author: hsz
+    > Brief: 按消息表展开的switch分发与原来手写switch + memcpy, 函数指针表的开销对比, 以及长度不符的请求是否被拒绝
+    > Created Time: Sun 18 Oct 2026 03:12:45 AM CST
+ ************************************************************************/
+
+#include "protocol/message.h"
+#include <log/log.h>
+#include <vector>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define LOG_TAG "main"
+
+static const uint32_t gFrames = 4096;
+static const uint32_t gRounds = 2000;
+
+static uint64_t nowNs()
+{
+    timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+#define TEST_MESSAGE_MAP(XX)                                                                                    \
+    XX(P2S_REQUEST_SEND_PEER_INFO,   P2S_RESPONSE_SEND_PEER_INFO,   Peer_Info,    0,               onSend)    \
+    XX(P2S_REQUEST_GET_PEER_INFO,    P2S_RESPONSE_GET_PEER_INFO,    Peer_Info,    Peer_Query_Size, onGet)     \
+    XX(P2S_REQUEST_CONNECT_TO_PEER,  P2S_RESPONSE_CONNECT_TO_PEER,  Peer_Connect, 0,               onConnect) \
+    XX(P2S_REQUEST_HEARTBEAT_DETECT, P2S_RESPONSE_HEARTBEAT_DETECT, Peer_Info,    0,               onSend)    \
+
+struct Result {
+    uint64_t sum = 0;
+    uint32_t rejected = 0;
+};
+
+class Handler
+{
+public:
+    MessageResult dispatch(const FrameView &frame, Result &ctx, MessageInfo &info)
+    {
+        P2S_MESSAGE_DISPATCH(TEST_MESSAGE_MAP)
+    }
+
+    void onSend(const FrameView &frame, const Peer_Info &info, Result &result)
+    {
+        result.sum += info.peer_name[0];
+    }
+    void onGet(const FrameView &frame, const Peer_Info &info, Result &result)
+    {
+        const Peer_Query *query = frame.get<Peer_Query>(Peer_Info_Size);
+        result.sum += info.peer_name[0] + (query ? query->max_count : 0);
+    }
+    void onConnect(const FrameView &frame, const Peer_Connect &msg, Result &result)
+    {
+        result.sum += msg.target.peer_name[0];
+    }
+};
+
+#define XX(cmd, response, type, extra, method) P2S_MESSAGE_STATIC_CHECK(cmd, response, type, extra, method)
+TEST_MESSAGE_MAP(XX)
+#undef XX
+
+static void dispatchMap(Handler &handler, const FrameView &frame, Result &result)
+{
+    MessageInfo info;
+    if (handler.dispatch(frame, result, info) != MessageResult::OK) {
+        ++result.rejected;
+    }
+}
+
+// 对照: 以命令为下标的函数指针表, 处理函数无法内联, 命令随机时间接调用预测失败
+struct TableEntry {
+    MessageInfo info;
+    void (*thunk)(Handler &, const FrameView &, Result &);
+};
+static TableEntry gTable[16];
+
+template<typename T, void (Handler::*Method)(const FrameView &, const T &, Result &)>
+static void invoke(Handler &handler, const FrameView &frame, Result &result)
+{
+    (handler.*Method)(frame, *reinterpret_cast<const T *>(frame.data()), result);
+}
+
+static void dispatchTable(Handler &handler, const FrameView &frame, Result &result)
+{
+    uint16_t slot = frame.commnd() - P2S_REQUEST;
+    if (slot >= 16 || gTable[slot].thunk == nullptr || !gTable[slot].info.accept(frame.length())) {
+        ++result.rejected;
+        return;
+    }
+    gTable[slot].thunk(handler, frame, result);
+}
+
+// 原来的写法: switch后复制到栈上的结构体, 各分支自行检查长度
+static void dispatchSwitch(Handler &handler, const FrameView &frame, Result &result)
+{
+    switch (frame.commnd()) {
+    case P2S_REQUEST_SEND_PEER_INFO:
+    case P2S_REQUEST_HEARTBEAT_DETECT:
+    {
+        if (frame.length() != Peer_Info_Size) {
+            ++result.rejected;
+            break;
+        }
+        Peer_Info info;
+        memcpy(&info, frame.data(), Peer_Info_Size);
+        handler.onSend(frame, info, result);
+        break;
+    }
+    case P2S_REQUEST_GET_PEER_INFO:
+    {
+        if (frame.length() < Peer_Info_Size || frame.length() > Peer_Info_Size + Peer_Query_Size) {
+            ++result.rejected;
+            break;
+        }
+        Peer_Info info;
+        memcpy(&info, frame.data(), Peer_Info_Size);
+        handler.onGet(frame, info, result);
+        break;
+    }
+    case P2S_REQUEST_CONNECT_TO_PEER:
+    {
+        if (frame.length() != Peer_Connect_Size) {
+            ++result.rejected;
+            break;
+        }
+        Peer_Connect msg;
+        memcpy(&msg, frame.data(), Peer_Connect_Size);
+        handler.onConnect(frame, msg, result);
+        break;
+    }
+    default:
+        ++result.rejected;
+        break;
+    }
+}
+
+template<typename Fun>
+static void bench(const char *name, const std::vector<FrameView> &frames, Fun fun)
+{
+    Handler handler;
+    Result result;
+    uint64_t start = nowNs();
+    for (uint32_t round = 0; round < gRounds; ++round) {
+        for (const FrameView &frame : frames) {
+            fun(handler, frame, result);
+        }
+    }
+    uint64_t elapsed = nowNs() - start;
+    uint64_t count = (uint64_t)frames.size() * gRounds;
+    printf("%-6s %5.2f ns/request, rejected %u per round (checksum %lu)\n",
+        name, (double)elapsed / count, result.rejected / gRounds, result.sum);
+}
+
+int main(int argc, char **argv)
+{
+    static const uint16_t commands[] = {
+        P2S_REQUEST_SEND_PEER_INFO, P2S_REQUEST_GET_PEER_INFO, P2S_REQUEST_CONNECT_TO_PEER,
+        P2S_REQUEST_HEARTBEAT_DETECT, P2S_REQUEST_SUBSCRIBE_PEERS,
+    };
+    static uint8_t payload[Peer_Connect_Size + Peer_Query_Size];
+    memset(payload, 'a', sizeof(payload));
+
+    // 随机命令, 约1/16的请求长度不符或命令未注册
+    srand(1);
+    uint32_t expectRejected = 0;
+    std::vector<FrameView> frames;
+    for (uint32_t i = 0; i < gFrames; ++i) {
+        uint16_t cmd = commands[rand() % 4];
+        uint32_t length = cmd == P2S_REQUEST_CONNECT_TO_PEER ? Peer_Connect_Size :
+            cmd == P2S_REQUEST_GET_PEER_INFO ? Peer_Info_Size + Peer_Query_Size : Peer_Info_Size;
+        if (rand() % 16 == 0) {
+            if (rand() & 1) {
+                length = Peer_Info_Size - 1;
+            } else {
+                cmd = commands[4];
+            }
+            ++expectRejected;
+        }
+        frames.push_back(FrameView(cmd, 0, payload, length));
+    }
+    printf("%u requests, %u malformed or unknown\n", gFrames, expectRejected);
+
+#define XX(cmd, response, type, extra, method)                                          \
+    gTable[cmd - P2S_REQUEST].info = MakeMessageInfo<type>(cmd, response, extra);       \
+    gTable[cmd - P2S_REQUEST].thunk = &invoke<type, &Handler::method>;
+    TEST_MESSAGE_MAP(XX)
+#undef XX
+
+    bench("switch", frames, dispatchSwitch);
+    bench("table", frames, dispatchTable);
+    bench("map", frames, dispatchMap);
+    return 0;
+}
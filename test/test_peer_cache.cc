@@ -0,0 +1,259 @@
+/*************************************************************************
+    > File Name: test_peer_cache.cc
+    > Author: hsz
+    > Brief: GET_PEER_INFO响应缓存: 每次生成 vs 命中时共用缓冲区的开销, 有变更时的命中率,
+    >        以及各种编码下共用结果与排除自身的结果一致
+    > Created Time: Sun 18 Oct 2026 07:12:35 AM CST
+ ************************************************************************/
+
+#include "peer_registry.h"
+#include "peer_cache.h"
+#include "p2p_session.h"
+#include "protocol/compress.h"
+#include "config.h"
+#include "core/clock.h"
+#include "protocol/protocol.h"
+#include <log/log.h>
+#include <arpa/inet.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#define LOG_TAG "main"
+
+static const uint32_t gPeers = 10000;
+static const uint32_t gRequests = 200000;
+static const uint32_t gChangeEvery = 1000;  // 平均每1000个请求有一次peer变更
+
+static uint64_t nowNs()
+{
+    timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static eular::String8 uuidOf(uint32_t i)
+{
+    char buf[UUID_SIZE];
+    snprintf(buf, sizeof(buf), "%08x%08x%016x", i * 2654435761u, i, i);
+    return eular::String8(buf);
+}
+
+// 每10个peer中有一个名字为PEER_NAME_SIZE个字符, 注册时截断, 客户端发送的是完整的
+static eular::String8 nameOf(uint32_t i)
+{
+    char name[PEER_NAME_SIZE + 1];
+    if (i % 10 == 0) {
+        snprintf(name, sizeof(name), "peer-%u-%026u", i % 1000, i);
+    } else {
+        snprintf(name, sizeof(name), "peer-%u", i % 1000);
+    }
+    return eular::String8(name);
+}
+
+static void join(eular::PeerRegistry *registry, uint32_t i)
+{
+    eular::PeerRecord record;
+    record.name = nameOf(i);
+    record.tcpHost = htonl(0x0a000000 + i);
+    record.tcpPort = htons(10000 + i % 50000);
+    record.lastSeenMs = eular::Clock::NowMs();
+    registry->registerPeer(uuidOf(i), record);
+    registry->updateUdp(uuidOf(i), htonl(0x0a000000 + i), htons(20000 + i % 40000));
+}
+
+static eular::P2PSession::FrameFormat formatOf(uint32_t capabilities)
+{
+    eular::P2PSession::FrameFormat format;
+    format.capabilities = capabilities;
+    format.compressThreshold = 4096;    // tcp.compress_threshold默认值
+    format.compressLevel = 1;
+    return format;
+}
+
+/**
+ * @brief 按客户端的方式解码响应帧: 解压, 再按紧凑编码或Peer_Info数组取出peer
+ */
+static bool decodePage(const std::vector<uint8_t> &frame, bool compact, uint16_t &statusCode,
+    std::vector<Peer_Info> &peers)
+{
+    FrameView view;
+    if (!ProtocolParser::ParseView(frame.data(), frame.size(), view)) {
+        return false;
+    }
+    std::vector<uint8_t> payload;
+    if (view.flags() & P2P_FRAME_COMPRESSED) {
+        if (!DecompressFrame(view, payload, P2P_POOL_BUFFER_MAX)) {
+            return false;
+        }
+    } else {
+        payload.assign(view.data(), view.data() + view.length());
+    }
+
+    peers.clear();
+    if (compact) {
+        if (payload.size() < P2S_Compact_Response_Size) {
+            return false;
+        }
+        const P2S_Compact_Response *response = (const P2S_Compact_Response *)payload.data();
+        statusCode = response->statusCode;
+        CompactPeerReader reader(payload.data() + P2S_Compact_Response_Size, payload.size() - P2S_Compact_Response_Size);
+        Peer_Info info;
+        while (reader.next(info)) {
+            peers.push_back(info);
+        }
+        return !reader.error() && peers.size() == response->number;
+    }
+    if (payload.size() < P2S_Response_Size) {
+        return false;
+    }
+    const P2S_Response *response = (const P2S_Response *)payload.data();
+    statusCode = response->statusCode;
+    if (payload.size() != P2S_Response_Size + Peer_Info_Size * response->number) {
+        return false;
+    }
+    const Peer_Info *begin = (const Peer_Info *)(payload.data() + P2S_Response_Size);
+    peers.assign(begin, begin + response->number);
+    return true;
+}
+
+/**
+ * @brief 共用的响应解码后须与排除请求者自身的结果(onRequestGetPeerInfo未命中缓存时发送的)相同
+ */
+static bool sameAsOwn(eular::PeerRegistry *registry, const eular::PeerQuery &query, const eular::String8 &self,
+    const eular::PeerListCache::EntrySP &entry, uint32_t capabilities)
+{
+    std::vector<Peer_Info> expect, peers;
+    bool more = registry->list(query, self, expect);
+    uint16_t statusCode = 0;
+    if (!decodePage(entry->frame, capabilities & P2P_CAP_COMPACT_PEERS, statusCode, peers)) {
+        return false;
+    }
+    if (statusCode != (more ? (uint16_t)P2PStatus::PARTIAL_CONTENT : (uint16_t)P2PStatus::OK) ||
+        peers.size() != expect.size()) {
+        return false;
+    }
+    for (size_t i = 0; i < peers.size(); ++i) {
+        if (peers[i].host_binary != expect[i].host_binary || peers[i].port_binary != expect[i].port_binary ||
+            strncmp(peers[i].peer_uuid, expect[i].peer_uuid, UUID_SIZE) != 0 ||
+            strncmp(peers[i].peer_name, expect[i].peer_name, PEER_NAME_SIZE) != 0) {
+            return false;
+        }
+    }
+    return true;
+}
+
+/**
+ * @brief 请求者是本页之后的那个peer, 且名字超过PEER_NAME_SIZE - 1: 排除自身后没有下一页,
+ * 须判断为在范围内自己生成, 不能共用状态为PARTIAL_CONTENT的响应
+ */
+static uint32_t checkBoundary(eular::PeerRegistry *registry)
+{
+    std::vector<eular::String8> uuids;
+    std::string name(PEER_NAME_SIZE, 'e');  // 客户端发送的完整名字
+    for (uint32_t i = 0; i < 3; ++i) {
+        char uuid[UUID_SIZE];
+        snprintf(uuid, sizeof(uuid), "edge-%u", i);
+        eular::PeerRecord record;
+        record.name = name.c_str();
+        record.tcpHost = htonl(0x0c000000 + i);
+        registry->registerPeer(uuid, record);
+        registry->updateUdp(uuid, htonl(0x0c000000 + i), htons(40000 + i));
+        uuids.push_back(uuid);
+    }
+
+    eular::PeerQuery query;
+    query.namePrefix = name.substr(0, PEER_NAME_SIZE - 1).c_str();
+    query.maxCount = 2;
+    uint32_t failed = 0;
+    std::vector<Peer_Info> scratch;
+    for (uint32_t capabilities = 0; capabilities <= P2P_CAP_SUPPORTED; ++capabilities) {
+        eular::PeerListCache::EntrySP entry = eular::P2PSession::FindSharedPage(query, name.c_str(), uuids[2],
+            formatOf(capabilities), scratch);
+        bool ok = !entry || sameAsOwn(registry, query, uuids[2], entry, capabilities);
+        printf("last of range with %u-char name, capabilities 0x%x: %s, %s\n", PEER_NAME_SIZE, capabilities,
+            entry ? "shared" : "own", ok ? "ok" : "FAILED");
+        failed += !ok;
+    }
+    return failed;
+}
+
+int main(int argc, char **argv)
+{
+    char path[] = "/tmp/test_peer_cache_XXXXXX";
+    int tmp = mkstemp(path);
+    dprintf(tmp, "registry:\n  shards: 16\n  redis_persist: false\n  page_limit: 256\n  list_cache_size: 1024\n");
+    ::close(tmp);
+    eular::ConfigManager::get()->Init(path);
+    unlink(path);
+
+    eular::PeerRegistry *registry = eular::PeerManager::get();
+    eular::PeerListCache *cache = eular::PeerCache::get();
+    for (uint32_t i = 0; i < gPeers; ++i) {
+        join(registry, i);
+    }
+
+    // 前4页的游标, 请求随机取其中一页
+    std::vector<eular::PeerQuery> queries(4);
+    for (size_t p = 1; p < queries.size(); ++p) {
+        std::vector<Peer_Info> page;
+        registry->list(queries[p - 1], eular::String8(), page);
+        queries[p].cursorName = page.back().peer_name;
+        queries[p].cursorUuid = page.back().peer_uuid;
+    }
+
+    srand(1);
+    uint32_t mismatched = 0, checked = 0;
+    uint64_t ownNs = 0, cachedNs = 0;
+    std::vector<Peer_Info> scratch;
+    uint32_t formats[P2P_CAP_SUPPORTED + 1] = { 0 };
+    for (uint32_t r = 0; r < gRequests; ++r) {
+        if (rand() % gChangeEvery == 0) {
+            uint32_t i = rand() % gPeers;
+            registry->updateUdp(uuidOf(i), htonl(0x0b000000 + r), htons(30000 + r % 30000));
+        }
+        uint32_t client = rand() % gPeers;
+        const eular::PeerQuery &query = queries[rand() % queries.size()];
+        eular::String8 self = uuidOf(client);
+        uint32_t capabilities = rand() % (P2P_CAP_SUPPORTED + 1);
+        eular::P2PSession::FrameFormat format = formatOf(capabilities);
+
+        // 不使用缓存时每个请求都生成一页
+        uint64_t start = nowNs();
+        eular::P2PSession::BuildSharedPage(query, format, scratch);
+        ownNs += nowNs() - start;
+
+        start = nowNs();
+        eular::PeerListCache::EntrySP entry = eular::P2PSession::FindSharedPage(query, nameOf(client), self,
+            format, scratch);
+        if (!entry) {
+            eular::P2PSession::BuildSharedPage(query, format, scratch);    // 请求者在这一页中, 自己生成
+        }
+        cachedNs += nowNs() - start;
+
+        // 共用的响应必须与排除自身生成的相同
+        if (entry) {
+            ++checked;
+            ++formats[capabilities];
+            if (!sameAsOwn(registry, query, self, entry, capabilities)) {
+                ++mismatched;
+            }
+        }
+    }
+
+    eular::PeerListCache::Stats stats = cache->getStats();
+    uint64_t lookups = stats.hits + stats.misses + stats.bypassed;
+    printf("%u peers, %u requests over %zu pages, 1 change per %u requests\n",
+        gPeers, gRequests, queries.size(), gChangeEvery);
+    printf("per request: build %.2f us, with cache %.2f us\n", ownNs / 1e3 / gRequests, cachedNs / 1e3 / gRequests);
+    printf("hits %lu, misses %lu, bypassed %lu, stored %lu, invalidations %lu, hit ratio %.1f%%\n",
+        stats.hits, stats.misses, stats.bypassed, stats.stored, stats.invalidations, 100.0 * stats.hits / lookups);
+    printf("shared responses checked against own: %u (legacy %u, compact %u, compressed %u, both %u), mismatched %u\n",
+        checked, formats[0], formats[P2P_CAP_COMPACT_PEERS], formats[P2P_CAP_COMPRESS], formats[P2P_CAP_SUPPORTED],
+        mismatched);
+
+    uint32_t failed = mismatched + checkBoundary(registry);
+    return failed != 0;
+}
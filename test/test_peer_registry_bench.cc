@@ -0,0 +1,194 @@
+/*************************************************************************
+    > File Name: test_peer_registry_bench.cc
+    > Author: hsz
+    > Brief: 1万/10万在线peer下GET_PEER_INFO(分页查询+编码响应)的延迟和心跳更新吞吐
+    > Created Time: Sat 17 Oct 2026 11:41:25 PM CST
+ ************************************************************************/
+
+#include "peer_registry.h"
+#include "config.h"
+#include "core/clock.h"
+#include "protocol/protocol.h"
+#include <log/log.h>
+#include <arpa/inet.h>
+#include <algorithm>
+#include <set>
+#include <string>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+
+#define LOG_TAG "main"
+
+static const uint32_t gRequests = 20;
+
+static uint64_t nowNs()
+{
+    timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static eular::String8 uuidOf(uint32_t i)
+{
+    char buf[UUID_SIZE];
+    snprintf(buf, sizeof(buf), "%08x-0000-4000-8000-%012x", i * 2654435761u, i);
+    return eular::String8(buf);
+}
+
+// 与P2PSession处理P2S_REQUEST_GET_PEER_INFO相同: 取一页后编码成一个响应帧
+static bool getPeerInfo(eular::PeerRegistry *registry, const eular::String8 &self,
+                        eular::PeerQuery &query, size_t &bytes, std::set<std::string> *seen = nullptr)
+{
+    std::vector<Peer_Info> peerInfoVec;
+    bool more = registry->list(query, self, peerInfoVec);
+
+    P2S_Response response;
+    memset(&response, 0, sizeof(response));
+    response.flag = P2S_RESPONSE_GET_PEER_INFO;
+    response.number = peerInfoVec.size();
+    eular::ByteBuffer temp;
+    temp.append((uint8_t *)&response, sizeof(P2S_Response));
+    temp.append((uint8_t *)peerInfoVec.data(), sizeof(Peer_Info) * peerInfoVec.size());
+    eular::ByteBuffer result = ProtocolGenerator::generator(P2S_RESPONSE, temp);
+    bytes = result.size();
+
+    if (seen) {
+        for (auto &info : peerInfoVec) {
+            seen->insert(info.peer_uuid);
+        }
+    }
+    if (!peerInfoVec.empty()) {     // 下一页的游标
+        query.cursorName = peerInfoVec.back().peer_name;
+        query.cursorUuid = peerInfoVec.back().peer_uuid;
+    }
+    return more;
+}
+
+static uint32_t bench(eular::PeerRegistry *registry, uint32_t peers)
+{
+    uint32_t begin = registry->size();
+    uint64_t start = nowNs();
+    for (uint32_t i = begin; i < peers; ++i) {
+        eular::PeerRecord record;
+        char name[PEER_NAME_SIZE];
+        snprintf(name, sizeof(name), "peer-%u", i % 1000);
+        record.name = name;
+        record.tcpHost = htonl(0x0a000000 + i);
+        record.tcpPort = htons(10000 + i % 50000);
+        record.lastSeenMs = eular::Clock::NowMs();
+        registry->registerPeer(uuidOf(i), record);
+        registry->updateUdp(uuidOf(i), htonl(0x0a000000 + i), htons(20000 + i % 40000));
+    }
+    uint64_t registerNs = nowNs() - start;
+
+    std::vector<uint64_t> samples;
+    size_t bytes = 0;
+    for (uint32_t r = 0; r < gRequests; ++r) {
+        eular::PeerQuery query;
+        start = nowNs();
+        getPeerInfo(registry, uuidOf(r), query, bytes);
+        samples.push_back(nowNs() - start);
+    }
+    std::sort(samples.begin(), samples.end());
+
+    // 翻完所有页, 检查没有重复和遗漏
+    eular::PeerQuery query;
+    uint32_t pages = 0;
+    size_t pageBytes = 0;
+    std::set<std::string> seen;
+    start = nowNs();
+    bool more = true;
+    while (more) {
+        more = getPeerInfo(registry, uuidOf(0), query, pageBytes, &seen);
+        ++pages;
+    }
+    uint64_t walkNs = nowNs() - start;
+    bool paged = seen.size() == peers - 1 && !seen.count(uuidOf(0).c_str());
+    if (!paged) {
+        printf("pagination error: %zu unique peers, expect %u\n", seen.size(), peers - 1);
+    }
+
+    eular::PeerQuery prefixQuery;
+    prefixQuery.namePrefix = "peer-42";     // peer-42, peer-420..peer-429
+    size_t prefixBytes = 0;
+    start = nowNs();
+    getPeerInfo(registry, uuidOf(0), prefixQuery, prefixBytes);
+    uint64_t prefixNs = nowNs() - start;
+
+    start = nowNs();
+    for (uint32_t i = 0; i < peers; ++i) {
+        registry->updateUdp(uuidOf(i), htonl(0x0a000000 + i), htons(20000 + i % 40000));
+    }
+    uint64_t heartbeatNs = nowNs() - start;
+
+    printf("%6u peers: register %6.0f ns/peer | first page p50 %6.3f ms, max %6.3f ms, %zu bytes | "
+        "all %u pages %7.1f ms | prefix page %6.3f ms, %zu bytes | heartbeat %5.0f ns/op\n",
+        peers, (double)registerNs / (peers - begin), samples[samples.size() / 2] / 1e6,
+        samples.back() / 1e6, bytes, pages, walkNs / 1e6, prefixNs / 1e6, prefixBytes,
+        (double)heartbeatNs / peers);
+    return !paged;
+}
+
+/**
+ * @brief 名字超过PEER_NAME_SIZE - 1时, 下发的名字被截断, 以它为游标翻页不能重复或遗漏
+ */
+static uint32_t checkLongNames(eular::PeerRegistry *registry)
+{
+    static const uint32_t count = 20;
+    std::string base(PEER_NAME_SIZE - 1, 'n');
+    for (uint32_t i = 0; i < count; ++i) {
+        eular::PeerRecord record;
+        record.name = (base + (char)('a' + i % 4)).c_str();     // 前31个字符相同, 第32个不同
+        record.tcpHost = htonl(0x0b000000 + i);
+        record.tcpPort = htons(10000 + i);
+        char uuid[UUID_SIZE];
+        snprintf(uuid, sizeof(uuid), "long-%02u", i);
+        registry->registerPeer(uuid, record);
+        registry->updateUdp(uuid, htonl(0x0b000000 + i), htons(20000 + i));
+    }
+
+    eular::PeerQuery query;
+    query.namePrefix = base.c_str();
+    query.maxCount = 3;
+    std::set<std::string> seen;
+    uint32_t returned = 0;
+    uint32_t pages = 0;
+    bool more = true;
+    while (more && pages < count) {
+        std::vector<Peer_Info> page;
+        more = registry->list(query, eular::String8(), page);
+        for (auto &info : page) {
+            seen.insert(info.peer_uuid);
+        }
+        returned += page.size();
+        if (!page.empty()) {
+            query.cursorName = page.back().peer_name;
+            query.cursorUuid = page.back().peer_uuid;
+        }
+        ++pages;
+    }
+    bool ok = !more && seen.size() == count && returned == count;
+    printf("%u peers with %u-char names, page size 3: %u returned, %zu unique in %u pages: %s\n",
+        count, PEER_NAME_SIZE, returned, seen.size(), pages, ok ? "ok" : "FAILED");
+    return !ok;
+}
+
+int main(int argc, char **argv)
+{
+    char path[] = "/tmp/test_peer_registry_XXXXXX";
+    int tmp = mkstemp(path);
+    dprintf(tmp, "registry:\n  shards: 16\n  redis_persist: false\n");
+    ::close(tmp);
+    eular::ConfigManager::get()->Init(path);
+    unlink(path);
+
+    // 原实现每次请求: 1次KEYS * + 每个peer一次HGETALL, 即N+1次redis往返
+    eular::PeerRegistry *registry = eular::PeerManager::get();
+    uint32_t failed = 0;
+    failed += bench(registry, 10000);
+    failed += bench(registry, 100000);
+    failed += checkLongNames(registry);
+    return failed != 0;
+}
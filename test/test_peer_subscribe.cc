@@ -0,0 +1,408 @@
+/*************************************************************************
+    > File Name: test_peer_subscribe.cc
+    > Author: hsz
+    > Brief: 订阅推送(按分片变更记录读取增量)与轮询GET_PEER_INFO(翻完所有页)的开销对比, 断线续传,
+    >        以及会话推送的顺序和慢订阅者的积压上限
+    > Created Time: Sun 18 Oct 2026 12:36:52 AM CST
+ ************************************************************************/
+
+#include "peer_registry.h"
+#include "p2p_session.h"
+#include "fdmanager.h"
+#include "iomanager.h"
+#include "config.h"
+#include "core/clock.h"
+#include "protocol/protocol.h"
+#include <log/log.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+#include <thread>
+
+#define LOG_TAG "main"
+
+static const uint32_t gPeers = 10000;
+static const uint32_t gClients = 100;       // 订阅者/轮询者数量
+static const uint32_t gRounds = 10;         // 每轮有gChanges个peer变化
+static const uint32_t gChanges = 50;
+static const uint32_t gMaxSendBuffer = 16 * 1024;   // tcp.max_send_buffer
+static uint32_t gFailed = 0;
+
+#define CHECK(cond) \
+    do { \
+        if (!(cond)) { \
+            printf("line %d: %s FAILED\n", __LINE__, #cond); \
+            ++gFailed; \
+        } \
+    } while (0)
+
+static uint64_t nowNs()
+{
+    timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static eular::String8 uuidOf(uint32_t i)
+{
+    char buf[UUID_SIZE];
+    snprintf(buf, sizeof(buf), "%08x-0000-4000-8000-%012x", i * 2654435761u, i);
+    return eular::String8(buf);
+}
+
+static void join(eular::PeerRegistry *registry, uint32_t i)
+{
+    eular::PeerRecord record;
+    char name[PEER_NAME_SIZE];
+    snprintf(name, sizeof(name), "peer-%u", i % 1000);
+    record.name = name;
+    record.tcpHost = htonl(0x0a000000 + i);
+    record.tcpPort = htons(10000 + i % 50000);
+    record.lastSeenMs = eular::Clock::NowMs();
+    registry->registerPeer(uuidOf(i), record);
+    registry->updateUdp(uuidOf(i), htonl(0x0a000000 + i), htons(20000 + i % 40000));
+}
+
+// 一轮变更: 一半下线, 一半udp地址变化
+static void churn(eular::PeerRegistry *registry, uint32_t round)
+{
+    for (uint32_t k = 0; k < gChanges; ++k) {
+        uint32_t i = (round * gChanges + k) * 7 % gPeers;
+        if (k & 1) {
+            registry->updateUdp(uuidOf(i), htonl(0x0b000000 + i), htons(30000 + round));
+        } else {
+            registry->removePeer(uuidOf(i));
+            join(registry, i);
+        }
+    }
+}
+
+// 服务端一端交给会话, 与P2PService::handle_client相同设为用户非阻塞
+class SessionSocket : public eular::Socket
+{
+public:
+    SessionSocket(int fd) : Socket(SOCK_STREAM)
+    {
+        eular::FdManager::get()->get(fd, true)->setUserNonblock(true);
+        init(fd);
+    }
+};
+
+static bool connectPair(int &server, int &client)
+{
+    int listener = ::socket(AF_INET, SOCK_STREAM, 0);
+    sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    socklen_t len = sizeof(addr);
+    if (::bind(listener, (sockaddr *)&addr, len) || ::listen(listener, 1) ||
+        getsockname(listener, (sockaddr *)&addr, &len)) {
+        ::close(listener);
+        return false;
+    }
+    client = ::socket(AF_INET, SOCK_STREAM, 0);
+    bool ok = ::connect(client, (sockaddr *)&addr, len) == 0;
+    server = ok ? ::accept(listener, nullptr, nullptr) : -1;
+    ::close(listener);
+    return server >= 0;
+}
+
+struct Pushed {
+    uint16_t flag = 0;
+    uint16_t statusCode = 0;
+    std::vector<Peer_Change> changes;
+    std::vector<uint64_t> cursors;  // 订阅响应中的各分片序号
+};
+
+/**
+ * @brief 客户端一端读取下一个响应帧. 读不到数据时调用会话的可写事件, 代替epoll发送积压的数据
+ *
+ * @return 超时或帧错误时返回false
+ */
+static bool readPushed(int fd, ProtocolDecoder &decoder, eular::P2PSession *session, int serverFd,
+    uint32_t timeoutMs, Pushed &pushed)
+{
+    uint64_t deadline = eular::Clock::NowMs() + timeoutMs;
+    FrameView frame;
+    while (true) {
+        ProtocolDecoder::Status status = decoder.next(frame);
+        if (status == ProtocolDecoder::FRAME_ERROR) {
+            printf("frame error\n");
+            return false;
+        }
+        if (status == ProtocolDecoder::FRAME_READY) {
+            break;
+        }
+        pollfd pfd = { fd, POLLIN, 0 };
+        if (poll(&pfd, 1, 10) <= 0) {
+            if (eular::Clock::NowMs() > deadline) {
+                return false;
+            }
+            if (session) {
+                session->onWritEvent(serverFd);
+            }
+            continue;
+        }
+        uint8_t buf[4096];
+        ssize_t n = ::recv(fd, buf, sizeof(buf), 0);
+        if (n <= 0) {
+            return false;
+        }
+        decoder.buffer().append(buf, n);
+    }
+
+    const P2S_Response *response = frame.get<P2S_Response>();
+    if (frame.commnd() != P2S_RESPONSE || response == nullptr) {
+        return false;
+    }
+    pushed.flag = response->flag;
+    pushed.statusCode = response->statusCode;
+    pushed.changes.clear();
+    pushed.cursors.clear();
+    if (response->flag == P2S_RESPONSE_PEER_CHANGE) {
+        const Peer_Change *changes = frame.get<Peer_Change>(P2S_Response_Size);
+        if (response->number && (changes == nullptr ||
+            frame.length() != P2S_Response_Size + Peer_Change_Size * response->number)) {
+            return false;
+        }
+        pushed.changes.assign(changes, changes + response->number);
+    } else if (response->flag == P2S_RESPONSE_SUBSCRIBE_PEERS) {
+        const Peer_Subscribe *sub = frame.get<Peer_Subscribe>(P2S_Response_Size);
+        if (sub == nullptr) {
+            return false;
+        }
+        pushed.cursors.resize(sub->shard_count);
+        memcpy(pushed.cursors.data(), frame.data() + P2S_Response_Size + Peer_Subscribe_Size,
+            sizeof(uint64_t) * sub->shard_count);
+    }
+    return true;
+}
+
+/**
+ * @brief 客户端发送订阅请求并读取响应, 返回各分片的起始序号
+ */
+static bool subscribe(eular::IOManager &iom, eular::P2PSession::SP session, int server, int client,
+    ProtocolDecoder &decoder, std::vector<uint64_t> &cursors)
+{
+    Peer_Info self;
+    memset(&self, 0, sizeof(self));
+    FrameBuilder request(P2S_REQUEST_SUBSCRIBE_PEERS);
+    request.append(&self, Peer_Info_Size);
+    const uint8_t *data = request.finish();
+    if (::send(client, data, request.size(), 0) != (ssize_t)request.size()) {
+        return false;
+    }
+    iom.schedule([session, server]() {
+        session->onReadEvent(server);
+    });
+
+    Pushed pushed;
+    if (!readPushed(client, decoder, nullptr, server, 1000, pushed)) {
+        return false;
+    }
+    cursors = pushed.cursors;
+    return pushed.flag == P2S_RESPONSE_SUBSCRIBE_PEERS &&
+        pushed.statusCode == (uint16_t)P2PStatus::RESET_CONTENT && !cursors.empty();
+}
+
+// 多个线程同时产生变更, 推送在各自的推送任务中完成
+static void produce(uint32_t threads, uint32_t perThread, uint32_t base)
+{
+    std::vector<std::thread> producers;
+    for (uint32_t t = 0; t < threads; ++t) {
+        producers.emplace_back([t, perThread, base]() {
+            for (uint32_t k = 0; k < perThread; ++k) {
+                join(eular::PeerManager::get(), base + t * perThread + k);
+            }
+        });
+    }
+    for (auto &it : producers) {
+        it.join();
+    }
+}
+
+/**
+ * @brief 收到的变更在每个分片内从订阅时的序号起连续, 即推送没有乱序、重复或遗漏
+ */
+static bool inOrder(std::vector<uint64_t> &cursors, const std::vector<Peer_Change> &changes)
+{
+    for (const Peer_Change &change : changes) {
+        if (change.shard >= cursors.size() || change.seq != cursors[change.shard] + 1) {
+            printf("shard %u seq %lu after %lu\n", change.shard, change.seq,
+                change.shard < cursors.size() ? cursors[change.shard] : 0);
+            return false;
+        }
+        cursors[change.shard] = change.seq;
+    }
+    return true;
+}
+
+/**
+ * @brief 会话级推送: 多个线程并发变更时, 推送帧按序号顺序且完整; 不读取的订阅者积压到上限后被取消订阅
+ */
+static void checkSession()
+{
+    eular::IOManager iom(2, false, "session");
+    static const uint32_t threads = 4;
+    static const uint32_t perThread = 100;  // 每个join产生加入和udp更新两个变更
+
+    // 正常读取的订阅者
+    int server = -1, client = -1;
+    CHECK(connectPair(server, client));
+    eular::P2PSession::SP session = std::make_shared<eular::P2PSession>(
+        std::make_shared<SessionSocket>(server));
+    ProtocolDecoder decoder;
+    std::vector<uint64_t> cursors;
+    bool subscribed = subscribe(iom, session, server, client, decoder, cursors);
+    CHECK(subscribed);
+
+    produce(threads, perThread, gPeers * 2);
+    uint32_t expect = threads * perThread * 2;
+    uint32_t received = 0, frames = 0;
+    bool ordered = true;
+    Pushed pushed;
+    while (subscribed && received < expect && readPushed(client, decoder, nullptr, server, 2000, pushed)) {
+        ++frames;
+        ordered &= pushed.flag == P2S_RESPONSE_PEER_CHANGE && pushed.statusCode == (uint16_t)P2PStatus::OK;
+        ordered &= inOrder(cursors, pushed.changes);
+        received += pushed.changes.size();
+    }
+    bool ok = ordered && received == expect;
+    printf("session push, %u threads: %u/%u changes in %u frames, in order: %s\n",
+        threads, received, expect, frames, ok ? "ok" : "FAILED");
+    gFailed += !ok;
+    session->onShutdown();
+
+    // 不读取的订阅者: socket写满后积压在会话中, 超过上限时取消订阅并在最后推送RESET_CONTENT
+    int slowServer = -1, slowClient = -1;
+    CHECK(connectPair(slowServer, slowClient));
+    int small = 4096;
+    setsockopt(slowServer, SOL_SOCKET, SO_SNDBUF, &small, sizeof(small));
+    setsockopt(slowClient, SOL_SOCKET, SO_RCVBUF, &small, sizeof(small));
+    eular::P2PSession::SP slow = std::make_shared<eular::P2PSession>(
+        std::make_shared<SessionSocket>(slowServer));
+    ProtocolDecoder slowDecoder;
+    subscribed = subscribe(iom, slow, slowServer, slowClient, slowDecoder, cursors);
+    CHECK(subscribed);
+
+    produce(threads, perThread * 4, gPeers * 3);
+    usleep(200 * 1000);     // 等推送任务都执行完, 期间不读取
+    expect = threads * perThread * 4 * 2;
+    received = 0;
+    frames = 0;
+    ordered = true;
+    bool reset = false;
+    while (subscribed && !reset && readPushed(slowClient, slowDecoder, slow.get(), slowServer, 2000, pushed)) {
+        ++frames;
+        ordered &= pushed.flag == P2S_RESPONSE_PEER_CHANGE && inOrder(cursors, pushed.changes);
+        received += pushed.changes.size();
+        reset = pushed.statusCode == (uint16_t)P2PStatus::RESET_CONTENT;
+    }
+    // 取消订阅之后不再推送
+    produce(1, perThread, gPeers * 4);
+    usleep(100 * 1000);
+    bool quiet = !readPushed(slowClient, slowDecoder, slow.get(), slowServer, 200, pushed);
+    ok = ordered && reset && quiet && received < expect;
+    printf("slow subscriber, %u bytes limit: %u/%u changes in %u frames then %s, %s: %s\n", gMaxSendBuffer,
+        received, expect, frames, reset ? "RESET_CONTENT" : "no reset", quiet ? "quiet" : "still pushed",
+        ok ? "ok" : "FAILED");
+    gFailed += !ok;
+    slow->onShutdown();
+
+    iom.stop();
+    ::close(client);
+    ::close(slowClient);
+}
+
+int main(int argc, char **argv)
+{
+    char path[] = "/tmp/test_peer_subscribe_XXXXXX";
+    int tmp = mkstemp(path);
+    dprintf(tmp, "registry:\n  shards: 16\n  redis_persist: false\n  changelog_size: 256\n"
+        "tcp:\n  max_send_buffer: %u\n", gMaxSendBuffer);
+    ::close(tmp);
+    eular::ConfigManager::get()->Init(path);
+    unlink(path);
+
+    eular::PeerRegistry *registry = eular::PeerManager::get();
+    uint32_t notified = 0;
+    uint64_t id = registry->subscribe([&notified]() { ++notified; });
+    for (uint32_t i = 0; i < gPeers; ++i) {
+        join(registry, i);
+    }
+
+    std::vector<std::vector<uint64_t>> cursors(gClients);
+    for (auto &it : cursors) {
+        registry->currentSeqs(it);
+    }
+
+    uint64_t pollNs = 0, pushNs = 0;
+    size_t pollItems = 0, pushItems = 0;
+    for (uint32_t round = 0; round < gRounds; ++round) {
+        churn(registry, round);
+
+        // 轮询: 每个客户端翻完所有页
+        uint64_t start = nowNs();
+        for (uint32_t c = 0; c < gClients; ++c) {
+            eular::PeerQuery query;
+            std::vector<Peer_Info> page;
+            bool more = true;
+            while (more) {
+                page.clear();
+                more = registry->list(query, uuidOf(c), page);
+                pollItems += page.size();
+                if (!page.empty()) {
+                    query.cursorName = page.back().peer_name;
+                    query.cursorUuid = page.back().peer_uuid;
+                }
+            }
+        }
+        pollNs += nowNs() - start;
+
+        // 推送: 每个订阅者读取自己游标之后的变更
+        start = nowNs();
+        for (uint32_t c = 0; c < gClients; ++c) {
+            std::vector<Peer_Change> changes;
+            bool ok = registry->readChanges(cursors[c], changes, UINT32_MAX);
+            if (!ok) {
+                printf("client %u cursor invalid\n", c);
+                ++gFailed;
+            }
+            pushItems += changes.size();
+        }
+        pushNs += nowNs() - start;
+    }
+
+    printf("%u peers, %u clients, %u changes/round: poll %8.3f ms/round (%zu items) | "
+        "push %6.3f ms/round (%zu items) | notify %u\n", gPeers, gClients, gChanges,
+        pollNs / 1e6 / gRounds, pollItems / gRounds, pushNs / 1e6 / gRounds, pushItems / gRounds, notified);
+
+    // 断线续传: 落后不超过changelog_size时可以续传, 超过后须全量获取
+    std::vector<uint64_t> stale = cursors[0];
+    churn(registry, gRounds);
+    std::vector<Peer_Change> changes;
+    std::vector<uint64_t> resume = stale;
+    bool ok = registry->readChanges(resume, changes, UINT32_MAX);
+    printf("resume after 1 round: %s, %zu changes\n", ok ? "ok" : "reset", changes.size());
+    CHECK(ok && !changes.empty());
+    for (uint32_t round = 0; round < 100; ++round) {
+        churn(registry, gRounds + 1 + round);
+    }
+    resume = stale;
+    changes.clear();
+    ok = registry->readChanges(resume, changes, UINT32_MAX);
+    printf("resume after 101 rounds: %s\n", ok ? "ok" : "reset");
+    CHECK(!ok);     // 落后超过changelog_size, 须全量获取
+    CHECK(notified > 0);
+
+    registry->unsubscribe(id);
+    checkSession();
+    return gFailed != 0;
+}
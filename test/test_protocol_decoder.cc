@@ -0,0 +1,140 @@
+/*************************************************************************
+    > File Name: test_protocol_decoder.cc
+    > Author: hsz
+    > Brief: ProtocolDecoder随机分段的正确性(半帧/多帧/非法帧)与连续解帧的吞吐
+    > Created Time: Sun 18 Oct 2026 01:24:37 AM CST
+ ************************************************************************/
+
+#include "protocol/protocol.h"
+#include <log/log.h>
+#include <vector>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define LOG_TAG "main"
+
+static const uint32_t gFrames = 2000;
+static const uint32_t gRounds = 200;
+static const uint32_t gMaxPayload = 512;
+
+static uint64_t nowNs()
+{
+    timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+struct Frame {
+    uint16_t cmd;
+    std::vector<uint8_t> payload;
+};
+
+static void makeStream(std::vector<Frame> &frames, eular::ByteBuffer &stream)
+{
+    frames.resize(gFrames);
+    stream.clear();
+    for (auto &frame : frames) {
+        frame.cmd = P2S_REQUEST + rand() % 8;
+        frame.payload.resize(rand() % 5 == 0 ? 0 : rand() % gMaxPayload);
+        for (auto &byte : frame.payload) {
+            byte = rand();
+        }
+        eular::ByteBuffer out = ProtocolGenerator::generator(frame.cmd, frame.payload.data(), frame.payload.size());
+        stream.append(out.const_data(), out.size());
+    }
+}
+
+// 按随机长度分段送入解码器, 检查取出的帧与发送的一致
+static bool feedRandom(const std::vector<Frame> &frames, const eular::ByteBuffer &stream, uint32_t maxSegment)
+{
+    ProtocolDecoder decoder;
+    ProtocolParser parser;
+    size_t offset = 0, index = 0;
+    while (offset < stream.size()) {
+        size_t segment = 1 + rand() % maxSegment;
+        if (segment > stream.size() - offset) {
+            segment = stream.size() - offset;
+        }
+        decoder.buffer().append(stream.const_data() + offset, segment);
+        offset += segment;
+
+        ProtocolDecoder::Status status;
+        while ((status = decoder.next(parser)) == ProtocolDecoder::FRAME_READY) {
+            const Frame &frame = frames[index++];
+            if (parser.commnd() != frame.cmd || parser.length() != frame.payload.size() ||
+                memcmp(parser.data().const_data(), frame.payload.data(), frame.payload.size()) != 0) {
+                printf("frame %zu mismatch\n", index - 1);
+                return false;
+            }
+        }
+        if (status == ProtocolDecoder::FRAME_ERROR) {
+            printf("unexpected frame error at frame %zu\n", index);
+            return false;
+        }
+    }
+    if (index != frames.size() || decoder.pending() != 0) {
+        printf("decoded %zu of %zu frames, %zu bytes pending\n", index, frames.size(), decoder.pending());
+        return false;
+    }
+    return true;
+}
+
+static bool expectError(const uint8_t *data, size_t len, uint32_t maxFrameSize)
+{
+    ProtocolDecoder decoder(maxFrameSize);
+    ProtocolParser parser;
+    decoder.buffer().append(data, len);
+    ProtocolDecoder::Status status;
+    while ((status = decoder.next(parser)) == ProtocolDecoder::FRAME_READY) {
+    }
+    return status == ProtocolDecoder::FRAME_ERROR;
+}
+
+int main(int argc, char **argv)
+{
+    srand(argc > 1 ? atoi(argv[1]) : time(nullptr));
+
+    std::vector<Frame> frames;
+    eular::ByteBuffer stream;
+    uint32_t failed = 0;
+    for (uint32_t round = 0; round < gRounds; ++round) {
+        makeStream(frames, stream);
+        // 从逐字节到一次多个帧
+        uint32_t maxSegment = round % 4 == 0 ? 1 : 1 + rand() % 4096;
+        if (!feedRandom(frames, stream, maxSegment)) {
+            ++failed;
+        }
+    }
+    printf("random segmentation: %u rounds x %u frames, %u failed\n", gRounds, gFrames, failed);
+
+    // 非法帧: 标志符错误, 长度超过上限, 有效帧之后跟垃圾数据
+    uint8_t payload[128] = {0};
+    eular::ByteBuffer good = ProtocolGenerator::generator(P2S_REQUEST_GET_PEER_INFO, payload, sizeof(payload));
+    eular::ByteBuffer bad = good;
+    bad[0] ^= 0xff;
+    eular::ByteBuffer garbage = good;
+    garbage.append((const uint8_t *)"garbage", 7);
+    printf("bad identifier: %s | oversized length: %s | trailing garbage: %s\n",
+        expectError(bad.const_data(), bad.size(), P2P_MAX_FRAME_SIZE) ? "rejected" : "ACCEPTED",
+        expectError(good.const_data(), good.size(), sizeof(payload) - 1) ? "rejected" : "ACCEPTED",
+        expectError(garbage.const_data(), garbage.size(), P2P_MAX_FRAME_SIZE) ? "rejected" : "ACCEPTED");
+
+    // 吞吐: 流水线请求一次读取全部到达
+    makeStream(frames, stream);
+    ProtocolDecoder decoder;
+    ProtocolParser parser;
+    uint64_t decoded = 0;
+    uint64_t start = nowNs();
+    for (uint32_t round = 0; round < gRounds; ++round) {
+        decoder.buffer().append(stream.const_data(), stream.size());
+        while (decoder.next(parser) == ProtocolDecoder::FRAME_READY) {
+            ++decoded;
+        }
+    }
+    uint64_t elapsed = nowNs() - start;
+    printf("pipelined: %lu frames in %.1f ms, %.2f Mframes/s, %.0f MB/s\n", decoded, elapsed / 1e6,
+        decoded * 1e3 / elapsed, (double)stream.size() * gRounds * 1e3 / elapsed);
+    return failed;
+}
@@ -0,0 +1,74 @@
+/*************************************************************************
+    > File Name: test_scheduler_bench.cc
+    > Author: hsz
+    > Brief: 调度器吞吐测试, 外部提交任务 + 任务内派生子任务(走本地队列与窃取)
+    > Created Time: Sat 17 Oct 2026 02:20:41 PM CST
+ ************************************************************************/
+
+#include "fiber/scheduler.h"
+#include <log/log.h>
+#include <atomic>
+#include <sched.h>
+#include <stdlib.h>
+#include <time.h>
+
+#define LOG_TAG "main"
+
+static const uint64_t gRootTasks = 20000;
+static const uint64_t gChildTasks = 8;
+static std::atomic<uint64_t> gDone(0);
+
+static uint64_t nowNs()
+{
+    timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static void childTask()
+{
+    ++gDone;
+}
+
+static void rootTask()
+{
+    eular::Scheduler *scheduler = eular::Scheduler::GetThis();
+    for (uint64_t i = 0; i < gChildTasks; ++i) {
+        scheduler->schedule(&childTask);
+    }
+    ++gDone;
+}
+
+static void bench(uint32_t threads)
+{
+    const uint64_t total = gRootTasks * (gChildTasks + 1);
+    gDone = 0;
+
+    eular::Scheduler scheduler(threads, false, "bench");
+    scheduler.start();
+
+    uint64_t begin = nowNs();
+    for (uint64_t i = 0; i < gRootTasks; ++i) {
+        scheduler.schedule(&rootTask);
+    }
+    while (gDone.load() < total) {
+        sched_yield();
+    }
+    uint64_t end = nowNs();
+    scheduler.stop();
+
+    eular::Scheduler::QueueStats stats = scheduler.getQueueStats();
+    printf("threads %2u: %8lu tasks in %8.3f ms, %12.0f tasks/sec | "
+        "injected %lu, drained %lu, contended %lu, inconsistent %lu, stolen %lu\n",
+        threads, total, (end - begin) / 1e6, total * 1e9 / (end - begin),
+        stats.injected, stats.drained, stats.drainContended, stats.inconsistent, stats.stolen);
+}
+
+int main(int argc, char **argv)
+{
+    uint32_t maxThreads = argc > 1 ? atoi(argv[1]) : 8;
+    for (uint32_t threads = 1; threads <= maxThreads; threads *= 2) {
+        bench(threads);
+    }
+    return 0;
+}
@@ -0,0 +1,138 @@
+/*************************************************************************
+    > File Name: test_stack_allocator.cc
+    > Author: hsz
+    > Brief: 协程栈池的命中/未命中/归还/释放计数, 线程隔离与保护页
+    > Created Time: Sun 18 Oct 2026 10:16:40 AM CST
+ ************************************************************************/
+
+#include "fiber/stack_allocator.h"
+#include "config.h"
+#include <log/log.h>
+#include <sys/wait.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <thread>
+#include <vector>
+
+#define LOG_TAG "main"
+
+static const uint32_t gCapacity = 4;
+static uint32_t gFailed = 0;
+
+#define CHECK(cond) \
+    do { \
+        if (!(cond)) { \
+            printf("line %d: %s FAILED\n", __LINE__, #cond); \
+            ++gFailed; \
+        } \
+    } while (0)
+
+// 与上一次调用相比的增量
+static eular::StackAllocator::Stats delta()
+{
+    static eular::StackAllocator::Stats last = {0, 0, 0, 0};
+    eular::StackAllocator::Stats now = eular::StackAllocator::GetStats();
+    eular::StackAllocator::Stats diff = {
+        now.hits - last.hits, now.misses - last.misses,
+        now.recycled - last.recycled, now.released - last.released
+    };
+    last = now;
+    return diff;
+}
+
+static bool expect(const char *step, uint64_t hits, uint64_t misses, uint64_t recycled, uint64_t released)
+{
+    eular::StackAllocator::Stats d = delta();
+    bool ok = d.hits == hits && d.misses == misses && d.recycled == recycled && d.released == released;
+    printf("%-32s hits %lu, misses %lu, recycled %lu, released %lu: %s\n",
+        step, d.hits, d.misses, d.recycled, d.released, ok ? "ok" : "FAILED");
+    gFailed += !ok;
+    return ok;
+}
+
+int main(int argc, char **argv)
+{
+    char path[] = "/tmp/test_stack_allocator_XXXXXX";
+    int tmp = mkstemp(path);
+    dprintf(tmp, "fiber:\n  stack_classes: 65536,262144\n  stack_pool_capacity: %u\n", gCapacity);
+    ::close(tmp);
+    eular::ConfigManager::get()->Init(path);
+    unlink(path);
+
+    uint64_t pageSize = sysconf(_SC_PAGESIZE);
+    CHECK(eular::StackAllocator::RoundSize(1000) == 65536);
+    CHECK(eular::StackAllocator::RoundSize(65536) == 65536);
+    CHECK(eular::StackAllocator::RoundSize(65537) == 262144);
+    CHECK(eular::StackAllocator::RoundSize(300000) == (300000 + pageSize - 1) / pageSize * pageSize);
+    delta();
+
+    // 池为空: 全部未命中; 归还到容量为止, 多出的直接释放
+    std::vector<void *> stacks;
+    for (uint32_t i = 0; i < gCapacity + 1; ++i) {
+        void *ptr = eular::StackAllocator::alloc(64 * 1024);
+        CHECK(ptr != nullptr);
+        memset(ptr, 0xA5, 64 * 1024);   // 整个栈可写
+        stacks.push_back(ptr);
+    }
+    expect("alloc capacity + 1", 0, gCapacity + 1, 0, 0);
+    for (void *ptr : stacks) {
+        eular::StackAllocator::dealloc(ptr, 64 * 1024);
+    }
+    expect("dealloc capacity + 1", 0, 0, gCapacity, 1);
+
+    // 再次分配命中池中的栈, 后进先出
+    std::vector<void *> again;
+    for (uint32_t i = 0; i < gCapacity; ++i) {
+        again.push_back(eular::StackAllocator::alloc(1000));
+    }
+    expect("alloc from pool", gCapacity, 0, 0, 0);
+    for (uint32_t i = 0; i < gCapacity; ++i) {
+        CHECK(again[i] == stacks[gCapacity - 1 - i]);
+    }
+    void *extra = eular::StackAllocator::alloc(1000);
+    expect("alloc past pool", 0, 1, 0, 0);
+    eular::StackAllocator::dealloc(extra, 1000);
+    for (void *ptr : again) {
+        eular::StackAllocator::dealloc(ptr, 1000);
+    }
+    expect("dealloc back", 0, 0, gCapacity, 1);
+
+    // 级别之间互不共用
+    void *large = eular::StackAllocator::alloc(200 * 1024);
+    expect("alloc other class", 0, 1, 0, 0);
+    eular::StackAllocator::dealloc(large, 200 * 1024);
+    expect("dealloc other class", 0, 0, 1, 0);
+
+    // 超过最大级别: 不缓存
+    void *huge = eular::StackAllocator::alloc(1024 * 1024);
+    CHECK(huge != nullptr);
+    eular::StackAllocator::dealloc(huge, 1024 * 1024);
+    expect("uncached size", 0, 1, 0, 1);
+
+    // 空闲链表是线程本地的: 其他线程取不到本线程归还的栈, 线程退出时释放自己的
+    std::thread other([]() {
+        void *ptr = eular::StackAllocator::alloc(1000);
+        eular::StackAllocator::dealloc(ptr, 1000);
+    });
+    other.join();
+    expect("other thread", 0, 1, 1, 0);
+
+    // 保护页: 越过栈底写入触发SIGSEGV
+    pid_t pid = fork();
+    if (pid == 0) {
+        signal(SIGSEGV, SIG_DFL);
+        volatile uint8_t *stack = (volatile uint8_t *)eular::StackAllocator::alloc(1000);
+        stack[-1] = 0;
+        _exit(0);
+    }
+    int status = 0;
+    waitpid(pid, &status, 0);
+    bool guarded = WIFSIGNALED(status) && WTERMSIG(status) == SIGSEGV;
+    printf("write below stack: %s\n", guarded ? "SIGSEGV, ok" : "FAILED");
+    gFailed += !guarded;
+
+    return gFailed != 0;
+}
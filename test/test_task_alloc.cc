@@ -0,0 +1,109 @@
+/*************************************************************************
+    > File Name: test_task_alloc.cc
+    > Author: hsz
+    > Brief: 统计每次事件分发的堆分配次数, 对比std::function与Task
+    > Created Time: Sat 17 Oct 2026 04:05:52 PM CST
+ ************************************************************************/
+
+#include "fiber/scheduler.h"
+#include <log/log.h>
+#include <sys/epoll.h>
+#include <atomic>
+#include <new>
+#include <sched.h>
+#include <stdlib.h>
+
+#define LOG_TAG "main"
+
+static std::atomic<uint64_t> gAllocCount(0);
+
+void *operator new(size_t size)
+{
+    ++gAllocCount;
+    void *ptr = malloc(size ? size : 1);
+    if (ptr == nullptr) {
+        throw std::bad_alloc();
+    }
+    return ptr;
+}
+
+void operator delete(void *ptr) noexcept
+{
+    free(ptr);
+}
+
+void operator delete(void *ptr, size_t) noexcept
+{
+    free(ptr);
+}
+
+static const uint64_t gEventCount = 200000;
+static const uint64_t gBurstSize = 1000;     // 每批投递的事件数, 模拟一次epoll_wait返回
+static std::atomic<uint64_t> gDone(0);
+
+// 模拟net/epoll.cpp中的FDContext
+struct FDContext {
+    int fd = 0;
+    void executeEvent(uint32_t event)
+    {
+        ++gDone;
+    }
+};
+
+static void benchConstruct()
+{
+    FDContext ctx;
+    uint64_t begin = gAllocCount.load();
+    for (uint64_t i = 0; i < gEventCount; ++i) {
+        std::function<void()> cb = std::bind(&FDContext::executeEvent, &ctx, EPOLLIN);
+        cb();
+    }
+    uint64_t funcAllocs = gAllocCount.load() - begin;
+
+    begin = gAllocCount.load();
+    for (uint64_t i = 0; i < gEventCount; ++i) {
+        eular::Task cb = std::bind(&FDContext::executeEvent, &ctx, EPOLLIN);
+        cb();
+    }
+    uint64_t taskAllocs = gAllocCount.load() - begin;
+
+    printf("construct std::function: %.3f allocs/event\n", (double)funcAllocs / gEventCount);
+    printf("construct Task:          %.3f allocs/event\n", (double)taskAllocs / gEventCount);
+}
+
+static void dispatch(eular::Scheduler &scheduler, FDContext &ctx)
+{
+    gDone = 0;
+    for (uint64_t i = 0; i < gEventCount; i += gBurstSize) {
+        for (uint64_t j = 0; j < gBurstSize; ++j) {
+            scheduler.schedule(std::bind(&FDContext::executeEvent, &ctx, EPOLLIN), -1, eular::Fiber::SmallStackSize());
+        }
+        while (gDone.load() < i + gBurstSize) {
+            sched_yield();
+        }
+    }
+}
+
+static void benchDispatch()
+{
+    FDContext ctx;
+    eular::Scheduler scheduler(1, false, "dispatch");
+    scheduler.start();
+
+    // 预热: 填充任务节点池并创建好执行回调的协程
+    dispatch(scheduler, ctx);
+
+    uint64_t begin = gAllocCount.load();
+    dispatch(scheduler, ctx);
+    uint64_t allocs = gAllocCount.load() - begin;
+    scheduler.stop();
+
+    printf("dispatch via Scheduler:  %.3f allocs/event\n", (double)allocs / gEventCount);
+}
+
+int main(int argc, char **argv)
+{
+    benchConstruct();
+    benchDispatch();
+    return 0;
+}
@@ -0,0 +1,193 @@
+/*************************************************************************
+    > File Name: test_timer_bench.cc
+    > Author: hsz
+    > Brief: 100万个定时器下对比时间轮与原std::set实现的插入/取消/到期开销
+    > Created Time: Sat 17 Oct 2026 08:03:37 PM CST
+ ************************************************************************/
+
+#include "core/timer.h"
+#include <log/log.h>
+#include <set>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+
+#define LOG_TAG "main"
+
+static const uint32_t gTimerCount = 1000000;
+static const uint32_t gMaxTimeoutMs = 2000;
+static const uint32_t gIdCancelSamples = 20;    // std::set按ID取消是O(n), 只抽样
+
+static uint64_t nowNs()
+{
+    timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+struct Stats {
+    uint64_t fired = 0;
+    uint64_t early = 0;         // 早于到期时间触发的次数, 应为0
+    uint64_t maxLateMs = 0;     // 相对到期时间(或开始处理到期的时间, 取较晚者)的延迟
+    uint64_t expireStart = 0;
+};
+
+static void onExpire(Stats *stats, uint64_t deadline)
+{
+    uint64_t now = eular::Timer::CurrentTime();
+    ++stats->fired;
+    if (now < deadline) {
+        ++stats->early;
+        return;
+    }
+    uint64_t due = deadline > stats->expireStart ? deadline : stats->expireStart;
+    if (now - due > stats->maxLateMs) {
+        stats->maxLateMs = now - due;
+    }
+}
+
+// 原实现: std::set按到期时间排序, delTimer(id)线性查找
+class SetTimerManager
+{
+public:
+    struct Timer {
+        uint64_t time;
+        uint64_t id;
+        eular::Task cb;
+
+        uint64_t getUniqueId() const { return id; }
+    };
+    typedef std::shared_ptr<Timer> SP;
+
+    SP addTimer(uint64_t ms, eular::Task cb)
+    {
+        SP timer(new Timer{eular::Timer::CurrentTime() + ms, ++mId, std::move(cb)});
+        mTimers.insert(timer);
+        return timer;
+    }
+
+    bool delTimer(uint64_t id)
+    {
+        for (auto it = mTimers.begin(); it != mTimers.end(); ++it) {
+            if ((*it)->id == id) {
+                mTimers.erase(it);
+                return true;
+            }
+        }
+        return false;
+    }
+
+    bool delTimer(const SP &timer)
+    {
+        return mTimers.erase(timer) > 0;
+    }
+
+    void ListExpireTimer(std::vector<eular::Task> &cbs)
+    {
+        uint64_t now = eular::Timer::CurrentTime();
+        auto it = mTimers.begin();
+        while (it != mTimers.end() && (*it)->time <= now) {
+            cbs.push_back(std::move((*it)->cb));
+            ++it;
+        }
+        mTimers.erase(mTimers.begin(), it);
+    }
+
+    size_t size() const { return mTimers.size(); }
+
+private:
+    struct Comparator {
+        bool operator()(const SP &left, const SP &right) const
+        {
+            if (left->time == right->time) {
+                return left->id < right->id;
+            }
+            return left->time < right->time;
+        }
+    };
+
+    uint64_t mId = 0;
+    std::set<SP, Comparator> mTimers;
+};
+
+class WheelTimerManager : public eular::TimerManager
+{
+public:
+    using eular::TimerManager::ListExpireTimer;
+
+protected:
+    virtual void onTimerInsertedAtFront() override {}
+};
+
+template<typename Manager, typename Handle>
+static void bench(const char *name, Manager &manager, std::vector<Handle> &handles)
+{
+    Stats stats;
+    srand(1);
+
+    uint64_t begin = nowNs();
+    for (uint32_t i = 0; i < gTimerCount; ++i) {
+        uint64_t ms = 1 + rand() % gMaxTimeoutMs;
+        uint64_t deadline = eular::Timer::CurrentTime() + ms;
+        handles.push_back(manager.addTimer(ms, std::bind(&onExpire, &stats, deadline)));
+    }
+    uint64_t insertNs = nowNs() - begin;
+
+    // 模拟IO先于超时完成: 取消一半
+    begin = nowNs();
+    uint32_t cancelled = 0;
+    for (uint32_t i = 0; i < gTimerCount; i += 2) {
+        cancelled += manager.delTimer(handles[i]) ? 1 : 0;
+    }
+    uint64_t cancelNs = nowNs() - begin;
+
+    begin = nowNs();
+    for (uint32_t i = 1; i < gIdCancelSamples * 2; i += 2) {
+        cancelled += manager.delTimer(handles[i]->getUniqueId()) ? 1 : 0;
+    }
+    uint64_t idCancelNs = nowNs() - begin;
+
+    uint64_t expireNs = 0;
+    uint64_t ticks = 0;
+    stats.expireStart = eular::Timer::CurrentTime();
+    std::vector<eular::Task> cbs;
+    while (stats.fired + cancelled < gTimerCount) {
+        usleep(1000);
+        begin = nowNs();
+        manager.ListExpireTimer(cbs);
+        expireNs += nowNs() - begin;
+        ++ticks;
+        for (auto &cb : cbs) {
+            cb();
+        }
+        cbs.clear();
+    }
+
+    printf("%-6s: insert %6.1f ns/op, cancel(handle) %7.1f ns/op, cancel(id) %10.1f ns/op, "
+        "expire %6.1f ns/timer over %lu ticks | fired %lu, early %lu, max late %lu ms\n",
+        name, (double)insertNs / gTimerCount, (double)cancelNs / (gTimerCount / 2),
+        (double)idCancelNs / gIdCancelSamples, (double)expireNs / stats.fired, ticks,
+        stats.fired, stats.early, stats.maxLateMs);
+}
+
+int main(int argc, char **argv)
+{
+    {
+        SetTimerManager manager;
+        std::vector<SetTimerManager::SP> handles;
+        handles.reserve(gTimerCount);
+        bench("set", manager, handles);
+    }
+    {
+        WheelTimerManager manager;
+        std::vector<eular::Timer::SP> handles;
+        handles.reserve(gTimerCount);
+        bench("wheel", manager, handles);
+
+        eular::TimerManager::TimerStats stats = manager.getTimerStats();
+        printf("wheel gauges: count %lu, expired last tick %lu, max per tick %lu, total %lu over %lu ticks\n",
+            stats.count, stats.expiredLastTick, stats.expiredMaxTick, stats.expiredTotal, stats.ticks);
+    }
+    return 0;
+}
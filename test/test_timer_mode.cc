@@ -0,0 +1,89 @@
+/*************************************************************************
+    > File Name: test_timer_mode.cc
+    > Author: hsz
+    > Brief: 对比poll与timerfd定时器模式下多个空闲线程的唤醒次数和到期延迟
+    > Created Time: Sat 17 Oct 2026 09:47:22 PM CST
+ ************************************************************************/
+
+#include "iomanager.h"
+#include "config.h"
+#include <log/log.h>
+#include <atomic>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#define LOG_TAG "main"
+
+static const uint32_t gTimerCount = 50;
+static const uint32_t gPeriodMs = 200;
+static const uint32_t gRunMs = 4000;
+
+struct Stats {
+    std::atomic<uint64_t> fired = {0};
+    std::atomic<uint64_t> early = {0};
+    std::atomic<uint64_t> maxLateMs = {0};
+};
+
+struct Heartbeat {
+    Stats *stats;
+    uint64_t deadline;
+
+    void operator()()
+    {
+        uint64_t now = eular::Timer::CurrentTime();
+        ++stats->fired;
+        if (now < deadline) {
+            ++stats->early;
+        } else {
+            uint64_t late = now - deadline;
+            uint64_t old = stats->maxLateMs.load();
+            while (late > old && !stats->maxLateMs.compare_exchange_weak(old, late)) {
+            }
+        }
+        deadline += gPeriodMs;
+    }
+};
+
+static void bench(const char *mode, bool perThread, uint32_t threads)
+{
+    char path[] = "/tmp/test_timer_mode_XXXXXX";
+    int tmp = mkstemp(path);
+    dprintf(tmp, "iomanager:\n  timer_mode: %s\n  epoll_per_thread: %s\n", mode, perThread ? "true" : "false");
+    ::close(tmp);
+    eular::ConfigManager::get()->Init(path);
+    unlink(path);
+
+    Stats stats;
+    eular::IOManager iom(threads, false, "timer_mode");
+    std::vector<eular::Timer::SP> timers;
+    srand(1);
+    for (uint32_t i = 0; i < gTimerCount; ++i) {
+        uint64_t first = 1 + rand() % gPeriodMs;
+        Heartbeat hb{&stats, eular::Timer::CurrentTime() + first};
+        timers.push_back(iom.addTimer(first, hb, gPeriodMs));
+    }
+
+    usleep(100 * 1000);
+    eular::IOManager::WakeupStats begin = iom.getWakeupStats();
+    usleep(gRunMs * 1000);
+    eular::IOManager::WakeupStats end = iom.getWakeupStats();
+    for (auto &timer : timers) {
+        iom.delTimer(timer);
+    }
+
+    printf("%-7s(%s) %s threads %u: %8.1f wakeups/sec (%6.1f by timeout) | fired %lu, early %lu, max late %lu ms\n",
+        mode, iom.timerFdEnabled() ? "timerfd" : "poll", perThread ? "per-thread" : "shared    ", threads,
+        (end.polls - begin.polls) * 1000.0 / gRunMs, (end.timeouts - begin.timeouts) * 1000.0 / gRunMs,
+        stats.fired.load(), stats.early.load(), stats.maxLateMs.load());
+}
+
+int main(int argc, char **argv)
+{
+    uint32_t threads = argc > 1 ? atoi(argv[1]) : 4;
+    bench("poll", false, threads);
+    bench("timerfd", false, threads);
+    bench("poll", true, threads);
+    bench("timerfd", true, threads);
+    return 0;
+}
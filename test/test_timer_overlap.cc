@@ -0,0 +1,58 @@
+/*************************************************************************
+    > File Name: test_timer_overlap.cc
+    > Author: hsz
+    > Brief: 循环定时器的回调耗时超过间隔时, 同一个回调不能在多个线程上同时执行
+    > Created Time: Sun 18 Oct 2026 10:41:05 AM CST
+ ************************************************************************/
+
+#include "iomanager.h"
+#include <log/log.h>
+#include <atomic>
+#include <stdio.h>
+#include <time.h>
+#include <unistd.h>
+
+#define LOG_TAG "main"
+
+static const uint32_t gPeriodMs = 5;
+static const uint32_t gWorkMs = 23;     // 每次回调耗时约为间隔的4.6倍
+static const uint32_t gRunMs = 1000;
+
+static std::atomic<int> gInFlight(0);
+static std::atomic<int> gMaxInFlight(0);
+static std::atomic<uint32_t> gRuns(0);
+
+static uint64_t nowMs()
+{
+    timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000ull + ts.tv_nsec / 1000000;
+}
+
+static void slowTick()
+{
+    int running = ++gInFlight;
+    int old = gMaxInFlight.load();
+    while (running > old && !gMaxInFlight.compare_exchange_weak(old, running)) {
+    }
+    uint64_t end = nowMs() + gWorkMs;
+    while (nowMs() < end) {     // 忙等, 不让出协程
+    }
+    ++gRuns;
+    --gInFlight;
+}
+
+int main(int argc, char **argv)
+{
+    eular::IOManager iom(4, false, "timer_overlap");
+    eular::Timer::SP timer = iom.addTimer(gPeriodMs, slowTick, gPeriodMs);
+    usleep(gRunMs * 1000);
+    iom.delTimer(timer);
+    usleep((gWorkMs + 10) * 1000);
+
+    uint32_t runs = gRuns.load();
+    bool ok = gMaxInFlight.load() == 1 && runs > gRunMs / gWorkMs / 2;
+    printf("period %u ms, callback %u ms, 4 threads: %u runs in %u ms, max concurrent %d: %s\n",
+        gPeriodMs, gWorkMs, runs, gRunMs, gMaxInFlight.load(), ok ? "ok" : "FAILED");
+    return !ok;
+}
@@ -0,0 +1,82 @@
+/*************************************************************************
+    > File Name: test_timer_slack.cc
+    > Author: hsz
+    > Brief: 心跳式循环定时器在不同slack下IOManager空闲线程的唤醒次数
+    > Created Time: Sat 17 Oct 2026 09:12:05 PM CST
+ ************************************************************************/
+
+#include "iomanager.h"
+#include <log/log.h>
+#include <atomic>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#define LOG_TAG "main"
+
+static const uint32_t gTimerCount = 500;
+static const uint32_t gPeriodMs = 1000;
+static const uint32_t gRunMs = 5000;
+
+struct Stats {
+    std::atomic<uint64_t> fired = {0};
+    std::atomic<uint64_t> early = {0};      // 早于名义到期时间, 应为0
+    std::atomic<uint64_t> maxLateMs = {0};  // 相对名义到期时间的最大延迟, 应不超过slack加调度延迟
+};
+
+struct Heartbeat {
+    Stats *stats;
+    uint64_t deadline;
+
+    void operator()()
+    {
+        uint64_t now = eular::Timer::CurrentTime();
+        ++stats->fired;
+        if (now < deadline) {
+            ++stats->early;
+        } else {
+            uint64_t late = now - deadline;
+            uint64_t old = stats->maxLateMs.load();
+            while (late > old && !stats->maxLateMs.compare_exchange_weak(old, late)) {
+            }
+        }
+        deadline += gPeriodMs;
+    }
+};
+
+static void bench(uint32_t slack)
+{
+    Stats stats;
+    eular::IOManager iom(1, false, "slack");
+    std::vector<eular::Timer::SP> timers;
+    srand(1);
+    // 各个客户端的心跳相位随机
+    for (uint32_t i = 0; i < gTimerCount; ++i) {
+        uint64_t first = 1 + rand() % gPeriodMs;
+        Heartbeat hb{&stats, eular::Timer::CurrentTime() + first};
+        timers.push_back(iom.addTimer(first, hb, gPeriodMs, slack));
+    }
+
+    usleep(200 * 1000);
+    eular::IOManager::WakeupStats begin = iom.getWakeupStats();
+    usleep(gRunMs * 1000);
+    eular::IOManager::WakeupStats end = iom.getWakeupStats();
+
+    for (auto &timer : timers) {
+        iom.delTimer(timer);
+    }
+
+    printf("slack %4u ms: %8.1f wakeups/sec (%5.1f by timeout) | fired %lu, early %lu, max late %lu ms\n",
+        slack, (end.polls - begin.polls) * 1000.0 / gRunMs,
+        (end.timeouts - begin.timeouts) * 1000.0 / gRunMs,
+        stats.fired.load(), stats.early.load(), stats.maxLateMs.load());
+}
+
+int main(int argc, char **argv)
+{
+    bench(0);
+    bench(10);
+    bench(50);
+    bench(250);
+    return 0;
+}